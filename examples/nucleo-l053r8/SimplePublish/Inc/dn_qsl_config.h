@@ -0,0 +1,31 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+QuickStart Library configuration of the NUCLEO-L053R8 port (see dn_defaults.h),
+pulled in by the DN_QSL_CONFIG symbol defined in the project settings.
+
+The values below are the library defaults on an MCU, spelled out as a starting
+point: change them here to fit the 8 KB of RAM of the STM32L053R8 to the
+application. The post-build step lists the RAM then taken by the library
+(tools/sizes/qsl_sizes.sh), dn_fsm_vars holding the inbox and buffers.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_QSL_CONFIG_H
+#define DN_QSL_CONFIG_H
+
+//=========================== defines =========================================
+
+// Downstream messages buffered until read, of DN_DEFAULT_PAYLOAD_SIZE_LIMIT bytes each
+#define DN_INBOX_SIZE					10
+#define DN_DEFAULT_PAYLOAD_SIZE_LIMIT	DN_PAYLOAD_SIZE_LIMIT_MNG_HIGH
+
+// Diagnostics: records of the trace ring, and the latency histogram (off)
+#define DN_TRACE_SIZE					16
+#define DN_LATENCY_HIST					0
+
+// Serial frames recorded into the RAM ring of main.c (see dn_capture.h)
+#define DN_CAPTURE						1
+
+#endif /* DN_QSL_CONFIG_H */
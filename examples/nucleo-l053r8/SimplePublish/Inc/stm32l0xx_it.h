@@ -46,6 +46,7 @@
 /* Exported functions ------------------------------------------------------- */
 
 void SysTick_Handler(void);
+void DMA1_Channel2_3_IRQHandler(void);
 void USART1_IRQHandler(void);
 
 #ifdef __cplusplus
@@ -61,6 +61,8 @@ void MX_USART2_UART_Init(void);
 
 
 void USART_SMIP_Interrupt(UART_HandleTypeDef *huart);
+uint8_t USART_SMIP_EnterStop(void);
+void USART_SMIP_ExitStop(void);
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
@@ -3,37 +3,211 @@ Copyright (c) 2016, Dust Networks. All rights reserved.
 
 Port of the time module to the NUCLEO-L053R8.
 
+Sleeps are spent in STOP mode, woken by LPTIM1 at the deadline or by USART1 on
+the start bit of a byte from the mote. LPTIM1 counts the 32.768 kHz LSE, which
+keeps running in STOP mode while SysTick does not; the time slept is read back
+from LPTIM1 and added to the HAL tick. While the DMA is busy with USART1, and
+for sleeps too short to be worth it, the core only enters SLEEP mode and
+SysTick wakes it up every ms.
+
+dn_time_us64 extends the ms count to 64 bits in HAL_IncTick, and interpolates
+within the current ms from the SysTick down-counter.
+
 \license See attached DN_LICENSE.txt.
 */
 
 #include "dn_time.h"
 #include "stm32l0xx_hal.h"
+#include "usart.h"
+
+//=========================== defines =========================================
+
+// LSE divided by 32
+#define LPTIM_PRESCALER		(LPTIM_CFGR_PRESC_2 | LPTIM_CFGR_PRESC_0)
+#define LPTIM_TICKS_PER_S	1024
+#define LPTIM_MAX_TICKS		0xffff // 64 s
+// Shorter sleeps cost more in setting up the timer and waking up than they save
+#define STOP_MIN_MS			3
 
 //=========================== variables =======================================
 
+// Incremented by HAL_IncTick, overridden below
+extern __IO uint32_t uwTick;
+
+typedef struct
+{
+	bool lptimInitialized;
+	volatile bool wakePending;
+	volatile uint64_t ticks64; // uwTick, without the wrap around
+	uint64_t stopped_ms; // Time spent in STOP mode, missed by SysTick
+	uint32_t stoppedRem; // LPTIM ticks slept that do not yet add up to a ms (times 1000)
+} dn_time_vars_t;
+
+static dn_time_vars_t dn_time_vars;
 
 //=========================== prototypes ======================================
 
+static void dn_time_initLptim(void);
+static void dn_time_stop(uint32_t duration_ms);
 
 //=========================== public ==========================================
 
 uint32_t dn_time_ms(void)
 {
-	return HAL_GetTick();
+	return HAL_GetTick() + (uint32_t)dn_time_vars.stopped_ms;
+}
+
+uint64_t dn_time_us64(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	uint64_t ms;
+	uint32_t load = SysTick->LOAD;
+	uint32_t val;
+
+	__disable_irq();
+	ms = dn_time_vars.ticks64 + dn_time_vars.stopped_ms;
+	val = SysTick->VAL;
+	if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)
+	{
+		// The counter reloaded, but the tick is not counted yet; read again past the reload
+		val = SysTick->VAL;
+		ms++;
+	}
+	__set_PRIMASK(primask);
+
+	// SysTick counts down from LOAD to 0 once per ms
+	return ms * 1000 + (load - val) * 1000 / (load + 1);
 }
 
 void dn_sleep_ms(uint32_t milliseconds)
 {
-	/* A simple delay is used for simplicity in this example.
-	 * To save power, we could instead have initialized a timer to fire an
-	 * interrupt after the set number of milliseconds, followed by entering
-	 * a low-power sleep mode. Upon wake up, we would have to check that we
-	 * were indeed woken by said interrupt (and e.g. not an USART interrupt)
-	 * to decide if we should go back to sleep or not. */
-	HAL_Delay(milliseconds);
+	uint32_t deadline_ms = dn_time_ms() + milliseconds;
+
+	// Go back to sleep if woken early, e.g. by a notification from the mote
+	while ((int32_t)(deadline_ms - dn_time_ms()) > 0) // Handle dn_time_ms wrap around
+	{
+		dn_sleep_until(deadline_ms);
+	}
+}
+
+void dn_sleep_until(uint32_t deadline_ms)
+{
+	int32_t remaining_ms;
+
+	if (!dn_time_vars.lptimInitialized)
+	{
+		dn_time_initLptim();
+		dn_time_vars.lptimInitialized = TRUE;
+	}
+
+	/*
+	 Interrupts are held off from the last check until the core is asleep, so
+	 that a wake-up cannot slip in between; a pending interrupt still wakes the
+	 core, and is served once they are enabled again.
+	 */
+	__disable_irq();
+	remaining_ms = (int32_t)(deadline_ms - dn_time_ms()); // Handle dn_time_ms wrap around
+	if (!dn_time_vars.wakePending && remaining_ms > 0)
+	{
+		if (remaining_ms >= STOP_MIN_MS && USART_SMIP_EnterStop())
+		{
+			dn_time_stop(remaining_ms);
+			USART_SMIP_ExitStop();
+		} else
+		{
+			HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+		}
+	}
+	dn_time_vars.wakePending = FALSE;
+	__enable_irq();
+}
+
+void dn_sleep_wake(void)
+{
+	dn_time_vars.wakePending = TRUE;
 }
 
 //=========================== private =========================================
 
+static void dn_time_initLptim(void)
+{
+	// LSE selected as LPTIM1 clock in SystemClock_ConfigStop (main.c)
+	__HAL_RCC_LPTIM1_CLK_ENABLE();
+
+	// Configuration and interrupts can only be set while disabled
+	LPTIM1->CR = 0;
+	LPTIM1->CFGR = LPTIM_PRESCALER;
+	LPTIM1->IER = LPTIM_IER_ARRMIE;
+
+	// Wake up from STOP mode on EXTI lines 29 (LPTIM1) and 25 (USART1)
+	EXTI->IMR |= EXTI_IMR_IM29 | EXTI_IMR_IM25;
+	HAL_NVIC_SetPriority(LPTIM1_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(LPTIM1_IRQn);
+
+	// Regulator and reference off in STOP mode, without waiting for the latter on wake-up
+	HAL_PWREx_EnableUltraLowPower();
+	HAL_PWREx_EnableFastWakeUp();
+}
+
+/**
+ Enter STOP mode for at most the given duration, and account for the time
+ actually slept. Called with interrupts disabled.
+ */
+static void dn_time_stop(uint32_t duration_ms)
+{
+	uint32_t ticks = duration_ms * LPTIM_TICKS_PER_S / 1000;
+	uint32_t count;
+
+	if (ticks > LPTIM_MAX_TICKS)
+	{
+		ticks = LPTIM_MAX_TICKS;
+	}
+
+	// Count once from 0 to the deadline
+	LPTIM1->CR = LPTIM_CR_ENABLE;
+	LPTIM1->ARR = ticks;
+	while (!(LPTIM1->ISR & LPTIM_ISR_ARROK));
+	LPTIM1->ICR = LPTIM_ICR_ARROKCF;
+	LPTIM1->CR = LPTIM_CR_ENABLE | LPTIM_CR_SNGSTRT;
+
+	HAL_SuspendTick();
+	HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+	HAL_ResumeTick();
+
+	if (LPTIM1->ISR & LPTIM_ISR_ARRM)
+	{
+		count = ticks;
+	} else
+	{
+		// Woken early; the counter runs on the LSE, so read until two reads agree
+		do
+		{
+			count = LPTIM1->CNT;
+		} while (count != LPTIM1->CNT);
+	}
+	LPTIM1->ICR = LPTIM_ICR_ARRMCF;
+	LPTIM1->CR = 0;
+
+	count = count * 1000 + dn_time_vars.stoppedRem;
+	dn_time_vars.stopped_ms += count / LPTIM_TICKS_PER_S;
+	dn_time_vars.stoppedRem = count % LPTIM_TICKS_PER_S;
+}
 
 //=========================== helpers =========================================
+
+//=========================== interrupt handlers ==============================
+
+/**
+ Replaces the weak HAL_IncTick of the HAL, called from SysTick_Handler.
+ */
+void HAL_IncTick(void)
+{
+	uwTick++;
+	dn_time_vars.ticks64++;
+}
+
+void LPTIM1_IRQHandler(void)
+{
+	// The deadline was reached; dn_time_stop has already taken note
+	LPTIM1->ICR = LPTIM_ICR_ARRMCF;
+}
@@ -2,76 +2,374 @@
 Copyright (c) 2016, Dust Networks. All rights reserved.
 
 Port of the uart module to the NUCLEO-L053R8.
-Setup and initialization found in usart.c (CubeMX auto-generated code).
+Setup and initialization found in usart.c and dma.c (CubeMX auto-generated code).
+
+RX runs on a DMA channel in circular mode. Received bytes are handed on in
+spans when the line goes idle after a burst, and when the DMA reaches the half
+or the end of its buffer, so the CPU is interrupted a few times per frame
+instead of once per byte. TX frames are sent by DMA from one of two buffers,
+while the next frame is staged in the other.
+
+Frames are also sent from the RX interrupts (acknowledgements), so the TX DMA
+channel is driven directly: the HAL only takes a new transfer once its own TX
+complete interrupt ran, which an interrupt of the same priority would wait for
+forever. Waiting on the DMA counter instead only depends on the hardware.
+
+The DMA does not run in STOP mode, so dn_time.c only enters it while nothing is
+in flight. USART1 (clocked by HSI16) then wakes the MCU on the start bit of the
+next byte from the mote, in time for the DMA to pick the byte up.
+
+With the byte-by-byte HDLC module of the C Library, which records nothing,
+the serial frames are captured here (see dn_capture.h): the RX spans as they
+are handed on, and the TX frames as their DMA transfer starts. main.c hands
+the capture a small ring in RAM, to be dumped from a debugger.
 
 \license See attached DN_LICENSE.txt.
 */
 
 #include "dn_uart.h"
+#include "dn_uart_span.h"
+#include "dn_ring.h"
 #include "dn_ipmt.h"
+#include "dn_time.h"
+#include "dn_capture.h"
+#define DN_LOG_MODULE	DN_LOG_UART
 #include "dn_debug.h"
 #include "usart.h"
 
 
 //=========================== defines =========================================
 
+/*
+ Power of two. Must hold the bytes received between two interrupts, which are
+ at most half a buffer apart.
+ */
+#define UART_RX_DMA_BUFFER_SIZE	256
+#define UART_RX_DMA_MASK		(UART_RX_DMA_BUFFER_SIZE - 1)
+#define UART_RX_DMA_HALF		(UART_RX_DMA_BUFFER_SIZE / 2)
+// Processing not triggered by the DMA reaching a half or the end of its buffer
+#define UART_RX_DMA_NO_BOUNDARY	0xFFFF
+// Worst case, every byte of a frame and its FCS is escaped, plus two flags
+#define UART_TX_BUFFER_SIZE		(2 * (MAX_FRAME_LENGTH + 2) + 2)
+// Capture the frames here; see above
+#ifndef UART_CAPTURE
+#define UART_CAPTURE			DN_CAPTURE
+#endif
+
 
 //=========================== variables =======================================
 
 typedef struct {
 	dn_uart_rxByte_cbt	ipmt_uart_rxByte_cb;
+	dn_uart_rxSpan_cbt	rxSpan_cb;
+	// RX
+	dn_ring_t			rxRing;
+	uint16_t			rxDmaPos;
+	uint8_t				rxDmaBuf[UART_RX_DMA_BUFFER_SIZE];
+	// TX
+	uint8_t				txBuf[2][UART_TX_BUFFER_SIZE];
+	uint8_t				txActive;
+	uint16_t			txLen;
+#if UART_CAPTURE
+	// Each only touched from its interrupts, or with interrupts disabled
+	dn_capture_stream_t	rxCapture;
+	dn_capture_stream_t	txCapture;
+#endif
 } dn_uart_vars_t;
 
 dn_uart_vars_t dn_uart_vars;
 
-//=========================== prototypes ======================================
+//=========================== prototypes ======================================
+
+static void dn_uart_rxSpanToBytes(const uint8_t* data, uint16_t len);
+static void dn_uart_rxDmaProcess(uint16_t boundary);
+static uint16_t dn_uart_rxDmaPending(uint16_t len);
+static bool dn_uart_txBusy(void);
+static void dn_uart_txStart(void);
 
 //=========================== public ==========================================
 
 void dn_uart_init(dn_uart_rxByte_cbt rxByte_cb)
 {
-	// Store RX callback function
+	// Store RX callback function, fed from the span callback
 	dn_uart_vars.ipmt_uart_rxByte_cb = rxByte_cb;
+	dn_uart_initSpan(dn_uart_rxSpanToBytes);
+}
 
-	// USART1 initialized in main by CubeMX auto-generated code
+void dn_uart_initSpan(dn_uart_rxSpan_cbt rxSpan_cb)
+{
+	UART_WakeUpTypeDef wakeUp = {0};
+
+	// Store RX callback function
+	dn_uart_vars.rxSpan_cb = rxSpan_cb;
 
-	// Enable Read Data Register Not Empty interrupt
-	__HAL_UART_ENABLE_IT(&huart1, UART_IT_RXNE);
+	// USART1 and its DMA channels initialized in main by CubeMX auto-generated code
+
+	// The ring starts at the DMA buffer start, as does the DMA channel
+	dn_ring_init(&dn_uart_vars.rxRing, dn_uart_vars.rxDmaBuf, UART_RX_DMA_BUFFER_SIZE);
+	dn_uart_vars.rxDmaPos = 0;
+	dn_uart_vars.txActive = 0;
+	dn_uart_vars.txLen = 0;
+
+	// TX DMA channel idle, without interrupts; each frame is started by dn_uart_txStart
+	__HAL_DMA_DISABLE(huart1.hdmatx);
+	__HAL_DMA_DISABLE_IT(huart1.hdmatx, DMA_IT_TC | DMA_IT_HT | DMA_IT_TE);
+	huart1.hdmatx->Instance->CPAR = (uint32_t)&huart1.Instance->TDR;
+	SET_BIT(huart1.Instance->CR3, USART_CR3_DMAT);
+
+	// Wake up from STOP mode on the start bit of a byte from the mote
+	wakeUp.WakeUpEvent = UART_WAKEUP_ON_STARTBIT;
+	HAL_UARTEx_StopModeWakeUpSourceConfig(&huart1, wakeUp);
+	HAL_UARTEx_EnableStopMode(&huart1);
+
+	// Start circular DMA reception, and catch the end of each burst of bytes
+	HAL_UART_Receive_DMA(&huart1, dn_uart_vars.rxDmaBuf, UART_RX_DMA_BUFFER_SIZE);
+	__HAL_UART_CLEAR_IDLEFLAG(&huart1);
+	__HAL_UART_ENABLE_IT(&huart1, UART_IT_IDLE);
 
 	debug("SMIP Serial Initialized");
 }
 
 void dn_uart_txByte(uint8_t byte)
 {
-	/* Make HAL transmit byte.
-	 * HAL_MAX_DELAY is passed to prevent timeout:
-	 * Timeout would cause HAL to deactivate all USART interrupts... */
-	HAL_UART_Transmit(&huart1, &byte, 1, HAL_MAX_DELAY);
+	uint32_t primask = __get_PRIMASK();
+
+	// Frames are staged from the main loop and from the RX interrupts alike
+	__disable_irq();
+	if (dn_uart_vars.txLen == UART_TX_BUFFER_SIZE)
+	{
+		// Should not happen for a single frame; send what is staged so far
+		__set_PRIMASK(primask);
+		dn_uart_txFlush();
+		__disable_irq();
+	}
+	dn_uart_vars.txBuf[dn_uart_vars.txActive][dn_uart_vars.txLen++] = byte;
+	__set_PRIMASK(primask);
 }
 
 void dn_uart_txFlush()
 {
-	// Nothing to do since we push byte-by-byte
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	while (dn_uart_vars.txLen > 0 && dn_uart_txBusy())
+	{
+		// The previous frame, in the other buffer, must be out; let interrupts in meanwhile
+		__set_PRIMASK(primask);
+		__disable_irq();
+	}
+	if (dn_uart_vars.txLen > 0)
+	{
+		dn_uart_txStart();
+	}
+	__set_PRIMASK(primask);
+}
+
+void dn_uart_txSpan(const uint8_t* data, uint16_t len)
+{
+	uint32_t primask = __get_PRIMASK();
+	uint16_t chunk;
+
+	while (len > 0)
+	{
+		// Staged whole, so that a frame sent from an interrupt cannot land in the middle
+		__disable_irq();
+		chunk = UART_TX_BUFFER_SIZE - dn_uart_vars.txLen;
+		if (chunk > len)
+		{
+			chunk = len;
+		}
+		memcpy(&dn_uart_vars.txBuf[dn_uart_vars.txActive][dn_uart_vars.txLen], data, chunk);
+		dn_uart_vars.txLen += chunk;
+		__set_PRIMASK(primask);
+		data += chunk;
+		len -= chunk;
+		dn_uart_txFlush();
+	}
+}
+
+uint8_t USART_SMIP_EnterStop(void)
+{
+	uint16_t pos = (UART_RX_DMA_BUFFER_SIZE - __HAL_DMA_GET_COUNTER(huart1.hdmarx)) & UART_RX_DMA_MASK;
+
+	// A frame still being sent, or received bytes not yet handed on, would stall
+	if (dn_uart_txBusy() || !__HAL_UART_GET_FLAG(&huart1, UART_FLAG_TC)
+			|| pos != dn_uart_vars.rxDmaPos || __HAL_UART_GET_FLAG(&huart1, UART_FLAG_BUSY))
+	{
+		return 0;
+	}
+
+	// Only while stopped; a wake-up interrupt per start bit would defeat the DMA
+	__HAL_UART_CLEAR_IT(&huart1, UART_CLEAR_WUF);
+	__HAL_UART_ENABLE_IT(&huart1, UART_IT_WUF);
+	return 1;
+}
+
+void USART_SMIP_ExitStop(void)
+{
+	__HAL_UART_DISABLE_IT(&huart1, UART_IT_WUF);
+	__HAL_UART_CLEAR_IT(&huart1, UART_CLEAR_WUF);
+
+	// HSI16 is switched off in STOP mode, apart from serving the wake-up
+	__HAL_RCC_HSI_CONFIG(RCC_HSI_ON);
 }
 
 //=========================== private =========================================
 
+/**
+ Feed a received span to the byte-oriented callback of dn_uart_init.
+ */
+static void dn_uart_rxSpanToBytes(const uint8_t* data, uint16_t len)
+{
+	uint16_t n;
+
+	for (n = 0; n < len; n++)
+	{
+		// Push individual byte to HDLC layer
+		dn_uart_vars.ipmt_uart_rxByte_cb(data[n]);
+	}
+}
+
+/**
+ Publish what the DMA has written since last time, and hand it on in (at most
+ two) contiguous spans. Only called from interrupts of equal priority.
+
+ The DMA does not wait for the CPU: if these interrupts are held off for more
+ than half the buffer, it overwrites bytes not handed on yet. Its position
+ alone cannot tell, but each half or end of the buffer it reaches raises its
+ own interrupt, which hands on up to there at the latest. So when one is
+ handled, what was handed on last lies in the half just completed, unless the
+ DMA went all the way around since; the ring then counts the overrun.
+
+ \param boundary The position the DMA just reached (0 or half the buffer), or
+ UART_RX_DMA_NO_BOUNDARY.
+ */
+static void dn_uart_rxDmaProcess(uint16_t boundary)
+{
+	uint16_t pos;
+	uint16_t len;
+	const uint8_t* span;
+
+	// The DMA counts remaining transfers down, reloading at the end of the buffer
+	pos = (UART_RX_DMA_BUFFER_SIZE - __HAL_DMA_GET_COUNTER(huart1.hdmarx)) & UART_RX_DMA_MASK;
+	len = (pos - dn_uart_vars.rxDmaPos) & UART_RX_DMA_MASK;
+
+	if (boundary != UART_RX_DMA_NO_BOUNDARY
+			&& ((boundary - dn_uart_vars.rxDmaPos) & UART_RX_DMA_MASK) > UART_RX_DMA_HALF)
+	{
+		len += UART_RX_DMA_BUFFER_SIZE;
+	}
+	else
+	{
+		len = dn_uart_rxDmaPending(len);
+	}
+
+	dn_ring_commit(&dn_uart_vars.rxRing, len);
+	dn_uart_vars.rxDmaPos = (dn_uart_vars.rxDmaPos + len) & UART_RX_DMA_MASK;
+
+	while ((len = dn_ring_readSpan(&dn_uart_vars.rxRing, &span)) > 0)
+	{
+#if UART_CAPTURE
+		dn_capture_stream(&dn_uart_vars.rxCapture, 0, span, len);
+#endif
+		// Push received bytes to HDLC layer
+		dn_uart_vars.rxSpan_cb(span, len);
+		dn_ring_consume(&dn_uart_vars.rxRing, len);
+		// Let the main loop act on what was received
+		dn_sleep_wake();
+	}
+}
+
+/**
+ Stop short of a half or end of the buffer the DMA reached before its position
+ was read, but whose interrupt is still pending; that interrupt follows and
+ hands on the rest, so that the check of dn_uart_rxDmaProcess holds.
+
+ \param len The number of bytes written since the last position handed on.
+ \return The number of bytes to hand on now.
+ */
+static uint16_t dn_uart_rxDmaPending(uint16_t len)
+{
+	uint16_t toBoundary;
+
+	if (__HAL_DMA_GET_FLAG(huart1.hdmarx, __HAL_DMA_GET_HT_FLAG_INDEX(huart1.hdmarx)) != RESET)
+	{
+		toBoundary = (UART_RX_DMA_HALF - dn_uart_vars.rxDmaPos) & UART_RX_DMA_MASK;
+		if (len > toBoundary)
+		{
+			len = toBoundary;
+		}
+	}
+	if (__HAL_DMA_GET_FLAG(huart1.hdmarx, __HAL_DMA_GET_TC_FLAG_INDEX(huart1.hdmarx)) != RESET)
+	{
+		toBoundary = (UART_RX_DMA_BUFFER_SIZE - dn_uart_vars.rxDmaPos) & UART_RX_DMA_MASK;
+		if (len > toBoundary)
+		{
+			len = toBoundary;
+		}
+	}
+	return len;
+}
+
 //=========================== helpers =========================================
 
+/**
+ Tell if the TX DMA channel still has bytes of a frame to move; the UART may
+ still be shifting out the last ones once it is done.
+ */
+static bool dn_uart_txBusy(void)
+{
+	return (huart1.hdmatx->Instance->CCR & DMA_CCR_EN) != 0 && huart1.hdmatx->Instance->CNDTR != 0;
+}
+
+/**
+ Send the staged frame, and stage the next one in the other buffer. Called
+ with interrupts disabled, once the TX DMA channel is done.
+ */
+static void dn_uart_txStart(void)
+{
+	DMA_Channel_TypeDef* channel = huart1.hdmatx->Instance;
+
+	channel->CCR &= ~DMA_CCR_EN;
+	channel->CMAR = (uint32_t)dn_uart_vars.txBuf[dn_uart_vars.txActive];
+	channel->CNDTR = dn_uart_vars.txLen;
+	channel->CCR |= DMA_CCR_EN;
+
+#if UART_CAPTURE
+	dn_capture_stream(&dn_uart_vars.txCapture, DN_CAPTURE_TO_MOTE,
+			dn_uart_vars.txBuf[dn_uart_vars.txActive], dn_uart_vars.txLen);
+#endif
+	dn_uart_vars.txActive ^= 1;
+	dn_uart_vars.txLen = 0;
+}
+
 //=========================== interrupt handlers ==============================
 
 void USART_SMIP_Interrupt(UART_HandleTypeDef *huart)
 {
-	uint8_t rbyte;
+	// Check that the Idle Line interrupt is enabled and has occurred
+	if((__HAL_UART_GET_IT(huart, UART_IT_IDLE) != RESET) && (__HAL_UART_GET_IT_SOURCE(huart, UART_IT_IDLE) != RESET))
+	{
+		__HAL_UART_CLEAR_IDLEFLAG(huart);
+		dn_uart_rxDmaProcess(UART_RX_DMA_NO_BOUNDARY);
+	}
 
-	// Check that the Read Data Register Not Empty interrupt is enabled and has occurred
-	if((__HAL_UART_GET_IT(huart, UART_IT_RXNE) != RESET) && (__HAL_UART_GET_IT_SOURCE(huart, UART_IT_RXNE) != RESET))
+	// Leave end of DMA transmission and line errors to the HAL
+	HAL_UART_IRQHandler(huart);
+}
+
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
+{
+	if (huart->Instance == USART1)
+	{
+		dn_uart_rxDmaProcess(UART_RX_DMA_HALF);
+	}
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	if (huart->Instance == USART1)
 	{
-		// Get byte from Read Data Register
-		rbyte = (uint8_t)(huart->Instance->RDR & (uint8_t)0xff);
-		// Flush Read Data Register to prevent overflow
-		__HAL_UART_SEND_REQ(huart, UART_RXDATA_FLUSH_REQUEST);
-		// Push byte to HDLC layer
-		dn_uart_vars.ipmt_uart_rxByte_cb(rbyte);
+		dn_uart_rxDmaProcess(0);
 	}
 }
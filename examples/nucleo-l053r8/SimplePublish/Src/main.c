@@ -32,6 +32,7 @@
   */
 /* Includes ------------------------------------------------------------------*/
 #include "stm32l0xx_hal.h"
+#include "dma.h"
 #include "usart.h"
 #include "gpio.h"
 
@@ -41,6 +42,7 @@
 #include "dn_debug.h"		// Included to borrow debug macros
 #include "dn_endianness.h"	// Included to borrow array copying
 #include "dn_time.h"		// Included to borrow sleep function
+#include "dn_capture.h"		// Included to keep the last serial frames in RAM
 /* USER CODE END Includes */
 
 /* Private variables ---------------------------------------------------------*/
@@ -53,6 +55,11 @@
 #define SRC_PORT		60000	// Default port used if zero (0xf0b8)
 #define DEST_PORT		0		// Default port used if zero (0xf0b8)
 #define DATA_PERIOD_MS	5000	// Should be longer than (or equal to) bandwidth
+#define CAPTURE_SLOTS	4		// Serial frames kept, at 144 bytes each; dump captureMem from a debugger
+
+#if DN_CAPTURE
+static uint64_t captureMem[DN_CAPTURE_MEM_SIZE(CAPTURE_SLOTS) / sizeof (uint64_t)];
+#endif
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -63,6 +70,7 @@ void Error_Handler(void);
 /* Private function prototypes -----------------------------------------------*/
 static uint16_t randomWalk(void);
 static void parsePayload(const uint8_t *payload, uint8_t size);
+static void SystemClock_ConfigStop(void);
 /* USER CODE END PFP */
 
 /* USER CODE BEGIN 0 */
@@ -89,11 +97,16 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_USART1_UART_Init();
   MX_USART2_UART_Init();
 
   /* USER CODE BEGIN 2 */
+  SystemClock_ConfigStop();
   log_info("Initializing...");
+#if DN_CAPTURE
+  dn_capture_init(captureMem, sizeof (captureMem), 0);
+#endif
   dn_qsl_init();
 
   // Flash green LED to indicate start-up complete
@@ -246,6 +259,41 @@ static void parsePayload(const uint8_t *payload, uint8_t size)
 	msg[size] = '\0';
 	log_info("\tMessage: %s", msg);
 }
+
+/**
+  * @brief  Clocks that keep running in STOP mode, on top of SystemClock_Config:
+  *         HSI16 for USART1, so that a start bit from the mote wakes the MCU,
+  *         and the LSE for LPTIM1, which wakes it at the deadline (dn_time.c).
+  *         USART1 is initialized again for its baud rate on the new clock.
+  */
+static void SystemClock_ConfigStop(void)
+{
+  RCC_OscInitTypeDef RCC_OscInitStruct;
+  RCC_PeriphCLKInitTypeDef PeriphClkInit;
+
+  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI|RCC_OSCILLATORTYPE_LSE;
+  RCC_OscInitStruct.HSIState = RCC_HSI_ON;
+  RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
+  RCC_OscInitStruct.LSEState = RCC_LSE_ON;
+  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_NONE;
+  if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+  {
+    Error_Handler();
+  }
+
+  PeriphClkInit.PeriphClockSelection = RCC_PERIPHCLK_USART1|RCC_PERIPHCLK_LPTIM1;
+  PeriphClkInit.Usart1ClockSelection = RCC_USART1CLKSOURCE_HSI;
+  PeriphClkInit.LptimClockSelection = RCC_LPTIM1CLKSOURCE_LSE;
+  if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit) != HAL_OK)
+  {
+    Error_Handler();
+  }
+
+  if (HAL_UART_Init(&huart1) != HAL_OK)
+  {
+    Error_Handler();
+  }
+}
 /* USER CODE END 4 */
 
 /**
@@ -0,0 +1,79 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Capture of the serial frames into a memory-mapped file, for the Raspberry Pi
+(see dn_capture_file.h).
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "dn_capture_file.h"
+#include "dn_capture.h"
+#include "dn_debug.h"
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+static uint64_t dn_capture_file_clockOffset_us(void);
+
+//=========================== public ==========================================
+
+bool dn_capture_file_start(const char* path, uint32_t slots)
+{
+	uint32_t size = DN_CAPTURE_MEM_SIZE(slots);
+	int fd;
+	void* map;
+
+	fd = open(path, O_CREAT | O_RDWR, 0644);
+	if (fd == -1)
+	{
+		log_err("Unable to open capture file %s", path);
+		return FALSE;
+	}
+	// Keeps what is there if the size is right; dn_capture_init checks the rest
+	if (ftruncate(fd, size) == -1)
+	{
+		log_err("Unable to size capture file %s", path);
+		close(fd);
+		return FALSE;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		log_err("Unable to map capture file %s", path);
+		return FALSE;
+	}
+
+	if (!dn_capture_init(map, size, dn_capture_file_clockOffset_us()))
+	{
+		log_err("Capture file %s too small", path);
+		munmap(map, size);
+		return FALSE;
+	}
+	log_info("Capturing serial frames to %s", path);
+	return TRUE;
+}
+
+//=========================== private =========================================
+
+/**
+ Offset of the wall clock from CLOCK_MONOTONIC, which dn_time_us64 reads.
+ */
+static uint64_t dn_capture_file_clockOffset_us(void)
+{
+	struct timespec wall;
+	struct timespec mono;
+
+	clock_gettime(CLOCK_REALTIME, &wall);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	return ((uint64_t)wall.tv_sec - mono.tv_sec) * 1000000 + (wall.tv_nsec - mono.tv_nsec) / 1000;
+}
+
+//=========================== helpers =========================================
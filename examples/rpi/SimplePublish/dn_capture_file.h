@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Capture of the serial frames into a memory-mapped file, for the Raspberry Pi
+(see dn_capture.h).
+
+The ring lives in a file mapped with mmap, so that recording a frame is no
+more than a copy into the page cache; the kernel writes it back, and the
+history survives a crash of the process. The timestamps are on the wall clock.
+Convert the file with tools/capture, even while it is being written.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_CAPTURE_FILE_H
+#define DN_CAPTURE_FILE_H
+
+#include "dn_common.h"
+
+//=========================== defines =========================================
+
+#define DN_CAPTURE_FILE_NAME	"/var/tmp/dn_capture.bin"
+
+//=========================== typedef =========================================
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Map the capture file and start capturing into it.
+
+ Call before dn_qsl_init. An existing file of the same layout is appended to.
+ Frames are captured by the span-based HDLC module with HDLC=qsl in the
+ simple_makefile, and by dn_uart.c otherwise.
+
+ \param path Path of the file, e.g. DN_CAPTURE_FILE_NAME.
+ \param slots Number of frames kept, rounded down to a power of two.
+ \return TRUE if the file was mapped and capturing started.
+ */
+bool dn_capture_file_start(const char* path, uint32_t slots);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_CAPTURE_FILE_H */
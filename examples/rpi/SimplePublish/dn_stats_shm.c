@@ -0,0 +1,213 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Export of the QuickStart Library stats through POSIX shared memory, for the
+Raspberry Pi (see dn_stats_shm.h).
+
+The publisher is a thread of its own, sleeping with nanosleep, so that it
+never takes the wake-ups meant for the FSM in dn_sleep_until. It is the only
+writer of the object. Everything is taken through the getters of
+dn_qsl_api.h, which take care of the counters being updated by the main loop
+and the read daemon meanwhile; a period whose copies may be torn is skipped,
+leaving the last publish in place.
+
+The object is created exclusively. One left over by a publisher that is gone
+is unlinked and created anew; one of a publisher still running is left alone.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dn_stats_shm.h"
+#include "dn_time.h"
+#include "dn_debug.h"
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	volatile dn_stats_shm_t* shm;
+	uint32_t period_ms;
+	pthread_t publisher;
+	dn_stats_shm_t next; // Staged, so that the seqlock is held for a copy only
+} dn_stats_shm_vars_t;
+
+static dn_stats_shm_vars_t dn_stats_shm_vars;
+
+//=========================== prototypes ======================================
+
+static int dn_stats_shm_create(const char* name);
+static bool dn_stats_shm_inUse(const char* name);
+static void* dn_stats_shm_publisher(void* arg);
+static bool dn_stats_shm_publish(void);
+
+//=========================== public ==========================================
+
+bool dn_stats_shm_start(const char* name, uint32_t period_ms)
+{
+	int fd;
+	void* map;
+
+	fd = dn_stats_shm_create(name);
+	if (fd == -1)
+	{
+		return FALSE;
+	}
+	if (ftruncate(fd, sizeof (dn_stats_shm_t)) == -1)
+	{
+		log_err("Unable to size shared memory %s", name);
+		close(fd);
+		return FALSE;
+	}
+	map = mmap(NULL, sizeof (dn_stats_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		log_err("Unable to map shared memory %s", name);
+		return FALSE;
+	}
+
+	// Odd until the first publish, so that a reader mapping it meanwhile retries
+	dn_stats_shm_vars.shm = map;
+	dn_stats_shm_vars.shm->seq = 1;
+	DN_MEMORY_BARRIER();
+	dn_stats_shm_vars.shm->magic = DN_STATS_SHM_MAGIC;
+	dn_stats_shm_vars.shm->version = DN_STATS_SHM_VERSION;
+	dn_stats_shm_vars.shm->size = sizeof (dn_stats_shm_t);
+	dn_stats_shm_vars.shm->pid = getpid();
+	dn_stats_shm_vars.shm->publishes = 0;
+	dn_stats_shm_vars.period_ms = period_ms;
+	dn_stats_shm_publish();
+
+	if (pthread_create(&dn_stats_shm_vars.publisher, NULL, dn_stats_shm_publisher, NULL) != 0)
+	{
+		log_err("Failed to start stats publisher");
+		return FALSE;
+	}
+	log_info("Publishing stats to shared memory %s every %u ms", name, period_ms);
+	return TRUE;
+}
+
+//=========================== private =========================================
+
+/**
+ Create the object exclusively, replacing one left over from a publisher that
+ is gone. Returns its descriptor, or -1.
+ */
+static int dn_stats_shm_create(const char* name)
+{
+	int fd;
+
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd == -1 && errno == EEXIST)
+	{
+		if (dn_stats_shm_inUse(name))
+		{
+			log_err("Shared memory %s is in use by another publisher", name);
+			return -1;
+		}
+		log_info("Replacing shared memory %s left over from an earlier run", name);
+		shm_unlink(name);
+		fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	}
+	if (fd == -1)
+	{
+		log_err("Unable to create shared memory %s", name);
+	}
+	return fd;
+}
+
+/**
+ Tell if an existing object belongs to a running publisher. An object that is
+ not a stats object, or cannot be read, is taken to be in use and left alone.
+ */
+static bool dn_stats_shm_inUse(const char* name)
+{
+	const dn_stats_shm_t* shm;
+	struct stat st;
+	bool inUse = TRUE;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1)
+	{
+		return errno != ENOENT;
+	}
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof (dn_stats_shm_t))
+	{
+		shm = mmap(NULL, sizeof (dn_stats_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+		if (shm != MAP_FAILED)
+		{
+			if (shm->magic == DN_STATS_SHM_MAGIC)
+			{
+				inUse = kill(shm->pid, 0) == 0 || errno == EPERM;
+			}
+			munmap((void*)shm, sizeof (dn_stats_shm_t));
+		}
+	}
+	close(fd);
+	return inUse;
+}
+
+static void* dn_stats_shm_publisher(void* arg)
+{
+	struct timespec period;
+
+	period.tv_sec = dn_stats_shm_vars.period_ms / 1000;
+	period.tv_nsec = (dn_stats_shm_vars.period_ms % 1000) * 1000000L;
+	while (TRUE)
+	{
+		nanosleep(&period, NULL);
+		dn_stats_shm_publish();
+	}
+	return NULL;
+}
+
+/**
+ Gather a new copy, then write it between two increments of seq. Returns
+ FALSE, leaving the last publish in place, if a copy may be torn.
+ */
+static bool dn_stats_shm_publish(void)
+{
+	volatile dn_stats_shm_t* shm = dn_stats_shm_vars.shm;
+	dn_stats_shm_t* next = &dn_stats_shm_vars.next;
+	uint32_t seq = shm->seq | 1; // Odd while writing; also recovers an odd start
+	bool consistent;
+	uint8_t cmd;
+
+	consistent = dn_qsl_getStats(&next->stats);
+	consistent = dn_qsl_getConnectStats(&next->connectStats) && consistent;
+	next->state = dn_qsl_getState();
+	for (cmd = 0; cmd < DN_QSL_NUM_CMDS; cmd++)
+	{
+		consistent = dn_qsl_getLatency(cmd, &next->latency[cmd]) && consistent;
+	}
+	if (!consistent)
+	{
+		debug("Stats changing too fast to copy; publish skipped");
+		return FALSE;
+	}
+	next->published_us = dn_time_us64();
+
+	shm->seq = seq;
+	DN_MEMORY_BARRIER(); // Mark the copy as under way before touching it
+	shm->publishes++;
+	shm->published_us = next->published_us;
+	shm->state = next->state;
+	memcpy((void*)&shm->stats, &next->stats, sizeof (dn_qsl_stats_t));
+	memcpy((void*)&shm->connectStats, &next->connectStats, sizeof (dn_qsl_connect_stats_t));
+	memcpy((void*)shm->latency, next->latency, sizeof (next->latency));
+	DN_MEMORY_BARRIER(); // Complete the copy before publishing it
+	shm->seq = seq + 1;
+	return TRUE;
+}
+
+//=========================== helpers =========================================
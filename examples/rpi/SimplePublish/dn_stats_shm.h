@@ -0,0 +1,106 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Export of the QuickStart Library stats through POSIX shared memory.
+
+A publisher thread copies the stats and the FSM state into a shared-memory
+object every period, guarded by a seqlock: seq is odd while the copy is being
+written, and changes with every publish. A monitoring process maps the object
+read-only and takes a snapshot with dn_stats_shm_read, which retries until it
+gets a copy that was not written meanwhile. Neither side takes a lock or makes
+a system call per snapshot, and the library itself is never blocked.
+
+The layout is shared with the reader CLI (examples/rpi/StatsReader), and only
+between processes on the same machine.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_STATS_SHM_H
+#define DN_STATS_SHM_H
+
+#include <string.h>
+
+#include "dn_common.h"
+#include "dn_defaults.h"
+#include "dn_qsl_api.h"
+
+//=========================== defines =========================================
+
+#define DN_STATS_SHM_NAME		"/dn_qsl_stats"
+#define DN_STATS_SHM_MAGIC		0x54535144 // "DQST"
+#define DN_STATS_SHM_VERSION	3
+#define DN_STATS_SHM_READ_TRIES	100 // Snapshots attempted before dn_stats_shm_read gives up
+
+//=========================== typedef =========================================
+
+typedef struct
+{
+	// Written once, when the object is created
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size; // Of this struct, to catch a reader built against another layout
+	uint32_t pid; // Of the publisher
+	// Guarded by seq
+	volatile uint32_t seq;
+	uint32_t publishes;
+	uint64_t published_us; // CLOCK_MONOTONIC, as dn_time_us64
+	uint8_t state; // DN_FSM_STATE_*
+	dn_qsl_stats_t stats;
+	dn_qsl_connect_stats_t connectStats;
+	dn_qsl_latency_t latency[DN_QSL_NUM_CMDS];
+} dn_stats_shm_t;
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Create the shared-memory object and start publishing to it.
+
+ Call after dn_qsl_init.
+
+ \param name Name of the object (see shm_open), e.g. DN_STATS_SHM_NAME.
+ \param period_ms Time between publishes.
+ \return TRUE if the object was created and the publisher started.
+ */
+bool dn_stats_shm_start(const char* name, uint32_t period_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ \brief Take a consistent snapshot of a mapped object; used by readers.
+
+ Inline, so that readers do not link against the library.
+
+ \param shm The object, mapped.
+ \param snapshot Where the copy is written.
+ \return FALSE if no consistent copy could be had in DN_STATS_SHM_READ_TRIES
+ attempts, e.g. as the publisher died while writing.
+ */
+static inline bool dn_stats_shm_read(const volatile dn_stats_shm_t* shm, dn_stats_shm_t* snapshot)
+{
+	uint32_t seq;
+	uint16_t tries;
+
+	for (tries = 0; tries < DN_STATS_SHM_READ_TRIES; tries++)
+	{
+		seq = shm->seq;
+		DN_MEMORY_BARRIER(); // Read seq before the contents...
+		memcpy(snapshot, (const void*)shm, sizeof (dn_stats_shm_t));
+		DN_MEMORY_BARRIER(); // ...and the contents before seq again
+		if ((seq & 1) == 0 && shm->seq == seq)
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+#endif /* DN_STATS_SHM_H */
@@ -8,14 +8,27 @@ Port of the lock module to the Raspberry Pi.
 
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "dn_time.h"
 #include "dn_debug.h"
 
 //=========================== variables =======================================
 
+typedef struct
+{
+	pthread_once_t wakeOnce;
+	pthread_mutex_t wakeLock;
+	pthread_cond_t wakeCond; // Signalled by the read daemon of dn_uart.c
+	bool wakePending;
+} dn_time_vars_t;
+
+static dn_time_vars_t dn_time_vars = {PTHREAD_ONCE_INIT};
+
 //=========================== prototypes ======================================
 
+static void dn_time_initWake(void);
+
 //=========================== public ==========================================
 
 uint32_t dn_time_ms(void)
@@ -28,17 +41,32 @@ uint32_t dn_time_ms(void)
 		log_err("Get time failed");
 	} else
 	{
-		ms = (uint32_t)spec.tv_sec * 1000 + (uint32_t)(spec.tv_nsec / 1.0e6);
+		ms = (uint32_t)spec.tv_sec * 1000 + (uint32_t)(spec.tv_nsec / 1000000);
 	}
 	return ms;
 }
 
+uint64_t dn_time_us64(void)
+{
+	uint64_t us = 0;
+	struct timespec spec;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &spec) == -1)
+	{
+		log_err("Get time failed");
+	} else
+	{
+		us = (uint64_t)spec.tv_sec * 1000000 + (uint64_t)(spec.tv_nsec / 1000);
+	}
+	return us;
+}
+
 void dn_sleep_ms(uint32_t milliseconds)
 {
 	struct timespec remaining;
 	
 	remaining.tv_sec = (time_t)(milliseconds / 1000);
-	remaining.tv_nsec = (milliseconds % 1000) * 1e6;
+	remaining.tv_nsec = (milliseconds % 1000) * 1000000L;
 	
 	// Sleep until the requested interval has elapsed
 	while (nanosleep(&remaining, &remaining) == -1)
@@ -54,6 +82,61 @@ void dn_sleep_ms(uint32_t milliseconds)
 	}
 }
 
+void dn_sleep_until(uint32_t deadline_ms)
+{
+	int32_t remaining_ms = (int32_t)(deadline_ms - dn_time_ms()); // Handle dn_time_ms wrap around
+	struct timespec until;
+	int rc = 0;
+
+	pthread_once(&dn_time_vars.wakeOnce, dn_time_initWake);
+	if (remaining_ms <= 0)
+	{
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &until);
+	until.tv_sec += remaining_ms / 1000;
+	until.tv_nsec += (remaining_ms % 1000) * 1000000L;
+	if (until.tv_nsec >= 1000000000L)
+	{
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+
+	// A wake-up signalled before we got here is not lost, but ends this sleep
+	pthread_mutex_lock(&dn_time_vars.wakeLock);
+	while (!dn_time_vars.wakePending && rc != ETIMEDOUT)
+	{
+		rc = pthread_cond_timedwait(&dn_time_vars.wakeCond, &dn_time_vars.wakeLock, &until);
+	}
+	dn_time_vars.wakePending = FALSE;
+	pthread_mutex_unlock(&dn_time_vars.wakeLock);
+}
+
+void dn_sleep_wake(void)
+{
+	pthread_once(&dn_time_vars.wakeOnce, dn_time_initWake);
+	pthread_mutex_lock(&dn_time_vars.wakeLock);
+	dn_time_vars.wakePending = TRUE;
+	pthread_cond_signal(&dn_time_vars.wakeCond);
+	pthread_mutex_unlock(&dn_time_vars.wakeLock);
+}
+
 //=========================== private =========================================
 
+/**
+ The condition variable times out on the same monotonic clock as dn_time_ms,
+ so that sleeps are not stretched or cut short when the wall clock is set.
+ */
+static void dn_time_initWake(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_mutex_init(&dn_time_vars.wakeLock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&dn_time_vars.wakeCond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
 //=========================== helpers =========================================
\ No newline at end of file
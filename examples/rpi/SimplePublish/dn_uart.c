@@ -3,6 +3,12 @@ Copyright (c) 2016, Dust Networks. All rights reserved.
 
 Port of the uart module to the Raspberry Pi.
 
+With the byte-by-byte HDLC module of the C Library, which records nothing,
+the serial frames are captured here (see dn_capture.h): every write is a
+whole frame, and received bytes are split on the HDLC flags. The
+simple_makefile turns this off with HDLC=qsl, whose HDLC module captures the
+frames itself.
+
 \license See attached DN_LICENSE.txt.
 */
 
@@ -10,10 +16,20 @@ Port of the uart module to the Raspberry Pi.
 #include <fcntl.h>
 #include <termios.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
 #include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 
 #include "dn_uart.h"
+#include "dn_uart_span.h"
 #include "dn_ipmt.h"
+#include "dn_time.h"
+#include "dn_capture.h"
+#define DN_LOG_MODULE	DN_LOG_UART
 #include "dn_debug.h"
 
 //=========================== defines =========================================
@@ -21,14 +37,45 @@ Port of the uart module to the Raspberry Pi.
 #define UART_EXTERNAL	"/dev/ttyUSB0" // External USB UART (set to ttyUSB3 for interface board)
 
 #define UART_PORTNAME			UART_INTERNAL
-#define UART_READ_TIMEOUT_US	500000
+/*
+ The read daemon blocks in read(), which returns as soon as a single byte is
+ in, instead of waiting for more bytes or an inter-byte timer to expire.
+ */
+#define UART_RX_VMIN			1
+#define UART_RX_VTIME			0
+/*
+ USB serial adapters (e.g. FTDI) hold received bytes for up to their latency
+ timer (16 ms by default) before passing them on. Set to 0 to leave it as is;
+ lowering it requires write access to sysfs (typically root).
+ */
+#define UART_USB_LATENCY_TIMER_MS	1
+#define UART_USB_SYSFS_FORMAT		"/sys/bus/usb-serial/devices/%s/latency_timer"
+// Log the time from a request being written until the first byte back
+#define UART_LOG_REPLY_LATENCY	TRUE
+/*
+ Bytes are staged and written in one call per frame. Worst case, every byte of
+ a frame and its 2-byte FCS is escaped, and the frame is wrapped in two flags.
+ */
+#define UART_TX_BUFFER_SIZE		(2 * (MAX_FRAME_LENGTH + 2) + 2)
+// Capture the frames here; see above
+#ifndef UART_CAPTURE
+#define UART_CAPTURE			DN_CAPTURE
+#endif
 
 //=========================== variables =======================================
 
 typedef struct {
 	dn_uart_rxByte_cbt		ipmt_uart_rxByte_cb;
+	dn_uart_rxSpan_cbt		rxSpan_cb;
 	int32_t					uart_fd;
 	pthread_t				read_daemon;
+	uint8_t					txBuf[UART_TX_BUFFER_SIZE];
+	uint16_t				txLen;
+	// Reply latency, handed from writer to read daemon
+	uint64_t				txDone_us;
+	volatile bool			awaitingReply;
+	// Only touched by the read daemon
+	dn_capture_stream_t		rxCapture;
 } dn_uart_vars_t;
 
 static dn_uart_vars_t dn_uart_vars;
@@ -37,18 +84,30 @@ static dn_uart_vars_t dn_uart_vars;
 //=========================== prototypes ======================================
 
 static void* dn_uart_read_daemon(void* arg);
+static void dn_uart_rxSpanToBytes(const uint8_t* data, uint16_t len);
+static void dn_uart_write(const uint8_t* data, uint16_t len);
+static void dn_uart_setLowLatency(int32_t fd);
+static void dn_uart_setUsbLatencyTimer(const char* portname);
+static void dn_uart_logReplyLatency(void);
 
 
 //=========================== public ==========================================
 
 void dn_uart_init(dn_uart_rxByte_cbt rxByte_cb)
+{
+	// Store byte received callback, fed from the span callback
+	dn_uart_vars.ipmt_uart_rxByte_cb = rxByte_cb;
+	dn_uart_initSpan(dn_uart_rxSpanToBytes);
+}
+
+void dn_uart_initSpan(dn_uart_rxSpan_cbt rxSpan_cb)
 {
 	char *portname = UART_PORTNAME;
 	struct termios options;
 	int32_t rc;
 	
-	// Store byte received callback
-	dn_uart_vars.ipmt_uart_rxByte_cb = rxByte_cb;
+	// Store span received callback
+	dn_uart_vars.rxSpan_cb = rxSpan_cb;
 	
 	// Open and store UART file descriptor
 	dn_uart_vars.uart_fd = -1;
@@ -72,11 +131,18 @@ void dn_uart_init(dn_uart_rxByte_cbt rxByte_cb)
 	options.c_oflag = 0;
 	// Local flags: None
 	options.c_lflag = 0;
+	// Blocking reads return on the first byte
+	options.c_cc[VMIN] = UART_RX_VMIN;
+	options.c_cc[VTIME] = UART_RX_VTIME;
 	
 	// Discard any data written and set new options
 	tcflush(dn_uart_vars.uart_fd, TCIFLUSH);
 	tcsetattr(dn_uart_vars.uart_fd, TCSANOW, &options);
 	
+	// Ask the driver to push received bytes to the TTY layer without delay
+	dn_uart_setLowLatency(dn_uart_vars.uart_fd);
+	dn_uart_setUsbLatencyTimer(portname);
+	
 	// Start read daemon to listen for UART RX
 	rc = pthread_create(&dn_uart_vars.read_daemon, NULL, dn_uart_read_daemon, NULL);
 	if (rc != 0)
@@ -87,30 +153,28 @@ void dn_uart_init(dn_uart_rxByte_cbt rxByte_cb)
 
 void dn_uart_txByte(uint8_t byte)
 {
-	int rc;
-	if (dn_uart_vars.uart_fd == -1)
+	if (dn_uart_vars.txLen == UART_TX_BUFFER_SIZE)
 	{
-		log_err("UART not initialized (tx)");
-		return;
+		// Should not happen for a single frame; send what is staged so far
+		log_warn("UART TX buffer full; frame split");
+		dn_uart_txFlush();
 	}
-	
-	rc = write(dn_uart_vars.uart_fd, &byte, 1);
-	if (rc < 0)
-	{
-		log_warn("Write to UART failed");
-	} else if (rc == 0)
-	{
-		// Nothing was sent
-		log_warn("Write to UART sent nothing");
-	} else
+	dn_uart_vars.txBuf[dn_uart_vars.txLen++] = byte;
+}
+
+void dn_uart_txFlush(void)
+{
+	if (dn_uart_vars.txLen > 0)
 	{
-		//debug("dn_uart: Sent a byte");
+		dn_uart_write(dn_uart_vars.txBuf, dn_uart_vars.txLen);
+		dn_uart_vars.txLen = 0;
 	}
 }
 
-void dn_uart_txFlush(void)
+void dn_uart_txSpan(const uint8_t* data, uint16_t len)
 {
-	// Nothing to do since POSIX driver is byte-oriented
+	dn_uart_txFlush();
+	dn_uart_write(data, len);
 }
 
 
@@ -118,12 +182,8 @@ void dn_uart_txFlush(void)
 
 static void* dn_uart_read_daemon(void* arg)
 {
-	struct timeval timeout;
-	int rc;
-	fd_set set;
 	uint8_t rxBuff[MAX_FRAME_LENGTH];
-	int8_t rxBytes = 0;
-	uint8_t n = 0;
+	ssize_t rxBytes = 0;
 	
 	if (dn_uart_vars.uart_fd == -1)
 	{
@@ -134,41 +194,191 @@ static void* dn_uart_read_daemon(void* arg)
 	
 	while(TRUE)
 	{
-		// Add socket to set
-		FD_ZERO(&set);
-		FD_SET(dn_uart_vars.uart_fd, &set);
-		// Set select timeout
-		timeout.tv_sec = 0;
-		timeout.tv_usec = UART_READ_TIMEOUT_US;
-		rc = select(dn_uart_vars.uart_fd + 1, &set, NULL, NULL, &timeout);
-		if (rc < 0)
-		{
-			log_warn("Read daemon select error");
-		} else if (rc == 0)
-		{
-			// Timeout
-		} else
+		// Blocks until at least UART_RX_VMIN bytes are available
+		rxBytes = read(dn_uart_vars.uart_fd, rxBuff, MAX_FRAME_LENGTH);
+		if (rxBytes < 0)
 		{
-			// There are Bytes ready to be read
-			rxBytes = read(dn_uart_vars.uart_fd, rxBuff, MAX_FRAME_LENGTH);
-			if (rxBytes < 0)
+			if (errno != EINTR)
 			{
 				log_warn("Read from UART failed");
-			} else if (rxBytes > 0)
+			}
+		} else if (rxBytes > 0)
+		{
+			dn_uart_logReplyLatency();
+			debug("Received %d bytes", (int)rxBytes);
+			if (UART_CAPTURE)
+			{
+				dn_capture_stream(&dn_uart_vars.rxCapture, 0, rxBuff, (uint16_t)rxBytes);
+			}
+			// Push all bytes read at once to HDLC layer
+			dn_uart_vars.rxSpan_cb(rxBuff, (uint16_t)rxBytes);
+			// Let the main thread act on what was received
+			dn_sleep_wake();
+		}
+	}
+	
+	
+}
+
+
+/**
+ Feed a received span to the byte-oriented callback of dn_uart_init.
+ */
+static void dn_uart_rxSpanToBytes(const uint8_t* data, uint16_t len)
+{
+	uint16_t n;
+	
+	for (n = 0; n < len; n++)
+	{
+		// Push individual byte to HDLC layer
+		dn_uart_vars.ipmt_uart_rxByte_cb(data[n]);
+	}
+}
+
+/**
+ Write bytes to the UART in as few calls as the driver allows, resuming after
+ short writes and interrupted calls.
+ */
+static void dn_uart_write(const uint8_t* data, uint16_t len)
+{
+	dn_capture_stream_t txCapture; // Writes come from the main thread and the read daemon alike
+	uint16_t sent = 0;
+	ssize_t rc;
+	
+	if (dn_uart_vars.uart_fd == -1)
+	{
+		log_err("UART not initialized (tx)");
+		return;
+	}
+	
+	while (sent < len)
+	{
+		rc = write(dn_uart_vars.uart_fd, &data[sent], len - sent);
+		if (rc < 0)
+		{
+			if (errno == EINTR)
 			{
-				debug("Received %d bytes", rxBytes);
-				for (n = 0; n < rxBytes; n++)
-				{
-					// Push individual byte to HDLC layer
-					dn_uart_vars.ipmt_uart_rxByte_cb(rxBuff[n]);
-				}
+				continue;
 			}
+			log_warn("Write to UART failed");
+			break;
+		} else if (rc == 0)
+		{
+			// Nothing was sent
+			log_warn("Write to UART sent nothing");
+			break;
 		}
+		sent += rc;
 	}
 	
+	if (UART_CAPTURE)
+	{
+		memset(&txCapture, 0, sizeof (txCapture));
+		dn_capture_stream(&txCapture, DN_CAPTURE_TO_MOTE, data, sent);
+	}
+	
+	/*
+	 Time a reply only for requests; acknowledgements of notifications
+	 (packet type bit set in the control byte after the flag) get none.
+	 */
+	if (UART_LOG_REPLY_LATENCY && sent > 1 && !(data[1] & 0x01))
+	{
+		dn_uart_vars.txDone_us = dn_time_us64();
+		__sync_synchronize(); // Publish timestamp before flag
+		dn_uart_vars.awaitingReply = TRUE;
+	}
+}
+
+/**
+ Request ASYNC_LOW_LATENCY, so that the driver does not defer passing
+ received bytes on. Not all drivers support it, which is harmless.
+ */
+static void dn_uart_setLowLatency(int32_t fd)
+{
+	struct serial_struct serial;
 	
+	if (ioctl(fd, TIOCGSERIAL, &serial) == -1)
+	{
+		debug("Serial driver does not support TIOCGSERIAL");
+		return;
+	}
+	serial.flags |= ASYNC_LOW_LATENCY;
+	if (ioctl(fd, TIOCSSERIAL, &serial) == -1)
+	{
+		debug("Serial driver does not support ASYNC_LOW_LATENCY");
+	} else
+	{
+		debug("ASYNC_LOW_LATENCY set");
+	}
 }
 
+/**
+ Lower the latency timer of a USB serial adapter through sysfs. Ports that
+ are not USB serial devices have no such attribute and are left untouched.
+ */
+static void dn_uart_setUsbLatencyTimer(const char* portname)
+{
+	char devPath[PATH_MAX];
+	char sysPath[PATH_MAX];
+	const char* devName;
+	FILE* file;
+	
+	if (UART_USB_LATENCY_TIMER_MS == 0)
+	{
+		return;
+	}
+	
+	// Resolve aliases such as /dev/serial0 to the actual device name
+	if (realpath(portname, devPath) == NULL)
+	{
+		return;
+	}
+	devName = strrchr(devPath, '/');
+	devName = (devName == NULL) ? devPath : devName + 1;
+	if (snprintf(sysPath, sizeof (sysPath), UART_USB_SYSFS_FORMAT, devName) >= (int)sizeof (sysPath))
+	{
+		debug("sysfs path of %s too long", devName);
+		return;
+	}
+	if (access(sysPath, F_OK) != 0)
+	{
+		debug("%s is not a USB serial device", devName);
+		return;
+	}
+	
+	file = fopen(sysPath, "w");
+	if (file == NULL)
+	{
+		log_warn("Could not lower latency timer of %s (requires root)", devName);
+		return;
+	}
+	fprintf(file, "%d", UART_USB_LATENCY_TIMER_MS);
+	if (fclose(file) != 0)
+	{
+		log_warn("Could not lower latency timer of %s", devName);
+	} else
+	{
+		log_info("Latency timer of %s set to %d ms", devName, UART_USB_LATENCY_TIMER_MS);
+	}
+}
+
+/**
+ Log the time from the last request being handed to the driver until the
+ first byte after it is read. This includes the line time of both frames.
+ */
+static void dn_uart_logReplyLatency(void)
+{
+	uint32_t latency_us;
+	
+	if (!dn_uart_vars.awaitingReply)
+	{
+		return;
+	}
+	__sync_synchronize(); // Read flag before timestamp
+	latency_us = (uint32_t)(dn_time_us64() - dn_uart_vars.txDone_us);
+	dn_uart_vars.awaitingReply = FALSE;
+	log_info("Reply latency: %u us", latency_us);
+}
 
 //=========================== helpers =========================================
 
@@ -3,15 +3,22 @@ Copyright (c) 2016, Dust Networks. All rights reserved.
 
 SimplePublish example application for the Raspberry Pi.
 
+Downstream payloads are requests for dn_rpc.h: an opcode, a correlation ID and
+the arguments. OPCODE_PRINT logs its arguments, and every request is answered
+on DEST_PORT with the opcode, correlation ID and a status.
+
 \license See attached DN_LICENSE.txt.
 */
 
 #include <stdlib.h>
 
 #include "dn_qsl_api.h"		// Only really need this include
+#include "dn_rpc.h"			// Downstream payloads are requests
 #include "dn_debug.h"		// Included to borrow debug macros
 #include "dn_endianness.h"	// Included to borrow array copying
 #include "dn_time.h"		// Included to borrow sleep function
+#include "dn_stats_shm.h"	// Stats for monitoring, see examples/rpi/StatsReader
+#include "dn_capture_file.h"	// Serial frames for debugging, see tools/capture
 
 #define NETID			0		// Factory default value used if zero (1229)
 #define JOINKEY			NULL	// Factory default value used if NULL (44 55 53 54 4E 45 54 57 4F 52 4B 53 52 4F 43 4B)
@@ -19,9 +26,12 @@ SimplePublish example application for the Raspberry Pi.
 #define SRC_PORT		60000	// Default port used if zero (0xf0b8)
 #define DEST_PORT		0		// Default port used if zero (0xf0b8)
 #define DATA_PERIOD_MS	5000	// Should be longer than (or equal to) bandwidth
+#define STATS_PERIOD_MS	1000	// Stats are published to shared memory this often
+#define CAPTURE_SLOTS	4096	// Last serial frames kept in DN_CAPTURE_FILE_NAME
+#define OPCODE_PRINT	1		// Logs the arguments, bytes and string
 
 static uint16_t randomWalk(void);
-static void parsePayload(const uint8_t *payload, uint8_t size);
+static uint8_t printArgs(const uint8_t* args, uint8_t argsLen, uint8_t* reply, uint8_t* replyLen);
 
 /*
  * 
@@ -29,11 +39,13 @@ static void parsePayload(const uint8_t *payload, uint8_t size);
 int main(int argc, char** argv)
 {
 	uint8_t payload[3];
-	uint8_t inboxBuf[DN_DEFAULT_PAYLOAD_SIZE_LIMIT];
-	uint8_t bytesRead;
 	
 	log_info("Initializing...");
+	dn_capture_file_start(DN_CAPTURE_FILE_NAME, CAPTURE_SLOTS); // Logs and carries on without if it fails
 	dn_qsl_init(); // Always returns TRUE at the moment
+	dn_rpc_init(DEST_PORT);
+	dn_rpc_register(OPCODE_PRINT, printArgs);
+	dn_stats_shm_start(DN_STATS_SHM_NAME, STATS_PERIOD_MS); // Logs and carries on without if it fails
 
 	while (TRUE)
 	{
@@ -54,11 +66,7 @@ int main(int argc, char** argv)
 				log_info("Send failed");
 			}
 
-			do
-			{
-				bytesRead = dn_qsl_read(inboxBuf);
-				parsePayload(inboxBuf, bytesRead);
-			} while (bytesRead > 0);
+			dn_rpc_poll();
 			
 			dn_sleep_ms(DATA_PERIOD_MS);
 		} else
@@ -95,24 +103,22 @@ static uint16_t randomWalk(void)
 	return lastValue;
 }
 
-static void parsePayload(const uint8_t *payload, uint8_t size)
+static uint8_t printArgs(const uint8_t* args, uint8_t argsLen, uint8_t* reply, uint8_t* replyLen)
 {
 	uint8_t i;
-	char msg[size + 1];
-	
-	if (size == 0)
-	{
-		// Nothing to parse
-		return;
-	}
+	char msg[argsLen + 1];
 	
 	// Parse bytes individually as well as together as a string
-	log_info("Received downstream payload of %u bytes:", size);
-	for (i = 0; i < size; i++)
+	log_info("Received print request of %u bytes:", argsLen);
+	for (i = 0; i < argsLen; i++)
 	{
-		msg[i] = payload[i];
-		log_info("\tByte# %03u: %#.2x (%u)", i, payload[i], payload[i]);
+		msg[i] = args[i];
+		log_info("\tByte# %03u: %#.2x (%u)", i, args[i], args[i]);
 	}
-	msg[size] = '\0';
+	msg[argsLen] = '\0';
 	log_info("\tMessage: %s", msg);
+	
+	// Nothing to reply but the status
+	*replyLen = 0;
+	return DN_RPC_RC_OK;
 }
@@ -0,0 +1,208 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Reader of the QuickStart Library stats published to shared memory by the
+Raspberry Pi port (see dn_stats_shm.h).
+
+Prints one snapshot as "name value" lines, for a monitoring agent to scrape,
+with the round-trip latency of each command to the mote on a line of its own,
+or a snapshot every period with -w:
+	./stats_reader [-n /dn_qsl_stats] [-w period_ms]
+The age of the snapshot tells a stalled publisher apart, and the publisher's
+PID one that has exited.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "dn_stats_shm.h"
+#include "dn_fsm.h"
+
+//=========================== defines =========================================
+
+//=========================== variables =======================================
+
+static const char* const reader_cmdNames[DN_QSL_NUM_CMDS] = {
+	"reset", "disconnect", "getMoteStatus", "getMoteInfo", "openSocket", "bindSocket",
+	"setJoinKey", "setNetworkId", "setJoinDutyCycle", "search", "join", "requestService",
+	"getServiceInfo", "sendTo", "getTime"
+};
+
+//=========================== prototypes ======================================
+
+static void print(const dn_stats_shm_t* snap);
+static const char* stateName(uint8_t state);
+static uint64_t now_us(void);
+
+//=========================== main ============================================
+
+int main(int argc, char** argv)
+{
+	const char* name = DN_STATS_SHM_NAME;
+	uint32_t watch_ms = 0;
+	const volatile dn_stats_shm_t* shm;
+	dn_stats_shm_t snap;
+	void* map;
+	int fd;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:w:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			name = optarg;
+			break;
+		case 'w':
+			watch_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			printf("Usage: %s [-n name] [-w period_ms]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	// Read-only; the reader can never disturb the publisher
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1)
+	{
+		perror("Unable to open shared memory (is the publisher running?)");
+		return 1;
+	}
+	map = mmap(NULL, sizeof (dn_stats_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		perror("Unable to map shared memory");
+		return 1;
+	}
+	shm = map;
+	if (shm->magic != DN_STATS_SHM_MAGIC || shm->version != DN_STATS_SHM_VERSION
+			|| shm->size != sizeof (dn_stats_shm_t))
+	{
+		fprintf(stderr, "Layout of %s does not match this reader (version %u)\n", name, DN_STATS_SHM_VERSION);
+		return 1;
+	}
+
+	do
+	{
+		if (!dn_stats_shm_read(shm, &snap))
+		{
+			fprintf(stderr, "No consistent snapshot; publisher stuck while writing?\n");
+			return 1;
+		}
+		print(&snap);
+		if (watch_ms > 0)
+		{
+			printf("\n");
+			fflush(stdout);
+			usleep(watch_ms * 1000);
+		}
+	} while (watch_ms > 0);
+
+	return 0;
+}
+
+//=========================== private =========================================
+
+static void print(const dn_stats_shm_t* snap)
+{
+	const dn_qsl_stats_t* s = &snap->stats;
+	const dn_qsl_connect_stats_t* c = &snap->connectStats;
+	uint8_t i;
+
+	printf("pid %u%s\n", snap->pid, kill(snap->pid, 0) == 0 || errno == EPERM ? "" : " (exited)");
+	printf("publishes %u\n", snap->publishes);
+	printf("age_ms %llu\n", (unsigned long long)((now_us() - snap->published_us) / 1000));
+	printf("state %s\n", stateName(snap->state));
+
+	printf("sends %u\n", s->sends);
+	printf("sends_queued %u\n", s->sendsQueued);
+	printf("bytes_sent %u\n", s->bytesSent);
+	printf("send_fails_not_connected %u\n", s->sendFailsNotConnected);
+	printf("send_fails_too_long %u\n", s->sendFailsTooLong);
+	printf("send_fails_rejected %u\n", s->sendFailsRejected);
+	printf("send_fails_serial %u\n", s->sendFailsSerial);
+	printf("send_fails_timeout %u\n", s->sendFailsTimeout);
+	printf("packets_received %u\n", s->packetsReceived);
+	printf("bytes_received %u\n", s->bytesReceived);
+	printf("inbox_overflows %u\n", s->inboxOverflows);
+	printf("commands %u\n", s->commands);
+	for (i = 0; i < DN_QSL_NUM_RC; i++)
+	{
+		if (s->replies[i] > 0)
+		{
+			printf("replies_rc_%#.2x%s %u\n", i, i == DN_QSL_NUM_RC - 1 ? "_or_above" : "", s->replies[i]);
+		}
+	}
+	for (i = 0; i < DN_QSL_NUM_CMDS; i++)
+	{
+		if (s->rspTimeouts[i] > 0)
+		{
+			printf("rsp_timeouts_%s %u\n", reader_cmdNames[i], s->rspTimeouts[i]);
+		}
+	}
+	printf("cmd_timeouts %u\n", s->cmdTimeouts);
+	printf("resets %u\n", s->resets);
+	printf("boots %u\n", s->boots);
+	printf("connections_lost %u\n", s->connectionsLost);
+
+	printf("connects %u\n", c->connects);
+	printf("connected %u\n", c->connected);
+	printf("joins %u\n", c->joins);
+	printf("join_fails %u\n", c->joinFails);
+	printf("join_duty_cycle %u\n", c->joinDutyCycle);
+	printf("last_connect_ms %u\n", c->lastConnect_ms);
+	printf("last_join_ms %u\n", c->lastJoin_ms);
+
+	for (i = 0; i < DN_QSL_NUM_CMDS; i++)
+	{
+		const dn_qsl_latency_t* l = &snap->latency[i];
+
+		if (l->count > 0 || l->timeouts > 0)
+		{
+			printf("latency_%s count %u timeouts %u p50_us %u p99_us %u max_us %u\n",
+					reader_cmdNames[i], l->count, l->timeouts, l->p50_us, l->p99_us, l->max_us);
+		}
+	}
+}
+
+//=========================== helpers =========================================
+
+static const char* stateName(uint8_t state)
+{
+	switch (state)
+	{
+	case DN_FSM_STATE_NOT_INITIALIZED:	return "not_initialized";
+	case DN_FSM_STATE_DISCONNECTED:		return "disconnected";
+	case DN_FSM_STATE_PRE_JOIN:			return "pre_join";
+	case DN_FSM_STATE_JOINING:			return "joining";
+	case DN_FSM_STATE_REQ_SERVICE:		return "req_service";
+	case DN_FSM_STATE_RESETTING:		return "resetting";
+	case DN_FSM_STATE_PROMISCUOUS:		return "promiscuous";
+	case DN_FSM_STATE_CONNECTED:		return "connected";
+	case DN_FSM_STATE_SENDING:			return "sending";
+	case DN_FSM_STATE_SEND_FAILED:		return "send_failed";
+	case DN_FSM_STATE_SYNCING_TIME:		return "syncing_time";
+	default:							return "unknown";
+	}
+}
+
+/**
+ Same clock as dn_time_us64 of the publisher.
+ */
+static uint64_t now_us(void)
+{
+	struct timespec spec;
+
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return (uint64_t)spec.tv_sec * 1000000 + spec.tv_nsec / 1000;
+}
@@ -47,9 +47,9 @@
 #ifndef CONF_RTC_H_INCLUDED
 #define CONF_RTC_H_INCLUDED
 
-/** Select RTC clock. Use 1.024kHz from 32kHz internal ULP oscillator(OSCULP32K)
+/** Select RTC clock. Use 32.768kHz from 32kHz internal ULP oscillator(OSCULP32K)
  *  for RTC clock.
  */
-#  define RTC_CLOCK_SOURCE    RTC_CLOCK_SELECTION_ULP1K
+#  define RTC_CLOCK_SOURCE    RTC_CLOCK_SELECTION_ULP32K
 
 #endif
@@ -3,19 +3,39 @@ Copyright (c) 2016, Dust Networks. All rights reserved.
 
 Port of the time module to the SAM C21 Xplained Pro.
 
+Sleeps are spent in STANDBY mode, woken by an RTC compare match at the
+deadline or by SERCOM3 on a byte from the mote. SERCOM3 runs in standby, and
+the 48 MHz oscillator is only started on its request (see conf_clocks.h).
+
+The RTC counts the 32.768 kHz clock of OSCULP32K without prescaling (see
+conf_rtc.h), for a resolution of about 31 us. Its 32-bit counter is extended
+to 64 bits by counting overflows, and both dn_time_ms and dn_time_us64 are
+derived from the extended count.
+
 \license See attached DN_LICENSE.txt.
 */
 
 #include <rtc_count.h>
+#include <interrupt.h>
+#include <power.h>
+#include <system_interrupt.h>
 
 #include "dn_time.h"
 #include "dn_debug.h"
-#include "delay.h"
+
+//=========================== defines =========================================
+
+// Shorter sleeps are spent polling; setting the compare takes a few RTC clocks
+#define STANDBY_MIN_MS	3
+#define RTC_TICKS_PER_S	32768
 
 //=========================== variables =======================================
 
 typedef struct {
 	struct rtc_module rtc_instance;
+	bool rtcInitialized;
+	volatile bool wakePending;
+	volatile uint32_t overflows; // Upper 32 bits of the RTC count
 } dn_time_vars_t;
 
 dn_time_vars_t dn_time_vars;
@@ -23,29 +43,69 @@ dn_time_vars_t dn_time_vars;
 //=========================== prototypes ======================================
 
 static void configure_rtc_count(void);
+static uint64_t dn_time_ticks(void);
 
 //=========================== public ==========================================
 
 uint32_t dn_time_ms(void)
 {
-	static bool rtc_initialized = FALSE;
-	if (!rtc_initialized)
+	// 1000 / 32768 = 125 / 4096; wraps around at 2^32 ms like the other ports
+	return (uint32_t)((dn_time_ticks() * 125) >> 12);
+}
+
+uint64_t dn_time_us64(void)
+{
+	// 1000000 / 32768 = 15625 / 512
+	return (dn_time_ticks() * 15625) >> 9;
+}
+
+void dn_sleep_ms(uint32_t milliseconds)
+{
+	uint32_t deadline_ms = dn_time_ms() + milliseconds;
+
+	// Go back to sleep if woken early, e.g. by a notification from the mote
+	while ((int32_t)(deadline_ms - dn_time_ms()) > 0) // Handle dn_time_ms wrap around
 	{
-		configure_rtc_count();
-		rtc_initialized = TRUE;
+		dn_sleep_until(deadline_ms);
 	}
-	return rtc_count_get_count(&dn_time_vars.rtc_instance);
 }
 
-void dn_sleep_ms(uint32_t milliseconds)
+void dn_sleep_until(uint32_t deadline_ms)
 {
-	/* A simple delay is used for simplicity in this example.
-	 * To save power, we could instead have initialized a timer to fire an
-	 * interrupt after the set number of milliseconds, followed by entering
-	 * a low-power sleep mode. Upon wake up, we would have to check that we
-	 * were indeed woken by said interrupt (and e.g. not an USART interrupt)
-	 * to decide if we should go back to sleep or not. */
-	delay_ms(milliseconds);
+	int32_t remaining_ms = (int32_t)(deadline_ms - dn_time_ms()); // Handle dn_time_ms wrap around
+	uint32_t compare;
+
+	if (remaining_ms < STANDBY_MIN_MS)
+	{
+		return;
+	}
+
+	/*
+	 Interrupts are held off from the last check until the CPU is asleep, so
+	 that a wake-up cannot slip in between; a pending interrupt still wakes the
+	 CPU, and is served once they are enabled again.
+	 */
+	cpu_irq_disable();
+	// Rounded up, so as not to wake up just short of the deadline; the compare wraps around with the count
+	compare = (uint32_t)dn_time_ticks()
+			+ (uint32_t)(((uint64_t)remaining_ms * RTC_TICKS_PER_S + 999) / 1000);
+	rtc_count_set_compare(&dn_time_vars.rtc_instance, compare, RTC_COUNT_COMPARE_0);
+	RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+	RTC->MODE0.INTENSET.reg = RTC_MODE0_INTENSET_CMP0;
+	// The match is missed if the deadline passed while the compare was set
+	if (!dn_time_vars.wakePending && (int32_t)(deadline_ms - dn_time_ms()) > 0)
+	{
+		system_set_sleepmode(SYSTEM_SLEEPMODE_STANDBY);
+		system_sleep();
+	}
+	RTC->MODE0.INTENCLR.reg = RTC_MODE0_INTENCLR_CMP0;
+	dn_time_vars.wakePending = FALSE;
+	cpu_irq_enable();
+}
+
+void dn_sleep_wake(void)
+{
+	dn_time_vars.wakePending = TRUE;
 }
 
 //=========================== private =========================================
@@ -55,12 +115,58 @@ static void configure_rtc_count(void)
 	struct rtc_count_config config_rtc_count;
 	rtc_count_get_config_defaults(&config_rtc_count);
 
-	config_rtc_count.prescaler	= RTC_COUNT_PRESCALER_DIV_1;	// Count milliseconds
+	config_rtc_count.prescaler	= RTC_COUNT_PRESCALER_DIV_1;	// Count 32.768 kHz clocks
 	config_rtc_count.mode		= RTC_COUNT_MODE_32BIT;			// Count to max 32-bit
 	
 	// Initialize and enable RTC
 	rtc_count_init(&dn_time_vars.rtc_instance, RTC, &config_rtc_count);
 	rtc_count_enable(&dn_time_vars.rtc_instance);
+
+	// Overflows are always counted; compare match interrupt is only enabled while sleeping
+	RTC->MODE0.INTENSET.reg = RTC_MODE0_INTENSET_OVF;
+	system_interrupt_enable(SYSTEM_INTERRUPT_MODULE_RTC);
+}
+
+/**
+ Read the RTC count, extended to 64 bits with the overflow count.
+ */
+static uint64_t dn_time_ticks(void)
+{
+	irqflags_t flags;
+	uint32_t count;
+	uint32_t overflows;
+
+	if (!dn_time_vars.rtcInitialized)
+	{
+		configure_rtc_count();
+		dn_time_vars.rtcInitialized = TRUE;
+	}
+
+	flags = cpu_irq_save();
+	count = rtc_count_get_count(&dn_time_vars.rtc_instance);
+	overflows = dn_time_vars.overflows;
+	if (RTC->MODE0.INTFLAG.reg & RTC_MODE0_INTFLAG_OVF)
+	{
+		// Overflowed, but not yet counted by RTC_Handler; read again past the overflow
+		count = rtc_count_get_count(&dn_time_vars.rtc_instance);
+		overflows++;
+	}
+	cpu_irq_restore(flags);
+
+	return ((uint64_t)overflows << 32) | count;
 }
 
-//=========================== helpers =========================================
\ No newline at end of file
+//=========================== helpers =========================================
+
+//=========================== interrupt handlers ==============================
+
+void RTC_Handler(void)
+{
+	if (RTC->MODE0.INTFLAG.reg & RTC_MODE0_INTFLAG_OVF)
+	{
+		RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_OVF;
+		dn_time_vars.overflows++;
+	}
+	// On a compare match, the deadline was reached; nothing to do but to have woken up
+	RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+}
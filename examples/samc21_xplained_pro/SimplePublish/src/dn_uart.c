@@ -10,7 +10,10 @@ Setup and initialization found in serial.c.
 #include <asf.h>
 
 #include "dn_uart.h"
+#include "dn_uart_span.h"
 #include "dn_ipmt.h"
+#include "dn_time.h"
+#define DN_LOG_MODULE	DN_LOG_UART
 #include "dn_debug.h"
 #include "serial.h"
 
@@ -21,18 +24,28 @@ Setup and initialization found in serial.c.
 
 typedef struct {
 	dn_uart_rxByte_cbt	ipmt_uart_rxByte_cb;
+	dn_uart_rxSpan_cbt	rxSpan_cb;
 } dn_uart_vars_t;
 
 dn_uart_vars_t dn_uart_vars;
 
 //=========================== prototypes ======================================
 
+static void dn_uart_rxSpanToBytes(const uint8_t* data, uint16_t len);
+
 //=========================== public ==========================================
 
 void dn_uart_init(dn_uart_rxByte_cbt rxByte_cb)
 {
-	// Store RX callback function
+	// Store RX callback function, fed from the span callback
 	dn_uart_vars.ipmt_uart_rxByte_cb = rxByte_cb;
+	dn_uart_initSpan(dn_uart_rxSpanToBytes);
+}
+
+void dn_uart_initSpan(dn_uart_rxSpan_cbt rxSpan_cb)
+{
+	// Store RX callback function
+	dn_uart_vars.rxSpan_cb = rxSpan_cb;
 
 	// Initialize external USART (SERCOM3)
 	ext_usart_clock_init();
@@ -55,19 +68,49 @@ void dn_uart_txFlush()
 	// Nothing to do since we push byte-by-byte
 }
 
+void dn_uart_txSpan(const uint8_t* data, uint16_t len)
+{
+	uint16_t n;
+
+	// No DMA set up for SERCOM3; push byte-by-byte
+	for (n = 0; n < len; n++)
+	{
+		dn_uart_txByte(data[n]);
+	}
+}
+
 
 //=========================== private =========================================
 
+/**
+ Feed a received span to the byte-oriented callback of dn_uart_init.
+ */
+static void dn_uart_rxSpanToBytes(const uint8_t* data, uint16_t len)
+{
+	uint16_t n;
+
+	for (n = 0; n < len; n++)
+	{
+		// Push individual byte to HDLC layer
+		dn_uart_vars.ipmt_uart_rxByte_cb(data[n]);
+	}
+}
+
 //=========================== helpers =========================================
 
 //=========================== interrupt handlers ==============================
 
 void SERCOM3_Handler()
 {
+	uint8_t rbyte;
+
 	// All interrupts for one peripheral are ORed together; check that it was RX completed
 	if (SERCOM3->USART.INTFLAG.bit.RXC){
 		//port_pin_toggle_output_level(LED_0_PIN);
+		rbyte = (uint8_t)SERCOM3->USART.DATA.reg;
 		// Push received byte to HDLC layer
-		dn_uart_vars.ipmt_uart_rxByte_cb(SERCOM3->USART.DATA.reg);
+		dn_uart_vars.rxSpan_cb(&rbyte, 1);
+		// Let the main loop act on what was received
+		dn_sleep_wake();
 	}
 }
\ No newline at end of file
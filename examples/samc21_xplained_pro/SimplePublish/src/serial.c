@@ -105,7 +105,8 @@ void ext_usart_init(void)
 	SERCOM3->USART.CTRLB.reg =
 		SERCOM_USART_CTRLB_CHSIZE(0x0)	// 8 bit character size
 		| SERCOM_USART_CTRLB_TXEN		// Enable transmitter
-		| SERCOM_USART_CTRLB_RXEN;		// Enable receiver
+		| SERCOM_USART_CTRLB_RXEN		// Enable receiver
+		| SERCOM_USART_CTRLB_SFDE;		// Wake up from standby on start of frame
 	
 	// Make sure synchronization is complete before enabling USART
 	while(SERCOM3->USART.SYNCBUSY.bit.CTRLB);
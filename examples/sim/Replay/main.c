@@ -0,0 +1,495 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Replay of a serial capture through the QuickStart Library under a virtual
+clock.
+
+The frames of a capture (dn_capture.h), taken on hardware or by the scenario
+runner, are fed back to the library by the simulated mote of tools/mote_emu:
+Notifications at their recorded times, and replies to the requests of the
+library as they come, after the recorded latency. The library runs the loop
+of SimplePublish on the simulator port of examples/sim/Scenarios, so a slow
+join, a reset storm or a burst of notifications recorded in the field plays
+out the same on every run, in a fraction of a second and without hardware:
+	./replay capture.bin
+
+The state transitions of the FSM are taken from the trace ring and listed,
+with the virtual time at which they happened. They can be written to a file
+with -o, and compared with those of an earlier run with -b, which reports the
+first transition that differs and how far the timings of the others have
+moved; the exit code is non-zero if any transition differs, or moved by more
+than -d ms. Requests of the library that have no recorded counterpart are
+counted as misses; they mark where the library no longer behaves as it did
+when the capture was taken.
+
+Only frames captured whole and with a good FCS are replayed. The capture
+should start at, or before, the start of the library; a capture that starts
+later replays, but the library begins by asking for things that were not
+recorded.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "dn_qsl_api.h"
+#include "dn_fsm.h"
+#include "dn_time.h"
+#include "dn_trace.h"
+#include "dn_capture.h"
+#include "dn_sim.h"
+#include "dn_mote_sim.h"
+
+//=========================== defines =========================================
+
+#define REPLAY_SRC_PORT			60000
+#define REPLAY_BANDWIDTH_MS		5000
+#define REPLAY_DATA_PERIOD_MS	5000
+#define REPLAY_TAIL_MS			10000 // Run on after the last recorded frame
+#define REPLAY_MAX_TRANSITIONS	10000
+#define REPLAY_NAME_LEN			16
+
+// Capture layout; little-endian, as written by every supported target
+#define CAP_HEADER_LEN			16
+#define CAP_SLOT_HEADER_LEN		16
+#define CAP_FRAME_HEADER_LEN	4 // Control, command ID, sequence number, length
+#define CAP_CTRL_ACK			0x01 // Reply or acknowledgement, not a request or notification
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	uint32_t t_ms;
+	char from[REPLAY_NAME_LEN];
+	char to[REPLAY_NAME_LEN];
+} replay_transition_t;
+
+typedef struct
+{
+	bool verbose;
+	uint16_t srcPort;
+	uint32_t period_ms;
+	uint32_t tolerance_ms;
+	const char* outFile;
+	const char* baselineFile;
+	// Recording
+	dn_mote_sim_rec_t* recs;
+	uint32_t recCount;
+	uint32_t recRequests;
+	uint32_t recNotifs;
+	uint32_t recSkipped;
+	// Outcome
+	replay_transition_t* transitions;
+	uint32_t transitionCount;
+	replay_transition_t* baseline;
+	uint32_t baselineCount;
+} replay_vars_t;
+
+static replay_vars_t replay_vars;
+
+//=========================== prototypes ======================================
+
+static bool loadCapture(const char* fileName);
+static void run(uint32_t end_ms);
+static void collectTransitions(void);
+static bool writeTransitions(const char* fileName);
+static bool loadBaseline(const char* fileName);
+static bool compareBaseline(void);
+static const char* stateName(uint8_t state);
+static uint64_t getU64(const uint8_t* p);
+static uint32_t getU32(const uint8_t* p);
+static uint16_t getU16(const uint8_t* p);
+static double now_s(void);
+
+//=========================== main ============================================
+
+int main(int argc, char** argv)
+{
+	const dn_mote_sim_stats_t* moteStats;
+	dn_qsl_stats_t stats;
+	dn_qsl_connect_stats_t connectStats;
+	uint32_t end_ms;
+	uint32_t i;
+	double start;
+	double elapsed;
+	bool ok = TRUE;
+	int opt;
+
+	replay_vars.srcPort = REPLAY_SRC_PORT;
+	replay_vars.period_ms = REPLAY_DATA_PERIOD_MS;
+	while ((opt = getopt(argc, argv, "p:s:o:b:d:v")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p':
+			replay_vars.period_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			replay_vars.srcPort = (uint16_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			replay_vars.outFile = optarg;
+			break;
+		case 'b':
+			replay_vars.baselineFile = optarg;
+			break;
+		case 'd':
+			replay_vars.tolerance_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			replay_vars.verbose = TRUE;
+			break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (optind != argc - 1 || replay_vars.period_ms == 0)
+	{
+		printf("Usage: %s [-p period_ms] [-s srcPort] [-o transitions.txt] [-b baseline.txt] [-d tolerance_ms] [-v] capture.bin\n",
+				argv[0]);
+		return 1;
+	}
+	if (!loadCapture(argv[optind]))
+	{
+		return 1;
+	}
+	if (replay_vars.baselineFile != NULL && !loadBaseline(replay_vars.baselineFile))
+	{
+		return 1;
+	}
+	printf("Recording: %u frames over %.1f s, %u requests and %u notifications from the mote; %u bad or torn skipped\n",
+			replay_vars.recCount, replay_vars.recs[replay_vars.recCount - 1].offset_ms / 1000.0,
+			replay_vars.recRequests, replay_vars.recNotifs, replay_vars.recSkipped);
+
+	dn_sim_setTime(0);
+	dn_sim_startReplay(replay_vars.recs, replay_vars.recCount);
+	end_ms = replay_vars.recs[replay_vars.recCount - 1].offset_ms + REPLAY_TAIL_MS;
+	start = now_s();
+	run(end_ms);
+	elapsed = now_s() - start;
+
+	collectTransitions();
+	for (i = 0; i < replay_vars.transitionCount; i++)
+	{
+		if (replay_vars.verbose || replay_vars.outFile == NULL)
+		{
+			printf("%10u %s %s\n", replay_vars.transitions[i].t_ms,
+					replay_vars.transitions[i].from, replay_vars.transitions[i].to);
+		}
+	}
+
+	moteStats = dn_mote_sim_getStats();
+	dn_qsl_getStats(&stats);
+	dn_qsl_getConnectStats(&connectStats);
+	printf("Replayed %.1f s in %.3f s of wall clock (%.0fx real time)\n",
+			dn_time_ms() / 1000.0, elapsed, dn_time_ms() / 1e3 / elapsed);
+	printf("Mote: %u replies and %u notifications replayed, %u requests without a recorded reply\n",
+			moteStats->replayedReplies, moteStats->replayedNotifs, moteStats->replayMisses);
+	printf("Library: %u transitions, %u connects (%u succeeded), %u sends (%u queued), %u packets received\n",
+			replay_vars.transitionCount, connectStats.connects, connectStats.connected, stats.sends, stats.sendsQueued,
+			stats.packetsReceived);
+
+	if (replay_vars.outFile != NULL && !writeTransitions(replay_vars.outFile))
+	{
+		return 1;
+	}
+	if (replay_vars.baselineFile != NULL)
+	{
+		ok = compareBaseline();
+	}
+	return ok ? 0 : 1;
+}
+
+//=========================== private =========================================
+
+/**
+ Read the frames of a capture, oldest first, into recordings for the mote.
+ The timestamps are taken relative to the first frame.
+ */
+static bool loadCapture(const char* fileName)
+{
+	uint8_t* dump;
+	long dumpLen;
+	FILE* f;
+	uint16_t frameLen;
+	uint32_t size;
+	uint32_t slotLen;
+	uint32_t head;
+	uint32_t index;
+	uint64_t ts0_us = 0;
+	uint64_t ts_us;
+	uint16_t len;
+	const uint8_t* slot;
+	dn_mote_sim_rec_t* rec;
+
+	f = fopen(fileName, "rb");
+	if (f == NULL)
+	{
+		perror("Unable to open capture");
+		return FALSE;
+	}
+	fseek(f, 0, SEEK_END);
+	dumpLen = ftell(f);
+	rewind(f);
+	dump = malloc(dumpLen > 0 ? dumpLen : 1);
+	if (dumpLen < CAP_HEADER_LEN || fread(dump, 1, dumpLen, f) != (size_t)dumpLen)
+	{
+		printf("Capture too short\n");
+		return FALSE;
+	}
+	fclose(f);
+
+	frameLen = getU16(&dump[6]);
+	size = getU32(&dump[8]);
+	head = getU32(&dump[12]);
+	slotLen = CAP_SLOT_HEADER_LEN + frameLen;
+	if (getU32(&dump[0]) != DN_CAPTURE_MAGIC || getU16(&dump[4]) != DN_CAPTURE_VERSION
+			|| size == 0 || (size & (size - 1)) != 0
+			|| (uint64_t)dumpLen < CAP_HEADER_LEN + (uint64_t)size * slotLen)
+	{
+		printf("Not a capture of version %u\n", DN_CAPTURE_VERSION);
+		return FALSE;
+	}
+
+	replay_vars.recs = malloc((head < size ? head : size) * sizeof (dn_mote_sim_rec_t) + 1);
+	for (index = head > size ? head - size : 0; index != head; index++)
+	{
+		slot = &dump[CAP_HEADER_LEN + (index & (size - 1)) * slotLen];
+		len = getU16(&slot[12]);
+		if (getU32(&slot[8]) != index || (slot[14] & DN_CAPTURE_BAD)
+				|| len < CAP_FRAME_HEADER_LEN || len > frameLen || len > DN_MOTE_SIM_MAX_FRAME_LEN)
+		{
+			replay_vars.recSkipped++;
+			continue;
+		}
+		ts_us = getU64(&slot[0]);
+		if (replay_vars.recCount == 0)
+		{
+			ts0_us = ts_us;
+		}
+		rec = &replay_vars.recs[replay_vars.recCount++];
+		rec->offset_ms = (uint32_t)((ts_us - ts0_us) / 1000);
+		rec->toMote = (slot[14] & DN_CAPTURE_TO_MOTE) != 0;
+		rec->len = (uint8_t)len;
+		memcpy(rec->frame, &slot[CAP_SLOT_HEADER_LEN], len);
+		if (!(rec->frame[0] & CAP_CTRL_ACK))
+		{
+			if (rec->toMote)
+			{
+				replay_vars.recRequests++;
+			} else
+			{
+				replay_vars.recNotifs++;
+			}
+		}
+	}
+	free(dump);
+
+	if (replay_vars.recCount == 0)
+	{
+		printf("No frames to replay\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ The loop of SimplePublish, until the given virtual time.
+ */
+static void run(uint32_t end_ms)
+{
+	uint8_t payload[3] = {0};
+	uint8_t inboxBuf[DN_DEFAULT_PAYLOAD_SIZE_LIMIT];
+	uint8_t count = 0;
+
+	dn_qsl_init();
+	while ((int32_t)(dn_time_ms() - end_ms) < 0)
+	{
+		if (dn_qsl_isConnected())
+		{
+			payload[2] = count++;
+			dn_qsl_send(payload, sizeof (payload), DN_DEFAULT_DEST_PORT);
+			while (dn_qsl_read(inboxBuf) > 0)
+			{
+				// Discard
+			}
+			dn_sleep_ms(replay_vars.period_ms);
+		} else
+		{
+			dn_qsl_connect(DN_DEFAULT_NET_ID, NULL, replay_vars.srcPort, REPLAY_BANDWIDTH_MS);
+		}
+	}
+}
+
+/**
+ Pick the state transitions out of the trace ring. The 32-bit microsecond
+ timestamps are unwrapped by adding up the differences between records, as
+ the virtual clock started at 0.
+ */
+static void collectTransitions(void)
+{
+	const dn_trace_rec_t* rec;
+	replay_transition_t* transition;
+	uint32_t head = dn_trace_ring.head;
+	uint32_t index;
+	uint32_t prevTs = 0;
+	uint64_t t_us = 0;
+
+	if (head > DN_TRACE_SIZE)
+	{
+		printf("Warning: %u trace records overwritten; the first transitions are missing\n", head - DN_TRACE_SIZE);
+	}
+	replay_vars.transitions = malloc(REPLAY_MAX_TRANSITIONS * sizeof (replay_transition_t));
+	for (index = head > DN_TRACE_SIZE ? head - DN_TRACE_SIZE : 0; index != head; index++)
+	{
+		rec = &dn_trace_ring.recs[index & (DN_TRACE_SIZE - 1)];
+		t_us += (uint32_t)(rec->ts_us - prevTs);
+		prevTs = rec->ts_us;
+		if (rec->id != DN_TRACE_FSM_STATE || replay_vars.transitionCount == REPLAY_MAX_TRANSITIONS)
+		{
+			continue;
+		}
+		transition = &replay_vars.transitions[replay_vars.transitionCount++];
+		transition->t_ms = (uint32_t)(t_us / 1000);
+		snprintf(transition->from, REPLAY_NAME_LEN, "%s", stateName((uint8_t)rec->arg0));
+		snprintf(transition->to, REPLAY_NAME_LEN, "%s", stateName((uint8_t)rec->arg1));
+	}
+}
+
+static bool writeTransitions(const char* fileName)
+{
+	FILE* f;
+	uint32_t i;
+
+	f = fopen(fileName, "w");
+	if (f == NULL)
+	{
+		perror("Unable to write transitions");
+		return FALSE;
+	}
+	for (i = 0; i < replay_vars.transitionCount; i++)
+	{
+		fprintf(f, "%u %s %s\n", replay_vars.transitions[i].t_ms,
+				replay_vars.transitions[i].from, replay_vars.transitions[i].to);
+	}
+	fclose(f);
+	return TRUE;
+}
+
+static bool loadBaseline(const char* fileName)
+{
+	FILE* f;
+	replay_transition_t* transition;
+
+	f = fopen(fileName, "r");
+	if (f == NULL)
+	{
+		perror("Unable to open baseline");
+		return FALSE;
+	}
+	replay_vars.baseline = malloc(REPLAY_MAX_TRANSITIONS * sizeof (replay_transition_t));
+	while (replay_vars.baselineCount < REPLAY_MAX_TRANSITIONS)
+	{
+		transition = &replay_vars.baseline[replay_vars.baselineCount];
+		if (fscanf(f, "%u %15s %15s", &transition->t_ms, transition->from, transition->to) != 3)
+		{
+			break;
+		}
+		replay_vars.baselineCount++;
+	}
+	fclose(f);
+	return TRUE;
+}
+
+/**
+ Compare the transitions with the baseline, in order. Timings are compared
+ up to the first transition that differs.
+ */
+static bool compareBaseline(void)
+{
+	const replay_transition_t* now;
+	const replay_transition_t* then;
+	uint32_t i;
+	uint32_t dt_ms;
+	uint32_t maxDt_ms = 0;
+	uint64_t sumDt_ms = 0;
+	uint32_t same = 0;
+	bool diverged = FALSE;
+
+	for (i = 0; i < replay_vars.transitionCount && i < replay_vars.baselineCount; i++)
+	{
+		now = &replay_vars.transitions[i];
+		then = &replay_vars.baseline[i];
+		if (strcmp(now->from, then->from) != 0 || strcmp(now->to, then->to) != 0)
+		{
+			printf("Transition %u differs: %s --> %s at %u ms, was %s --> %s at %u ms\n",
+					i, now->from, now->to, now->t_ms, then->from, then->to, then->t_ms);
+			diverged = TRUE;
+			break;
+		}
+		dt_ms = now->t_ms > then->t_ms ? now->t_ms - then->t_ms : then->t_ms - now->t_ms;
+		if (dt_ms > maxDt_ms)
+		{
+			maxDt_ms = dt_ms;
+		}
+		sumDt_ms += dt_ms;
+		same++;
+	}
+	if (!diverged && replay_vars.transitionCount != replay_vars.baselineCount)
+	{
+		printf("Transitions: %u, were %u\n", replay_vars.transitionCount, replay_vars.baselineCount);
+		diverged = TRUE;
+	}
+	printf("Baseline: %u of %u transitions the same, timings moved by %.1f ms on average, %u ms at most\n",
+			same, replay_vars.baselineCount, same > 0 ? (double)sumDt_ms / same : 0.0, maxDt_ms);
+	return !diverged && maxDt_ms <= replay_vars.tolerance_ms;
+}
+
+//=========================== helpers =========================================
+
+static const char* stateName(uint8_t state)
+{
+	switch (state)
+	{
+	case DN_FSM_STATE_NOT_INITIALIZED:	return "NOT_INITIALIZED";
+	case DN_FSM_STATE_DISCONNECTED:		return "DISCONNECTED";
+	case DN_FSM_STATE_PRE_JOIN:			return "PRE_JOIN";
+	case DN_FSM_STATE_JOINING:			return "JOINING";
+	case DN_FSM_STATE_REQ_SERVICE:		return "REQ_SERVICE";
+	case DN_FSM_STATE_RESETTING:		return "RESETTING";
+	case DN_FSM_STATE_PROMISCUOUS:		return "PROMISCUOUS";
+	case DN_FSM_STATE_CONNECTED:		return "CONNECTED";
+	case DN_FSM_STATE_SENDING:			return "SENDING";
+	case DN_FSM_STATE_SEND_FAILED:		return "SEND_FAILED";
+	case DN_FSM_STATE_SYNCING_TIME:		return "SYNCING_TIME";
+	default:							return "?";
+	}
+}
+
+static uint64_t getU64(const uint8_t* p)
+{
+	return (uint64_t)getU32(p) | ((uint64_t)getU32(&p[4]) << 32);
+}
+
+static uint32_t getU32(const uint8_t* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t getU16(const uint8_t* p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
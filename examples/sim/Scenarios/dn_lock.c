@@ -0,0 +1,27 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Port of the lock module to the simulator.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include "dn_lock.h"
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+//=========================== public ==========================================
+
+void dn_lock(void) {
+   // the simulator is single threaded, no need to lock.
+}
+
+void dn_unlock(void) {
+   // the simulator is single threaded, no need to lock.
+}
+
+//=========================== private =========================================
+
+//=========================== helpers =========================================
\ No newline at end of file
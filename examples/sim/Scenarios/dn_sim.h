@@ -0,0 +1,56 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Controls of the simulator port, on top of the regular port modules: A virtual
+clock (dn_time.c) that only moves when the QuickStart Library sleeps, and a
+simulated mote (dn_mote_sim.c) behind the UART (dn_uart.c). The port is
+shared by the scenario runner and the replay of captures (examples/sim/Replay).
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_SIM_H
+#define DN_SIM_H
+
+#include "dn_common.h"
+#include "dn_mote_sim.h"
+
+//=========================== defines =========================================
+
+//=========================== typedef =========================================
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Set the virtual clock, e.g. just before dn_time_ms wraps around.
+ */
+void dn_sim_setTime(uint32_t now_ms);
+
+/**
+ \brief Get the number of times the CPU would have woken up so far: Once per
+ return from dn_sleep_until, including those within dn_sleep_ms.
+ */
+uint32_t dn_sim_wakeups(void);
+
+/**
+ \brief Power up a new simulated mote at the current virtual time.
+ */
+void dn_sim_startMote(const dn_mote_sim_cfg_t* cfg);
+
+/**
+ \brief Have the simulated mote replay a recorded session instead, from the
+ current virtual time (see dn_mote_sim_initReplay).
+ */
+void dn_sim_startReplay(const dn_mote_sim_rec_t* recs, uint32_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_SIM_H */
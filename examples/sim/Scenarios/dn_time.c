@@ -0,0 +1,95 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Port of the time module to the simulator.
+
+Time is virtual: It stands still while the QuickStart Library runs, and
+dn_sleep_until moves it forward, jumping from one simulated mote event to the
+next. Replies and notifications are thus delivered from within the sleep,
+much like a UART interrupt would interrupt a sleeping MCU, and end it early.
+Every return from dn_sleep_until counts as one wake-up of the CPU.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include "dn_time.h"
+#include "dn_sim.h"
+#include "dn_mote_sim.h"
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	uint32_t now_ms;
+	uint64_t now_us; // Only moved forward, unlike now_ms (see dn_sim_setTime)
+	bool wakePending;
+	uint32_t wakeups;
+} dn_time_vars_t;
+
+static dn_time_vars_t dn_time_vars;
+
+//=========================== prototypes ======================================
+
+//=========================== public ==========================================
+
+uint32_t dn_time_ms(void)
+{
+	return dn_time_vars.now_ms;
+}
+
+uint64_t dn_time_us64(void)
+{
+	return dn_time_vars.now_us;
+}
+
+void dn_sleep_ms(uint32_t milliseconds)
+{
+	uint32_t deadline_ms = dn_time_vars.now_ms + milliseconds;
+
+	// Like the MCU ports: Go back to sleep when woken early by the mote
+	do
+	{
+		dn_sleep_until(deadline_ms);
+	} while (dn_time_vars.now_ms != deadline_ms);
+}
+
+void dn_sleep_until(uint32_t deadline_ms)
+{
+	int32_t remaining_ms;
+	uint32_t step;
+
+	while (!dn_time_vars.wakePending
+			&& (remaining_ms = (int32_t)(deadline_ms - dn_time_vars.now_ms)) > 0) // Handle dn_time_ms wrap around
+	{
+		// Jump to the next mote event, or to the deadline
+		step = dn_mote_sim_nextEvent(dn_time_vars.now_ms);
+		if (step > (uint32_t)remaining_ms)
+		{
+			step = remaining_ms;
+		}
+		dn_time_vars.now_ms += step; // Wraps around like a real tick counter
+		dn_time_vars.now_us += (uint64_t)step * 1000;
+		dn_mote_sim_run(dn_time_vars.now_ms);
+	}
+	dn_time_vars.wakePending = FALSE;
+	dn_time_vars.wakeups++;
+}
+
+void dn_sleep_wake(void)
+{
+	dn_time_vars.wakePending = TRUE;
+}
+
+void dn_sim_setTime(uint32_t now_ms)
+{
+	dn_time_vars.now_ms = now_ms;
+}
+
+uint32_t dn_sim_wakeups(void)
+{
+	return dn_time_vars.wakeups;
+}
+
+//=========================== private =========================================
+
+//=========================== helpers =========================================
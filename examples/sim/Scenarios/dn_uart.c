@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Port of the uart module to the simulator: The "wire" leads straight into the
+simulated mote, in the same process.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include "dn_uart.h"
+#include "dn_uart_span.h"
+#include "dn_time.h"
+#include "dn_sim.h"
+#include "dn_mote_sim.h"
+
+//=========================== defines =========================================
+
+// Worst case HDLC frame: every byte and the 2-byte FCS escaped, and two flags
+#define UART_TX_BUFFER_SIZE		(2 * (DN_MOTE_SIM_MAX_FRAME_LEN + 2) + 2)
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	dn_uart_rxByte_cbt		ipmt_uart_rxByte_cb;
+	dn_uart_rxSpan_cbt		rxSpan_cb;
+	uint8_t					txBuf[UART_TX_BUFFER_SIZE];
+	uint16_t				txLen;
+} dn_uart_vars_t;
+
+static dn_uart_vars_t dn_uart_vars;
+
+//=========================== prototypes ======================================
+
+static void dn_uart_rxSpanToBytes(const uint8_t* data, uint16_t len);
+static void dn_uart_moteTx(const uint8_t* data, uint16_t len);
+
+//=========================== public ==========================================
+
+void dn_uart_init(dn_uart_rxByte_cbt rxByte_cb)
+{
+	// Store byte received callback, fed from the span callback
+	dn_uart_vars.ipmt_uart_rxByte_cb = rxByte_cb;
+	dn_uart_initSpan(dn_uart_rxSpanToBytes);
+}
+
+void dn_uart_initSpan(dn_uart_rxSpan_cbt rxSpan_cb)
+{
+	dn_uart_vars.rxSpan_cb = rxSpan_cb;
+	dn_uart_vars.txLen = 0;
+}
+
+void dn_uart_txByte(uint8_t byte)
+{
+	if (dn_uart_vars.txLen == sizeof (dn_uart_vars.txBuf))
+	{
+		dn_uart_txFlush();
+	}
+	dn_uart_vars.txBuf[dn_uart_vars.txLen++] = byte;
+}
+
+void dn_uart_txFlush(void)
+{
+	dn_uart_txSpan(dn_uart_vars.txBuf, dn_uart_vars.txLen);
+	dn_uart_vars.txLen = 0;
+}
+
+void dn_uart_txSpan(const uint8_t* data, uint16_t len)
+{
+	/*
+	 The mote only takes the request in here; its reply goes out once time
+	 moves on, so that the FSM has armed its reply callback by then.
+	 */
+	if (len > 0)
+	{
+		dn_mote_sim_rx(data, len, dn_time_ms());
+	}
+}
+
+void dn_sim_startMote(const dn_mote_sim_cfg_t* cfg)
+{
+	dn_uart_vars.txLen = 0;
+	dn_mote_sim_init(cfg, dn_uart_moteTx, NULL, dn_time_ms());
+}
+
+void dn_sim_startReplay(const dn_mote_sim_rec_t* recs, uint32_t count)
+{
+	dn_uart_vars.txLen = 0;
+	dn_mote_sim_initReplay(recs, count, dn_uart_moteTx, NULL, dn_time_ms());
+}
+
+//=========================== private =========================================
+
+static void dn_uart_rxSpanToBytes(const uint8_t* data, uint16_t len)
+{
+	while (len-- > 0)
+	{
+		dn_uart_vars.ipmt_uart_rxByte_cb(*data++);
+	}
+}
+
+static void dn_uart_moteTx(const uint8_t* data, uint16_t len)
+{
+	if (dn_uart_vars.rxSpan_cb != NULL)
+	{
+		dn_uart_vars.rxSpan_cb(data, len);
+		dn_sleep_wake();
+	}
+}
+
+//=========================== helpers =========================================
@@ -0,0 +1,24 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Port of the watchdog module to the simulator.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include "dn_watchdog.h"
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+//=========================== public ==========================================
+
+void dn_watchdog_feed(void)
+{
+	// Nothing to do since we have not implemented watchdog in the simulator
+}
+
+//=========================== private =========================================
+
+//=========================== helpers =========================================
\ No newline at end of file
@@ -0,0 +1,572 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Scenario runner for the QuickStart Library under a virtual clock.
+
+Each scenario powers up a simulated mote with randomized timing and network
+conditions, connects, sends a few packets, resets the mote behind the
+library's back and reconnects. As time only moves while the library sleeps,
+a connect that takes a minute on hardware takes microseconds here. A quarter
+of the scenarios start just before dn_time_ms wraps around.
+
+Outcomes that differ from what the scenario calls for are counted as
+failures. A connect that times out while the mote is still busy joining or
+waiting for its service request (slow and repeatedly failing join attempts add
+up) is not a failure, but is counted separately. The distribution of the
+simulated time to connected is reported, as is how often the CPU wakes up
+while connecting and over each data period of sending and sleeping.
+
+The join duty cycle options of the library can be given with -j, to weigh the
+time to connected against the time the mote spends listening while joining:
+	-j 255:32	Adaptive, from full duty cycle down to 32 (the default)
+	-j 64:64	Fixed at the default of the mote
+	-j off		Left to the mote
+
+With -t, the trace ring (dn_trace.h) is written to a file at the end, for
+tools/trace to decode; it holds the last records of the last scenario. With
+-c, the last serial frames (dn_capture.h) are, for tools/capture to convert
+or examples/sim/Replay to play back; frames are only captured with the
+span-based HDLC module (HDLC=qsl).
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "dn_qsl_api.h"
+#include "dn_fsm.h"
+#include "dn_time.h"
+#include "dn_trace.h"
+#include "dn_capture.h"
+#include "dn_sim.h"
+#include "dn_mote_sim.h"
+
+//=========================== defines =========================================
+
+#define SIM_DEFAULT_SCENARIOS	1000
+#define SIM_MAX_SCENARIOS		100000
+#define SIM_BANDWIDTH_MS		5000
+#define SIM_SRC_PORT			60000
+#define SIM_DATA_PERIOD_MS		5000
+#define SIM_NUM_SENDS			5
+#define SIM_DISCONNECT_WAIT_MS	10000 // Mote reset until the library must have noticed
+#define SIM_WRAP_WINDOW_MS		(2 * DN_CONNECT_TIMEOUT_S * 1000) // Starts this close to the wrap around
+#define SIM_HISTOGRAM_BIN_S		10
+#define SIM_CAPTURE_SLOTS		1024 // Frames kept for -c
+
+// Scenario kinds
+#define SIM_KIND_NORMAL			0
+#define SIM_KIND_PROMISCUOUS	1 // Join any network, picked from advertisements
+#define SIM_KIND_WRONG_KEY		2 // Every join attempt fails; connect must time out
+#define SIM_KIND_NO_NETWORK		3 // Nothing in range; connect must time out
+#define SIM_NUM_KINDS			4
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	uint32_t* samples;
+	uint32_t count;
+} sim_dist_t;
+
+typedef struct
+{
+	bool verbose;
+	const char* traceFile;
+	const char* captureFile;
+	uint32_t failures;
+	uint32_t slowJoins; // Connect timed out with the mote still joining
+	uint32_t svcGrants; // Mote counter when the connect under way started
+	uint32_t nearWrap;
+	uint32_t kindCount[SIM_NUM_KINDS];
+	uint64_t simulated_ms;
+	sim_dist_t connect;
+	sim_dist_t reconnect;
+	// CPU wake-ups, and the simulated time they were counted over
+	uint64_t connectWakeups;
+	uint64_t connect_ms;
+	uint64_t periodWakeups;
+	uint64_t period_ms;
+	// Join duty cycle
+	bool optsGiven;
+	dn_qsl_connect_opts_t connectOpts;
+	uint64_t joins;
+	uint64_t joinFails;
+	uint64_t join_ms;
+	uint64_t joinListen_ms;
+	// Serial commands
+	uint64_t commands;
+	uint64_t repliesNotOk;
+	uint64_t rspTimeouts;
+} sim_vars_t;
+
+static sim_vars_t sim_vars;
+
+static dn_trace_ring_t sim_traceCopy; // The mote thread may still be recording
+
+static uint64_t sim_captureMem[DN_CAPTURE_MEM_SIZE(SIM_CAPTURE_SLOTS) / sizeof (uint64_t)];
+
+static const char* const sim_kindNames[SIM_NUM_KINDS] = {
+	"normal", "promiscuous", "wrong key", "no network"
+};
+
+//=========================== prototypes ======================================
+
+static void runScenario(uint32_t index);
+static void checkConnect(uint32_t index, uint8_t kind, bool connected, bool expectConnect, const char* what);
+static void collectStats(void);
+static bool parseDutyCycle(const char* arg);
+static bool writeDump(const char* fileName, const uint8_t* data, uint32_t size, const char* what);
+static uint8_t randomCfg(dn_mote_sim_cfg_t* cfg, uint16_t* netId);
+static uint32_t randomRange(uint32_t min, uint32_t max);
+static void fail(uint32_t index, uint8_t kind, const char* what);
+static void record(sim_dist_t* dist, uint32_t value);
+static void report(const char* title, sim_dist_t* dist);
+static int compareU32(const void* a, const void* b);
+static double now_s(void);
+
+//=========================== main ============================================
+
+int main(int argc, char** argv)
+{
+	uint32_t numScenarios = SIM_DEFAULT_SCENARIOS;
+	uint32_t seed = 1;
+	double start;
+	double elapsed;
+	const uint8_t* dump;
+	uint32_t size;
+	uint32_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:x:j:t:c:v")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			numScenarios = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			if (!parseDutyCycle(optarg))
+			{
+				printf("Join duty cycle must be first[:min] (0-255) or off\n");
+				return 1;
+			}
+			break;
+		case 't':
+			sim_vars.traceFile = optarg;
+			break;
+		case 'c':
+			sim_vars.captureFile = optarg;
+			break;
+		case 'v':
+			sim_vars.verbose = TRUE;
+			break;
+		default:
+			printf("Usage: %s [-n scenarios] [-x seed] [-j first[:min] | -j off] [-t trace.bin] [-c capture.bin] [-v]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (numScenarios == 0 || numScenarios > SIM_MAX_SCENARIOS)
+	{
+		printf("Number of scenarios must be 1-%u\n", SIM_MAX_SCENARIOS);
+		return 1;
+	}
+	sim_vars.connect.samples = malloc(numScenarios * sizeof (uint32_t));
+	sim_vars.reconnect.samples = malloc(numScenarios * sizeof (uint32_t));
+	srand(seed);
+	if (sim_vars.captureFile != NULL)
+	{
+		dn_capture_init(sim_captureMem, sizeof (sim_captureMem), 0);
+	}
+
+	start = now_s();
+	for (i = 0; i < numScenarios; i++)
+	{
+		runScenario(i);
+	}
+	elapsed = now_s() - start;
+
+	printf("Scenarios: %u (seed %u), %u starting near the dn_time_ms wrap around\n",
+			numScenarios, seed, sim_vars.nearWrap);
+	for (i = 0; i < SIM_NUM_KINDS; i++)
+	{
+		printf("  %-12s %u\n", sim_kindNames[i], sim_vars.kindCount[i]);
+	}
+	printf("Simulated %.1f h in %.2f s of wall clock (%.0fx real time)\n",
+			sim_vars.simulated_ms / 3600e3, elapsed, sim_vars.simulated_ms / 1e3 / elapsed);
+	report("Time to connected", &sim_vars.connect);
+	report("Time to reconnected after mote reset", &sim_vars.reconnect);
+	printf("CPU wake-ups per s: %.2f while connecting, %.2f over data periods of %u ms (polling every 10 ms: 100)\n",
+			sim_vars.connectWakeups * 1000.0 / sim_vars.connect_ms,
+			sim_vars.periodWakeups * 1000.0 / sim_vars.period_ms, SIM_DATA_PERIOD_MS);
+	if (sim_vars.joins > 0)
+	{
+		printf("Joins: %llu (%llu failed attempts), on average %.1f s joining, %.1f s of it listening (%.0f mC)\n",
+				(unsigned long long)sim_vars.joins, (unsigned long long)sim_vars.joinFails,
+				sim_vars.join_ms / 1000.0 / sim_vars.joins, sim_vars.joinListen_ms / 1000.0 / sim_vars.joins,
+				sim_vars.joinListen_ms * (DN_MOTE_RX_CURRENT_UA / 1000.0) / 1000.0 / sim_vars.joins);
+	}
+	printf("Serial: %llu commands, %llu replies not OK, %llu response timeouts\n",
+			(unsigned long long)sim_vars.commands, (unsigned long long)sim_vars.repliesNotOk,
+			(unsigned long long)sim_vars.rspTimeouts);
+	printf("Timed out while the mote was still joining: %u\n", sim_vars.slowJoins);
+	printf("Unexpected outcomes: %u\n", sim_vars.failures);
+	if (sim_vars.traceFile != NULL)
+	{
+		size = dn_trace_copy(&sim_traceCopy);
+		dump = size > 0 ? (const uint8_t*)&sim_traceCopy : NULL;
+		if (!writeDump(sim_vars.traceFile, dump, size, "Trace ring"))
+		{
+			return 1;
+		}
+	}
+	if (sim_vars.captureFile != NULL)
+	{
+		dump = dn_capture_get(&size);
+		if (!writeDump(sim_vars.captureFile, dump, size, "Capture"))
+		{
+			return 1;
+		}
+	}
+	return sim_vars.failures == 0 ? 0 : 1;
+}
+
+//=========================== private =========================================
+
+/**
+ Connect, send, lose the mote to a reset and reconnect; check each step
+ against what the scenario calls for.
+ */
+static void runScenario(uint32_t index)
+{
+	dn_mote_sim_cfg_t cfg;
+	dn_qsl_stats_t stats;
+	uint8_t payload[4] = {0};
+	uint32_t start_ms;
+	uint32_t t0_ms;
+	uint32_t elapsed_ms;
+	uint32_t wakeups;
+	uint16_t netId;
+	uint8_t kind;
+	bool expectConnect;
+	bool connected;
+	uint8_t i;
+
+	kind = randomCfg(&cfg, &netId);
+	expectConnect = (kind == SIM_KIND_NORMAL || kind == SIM_KIND_PROMISCUOUS);
+	sim_vars.kindCount[kind]++;
+
+	// Anywhere on the clock, or just before it wraps
+	if (rand() % 4 == 0)
+	{
+		start_ms = -randomRange(1, SIM_WRAP_WINDOW_MS);
+		sim_vars.nearWrap++;
+	} else
+	{
+		start_ms = (uint32_t)rand() * 2 + rand() % 2;
+	}
+	dn_sim_setTime(start_ms);
+	dn_sim_startMote(&cfg);
+	dn_qsl_init();
+	if (sim_vars.optsGiven)
+	{
+		dn_qsl_setConnectOptions(&sim_vars.connectOpts);
+	}
+
+	// Connect
+	sim_vars.svcGrants = dn_mote_sim_getStats()->svcGrants;
+	wakeups = dn_sim_wakeups();
+	t0_ms = dn_time_ms();
+	connected = dn_qsl_connect(netId, NULL, SIM_SRC_PORT, SIM_BANDWIDTH_MS);
+	elapsed_ms = dn_time_ms() - t0_ms;
+	sim_vars.connectWakeups += dn_sim_wakeups() - wakeups;
+	sim_vars.connect_ms += elapsed_ms;
+	if (sim_vars.verbose)
+	{
+		printf("#%-5u %-12s start %#.8x: %s after %.1f s\n", index, sim_kindNames[kind],
+				start_ms, connected ? "connected" : "gave up", elapsed_ms / 1000.0);
+	}
+	checkConnect(index, kind, connected, expectConnect, "connect");
+	if (!connected)
+	{
+		if (elapsed_ms > (DN_CONNECT_TIMEOUT_S + 1) * 1000)
+		{
+			fail(index, kind, "connect overran its timeout");
+		}
+		sim_vars.simulated_ms += (uint32_t)(dn_time_ms() - start_ms);
+		collectStats();
+		return;
+	}
+	record(&sim_vars.connect, elapsed_ms);
+
+	// Send
+	wakeups = dn_sim_wakeups();
+	t0_ms = dn_time_ms();
+	for (i = 0; i < SIM_NUM_SENDS; i++)
+	{
+		payload[0] = i;
+		if (!dn_qsl_send(payload, sizeof (payload), 0))
+		{
+			fail(index, kind, "send failed");
+		}
+		dn_sleep_ms(SIM_DATA_PERIOD_MS);
+	}
+	sim_vars.periodWakeups += dn_sim_wakeups() - wakeups;
+	sim_vars.period_ms += (uint32_t)(dn_time_ms() - t0_ms);
+	if (dn_mote_sim_getStats()->packetsSent != SIM_NUM_SENDS)
+	{
+		fail(index, kind, "mote did not get every packet");
+	}
+	dn_qsl_getStats(&stats);
+	if (stats.sends != SIM_NUM_SENDS || stats.sendsQueued != SIM_NUM_SENDS
+			|| stats.bytesSent != SIM_NUM_SENDS * sizeof (payload))
+	{
+		fail(index, kind, "send stats miscounted");
+	}
+
+	// Reset the mote; the library must notice and reconnect
+	dn_mote_sim_reboot(dn_time_ms());
+	dn_sleep_ms(SIM_DISCONNECT_WAIT_MS);
+	if (dn_qsl_isConnected())
+	{
+		fail(index, kind, "mote reset went unnoticed");
+	}
+	dn_qsl_getStats(&stats);
+	if (stats.connectionsLost != 1)
+	{
+		fail(index, kind, "lost connection miscounted");
+	}
+	sim_vars.svcGrants = dn_mote_sim_getStats()->svcGrants;
+	t0_ms = dn_time_ms();
+	connected = dn_qsl_connect(netId, NULL, SIM_SRC_PORT, SIM_BANDWIDTH_MS);
+	checkConnect(index, kind, connected, TRUE, "reconnect");
+	if (connected)
+	{
+		record(&sim_vars.reconnect, dn_time_ms() - t0_ms);
+	}
+	sim_vars.simulated_ms += (uint32_t)(dn_time_ms() - start_ms);
+	collectStats();
+}
+
+/**
+ A connect that should succeed may still time out, as long as the mote has not
+ joined and been granted its service; the library must not give up on a mote
+ that has.
+ */
+static void checkConnect(uint32_t index, uint8_t kind, bool connected, bool expectConnect, const char* what)
+{
+	char msg[64];
+
+	if (connected == expectConnect)
+	{
+		return;
+	}
+	if (!connected && (dn_mote_sim_state() != DN_MOTE_STATE_OPERATIONAL
+			|| dn_mote_sim_getStats()->svcGrants == sim_vars.svcGrants))
+	{
+		sim_vars.slowJoins++;
+		return;
+	}
+	snprintf(msg, sizeof (msg), "%s %s", what, connected ? "succeeded" : "gave up on a connected mote");
+	fail(index, kind, msg);
+}
+
+/**
+ Add up the stats of the scenario, before dn_qsl_init clears them.
+ */
+static void collectStats(void)
+{
+	dn_qsl_connect_stats_t stats;
+	dn_qsl_stats_t counters;
+	uint8_t i;
+
+	dn_qsl_getConnectStats(&stats);
+	sim_vars.joins += stats.joins;
+	sim_vars.joinFails += stats.joinFails;
+	sim_vars.join_ms += stats.totalJoin_ms;
+	sim_vars.joinListen_ms += stats.totalJoinListen_ms;
+
+	dn_qsl_getStats(&counters);
+	sim_vars.commands += counters.commands;
+	for (i = 1; i < DN_QSL_NUM_RC; i++)
+	{
+		sim_vars.repliesNotOk += counters.replies[i];
+	}
+	for (i = 0; i < DN_QSL_NUM_CMDS; i++)
+	{
+		sim_vars.rspTimeouts += counters.rspTimeouts[i];
+	}
+}
+
+static bool parseDutyCycle(const char* arg)
+{
+	unsigned long first;
+	unsigned long min;
+	char* end;
+
+	sim_vars.optsGiven = TRUE;
+	memset(&sim_vars.connectOpts, 0, sizeof (sim_vars.connectOpts));
+	if (strcmp(arg, "off") == 0)
+	{
+		return TRUE;
+	}
+	first = min = strtoul(arg, &end, 0);
+	if (end == arg)
+	{
+		return FALSE;
+	}
+	if (*end == ':')
+	{
+		min = strtoul(end + 1, &end, 0);
+	}
+	sim_vars.connectOpts.setJoinDutyCycle = TRUE;
+	sim_vars.connectOpts.joinDutyCycle = first;
+	sim_vars.connectOpts.minJoinDutyCycle = min;
+	return *end == '\0' && first <= 0xff && min <= 0xff;
+}
+
+static bool writeDump(const char* fileName, const uint8_t* data, uint32_t size, const char* what)
+{
+	FILE* f;
+
+	if (data == NULL)
+	{
+		printf("%s not built in\n", what);
+		return FALSE;
+	}
+	f = fopen(fileName, "wb");
+	if (f == NULL || fwrite(data, 1, size, f) != size)
+	{
+		perror("Unable to write dump");
+		return FALSE;
+	}
+	fclose(f);
+	return TRUE;
+}
+
+/**
+ Draw the mote timing and the networks within range, and pick the network ID
+ to connect with. Returns the scenario kind.
+ */
+static uint8_t randomCfg(dn_mote_sim_cfg_t* cfg, uint16_t* netId)
+{
+	uint8_t kind;
+	uint8_t i;
+	uint32_t r = rand() % 10;
+
+	kind = (r < 6) ? SIM_KIND_NORMAL
+			: (r < 8) ? SIM_KIND_PROMISCUOUS
+			: (r < 9) ? SIM_KIND_WRONG_KEY
+			: SIM_KIND_NO_NETWORK;
+
+	dn_mote_sim_defaultCfg(cfg);
+	cfg->seed = rand() + 1;
+	cfg->replyDelay_ms = randomRange(1, 30);
+	cfg->bootDelay_ms = randomRange(200, 2000);
+	cfg->joinDelay_ms = randomRange(5000, 60000);
+	cfg->svcDelay_ms = randomRange(500, 15000);
+	cfg->advPeriod_ms = randomRange(200, 2000);
+	cfg->joinFail_pct = randomRange(0, 30);
+	cfg->minService_ms = randomRange(1000, SIM_BANDWIDTH_MS);
+	*netId = DN_DEFAULT_NET_ID;
+
+	switch (kind)
+	{
+	case SIM_KIND_PROMISCUOUS:
+		// Old and new firmware: with and without join-any-network support
+		cfg->swVerMinor = randomRange(3, 4);
+		cfg->numNets = randomRange(1, DN_MOTE_SIM_MAX_NETS);
+		for (i = 0; i < cfg->numNets; i++)
+		{
+			cfg->nets[i].netId = randomRange(1, 0xfffe);
+			cfg->nets[i].rssi = -(int8_t)randomRange(40, 90);
+			memcpy(cfg->nets[i].joinKey, dn_default_joinKey, DN_JOIN_KEY_LEN);
+		}
+		*netId = DN_PROMISCUOUS_NET_ID;
+		break;
+	case SIM_KIND_WRONG_KEY:
+		cfg->nets[0].joinKey[0] ^= 0xff;
+		break;
+	case SIM_KIND_NO_NETWORK:
+		cfg->numNets = 0;
+		break;
+	}
+	return kind;
+}
+
+static uint32_t randomRange(uint32_t min, uint32_t max)
+{
+	return min + (uint32_t)rand() % (max - min + 1);
+}
+
+static void fail(uint32_t index, uint8_t kind, const char* what)
+{
+	sim_vars.failures++;
+	printf("FAIL #%u (%s): %s\n", index, sim_kindNames[kind], what);
+}
+
+static void record(sim_dist_t* dist, uint32_t value)
+{
+	dist->samples[dist->count++] = value;
+}
+
+/**
+ Print percentiles and a histogram of a distribution of times in ms.
+ */
+static void report(const char* title, sim_dist_t* dist)
+{
+	uint32_t bins[DN_CONNECT_TIMEOUT_S / SIM_HISTOGRAM_BIN_S + 1] = {0};
+	uint64_t sum = 0;
+	uint32_t bin;
+	uint32_t i;
+
+	printf("%s (%u samples):\n", title, dist->count);
+	if (dist->count == 0)
+	{
+		return;
+	}
+	qsort(dist->samples, dist->count, sizeof (dist->samples[0]), compareU32);
+	for (i = 0; i < dist->count; i++)
+	{
+		sum += dist->samples[i];
+		bin = dist->samples[i] / 1000 / SIM_HISTOGRAM_BIN_S;
+		bins[bin < sizeof (bins) / sizeof (bins[0]) ? bin : sizeof (bins) / sizeof (bins[0]) - 1]++;
+	}
+	printf("  min %.1f s, p50 %.1f s, p90 %.1f s, p99 %.1f s, max %.1f s, mean %.1f s\n",
+			dist->samples[0] / 1000.0,
+			dist->samples[dist->count * 50 / 100] / 1000.0,
+			dist->samples[dist->count * 90 / 100] / 1000.0,
+			dist->samples[dist->count * 99 / 100] / 1000.0,
+			dist->samples[dist->count - 1] / 1000.0,
+			sum / 1000.0 / dist->count);
+	for (i = 0; i < sizeof (bins) / sizeof (bins[0]); i++)
+	{
+		if (bins[i] > 0)
+		{
+			printf("  %3u-%3u s: %6u %.*s\n", i * SIM_HISTOGRAM_BIN_S, (i + 1) * SIM_HISTOGRAM_BIN_S, bins[i],
+					(int)(bins[i] * 50 / dist->count + 1), "##################################################");
+		}
+	}
+}
+
+static int compareU32(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
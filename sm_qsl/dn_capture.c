@@ -0,0 +1,152 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Capture of the serial frames between the QuickStart Library and the mote.
+
+As in the trace ring, a slot is claimed with dn_atomic_fetchInc on the head,
+so that the main loop and the UART context never share one.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <string.h>
+
+#include "dn_capture.h"
+#include "dn_time.h"
+#include "dn_hdlc.h"
+#include "dn_fcs.h"
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	dn_capture_hdr_t* hdr; // NULL until started
+	dn_capture_slot_t* slots;
+	uint32_t mask;
+	uint64_t origin_us;
+} dn_capture_vars_t;
+
+static dn_capture_vars_t dn_capture_vars;
+
+//=========================== prototypes ======================================
+
+static void dn_capture_streamClose(dn_capture_stream_t* stream, uint8_t flags);
+
+//=========================== public ==========================================
+
+bool dn_capture_init(void* mem, uint32_t memSize, uint64_t origin_us)
+{
+	dn_capture_hdr_t* hdr = mem;
+	uint32_t size = 1;
+
+	if (memSize < DN_CAPTURE_MEM_SIZE(1))
+	{
+		return FALSE;
+	}
+	while (DN_CAPTURE_MEM_SIZE(2 * size) <= memSize)
+	{
+		size *= 2;
+	}
+	// For the FCS checks of dn_capture_stream
+	dn_fcs_init();
+
+	if (hdr->magic != DN_CAPTURE_MAGIC || hdr->version != DN_CAPTURE_VERSION
+			|| hdr->frameLen != DN_CAPTURE_FRAME_LEN || hdr->size != size)
+	{
+		memset(mem, 0, DN_CAPTURE_MEM_SIZE(size));
+		hdr->version = DN_CAPTURE_VERSION;
+		hdr->frameLen = DN_CAPTURE_FRAME_LEN;
+		hdr->size = size;
+		hdr->head = 0;
+		DN_MEMORY_BARRIER(); // A reader must never see the magic with another layout
+		hdr->magic = DN_CAPTURE_MAGIC;
+	}
+	dn_capture_vars.slots = (dn_capture_slot_t*)(hdr + 1);
+	dn_capture_vars.mask = size - 1;
+	dn_capture_vars.origin_us = origin_us;
+	DN_MEMORY_BARRIER();
+	dn_capture_vars.hdr = hdr;
+	return TRUE;
+}
+
+void dn_capture_frame(uint8_t flags, const uint8_t* frame, uint16_t len)
+{
+	dn_capture_slot_t* slot;
+	uint32_t index;
+
+	if (dn_capture_vars.hdr == NULL)
+	{
+		return;
+	}
+	index = dn_atomic_fetchInc(&dn_capture_vars.hdr->head);
+	slot = &dn_capture_vars.slots[index & dn_capture_vars.mask];
+
+	slot->ts_us = dn_time_us64() + dn_capture_vars.origin_us;
+	slot->len = len;
+	slot->flags = flags;
+	memcpy(slot->frame, frame, (len < DN_CAPTURE_FRAME_LEN) ? len : DN_CAPTURE_FRAME_LEN);
+	DN_MEMORY_BARRIER(); // Publish the contents before the sequence number
+	slot->seq = index;
+}
+
+void dn_capture_stream(dn_capture_stream_t* stream, uint8_t flags, const uint8_t* data, uint16_t len)
+{
+	uint16_t n;
+	uint8_t byte;
+
+	for (n = 0; n < len; n++)
+	{
+		if (data[n] == DN_HDLC_FLAG)
+		{
+			// Flags also open frames, and may come back to back
+			if (stream->len > 0 || stream->overflow)
+			{
+				dn_capture_streamClose(stream, flags);
+			}
+		} else if (data[n] == DN_HDLC_ESCAPE)
+		{
+			stream->escaping = TRUE;
+		} else
+		{
+			byte = stream->escaping ? data[n] ^ DN_HDLC_ESCAPE_MASK : data[n];
+			stream->escaping = FALSE;
+			if (stream->len < sizeof (stream->frame))
+			{
+				stream->frame[stream->len++] = byte;
+			} else
+			{
+				stream->overflow = TRUE;
+			}
+		}
+	}
+}
+
+const uint8_t* dn_capture_get(uint32_t* size)
+{
+	if (dn_capture_vars.hdr == NULL)
+	{
+		*size = 0;
+		return NULL;
+	}
+	*size = DN_CAPTURE_MEM_SIZE(dn_capture_vars.hdr->size);
+	return (const uint8_t*)dn_capture_vars.hdr;
+}
+
+//=========================== private =========================================
+
+static void dn_capture_streamClose(dn_capture_stream_t* stream, uint8_t flags)
+{
+	if (!stream->overflow && stream->len > DN_CAPTURE_FCS_LEN
+			&& dn_fcs_update(DN_HDLC_CRCINIT, stream->frame, stream->len) == DN_HDLC_CRCGOOD)
+	{
+		dn_capture(flags, stream->frame, stream->len - DN_CAPTURE_FCS_LEN);
+	} else
+	{
+		dn_capture(flags | DN_CAPTURE_BAD, stream->frame, stream->len);
+	}
+	stream->len = 0;
+	stream->escaping = FALSE;
+	stream->overflow = FALSE;
+}
+
+//=========================== helpers =========================================
@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Capture of the serial frames between the QuickStart Library and the mote.
+
+Once dn_capture_init has been handed some memory, the HDLC module records every
+frame sent to or received from the mote, unescaped and without its FCS, into
+a ring of fixed-size slots in that memory, overwriting the oldest. Each slot
+holds a microsecond timestamp, a direction flag and the frame itself, so that
+recording costs one memcpy per frame. Received frames that fail their FCS or
+overflow are kept as well, flagged as bad and with whatever was received.
+
+The memory can be a buffer in RAM, to be dumped from a debugger like the trace
+ring (dn_trace.h), or, on Linux, a file mapped with mmap (see
+examples/rpi/SimplePublish/dn_capture_file.h), which outlives a crash of the
+process. A ring found in the memory with the same layout is carried on, so
+that a restart appends to the history. tools/capture converts a dump or the
+file into a pcapng file for Wireshark.
+
+The tap sits in the span-based HDLC module (dn_hdlc_span.c); the
+byte-by-byte HDLC module of the C Library does not record anything, so ports
+that use it feed the raw bytes of their UART to dn_capture_stream instead,
+which unescapes and checks the frames the same way (see the dn_uart.c of the
+Raspberry Pi and NUCLEO-L053R8 ports). Both check the FCS with dn_fcs.c,
+which must then be built in. Building with DN_CAPTURE set to 0 compiles the
+taps away.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_CAPTURE_H
+#define DN_CAPTURE_H
+
+#include "dn_common.h"
+#include "dn_defaults.h"
+
+//=========================== defines =========================================
+
+#ifndef DN_CAPTURE
+#define DN_CAPTURE			1
+#endif
+
+#define DN_CAPTURE_MAGIC	0x50414344 // "DCAP" in a little-endian dump
+#define DN_CAPTURE_VERSION	1
+#define DN_CAPTURE_FRAME_LEN	128 // Bytes kept per frame; the longest frame of the serial API
+#define DN_CAPTURE_FCS_LEN	2 // Ending each frame on the serial line
+
+// Flags of a slot
+#define DN_CAPTURE_TO_MOTE	0x01 // Sent by the library; received otherwise
+#define DN_CAPTURE_BAD		0x02 // Failed its FCS or overflowed; kept with its FCS
+
+// Memory needed for a ring of the given number of slots
+#define DN_CAPTURE_MEM_SIZE(slots)	(sizeof (dn_capture_hdr_t) + (slots) * sizeof (dn_capture_slot_t))
+
+#if DN_CAPTURE
+#define dn_capture(flags, frame, len)	dn_capture_frame((flags), (frame), (len))
+#else
+#define dn_capture(flags, frame, len)	do {}while(0)
+#endif
+
+//=========================== typedef =========================================
+
+/*
+ The layout of the memory, read by the host converter: A header followed by
+ size slots. head is the index of the next slot to be written; the frames
+ before it, up to size of them, are in slots[index % size], each holding the
+ lower 32 bits of its index in seq.
+ */
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t frameLen; // DN_CAPTURE_FRAME_LEN
+	uint32_t size; // Number of slots
+	volatile uint32_t head;
+} dn_capture_hdr_t;
+
+typedef struct
+{
+	uint64_t ts_us; // dn_time_us64, plus the origin given to dn_capture_init
+	uint32_t seq; // Written last, so torn slots can be told
+	uint16_t len; // Of the frame, possibly more than was kept
+	uint8_t flags; // DN_CAPTURE_*
+	uint8_t reserved;
+	uint8_t frame[DN_CAPTURE_FRAME_LEN];
+} dn_capture_slot_t;
+
+// A frame being unescaped by dn_capture_stream; zeroed to start
+typedef struct
+{
+	uint8_t frame[DN_CAPTURE_FRAME_LEN + DN_CAPTURE_FCS_LEN];
+	uint16_t len;
+	bool escaping;
+	bool overflow;
+} dn_capture_stream_t;
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Start capturing into the given memory.
+
+ Carries on with the ring already in the memory if it has the same layout;
+ lays out an empty ring otherwise. Call before dn_qsl_init to capture the
+ whole conversation.
+
+ \param mem 8-byte aligned memory, outliving the capture.
+ \param memSize Its size; the ring takes the largest power of two of slots
+ that fits.
+ \param origin_us Added to dn_time_us64 for the timestamps, e.g. the offset of
+ the wall clock, so that they stay meaningful across restarts; 0 for uptime.
+ \return FALSE if the memory cannot hold a single slot.
+ */
+bool dn_capture_init(void* mem, uint32_t memSize, uint64_t origin_us);
+
+/**
+ \brief Record a frame; use the dn_capture() macro instead.
+
+ Safe from the main loop and the context feeding the UART data alike. Does
+ nothing until dn_capture_init has been called.
+
+ \param flags DN_CAPTURE_*.
+ */
+void dn_capture_frame(uint8_t flags, const uint8_t* frame, uint16_t len);
+
+/**
+ \brief Record the frames in raw bytes of the serial line.
+
+ Unescapes the bytes, and records each frame as the flag closing it comes in:
+ without its FCS if it checks out, flagged as bad with whatever was received
+ otherwise. For ports on the byte-by-byte HDLC module of the C Library.
+
+ \param stream The frame being unescaped, kept across calls; one per direction
+ and context.
+ \param flags DN_CAPTURE_*, except DN_CAPTURE_BAD.
+ */
+void dn_capture_stream(dn_capture_stream_t* stream, uint8_t flags, const uint8_t* data, uint16_t len);
+
+/**
+ \brief Get the ring, laid out as the host converter reads it.
+
+ \param size Set to the byte size of the ring.
+ \return A pointer to the ring, or NULL if not capturing.
+ */
+const uint8_t* dn_capture_get(uint32_t* size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_CAPTURE_H */
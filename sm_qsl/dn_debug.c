@@ -0,0 +1,91 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Runtime log levels and rate limiting of the debug macros.
+
+The refill reads dn_time_ms, whose port may itself log when the clock fails.
+Such a message is let through on the tokens left, without a refill, rather
+than reading the failing clock again and again down the stack.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include "dn_debug.h"
+#include "dn_time.h"
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	volatile bool refilling; // Reading the time for a refill
+} dn_debug_vars_t;
+
+static dn_debug_vars_t dn_debug_vars;
+
+uint8_t dn_log_levels[DN_LOG_NUM_MODULES] = {
+	DN_LOG_DEFAULT_LEVEL, DN_LOG_DEFAULT_LEVEL, DN_LOG_DEFAULT_LEVEL, DN_LOG_DEFAULT_LEVEL
+};
+
+//=========================== prototypes ======================================
+
+//=========================== public ==========================================
+
+void dn_log_setLevel(uint8_t module, uint8_t level)
+{
+	uint8_t i;
+
+	if (module == DN_LOG_ALL)
+	{
+		for (i = 0; i < DN_LOG_NUM_MODULES; i++)
+		{
+			dn_log_levels[i] = level;
+		}
+	} else if (module < DN_LOG_NUM_MODULES)
+	{
+		dn_log_levels[module] = level;
+	}
+}
+
+uint8_t dn_log_getLevel(uint8_t module)
+{
+	return module < DN_LOG_NUM_MODULES ? dn_log_levels[module] : DN_LOG_LEVEL_NONE;
+}
+
+bool dn_log_take(dn_log_bucket_t* bucket, const char* file, int line)
+{
+	uint16_t now;
+	uint16_t refill;
+
+	// Refill for the periods passed; after 65536 periods without a message, the stamp may have wrapped around to near now
+	if (!dn_debug_vars.refilling)
+	{
+		dn_debug_vars.refilling = TRUE;
+		now = (uint16_t)(dn_time_ms() / DN_LOG_REFILL_MS);
+		dn_debug_vars.refilling = FALSE;
+		refill = now - bucket->stamp;
+		bucket->stamp = now;
+		bucket->used = refill >= bucket->used ? 0 : bucket->used - refill;
+	}
+
+	if (bucket->used >= DN_LOG_BURST)
+	{
+		if (bucket->suppressed < 0xff)
+		{
+			bucket->suppressed++;
+		}
+		return FALSE;
+	}
+	bucket->used++;
+
+	if (bucket->suppressed > 0)
+	{
+		fprintf(stderr, "[LOG] (%s:%d) %s%u messages suppressed\r\n",
+				file, line, bucket->suppressed == 0xff ? "at least " : "", bucket->suppressed);
+		bucket->suppressed = 0;
+	}
+	return TRUE;
+}
+
+//=========================== private =========================================
+
+//=========================== helpers =========================================
@@ -3,6 +3,19 @@ Copyright (c) 2016, Dust Networks. All rights reserved.
 
 Debug macros (based on http://c.learncodethehardway.org/book/ex20.html ).
 
+Messages are filtered at runtime by a level per module, set with
+dn_log_setLevel, so that diagnostics can be turned up in the field without a
+reflash; a message below the level of its module costs a single branch. A file
+picks its module by defining DN_LOG_MODULE before including this header, and
+is part of the application otherwise.
+
+Each call site is also rate limited by a token bucket of its own, refilled at
+one message per DN_LOG_REFILL_MS up to a burst of DN_LOG_BURST, so that a
+condition repeating in a loop cannot flood the console and stall it; the
+number of messages suppressed is printed when the site is let through again.
+
+NDEBUG and NLOG still compile the messages away entirely, e.g. to save flash.
+
 \license See attached DN_LICENSE.txt.
 */
 
@@ -13,16 +26,64 @@ Debug macros (based on http://c.learncodethehardway.org/book/ex20.html ).
 #include <errno.h>
 #include <string.h>
 
+#include "dn_common.h"
+#include "dn_defaults.h"
+
 /* Comment out this define to include debug messages */
 #define NDEBUG
 
 /* Comment out this define to include log messages */
 //#define NLOG
 
+//=========================== defines =========================================
+
+// Modules
+#define DN_LOG_FSM			0 // State machine and RPC dispatch of the QuickStart Library
+#define DN_LOG_UART			1 // UART port
+#define DN_LOG_HDLC			2 // HDLC framing
+#define DN_LOG_APP			3 // Everything else
+#define DN_LOG_NUM_MODULES	4
+#define DN_LOG_ALL			0xff // Every module, for dn_log_setLevel
+
+#ifndef DN_LOG_MODULE
+#define DN_LOG_MODULE		DN_LOG_APP
+#endif
+
+// Levels; a module prints the messages up to its level
+#define DN_LOG_LEVEL_NONE	0
+#define DN_LOG_LEVEL_ERR	1
+#define DN_LOG_LEVEL_WARN	2
+#define DN_LOG_LEVEL_INFO	3
+#define DN_LOG_LEVEL_DEBUG	4
+
+#ifndef DN_LOG_DEFAULT_LEVEL
+#define DN_LOG_DEFAULT_LEVEL	DN_LOG_LEVEL_DEBUG // Whatever is compiled in
+#endif
+
+// Rate limit per call site
+#ifndef DN_LOG_BURST
+#define DN_LOG_BURST		5
+#endif
+#ifndef DN_LOG_REFILL_MS
+#define DN_LOG_REFILL_MS	1000
+#endif
+
+/*
+ Print a message if its module is at the level or above, and its call site
+ has a token left.
+ */
+#define dn_log(level, M, ...)	do { \
+	static dn_log_bucket_t dn_log_bucket; \
+	if (dn_log_levels[DN_LOG_MODULE] >= (level) && dn_log_take(&dn_log_bucket, __FILE__, __LINE__)) \
+	{ \
+		fprintf(stderr, M "\r\n", ##__VA_ARGS__); \
+	} \
+} while (0)
+
 #ifdef NDEBUG
 #define debug(M, ...)	do {}while(0)
 #else
-#define debug(M, ...)	fprintf(stderr, "DEBUG %s:%d: " M "\r\n", __FILE__, __LINE__, ##__VA_ARGS__)
+#define debug(M, ...)	dn_log(DN_LOG_LEVEL_DEBUG, "DEBUG %s:%d: " M, __FILE__, __LINE__, ##__VA_ARGS__)
 #endif
 
 #define clean_errno() (errno == 0 ? "None" : strerror(errno))
@@ -32,9 +93,56 @@ Debug macros (based on http://c.learncodethehardway.org/book/ex20.html ).
 #define log_warn(M, ...)	do {}while(0)
 #define log_info(M, ...)	do {}while(0)
 #else
-#define log_err(M, ...)		fprintf(stderr, "[ERROR] (%s:%d: errno: %s) " M "\r\n", __FILE__, __LINE__, clean_errno(), ##__VA_ARGS__)
-#define log_warn(M, ...)	fprintf(stderr, "[WARN] (%s:%d: errno: %s) " M "\r\n", __FILE__, __LINE__, clean_errno(), ##__VA_ARGS__)
-#define log_info(M, ...)	fprintf(stderr, "[INFO] (%s:%d) " M "\r\n", __FILE__, __LINE__, ##__VA_ARGS__)
+#define log_err(M, ...)		dn_log(DN_LOG_LEVEL_ERR, "[ERROR] (%s:%d: errno: %s) " M, __FILE__, __LINE__, clean_errno(), ##__VA_ARGS__)
+#define log_warn(M, ...)	dn_log(DN_LOG_LEVEL_WARN, "[WARN] (%s:%d: errno: %s) " M, __FILE__, __LINE__, clean_errno(), ##__VA_ARGS__)
+#define log_info(M, ...)	dn_log(DN_LOG_LEVEL_INFO, "[INFO] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__)
+#endif
+
+//=========================== typedef =========================================
+
+/*
+ Token bucket of a call site; all zero is a full bucket. Updates from the main
+ loop and the UART context may race, which at worst miscounts a token.
+ */
+typedef struct
+{
+	uint16_t stamp; // Time of the last refill, in DN_LOG_REFILL_MS
+	uint8_t used; // Tokens taken since
+	uint8_t suppressed; // Messages dropped since the last one printed; saturates
+} dn_log_bucket_t;
+
+//=========================== variables =======================================
+
+extern uint8_t dn_log_levels[DN_LOG_NUM_MODULES];
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Set the level of messages printed by a module.
+ \param module One of DN_LOG_FSM, DN_LOG_UART, DN_LOG_HDLC and DN_LOG_APP, or
+ DN_LOG_ALL for all of them.
+ \param level One of the DN_LOG_LEVEL_* defines; DN_LOG_LEVEL_NONE silences
+ the module.
+ */
+void dn_log_setLevel(uint8_t module, uint8_t level);
+
+/**
+ \brief Get the level of messages printed by a module.
+ */
+uint8_t dn_log_getLevel(uint8_t module);
+
+/**
+ \brief Take a token from the bucket of a call site; used by the log macros.
+ \return TRUE if the message is to be printed.
+ */
+bool dn_log_take(dn_log_bucket_t* bucket, const char* file, int line);
+
+#ifdef __cplusplus
+}
 #endif
 
 #endif
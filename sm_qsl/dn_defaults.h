@@ -3,6 +3,21 @@ Copyright (c) 2016, Dust Networks. All rights reserved.
 
 Default values and common definitions for the QuickStart Library.
 
+Buffer sizes, timeouts and other tunables of the library are defaults that a
+product can override without patching the library: Build with DN_QSL_CONFIG
+defined and put a dn_qsl_config.h of your own on the include path, defining
+whichever values differ for the board, e.g.
+	#define DN_INBOX_SIZE					2
+	#define DN_DEFAULT_PAYLOAD_SIZE_LIMIT	DN_PAYLOAD_SIZE_LIMIT_IP_LOW
+	#define DN_CONNECT_TIMEOUT_S			300
+Every define guarded by #ifndef in the headers of the library (this one,
+dn_fsm.h, dn_trace.h, dn_capture.h, dn_hist.h, dn_fcs.h, dn_debug.h) can be
+set this way. Values that do not add up are caught at compile time by
+DN_STATIC_ASSERT. tools/sizes/qsl_sizes.sh lists the RAM the library then
+takes, e.g. the size of its FSM variables; "make sizes" in the Raspberry Pi and
+simulator makefiles runs it, as does the post-build step of the NUCLEO-L053R8
+project, whose settings define DN_QSL_CONFIG for its Inc/dn_qsl_config.h.
+
 \license See attached DN_LICENSE.txt.
 */
 
@@ -11,6 +26,10 @@ Default values and common definitions for the QuickStart Library.
 
 #include "dn_common.h"
 
+#ifdef DN_QSL_CONFIG
+#include "dn_qsl_config.h"
+#endif
+
 //=========================== defines =========================================
 
 #define DN_IPv6ADDR_LEN	16
@@ -52,17 +71,67 @@ static const uint8_t dn_default_manager_ipv6Addr[DN_IPv6ADDR_LEN] = {
 /*
  This is not a valid network ID, but will instead cause the QSL to to take the
  mote through a promiscuous listen state to identify the ID of advertising
- networks, further attempting to join the first one found.
+ networks, further attempting to join the first one found (or the best one
+ heard within DN_PROMISCUOUS_SCAN_WINDOW_MS, see dn_fsm.h).
  */
 #define DN_PROMISCUOUS_NET_ID	0xffff
 
+#ifndef DN_DEFAULT_NET_ID
 #define DN_DEFAULT_NET_ID				1229
+#endif
 #define DN_DEFAULT_JOIN_KEY				(uint8_t*)dn_default_joinKey
+#ifndef DN_DEFAULT_DEST_PORT
 #define DN_DEFAULT_DEST_PORT			DN_WELL_KNOWN_PORT_1
+#endif
 #define DN_DEFAULT_DEST_IP				(uint8_t*)dn_default_manager_ipv6Addr
+#ifndef DN_DEFAULT_SRC_PORT
 #define DN_DEFAULT_SRC_PORT				DN_WELL_KNOWN_PORT_1
-#define DN_DEFAULT_PAYLOAD_SIZE_LIMIT	DN_PAYLOAD_SIZE_LIMIT_MNG_HIGH
+#endif
+#ifndef DN_DEFAULT_SERVICE_MS
 #define DN_DEFAULT_SERVICE_MS			9000 // Base bandwidth provided by manager
+#endif
+
+/*
+ Longest payload sent or received, and the size of every payload buffer of the
+ library (the inbox holds DN_INBOX_SIZE of them, see dn_fsm.h). Lower it to
+ save RAM if all packets are shorter; longer ones are then refused by
+ dn_qsl_send and dropped on reception.
+ */
+#ifndef DN_DEFAULT_PAYLOAD_SIZE_LIMIT
+#define DN_DEFAULT_PAYLOAD_SIZE_LIMIT	DN_PAYLOAD_SIZE_LIMIT_MNG_HIGH
+#endif
+
+/*
+ Set on hosted builds (Linux, e.g. the Raspberry Pi and the simulator), where
+ RAM is plentiful. Diagnostics that take a lot of RAM default to smaller
+ sizes, or to off, on the MCU ports (see DN_TRACE_SIZE and DN_LATENCY_HIST).
+ */
+#ifndef DN_HOSTED
+#if defined(__linux__) || defined(__APPLE__) || defined(_WIN32)
+#define DN_HOSTED	1
+#else
+#define DN_HOSTED	0
+#endif
+#endif
+
+/*
+ Full memory barrier, used by the lock-free queues shared between the context
+ feeding the UART data (an interrupt or reader thread) and the main loop.
+ Override if your toolchain lacks the GCC builtin.
+ */
+#ifndef DN_MEMORY_BARRIER
+#define DN_MEMORY_BARRIER()	__sync_synchronize()
+#endif
+
+/*
+ Compile-time check of the configuration, for compilers without
+ _Static_assert; msg must be a valid identifier, as it names the array type
+ that fails to compile.
+ */
+#define DN_STATIC_ASSERT(cond, msg)	typedef char dn_static_assert_ ## msg[(cond) ? 1 : -1]
+
+DN_STATIC_ASSERT(DN_DEFAULT_PAYLOAD_SIZE_LIMIT > 0 && DN_DEFAULT_PAYLOAD_SIZE_LIMIT <= DN_PAYLOAD_SIZE_LIMIT_MNG_HIGH,
+		payload_size_limit_within_serial_api);
 
 //=========================== typedef =========================================
 
@@ -75,8 +144,28 @@ extern "C"
 {
 #endif
 
+/**
+ \brief Atomically increment a counter, and return its value before.
 
-
+ Used to claim slots of the rings shared between the main loop and the context
+ feeding the UART data (dn_trace.c, dn_capture.c), so that no two writers ever
+ get the same one. Cortex-M0+ and other cores without atomic instructions hold
+ interrupts off for the increment instead.
+ */
+static inline uint32_t dn_atomic_fetchInc(volatile uint32_t* counter)
+{
+#if defined(__ARM_ARCH_6M__)
+	uint32_t primask;
+	uint32_t value;
+
+	__asm volatile ("mrs %0, primask\n\tcpsid i" : "=r" (primask) :: "memory");
+	value = (*counter)++;
+	__asm volatile ("msr primask, %0" :: "r" (primask) : "memory");
+	return value;
+#else
+	return __sync_fetch_and_add(counter, 1);
+#endif
+}
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Frame check sequence (FCS-16, RFC 1662) of the HDLC layer.
+
+The implementation is picked at compile time with DN_FCS_IMPL, trading table
+size for speed:
+ - DN_FCS_SLICE8: 8 tables of 256 entries (4 KiB RAM), 8 bytes per step
+ - DN_FCS_SLICE4: 4 tables of 256 entries (2 KiB RAM), 4 bytes per step
+ - DN_FCS_TABLE:  1 table of 256 entries (512 bytes flash), 1 byte per step
+ - DN_FCS_NIBBLE: 1 table of 16 entries (32 bytes flash), 4 bits per step
+Slice-by-N tables are derived from the 256-entry table by dn_fcs_init.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_FCS_H
+#define DN_FCS_H
+
+#include "dn_common.h"
+#include "dn_defaults.h"
+
+//=========================== defines =========================================
+
+#define DN_FCS_SLICE8	8
+#define DN_FCS_SLICE4	4
+#define DN_FCS_TABLE	1
+#define DN_FCS_NIBBLE	0
+
+#ifndef DN_FCS_IMPL
+#if defined(__linux__)
+#define DN_FCS_IMPL		DN_FCS_SLICE8 // Gateways have cache to spare
+#else
+#define DN_FCS_IMPL		DN_FCS_TABLE
+#endif
+#endif
+
+//=========================== typedef =========================================
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Prepare the tables of the selected implementation, if any.
+
+ Must be called before dn_fcs_update; calling it again is harmless.
+ */
+void dn_fcs_init(void);
+
+/**
+ \brief Run bytes through the FCS.
+
+ \param fcs The FCS so far (DN_HDLC_CRCINIT for a new frame).
+ \param data The bytes to add.
+ \param len The number of bytes.
+ \return The updated FCS. A frame including its own FCS yields DN_HDLC_CRCGOOD.
+ */
+uint16_t dn_fcs_update(uint16_t fcs, const uint8_t* data, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_FCS_H */
@@ -11,6 +11,9 @@ Finite State Machine for the QuickStart Library.
 #include "dn_time.h"
 #include "dn_watchdog.h"
 #include "dn_qsl_api.h"
+#include "dn_trace.h"
+#include "dn_qsl_hooks.h"
+#define DN_LOG_MODULE	DN_LOG_FSM
 #include "dn_debug.h"
 
 //=========================== variables =======================================
@@ -25,8 +28,11 @@ typedef struct
 	// C Library API
 	dn_fsm_reply_cbt replyCb;
 	dn_fsm_timer_cbt fsmCb;
-	uint8_t replyBuf[MAX_FRAME_LENGTH];
+	uint8_t replyBuf[DN_REPLY_BUF_LEN];
 	uint8_t notifBuf[MAX_FRAME_LENGTH];
+	// Mote
+	bool capsKnown;
+	uint8_t caps;
 	// Connection
 	uint8_t socketId;
 	uint16_t networkId;
@@ -38,19 +44,64 @@ typedef struct
 	uint8_t destIPv6[DN_IPv6ADDR_LEN];
 	uint16_t destPort;
 	dn_inbox_t inbox;
+	// Promiscuous search
+	bool promiscuous;
+	volatile bool scanning;
+	uint8_t numCandidates;
+	uint8_t joinFails;
+	dn_candidate_net_t candidates[DN_MAX_CANDIDATE_NETWORKS];
+	// Join duty cycle
+	dn_qsl_connect_opts_t connectOpts;
+	uint8_t joinDutyCycle; // Of the join under way
+	uint8_t failedJoins; // Since the last successful join
+	bool joinTimed; // A join operation is under way
+	uint32_t joinStart_ms;
+	dn_qsl_connect_stats_t connectStats;
+	// Stats
+	uint8_t cmdInFlight; // DN_QSL_CMD_* of the last command issued
+	dn_qsl_stats_t stats;
+#if DN_LATENCY_HIST
+	uint64_t cmdIssued_us;
+	dn_hist_t latency[DN_QSL_NUM_CMDS]; // In DN_LATENCY_UNIT_US
+#endif
+	// Network time
+	uint32_t timeCmdStart_ms; // Anchors the sync to dn_time_ms
+	uint64_t timeCmdStart_us; // Times the round trip
+	dn_time_sync_t timeSync;
 } dn_fsm_vars_t;
 
 static dn_fsm_vars_t dn_fsm_vars;
 
+// Every reply the FSM asks for must fit the reply buffer (see DN_REPLY_BUF_LEN)
+DN_STATIC_ASSERT(DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_reset_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_disconnect_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_getParameter_moteStatus_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_getParameter_moteInfo_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_getParameter_time_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_openSocket_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_bindSocket_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_setParameter_joinKey_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_setParameter_networkId_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_setParameter_joinDutyCycle_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_search_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_join_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_requestService_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_getServiceInfo_rpt)
+		&& DN_REPLY_BUF_LEN >= sizeof (dn_ipmt_sendTo_rpt), reply_buf_holds_every_reply);
+
 
 //=========================== prototypes ======================================
 // FSM
-static void dn_fsm_run(void);
+static void dn_fsm_run(uint32_t cmdStart_ms, uint32_t cmdTimeout_ms);
 static void dn_fsm_scheduleEvent(uint16_t delay, dn_fsm_timer_cbt cb);
 static void dn_fsm_cancelEvent(void);
-static void dn_fsm_setReplyCallback(dn_fsm_reply_cbt cb);
+static void dn_fsm_setReplyCallback(dn_fsm_reply_cbt cb, uint8_t cmd);
 static void dn_fsm_enterState(uint8_t newState, uint16_t spesificDelay);
 static bool dn_fsm_cmd_timeout(uint32_t cmdStart_ms, uint32_t cmdTimeout_ms);
+// Inbox
+static bool dn_inbox_push(const uint8_t* payload, uint8_t size);
+static uint8_t dn_inbox_pop(uint8_t* buf);
+static uint8_t dn_inbox_count(uint8_t head, uint8_t tail);
 // C Library API
 static void dn_ipmt_notif_cb(uint8_t cmdId, uint8_t subCmdId);
 static void dn_ipmt_reply_cb(uint8_t cmdId);
@@ -61,6 +112,8 @@ static void dn_event_disconnect(void);
 static void dn_reply_disconnect(void);
 static void dn_event_getMoteStatus(void);
 static void dn_reply_getMoteStatus(void);
+static void dn_event_getMoteInfo(void);
+static void dn_reply_getMoteInfo(void);
 static void dn_event_openSocket(void);
 static void dn_reply_openSocket(void);
 static void dn_event_bindSocket(void);
@@ -69,8 +122,11 @@ static void dn_event_setJoinKey(void);
 static void dn_reply_setJoinKey(void);
 static void dn_event_setNetworkId(void);
 static void dn_reply_setNetworkId(void);
+static void dn_event_setJoinDutyCycle(void);
+static void dn_reply_setJoinDutyCycle(void);
 static void dn_event_search(void);
 static void dn_reply_search(void);
+static void dn_event_scanComplete(void);
 static void dn_event_join(void);
 static void dn_reply_join(void);
 static void dn_event_requestService(void);
@@ -79,9 +135,25 @@ static void dn_event_getServiceInfo(void);
 static void dn_reply_getServiceInfo(void);
 static void dn_event_sendTo(void);
 static void dn_reply_sendTo(void);
+static void dn_event_getTime(void);
+static void dn_reply_getTime(void);
+// Promiscuous search
+static void dn_candidate_record(const dn_ipmt_advReceived_nt* adv);
+static int16_t dn_candidate_score(const dn_candidate_net_t* candidate);
+static dn_candidate_net_t* dn_candidate_best(void);
+static bool dn_candidate_fallback(void);
+
+static uint8_t dn_join_dutyCycle(void);
+static bool dn_join_failed(void);
+static void dn_join_end(bool joined);
+// Network time
+static void dn_time_sync(uint32_t local_ms, const uint8_t* utcSecs, uint32_t utcUsecs, const uint8_t* asn, uint16_t asnOffset);
+static void dn_time_snapshot(dn_time_sync_t* sync);
 // helpers
 static dn_err_t checkAndSaveNetConfig(uint16_t netID, const uint8_t* joinKey, uint16_t srcPort, uint32_t req_service_ms);
 static uint8_t getPayloadLimit(uint16_t destPort);
+static uint64_t readUintBE(const uint8_t* from, uint8_t len);
+static bool snapshotCounters(void* copy, const void* counters, uint16_t size);
 
 //=========================== public ==========================================
 
@@ -92,6 +164,9 @@ bool dn_qsl_init(void)
 	debug("QSL: Init");
 	// Reset local variables
 	memset(&dn_fsm_vars, 0, sizeof (dn_fsm_vars));
+	dn_fsm_vars.connectOpts.setJoinDutyCycle = TRUE;
+	dn_fsm_vars.connectOpts.joinDutyCycle = DN_JOIN_DUTY_CYCLE_FIRST;
+	dn_fsm_vars.connectOpts.minJoinDutyCycle = DN_JOIN_DUTY_CYCLE_MIN;
 
 	// Initialize the ipmt module
 	dn_ipmt_init // Should be augmented with return value to know if successful...
@@ -112,9 +187,15 @@ bool dn_qsl_isConnected(void)
 	return dn_fsm_vars.state == DN_FSM_STATE_CONNECTED;
 }
 
+uint8_t dn_qsl_getState(void)
+{
+	return dn_fsm_vars.state;
+}
+
 bool dn_qsl_connect(uint16_t netID, const uint8_t* joinKey, uint16_t srcPort, uint32_t req_service_ms)
 {
 	uint32_t cmdStart_ms = dn_time_ms();
+	bool started = FALSE;
 	dn_err_t err;
 	debug("QSL: Connect");
 	switch (dn_fsm_vars.state)
@@ -130,6 +211,7 @@ bool dn_qsl_connect(uint16_t netID, const uint8_t* joinKey, uint16_t srcPort, ui
 		}
 		debug("Starting connect process...");
 		dn_fsm_enterState(DN_FSM_STATE_PRE_JOIN, 0);
+		started = TRUE;
 		break;
 	case DN_FSM_STATE_CONNECTED:
 		if ((netID > 0 && netID != dn_fsm_vars.networkId)
@@ -143,6 +225,7 @@ bool dn_qsl_connect(uint16_t netID, const uint8_t* joinKey, uint16_t srcPort, ui
 			}
 			debug("New network ID, join key and/or source port; reconnecting...");
 			dn_fsm_enterState(DN_FSM_STATE_RESETTING, 0);
+			started = TRUE;
 		} else if (req_service_ms > 0 && req_service_ms != dn_fsm_vars.service_ms)
 		{
 			debug("New service request");
@@ -166,17 +249,71 @@ bool dn_qsl_connect(uint16_t netID, const uint8_t* joinKey, uint16_t srcPort, ui
 			&& !dn_fsm_cmd_timeout(cmdStart_ms, DN_CONNECT_TIMEOUT_S * 1000))
 	{
 		dn_watchdog_feed();
-		dn_fsm_run();
+		dn_fsm_run(cmdStart_ms, DN_CONNECT_TIMEOUT_S * 1000);
 	}
 
+	if (started)
+	{
+		dn_fsm_vars.connectStats.connects++;
+		if (dn_fsm_vars.state == DN_FSM_STATE_CONNECTED)
+		{
+			dn_fsm_vars.connectStats.connected++;
+			dn_fsm_vars.connectStats.lastConnect_ms = dn_time_ms() - cmdStart_ms;
+		}
+	}
 	return dn_fsm_vars.state == DN_FSM_STATE_CONNECTED;
 }
 
+void dn_qsl_setConnectOptions(const dn_qsl_connect_opts_t* opts)
+{
+	debug("QSL: setConnectOptions");
+	memcpy(&dn_fsm_vars.connectOpts, opts, sizeof (dn_qsl_connect_opts_t));
+}
+
+bool dn_qsl_getConnectStats(dn_qsl_connect_stats_t* stats)
+{
+	return snapshotCounters(stats, &dn_fsm_vars.connectStats, sizeof (dn_qsl_connect_stats_t));
+}
+
+bool dn_qsl_getStats(dn_qsl_stats_t* stats)
+{
+	return snapshotCounters(stats, &dn_fsm_vars.stats, sizeof (dn_qsl_stats_t));
+}
+
+bool dn_qsl_getLatency(uint8_t cmd, dn_qsl_latency_t* latency)
+{
+#if DN_LATENCY_HIST
+	dn_hist_t hist;
+#endif
+	bool consistent = TRUE;
+
+	if (cmd >= DN_QSL_NUM_CMDS)
+	{
+		return FALSE;
+	}
+	memset(latency, 0, sizeof (dn_qsl_latency_t));
+	latency->timeouts = dn_fsm_vars.stats.rspTimeouts[cmd];
+#if DN_LATENCY_HIST
+	// Bins and count are updated one after the other, from the UART context
+	consistent = snapshotCounters(&hist, &dn_fsm_vars.latency[cmd], sizeof (dn_hist_t));
+	latency->count = hist.count;
+	if (hist.count > 0)
+	{
+		// Round up to the end of the unit
+		latency->p50_us = (dn_hist_percentile(&hist, 50) + 1) * DN_LATENCY_UNIT_US;
+		latency->p99_us = (dn_hist_percentile(&hist, 99) + 1) * DN_LATENCY_UNIT_US;
+		latency->max_us = (hist.max + 1) * DN_LATENCY_UNIT_US;
+	}
+#endif
+	return consistent;
+}
+
 bool dn_qsl_send(const uint8_t* payload, uint8_t payloadSize_B, uint16_t destPort)
 {
 	uint32_t cmdStart_ms = dn_time_ms();
 	uint8_t maxPayloadSize;
-	debug("QSL: Send");
+	dn_trace(SEND, payloadSize_B, destPort);
+	dn_fsm_vars.stats.sends++;
 	switch (dn_fsm_vars.state)
 	{
 	case DN_FSM_STATE_CONNECTED:
@@ -185,6 +322,7 @@ bool dn_qsl_send(const uint8_t* payload, uint8_t payloadSize_B, uint16_t destPor
 		if (payloadSize_B > maxPayloadSize)
 		{
 			log_warn("Payload size (%u) exceeds limit (%u)", payloadSize_B, maxPayloadSize);
+			dn_fsm_vars.stats.sendFailsTooLong++;
 			return FALSE;
 		}
 		// Store outbound payload and parameters
@@ -197,6 +335,7 @@ bool dn_qsl_send(const uint8_t* payload, uint8_t payloadSize_B, uint16_t destPor
 		break;
 	default:
 		log_warn("Can't send; not connected");
+		dn_fsm_vars.stats.sendFailsNotConnected++;
 		return FALSE;
 	}
 
@@ -205,10 +344,11 @@ bool dn_qsl_send(const uint8_t* payload, uint8_t payloadSize_B, uint16_t destPor
 			&& !dn_fsm_cmd_timeout(cmdStart_ms, DN_SEND_TIMEOUT_MS))
 	{
 		dn_watchdog_feed();
-		dn_fsm_run();
+		dn_fsm_run(cmdStart_ms, DN_SEND_TIMEOUT_MS);
 	}
 
 	// Catch send failure
+	dn_trace(SEND_DONE, dn_fsm_vars.state == DN_FSM_STATE_CONNECTED, dn_fsm_vars.state);
 	if (dn_fsm_vars.state == DN_FSM_STATE_SEND_FAILED)
 	{
 		debug("Send failed");
@@ -219,22 +359,18 @@ bool dn_qsl_send(const uint8_t* payload, uint8_t payloadSize_B, uint16_t destPor
 	return dn_fsm_vars.state == DN_FSM_STATE_CONNECTED;
 }
 
+uint8_t dn_qsl_getPayloadLimit(uint16_t destPort)
+{
+	return getPayloadLimit(destPort);
+}
+
 uint8_t dn_qsl_read(uint8_t* readBuffer)
 {
-	uint8_t bytesRead = 0;
+	uint8_t bytesRead;
 	debug("QSL: Read");
-	if (dn_fsm_vars.inbox.unreadPackets > 0)
+	bytesRead = dn_inbox_pop(readBuffer);
+	if (bytesRead > 0)
 	{
-		// Pop payload at head of inbox
-		memcpy
-				(
-				readBuffer,
-				dn_fsm_vars.inbox.pktBuf[dn_fsm_vars.inbox.head],
-				dn_fsm_vars.inbox.pktSize[dn_fsm_vars.inbox.head]
-				);
-		bytesRead = dn_fsm_vars.inbox.pktSize[dn_fsm_vars.inbox.head];
-		dn_fsm_vars.inbox.head = (dn_fsm_vars.inbox.head + 1) % DN_INBOX_SIZE;
-		dn_fsm_vars.inbox.unreadPackets--;
 		debug("Read %u bytes from inbox", bytesRead);
 	} else
 	{
@@ -243,6 +379,71 @@ uint8_t dn_qsl_read(uint8_t* readBuffer)
 	return bytesRead;
 }
 
+uint64_t dn_qsl_networkTime_us(void)
+{
+	uint32_t cmdStart_ms = dn_time_ms();
+	dn_time_sync_t sync;
+	uint64_t elapsed_us;
+	debug("QSL: Network time");
+
+	dn_time_snapshot(&sync);
+	if (dn_fsm_vars.state == DN_FSM_STATE_CONNECTED
+			&& (!sync.valid || sync.stale
+			|| (uint32_t)(cmdStart_ms - sync.local_ms) > DN_TIME_SYNC_PERIOD_S * 1000))
+	{
+		// Mapping missing or old; ask the mote for a new sync point
+		dn_fsm_enterState(DN_FSM_STATE_SYNCING_TIME, 0);
+		while (dn_fsm_vars.state == DN_FSM_STATE_SYNCING_TIME
+				&& !dn_fsm_cmd_timeout(cmdStart_ms, DN_TIME_SYNC_TIMEOUT_MS))
+		{
+			dn_watchdog_feed();
+			dn_fsm_run(cmdStart_ms, DN_TIME_SYNC_TIMEOUT_MS);
+		}
+		dn_time_snapshot(&sync);
+	}
+
+	if (!sync.valid)
+	{
+		return 0;
+	}
+
+	// Extrapolate from the sync point, correcting for local clock drift
+	elapsed_us = (uint64_t)(uint32_t)(dn_time_ms() - sync.local_ms) * 1000; // Handle dn_time_ms wrap around
+	return sync.utc_us + elapsed_us + (int64_t)elapsed_us * sync.drift_ppb / 1000000000;
+}
+
+uint64_t dn_qsl_networkAsn(void)
+{
+	dn_time_sync_t sync;
+	uint64_t elapsed_us;
+
+	dn_time_snapshot(&sync);
+	if (!sync.valid)
+	{
+		return 0;
+	}
+
+	elapsed_us = (uint64_t)(uint32_t)(dn_time_ms() - sync.local_ms) * 1000; // Handle dn_time_ms wrap around
+	elapsed_us += (int64_t)elapsed_us * sync.drift_ppb / 1000000000;
+	return sync.asn + (elapsed_us + sync.asnOffset_us) / DN_ASN_SLOT_US;
+}
+
+//========== Hooks
+
+#if DN_QSL_HOOKS
+bool dn_qsl_hook_inboxPush(const uint8_t* payload, uint8_t size)
+{
+	return dn_inbox_push(payload, size);
+}
+
+void dn_qsl_hook_dispatchEvent(dn_qsl_hook_event_cbt cb)
+{
+	dn_fsm_scheduleEvent(0, cb);
+	dn_fsm_vars.fsmEventScheduled_ms--; // Backdated, so that it is due
+	dn_fsm_run(dn_time_ms(), DN_SEND_TIMEOUT_MS);
+}
+#endif
+
 //=========================== private =========================================
 
 //========== FSM
@@ -250,11 +451,15 @@ uint8_t dn_qsl_read(uint8_t* readBuffer)
 //===== run
 
 /**
- Check if an event is scheduled and run it if due.
+ Check if an event is scheduled and run it if due. Otherwise sleep until it is
+ due, until the command being driven times out or until the mote sends
+ something, whichever comes first.
  */
-static void dn_fsm_run(void)
+static void dn_fsm_run(uint32_t cmdStart_ms, uint32_t cmdTimeout_ms)
 {
-	uint32_t timePassed_ms = dn_time_ms() - dn_fsm_vars.fsmEventScheduled_ms; // Handle dn_time_ms wrap around
+	uint32_t now_ms = dn_time_ms();
+	uint32_t timePassed_ms = now_ms - dn_fsm_vars.fsmEventScheduled_ms; // Handle dn_time_ms wrap around
+	uint32_t sleep_ms;
 	if (dn_fsm_vars.fsmArmed && (timePassed_ms > dn_fsm_vars.fsmDelay_ms))
 	{
 		// Scheduled event is due; execute it
@@ -265,8 +470,18 @@ static void dn_fsm_run(void)
 		}
 	} else
 	{
-		// Sleep to save CPU power
-		dn_sleep_ms(DN_FSM_RUN_INTERVAL_MS);
+		// The timeout and the event are both due once more than their delay has passed
+		sleep_ms = DN_FSM_MAX_IDLE_MS;
+		if (cmdTimeout_ms + 1 - (now_ms - cmdStart_ms) < sleep_ms)
+		{
+			sleep_ms = cmdTimeout_ms + 1 - (now_ms - cmdStart_ms);
+		}
+		if (dn_fsm_vars.fsmArmed && dn_fsm_vars.fsmDelay_ms + 1 - timePassed_ms < sleep_ms)
+		{
+			sleep_ms = dn_fsm_vars.fsmDelay_ms + 1 - timePassed_ms;
+		}
+		// Sleep to save CPU power; replies and notifications wake us up
+		dn_sleep_until(now_ms + sleep_ms);
 	}
 }
 
@@ -299,10 +514,18 @@ static void dn_fsm_cancelEvent(void)
 
 /**
  Set the callback function that the C Library will execute when the next reply
- is received and the reply buffer is ready to be parsed.
+ is received and the reply buffer is ready to be parsed, and note the command
+ about to be issued (DN_QSL_CMD_*) for the stats.
  */
-static void dn_fsm_setReplyCallback(dn_fsm_reply_cbt cb)
+static void dn_fsm_setReplyCallback(dn_fsm_reply_cbt cb, uint8_t cmd)
 {
+	// Always followed by the command; the decoder names it after the reply
+	dn_trace(FSM_CMD, dn_fsm_vars.state, cmd);
+	dn_fsm_vars.cmdInFlight = cmd;
+	dn_fsm_vars.stats.commands++;
+#if DN_LATENCY_HIST
+	dn_fsm_vars.cmdIssued_us = dn_time_us64();
+#endif
 	dn_fsm_vars.replyCb = cb;
 }
 
@@ -313,27 +536,32 @@ static void dn_fsm_setReplyCallback(dn_fsm_reply_cbt cb)
  */
 static void dn_fsm_enterState(uint8_t newState, uint16_t spesificDelay)
 {
-	uint32_t now = dn_time_ms();
 	uint16_t delay = DN_CMD_PERIOD_MS;
-	static uint32_t lastTransition = 0;
-	if (lastTransition == 0)
-		lastTransition = now;
 
 	// Use default delay if none given
 	if (spesificDelay > 0)
 		delay = spesificDelay;
 
+	// Leaving the joining state, one way or another, ends the join under way
+	if (dn_fsm_vars.joinTimed && newState != DN_FSM_STATE_JOINING)
+		dn_join_end(newState == DN_FSM_STATE_REQ_SERVICE || newState == DN_FSM_STATE_CONNECTED);
+
 	// Schedule default events for transition into states
 	switch (newState)
 	{
 	case DN_FSM_STATE_PRE_JOIN:
+		dn_fsm_vars.scanning = FALSE; // Any scan window was interrupted
 		dn_fsm_scheduleEvent(delay, dn_event_getMoteStatus);
 		break;
 	case DN_FSM_STATE_PROMISCUOUS:
 		dn_fsm_scheduleEvent(delay, dn_event_search);
 		break;
 	case DN_FSM_STATE_JOINING:
-		dn_fsm_scheduleEvent(delay, dn_event_join);
+		dn_fsm_vars.joinDutyCycle = dn_join_dutyCycle();
+		if (dn_fsm_vars.connectOpts.setJoinDutyCycle)
+			dn_fsm_scheduleEvent(delay, dn_event_setJoinDutyCycle);
+		else
+			dn_fsm_scheduleEvent(delay, dn_event_join);
 		break;
 	case DN_FSM_STATE_REQ_SERVICE:
 		dn_fsm_scheduleEvent(delay, dn_event_requestService);
@@ -351,6 +579,10 @@ static void dn_fsm_enterState(uint8_t newState, uint16_t spesificDelay)
 		 */
 		dn_fsm_scheduleEvent(0, dn_event_sendTo);
 		break;
+	case DN_FSM_STATE_SYNCING_TIME:
+		// Scheduled immediately for the same reason as send
+		dn_fsm_scheduleEvent(0, dn_event_getTime);
+		break;
 	case DN_FSM_STATE_SEND_FAILED:
 	case DN_FSM_STATE_DISCONNECTED:
 	case DN_FSM_STATE_CONNECTED:
@@ -361,9 +593,7 @@ static void dn_fsm_enterState(uint8_t newState, uint16_t spesificDelay)
 		return;
 	}
 
-	debug("FSM state transition: %#.2x --> %#.2x (%u ms)",
-			dn_fsm_vars.state, newState, (uint32_t)(now - lastTransition));
-	lastTransition = now;
+	dn_trace(FSM_STATE, dn_fsm_vars.state, newState);
 	dn_fsm_vars.state = newState;
 }
 
@@ -379,11 +609,20 @@ static bool dn_fsm_cmd_timeout(uint32_t cmdStart_ms, uint32_t cmdTimeout_ms)
 	bool timeout = timePassed_ms > cmdTimeout_ms;
 	if (timeout)
 	{
+		dn_trace(FSM_CMD_TIMEOUT, dn_fsm_vars.state, timePassed_ms);
+		dn_fsm_vars.stats.cmdTimeouts++;
+
 		// Cancel any ongoing transmission or scheduled event and reset reply cb
 		dn_ipmt_cancelTx();
 		dn_fsm_vars.replyCb = NULL;
 		dn_fsm_cancelEvent();
 
+		if (dn_fsm_vars.state == DN_FSM_STATE_JOINING)
+		{
+			// Counts as a failed attempt, so that the next connect may listen less
+			dn_join_failed();
+		}
+
 		// Default timeout state is different while connecting vs sending
 		switch (dn_fsm_vars.state)
 		{
@@ -396,8 +635,13 @@ static bool dn_fsm_cmd_timeout(uint32_t cmdStart_ms, uint32_t cmdTimeout_ms)
 			break;
 		case DN_FSM_STATE_SENDING:
 			debug("Send timeout");
+			dn_fsm_vars.stats.sendFailsTimeout++;
 			dn_fsm_enterState(DN_FSM_STATE_SEND_FAILED, 0);
 			break;
+		case DN_FSM_STATE_SYNCING_TIME:
+			debug("Time sync timeout");
+			dn_fsm_enterState(DN_FSM_STATE_CONNECTED, 0);
+			break;
 		default:
 			log_err("Command timeout in unexpected state: %#x", dn_fsm_vars.state);
 			break;
@@ -406,6 +650,77 @@ static bool dn_fsm_cmd_timeout(uint32_t cmdStart_ms, uint32_t cmdTimeout_ms)
 	return timeout;
 }
 
+//========== Inbox
+
+//===== push
+
+/**
+ Copy a payload into the slot at the tail and publish it. Only called from the
+ notification callback (producer). Returns FALSE if the inbox is full or the
+ payload does not fit in a slot.
+ */
+static bool dn_inbox_push(const uint8_t* payload, uint8_t size)
+{
+	dn_inbox_t* inbox = &dn_fsm_vars.inbox;
+	uint8_t tail = inbox->tail;
+	uint8_t slot = (tail >= DN_INBOX_SIZE) ? tail - DN_INBOX_SIZE : tail;
+
+	if (size > DN_DEFAULT_PAYLOAD_SIZE_LIMIT
+			|| dn_inbox_count(inbox->head, tail) == DN_INBOX_SIZE)
+	{
+		dn_fsm_vars.stats.inboxOverflows++;
+		return FALSE;
+	}
+
+	memcpy(inbox->pktBuf[slot], payload, size);
+	inbox->pktSize[slot] = size;
+
+	// Slot must be written before the consumer can see it
+	DN_MEMORY_BARRIER();
+	inbox->tail = (tail + 1) % (2 * DN_INBOX_SIZE);
+	debug("Inbox capacity at %u / %u", dn_inbox_count(inbox->head, inbox->tail), DN_INBOX_SIZE);
+	return TRUE;
+}
+
+//===== pop
+
+/**
+ Copy the payload at the head into the given buffer and release its slot. Only
+ called from dn_qsl_read (consumer). Returns the payload size, 0 if empty.
+ */
+static uint8_t dn_inbox_pop(uint8_t* buf)
+{
+	dn_inbox_t* inbox = &dn_fsm_vars.inbox;
+	uint8_t head = inbox->head;
+	uint8_t slot = (head >= DN_INBOX_SIZE) ? head - DN_INBOX_SIZE : head;
+	uint8_t size;
+
+	if (dn_inbox_count(head, inbox->tail) == 0)
+	{
+		return 0;
+	}
+
+	// Tail must be read before the slot it published
+	DN_MEMORY_BARRIER();
+	size = inbox->pktSize[slot];
+	memcpy(buf, inbox->pktBuf[slot], size);
+
+	// Slot must be read before the producer can reuse it
+	DN_MEMORY_BARRIER();
+	inbox->head = (head + 1) % (2 * DN_INBOX_SIZE);
+	return size;
+}
+
+//===== count
+
+/**
+ Number of unread packets between the given head and tail.
+ */
+static uint8_t dn_inbox_count(uint8_t head, uint8_t tail)
+{
+	return (tail + 2 * DN_INBOX_SIZE - head) % (2 * DN_INBOX_SIZE);
+}
+
 //========== C Library API
 
 //===== notif_cb
@@ -418,29 +733,59 @@ static bool dn_fsm_cmd_timeout(uint32_t cmdStart_ms, uint32_t cmdTimeout_ms)
  */
 static void dn_ipmt_notif_cb(uint8_t cmdId, uint8_t subCmdId)
 {
-	//dn_ipmt_timeIndication_nt* notif_timeIndication;
+	dn_ipmt_timeIndication_nt* notif_timeIndication;
 	dn_ipmt_events_nt* notif_events;
 	dn_ipmt_receive_nt* notif_receive;
 	//dn_ipmt_macRx_nt* notif_macRx;
 	//dn_ipmt_txDone_nt* notif_txDone;
 	dn_ipmt_advReceived_nt* notif_advReceived;
+	bool relax;
 
-	debug("Got notification: cmdId; %#.2x (%u), subCmdId; %#.2x (%u)",
-			cmdId, cmdId, subCmdId, subCmdId);
+	dn_trace(NOTIF, cmdId, subCmdId);
 
 	switch (cmdId)
 	{
 	case CMDID_TIMEINDICATION:
-		// Not implemented
+		notif_timeIndication = (dn_ipmt_timeIndication_nt*)dn_fsm_vars.notifBuf;
+		debug("Received time indication");
+		dn_time_sync
+				(
+				dn_time_ms(),
+				notif_timeIndication->utcSecs,
+				notif_timeIndication->utcUsecs,
+				notif_timeIndication->asn,
+				notif_timeIndication->asnOffset
+				);
 		break;
 	case CMDID_EVENTS:
 		notif_events = (dn_ipmt_events_nt*)dn_fsm_vars.notifBuf;
-		debug("State: %#.2x | Events: %#.4x", notif_events->state, notif_events->events);
+		dn_trace(MOTE_EVENTS, notif_events->events, notif_events->state);
+
+		if (notif_events->events & DN_MOTE_EVENT_MASK_BOOT)
+		{
+			dn_fsm_vars.stats.boots++;
+		}
+
+		if (notif_events->events & DN_MOTE_EVENT_MASK_TIME_CHANGE)
+		{
+			// Network time jumped; mapping must be refreshed
+			dn_fsm_vars.timeSync.stale = TRUE;
+		}
 
 		// Check if in fsm state where we expect a certain mote event
 		switch (dn_fsm_vars.state)
 		{
 		case DN_FSM_STATE_JOINING:
+			if (notif_events->events & DN_MOTE_EVENT_MASK_JOIN_FAIL)
+			{
+				relax = dn_join_failed();
+				if (dn_candidate_fallback() || relax)
+				{
+					// Giving up on this network or duty cycle; reset to join the next best one, or listen less
+					dn_fsm_enterState(DN_FSM_STATE_RESETTING, 0);
+					return;
+				}
+			}
 			if (notif_events->events & DN_MOTE_EVENT_MASK_OPERATIONAL)
 			{
 				// Join complete
@@ -481,7 +826,9 @@ static void dn_ipmt_notif_cb(uint8_t cmdId, uint8_t subCmdId)
 			case DN_FSM_STATE_CONNECTED:
 			case DN_FSM_STATE_SENDING:
 			case DN_FSM_STATE_SEND_FAILED:
+			case DN_FSM_STATE_SYNCING_TIME:
 				// Disconnect/reset; set state accordingly
+				dn_fsm_vars.stats.connectionsLost++;
 				dn_fsm_enterState(DN_FSM_STATE_DISCONNECTED, 0);
 				break;
 			}
@@ -504,24 +851,14 @@ static void dn_ipmt_notif_cb(uint8_t cmdId, uint8_t subCmdId)
 	case CMDID_RECEIVE:
 		notif_receive = (dn_ipmt_receive_nt*)dn_fsm_vars.notifBuf;
 		debug("Received downstream data");
+		dn_fsm_vars.stats.packetsReceived++;
+		dn_fsm_vars.stats.bytesReceived += notif_receive->payloadLen;
 
 		// Push payload at tail of inbox
-		memcpy
-				(
-				dn_fsm_vars.inbox.pktBuf[dn_fsm_vars.inbox.tail],
-				notif_receive->payload,
-				notif_receive->payloadLen
-				);
-		dn_fsm_vars.inbox.pktSize[dn_fsm_vars.inbox.tail] = notif_receive->payloadLen;
-		dn_fsm_vars.inbox.tail = (dn_fsm_vars.inbox.tail + 1) % DN_INBOX_SIZE;
-		if(dn_fsm_vars.inbox.unreadPackets == DN_INBOX_SIZE)
-		{
-			log_warn("Inbox overflow; oldest packet dropped");
-		} else
+		if (!dn_inbox_push(notif_receive->payload, notif_receive->payloadLen))
 		{
-			dn_fsm_vars.inbox.unreadPackets++;
+			dn_trace(INBOX_OVERFLOW, notif_receive->payloadLen, dn_fsm_vars.stats.inboxOverflows);
 		}
-		debug("Inbox capacity at %u / %u", dn_fsm_vars.inbox.unreadPackets, DN_INBOX_SIZE);
 
 		break;
 	case CMDID_MACRX:
@@ -534,7 +871,11 @@ static void dn_ipmt_notif_cb(uint8_t cmdId, uint8_t subCmdId)
 		notif_advReceived = (dn_ipmt_advReceived_nt*)dn_fsm_vars.notifBuf;
 		debug("Received network advertisement");
 
-		if (dn_fsm_vars.state == DN_FSM_STATE_PROMISCUOUS
+		if (dn_fsm_vars.scanning)
+		{
+			// Gather all networks heard during scan window
+			dn_candidate_record(notif_advReceived);
+		} else if (dn_fsm_vars.state == DN_FSM_STATE_PROMISCUOUS
 				&& dn_fsm_vars.networkId == DN_PROMISCUOUS_NET_ID)
 		{
 			debug("Saving network ID: %#.4x (%u)",
@@ -559,12 +900,18 @@ static void dn_ipmt_notif_cb(uint8_t cmdId, uint8_t subCmdId)
  */
 static void dn_ipmt_reply_cb(uint8_t cmdId)
 {
-	debug("Got reply: cmdId; %#.2x (%u)", cmdId, cmdId);
+	// Every reply starts with its response code
+	dn_trace(FSM_REPLY, cmdId, dn_fsm_vars.replyBuf[0]);
+	dn_fsm_vars.stats.replies[dn_fsm_vars.replyBuf[0] < DN_QSL_NUM_RC ? dn_fsm_vars.replyBuf[0] : DN_QSL_NUM_RC - 1]++;
 	if (dn_fsm_vars.replyCb == NULL)
 	{
 		debug("Reply callback empty");
 		return;
 	}
+#if DN_LATENCY_HIST
+	dn_hist_record(&dn_fsm_vars.latency[dn_fsm_vars.cmdInFlight],
+			(uint32_t)(dn_time_us64() - dn_fsm_vars.cmdIssued_us) / DN_LATENCY_UNIT_US);
+#endif
 	dn_fsm_vars.replyCb();
 }
 
@@ -576,7 +923,8 @@ static void dn_ipmt_reply_cb(uint8_t cmdId)
  */
 static void dn_event_responseTimeout(void)
 {
-	debug("Response timeout");
+	dn_trace(FSM_RSP_TIMEOUT, dn_fsm_vars.state, dn_fsm_vars.cmdInFlight);
+	dn_fsm_vars.stats.rspTimeouts[dn_fsm_vars.cmdInFlight]++;
 
 	// Cancel any ongoing transmission and reset reply cb
 	dn_ipmt_cancelTx();
@@ -589,13 +937,24 @@ static void dn_event_responseTimeout(void)
 	case DN_FSM_STATE_REQ_SERVICE:
 	case DN_FSM_STATE_RESETTING:
 	case DN_FSM_STATE_PROMISCUOUS:
+		if (dn_fsm_vars.cmdInFlight == DN_QSL_CMD_GET_MOTE_INFO)
+		{
+			// A mote that does not answer is assumed to support nothing, rather than asked forever
+			dn_fsm_vars.caps = DN_MOTE_CAP_NONE;
+			dn_fsm_vars.capsKnown = TRUE;
+		}
 		// Response timeout during connect; retry
 		dn_fsm_enterState(DN_FSM_STATE_PRE_JOIN, 0);
 		break;
 	case DN_FSM_STATE_SENDING:
 		// Response timeout during send; fail
+		dn_fsm_vars.stats.sendFailsTimeout++;
 		dn_fsm_enterState(DN_FSM_STATE_SEND_FAILED, 0);
 		break;
+	case DN_FSM_STATE_SYNCING_TIME:
+		// Response timeout during time sync; keep using old mapping
+		dn_fsm_enterState(DN_FSM_STATE_CONNECTED, 0);
+		break;
 	default:
 		log_err("Response timeout in unexpected state: %#x", dn_fsm_vars.state);
 		break;
@@ -611,8 +970,9 @@ static void dn_event_responseTimeout(void)
 static void dn_event_reset(void)
 {
 	debug("Reset");
+	dn_fsm_vars.stats.resets++;
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_reset);
+	dn_fsm_setReplyCallback(dn_reply_reset, DN_QSL_CMD_RESET);
 
 	// Issue mote API command
 	dn_ipmt_reset
@@ -660,9 +1020,10 @@ static void dn_reply_reset(void)
 static void dn_event_disconnect(void)
 {
 	debug("Disconnect");
+	dn_fsm_vars.stats.resets++;
 
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_disconnect);
+	dn_fsm_setReplyCallback(dn_reply_disconnect, DN_QSL_CMD_DISCONNECT);
 
 	// Issue mote API command
 	dn_ipmt_disconnect
@@ -715,7 +1076,7 @@ static void dn_event_getMoteStatus(void)
 	debug("Mote status");
 
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_getMoteStatus);
+	dn_fsm_setReplyCallback(dn_reply_getMoteStatus, DN_QSL_CMD_GET_MOTE_STATUS);
 
 	// Issue mote API command
 	dn_ipmt_getParameter_moteStatus
@@ -743,7 +1104,14 @@ static void dn_reply_getMoteStatus(void)
 	switch (reply->state)
 	{
 	case DN_MOTE_STATE_IDLE:
-		dn_fsm_scheduleEvent(DN_CMD_PERIOD_MS, dn_event_openSocket);
+		if (!dn_fsm_vars.capsKnown)
+		{
+			// Only needed once, as the capabilities are cached
+			dn_fsm_scheduleEvent(DN_CMD_PERIOD_MS, dn_event_getMoteInfo);
+		} else
+		{
+			dn_fsm_scheduleEvent(DN_CMD_PERIOD_MS, dn_event_openSocket);
+		}
 		break;
 	case DN_MOTE_STATE_OPERATIONAL:
 		dn_fsm_enterState(DN_FSM_STATE_RESETTING, 0);
@@ -754,6 +1122,65 @@ static void dn_reply_getMoteStatus(void)
 	}
 }
 
+//===== getMoteInfo
+
+/**
+ Asks the mote for its software version, from which a bitmap of capabilities
+ is derived and cached. Should the mote not answer as expected, or not at
+ all (see dn_event_responseTimeout), it is assumed to support none of them.
+ */
+static void dn_event_getMoteInfo(void)
+{
+	debug("Mote info");
+
+	// Arm reply callback
+	dn_fsm_setReplyCallback(dn_reply_getMoteInfo, DN_QSL_CMD_GET_MOTE_INFO);
+
+	// Issue mote API command
+	dn_ipmt_getParameter_moteInfo
+			(
+			(dn_ipmt_getParameter_moteInfo_rpt*)dn_fsm_vars.replyBuf
+			);
+
+	// Schedule timeout for reply
+	dn_fsm_scheduleEvent(DN_SERIAL_RESPONSE_TIMEOUT_MS, dn_event_responseTimeout);
+}
+
+static void dn_reply_getMoteInfo(void)
+{
+	dn_ipmt_getParameter_moteInfo_rpt* reply;
+	debug("Mote info reply");
+
+	// Cancel reply timeout
+	dn_fsm_cancelEvent();
+
+	// Parse reply
+	reply = (dn_ipmt_getParameter_moteInfo_rpt*)dn_fsm_vars.replyBuf;
+
+	dn_fsm_vars.caps = DN_MOTE_CAP_NONE;
+	switch (reply->RC)
+	{
+	case DN_RC_OK:
+		debug("Mote software version %u.%u.%u.%u",
+				reply->swVerMajor, reply->swVerMinor, reply->swVerPatch, reply->swVerBuild);
+		if (reply->swVerMajor > DN_MOTE_CAP_JOIN_ANY_NET_ID_MIN_MAJOR
+				|| (reply->swVerMajor == DN_MOTE_CAP_JOIN_ANY_NET_ID_MIN_MAJOR
+				&& reply->swVerMinor >= DN_MOTE_CAP_JOIN_ANY_NET_ID_MIN_MINOR))
+		{
+			dn_fsm_vars.caps |= DN_MOTE_CAP_JOIN_ANY_NET_ID;
+		}
+		break;
+	default:
+		log_warn("Unexpected response code: %#x", reply->RC);
+		break;
+	}
+	dn_fsm_vars.capsKnown = TRUE;
+	debug("Mote capabilities: %#.2x", dn_fsm_vars.caps);
+
+	// Choose next event
+	dn_fsm_scheduleEvent(DN_CMD_PERIOD_MS, dn_event_openSocket);
+}
+
 //===== openSocket
 
 /**
@@ -766,7 +1193,7 @@ static void dn_event_openSocket(void)
 	debug("Open socket");
 
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_openSocket);
+	dn_fsm_setReplyCallback(dn_reply_openSocket, DN_QSL_CMD_OPEN_SOCKET);
 
 	// Issue mote API command
 	dn_ipmt_openSocket
@@ -820,7 +1247,7 @@ static void dn_event_bindSocket(void)
 	debug("Bind socket");
 
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_bindSocket);
+	dn_fsm_setReplyCallback(dn_reply_bindSocket, DN_QSL_CMD_BIND_SOCKET);
 
 	// Issue mote API command
 	dn_ipmt_bindSocket
@@ -878,7 +1305,7 @@ static void dn_event_setJoinKey(void)
 	debug("Set join key");
 
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_setJoinKey);
+	dn_fsm_setReplyCallback(dn_reply_setJoinKey, DN_QSL_CMD_SET_JOIN_KEY);
 
 	// Issue mote API command
 	dn_ipmt_setParameter_joinKey
@@ -907,17 +1334,19 @@ static void dn_reply_setJoinKey(void)
 	{
 	case DN_RC_OK:
 		debug("Join key set");
-		if (dn_fsm_vars.networkId == DN_PROMISCUOUS_NET_ID)
+		if (dn_fsm_vars.networkId == DN_PROMISCUOUS_NET_ID
+				&& (DN_PROMISCUOUS_SCAN_WINDOW_MS > 0
+				|| !(dn_fsm_vars.caps & DN_MOTE_CAP_JOIN_ANY_NET_ID)))
 		{
 			// Promiscuous netID set; search for new first
 			dn_fsm_enterState(DN_FSM_STATE_PROMISCUOUS, 0);
+		} else
+		{
 			/*
 			 As of version 1.4.x, a network ID of 0xFFFF can be used to indicate
 			 that the mote should join the first network heard. Thus, searching
-			 before joining will not be necessary.
-			*/
-		} else
-		{
+			 before joining is skipped unless networks are to be ranked.
+			 */
 			dn_fsm_scheduleEvent(DN_CMD_PERIOD_MS, dn_event_setNetworkId);
 		}
 		break;
@@ -942,7 +1371,7 @@ static void dn_event_setNetworkId(void)
 	debug("Set network ID");
 
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_setNetworkId);
+	dn_fsm_setReplyCallback(dn_reply_setNetworkId, DN_QSL_CMD_SET_NETWORK_ID);
 
 	// Issue mote API command
 	dn_ipmt_setParameter_networkId
@@ -984,6 +1413,55 @@ static void dn_reply_setNetworkId(void)
 	}
 }
 
+//===== setJoinDutyCycle
+
+/**
+ Configures how much of the time the mote should listen for advertisements
+ while joining, as chosen on entering the joining state. The join follows
+ regardless of the reply, as the mote can still join at its own duty cycle.
+ */
+static void dn_event_setJoinDutyCycle(void)
+{
+	debug("Set join duty cycle");
+
+	// Arm reply callback
+	dn_fsm_setReplyCallback(dn_reply_setJoinDutyCycle, DN_QSL_CMD_SET_JOIN_DUTY_CYCLE);
+
+	// Issue mote API command
+	dn_ipmt_setParameter_joinDutyCycle
+			(
+			dn_fsm_vars.joinDutyCycle,
+			(dn_ipmt_setParameter_joinDutyCycle_rpt*)dn_fsm_vars.replyBuf
+			);
+
+	// Schedule timeout for reply
+	dn_fsm_scheduleEvent(DN_SERIAL_RESPONSE_TIMEOUT_MS, dn_event_responseTimeout);
+}
+
+static void dn_reply_setJoinDutyCycle(void)
+{
+	dn_ipmt_setParameter_joinDutyCycle_rpt* reply;
+	debug("Set join duty cycle reply");
+
+	// Cancel reply timeout
+	dn_fsm_cancelEvent();
+
+	// Parse reply
+	reply = (dn_ipmt_setParameter_joinDutyCycle_rpt*)dn_fsm_vars.replyBuf;
+
+	// Choose next event or state transition
+	switch (reply->RC)
+	{
+	case DN_RC_OK:
+		debug("Join duty cycle set to %u", dn_fsm_vars.joinDutyCycle);
+		break;
+	default:
+		log_warn("Unexpected response code: %#x", reply->RC);
+		break;
+	}
+	dn_fsm_scheduleEvent(DN_CMD_PERIOD_MS, dn_event_join);
+}
+
 //===== search
 
 /**
@@ -997,7 +1475,7 @@ static void dn_event_search(void)
 	debug("Search");
 
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_search);
+	dn_fsm_setReplyCallback(dn_reply_search, DN_QSL_CMD_SEARCH);
 
 	// Issue mote API command
 	dn_ipmt_search
@@ -1025,7 +1503,13 @@ static void dn_reply_search(void)
 	{
 	case DN_RC_OK:
 		debug("Searching for network advertisements");
-		// Will wait for notification of advertisement received
+		if (DN_PROMISCUOUS_SCAN_WINDOW_MS > 0)
+		{
+			// Rank all networks heard within the scan window
+			dn_fsm_vars.scanning = TRUE;
+			dn_fsm_scheduleEvent(DN_PROMISCUOUS_SCAN_WINDOW_MS, dn_event_scanComplete);
+		}
+		// Else wait for notification of advertisement received
 		break;
 	case DN_RC_INVALID_STATE:
 		debug("The mote is in an invalid state to start searching");
@@ -1038,6 +1522,36 @@ static void dn_reply_search(void)
 	}
 }
 
+//===== scanComplete
+
+/**
+ Ends the scan window by picking the best ranked network heard. If nothing was
+ heard, the mote keeps searching and a new window is started.
+ */
+static void dn_event_scanComplete(void)
+{
+	dn_candidate_net_t* best;
+
+	// Stop recording before reading the candidates
+	dn_fsm_vars.scanning = FALSE;
+	DN_MEMORY_BARRIER();
+
+	best = dn_candidate_best();
+	if (best == NULL)
+	{
+		debug("No networks heard; extending scan window");
+		dn_fsm_vars.scanning = TRUE;
+		dn_fsm_scheduleEvent(DN_PROMISCUOUS_SCAN_WINDOW_MS, dn_event_scanComplete);
+		return;
+	}
+
+	debug("Heard %u network(s); joining %#.4x (RSSI %d dBm, %u neighbors)",
+			dn_fsm_vars.numCandidates, best->netId, best->bestRssi, best->numNeighbors);
+	dn_fsm_vars.networkId = best->netId;
+	dn_fsm_vars.joinFails = 0;
+	dn_fsm_scheduleEvent(DN_CMD_PERIOD_MS, dn_event_setNetworkId);
+}
+
 //===== join
 
 /**
@@ -1052,7 +1566,7 @@ static void dn_event_join(void)
 	debug("Join");
 
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_join);
+	dn_fsm_setReplyCallback(dn_reply_join, DN_QSL_CMD_JOIN);
 
 	// Issue mote API command
 	dn_ipmt_join
@@ -1080,6 +1594,10 @@ static void dn_reply_join(void)
 	{
 	case DN_RC_OK:
 		debug("Join operation started");
+		dn_fsm_vars.joinTimed = TRUE;
+		dn_fsm_vars.joinStart_ms = dn_time_ms();
+		dn_fsm_vars.connectStats.joins++;
+		dn_fsm_vars.connectStats.joinDutyCycle = dn_fsm_vars.joinDutyCycle;
 		// Will wait for join complete notification (operational event)
 		break;
 	case DN_RC_INVALID_STATE:
@@ -1109,7 +1627,7 @@ static void dn_event_requestService(void)
 	debug("Request service");
 
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_requestService);
+	dn_fsm_setReplyCallback(dn_reply_requestService, DN_QSL_CMD_REQUEST_SERVICE);
 
 	// Issue mote API command
 	dn_ipmt_requestService
@@ -1161,7 +1679,7 @@ static void dn_event_getServiceInfo(void)
 	debug("Get service info");
 
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_getServiceInfo);
+	dn_fsm_setReplyCallback(dn_reply_getServiceInfo, DN_QSL_CMD_GET_SERVICE_INFO);
 
 	// Issue mote API command
 	dn_ipmt_getServiceInfo
@@ -1227,7 +1745,7 @@ static void dn_event_sendTo(void)
 	debug("Send");
 
 	// Arm reply callback
-	dn_fsm_setReplyCallback(dn_reply_sendTo);
+	dn_fsm_setReplyCallback(dn_reply_sendTo, DN_QSL_CMD_SEND_TO);
 
 	// Issue mote API command
 	err = dn_ipmt_sendTo
@@ -1245,6 +1763,7 @@ static void dn_event_sendTo(void)
 	if (err != DN_ERR_NONE)
 	{
 		debug("Send error: %u", err);
+		dn_fsm_vars.stats.sendFailsSerial++;
 		dn_fsm_enterState(DN_FSM_STATE_SEND_FAILED, 0);
 	}
 
@@ -1268,19 +1787,366 @@ static void dn_reply_sendTo(void)
 	{
 	case DN_RC_OK:
 		debug("Packet was queued up for transmission");
+		dn_fsm_vars.stats.sendsQueued++;
+		dn_fsm_vars.stats.bytesSent += dn_fsm_vars.payloadSize;
 		dn_fsm_enterState(DN_FSM_STATE_CONNECTED, 0);
 		break;
 	case DN_RC_NO_RESOURCES:
 		debug("No queue space to accept the packet");
+		dn_fsm_vars.stats.sendFailsRejected++;
 		dn_fsm_enterState(DN_FSM_STATE_SEND_FAILED, 0);
 		break;
 	default:
 		log_warn("Unexpected response code: %#x", reply->RC);
+		dn_fsm_vars.stats.sendFailsRejected++;
 		dn_fsm_enterState(DN_FSM_STATE_SEND_FAILED, 0);
 		break;
 	}
 }
 
+//===== getTime
+
+/**
+ Asks the mote for its current network time. As the mote samples its time at
+ some point between command and reply, the midpoint of the two is used as the
+ corresponding local time.
+ */
+static void dn_event_getTime(void)
+{
+	debug("Get time");
+
+	// Arm reply callback
+	dn_fsm_setReplyCallback(dn_reply_getTime, DN_QSL_CMD_GET_TIME);
+
+	// Issue mote API command
+	dn_fsm_vars.timeCmdStart_ms = dn_time_ms();
+	dn_fsm_vars.timeCmdStart_us = dn_time_us64();
+	dn_ipmt_getParameter_time
+			(
+			(dn_ipmt_getParameter_time_rpt*)dn_fsm_vars.replyBuf
+			);
+
+	// Schedule timeout for reply
+	dn_fsm_scheduleEvent(DN_SERIAL_RESPONSE_TIMEOUT_MS, dn_event_responseTimeout);
+}
+
+static void dn_reply_getTime(void)
+{
+	dn_ipmt_getParameter_time_rpt* reply;
+	uint32_t roundTrip_us = (uint32_t)(dn_time_us64() - dn_fsm_vars.timeCmdStart_us);
+	debug("Get time reply");
+
+	// Cancel reply timeout
+	dn_fsm_cancelEvent();
+
+	// Parse reply
+	reply = (dn_ipmt_getParameter_time_rpt*)dn_fsm_vars.replyBuf;
+
+	// Choose next event or state transition
+	switch (reply->RC)
+	{
+	case DN_RC_OK:
+		debug("Network time received after %u us", roundTrip_us);
+		dn_time_sync
+				(
+				dn_fsm_vars.timeCmdStart_ms + (roundTrip_us + 1000) / 2000, // Half the round trip, rounded to ms
+				reply->utcSecs,
+				reply->utcUsecs,
+				reply->asn,
+				reply->asnOffset
+				);
+		break;
+	default:
+		log_warn("Unexpected response code: %#x", reply->RC);
+		break;
+	}
+	dn_fsm_enterState(DN_FSM_STATE_CONNECTED, 0);
+}
+
+//========== Promiscuous search
+
+//===== record
+
+/**
+ Add an advertisement to the candidate table, updating the entry of its
+ network or, if the table is full, replacing the worst ranked entry if the new
+ network would rank better.
+ */
+static void dn_candidate_record(const dn_ipmt_advReceived_nt* adv)
+{
+	dn_candidate_net_t* candidate = NULL;
+	dn_candidate_net_t* worst = NULL;
+	uint8_t i;
+
+	for (i = 0; i < dn_fsm_vars.numCandidates; i++)
+	{
+		if (dn_fsm_vars.candidates[i].netId == adv->netId)
+		{
+			candidate = &dn_fsm_vars.candidates[i];
+			break;
+		}
+		if (worst == NULL || dn_candidate_score(&dn_fsm_vars.candidates[i]) < dn_candidate_score(worst))
+		{
+			worst = &dn_fsm_vars.candidates[i];
+		}
+	}
+
+	if (candidate == NULL)
+	{
+		if (dn_fsm_vars.numCandidates < DN_MAX_CANDIDATE_NETWORKS)
+		{
+			candidate = &dn_fsm_vars.candidates[dn_fsm_vars.numCandidates++];
+		} else if (adv->rssi > dn_candidate_score(worst))
+		{
+			candidate = worst;
+		} else
+		{
+			return;
+		}
+		memset(candidate, 0, sizeof (dn_candidate_net_t));
+		candidate->netId = adv->netId;
+		candidate->bestRssi = adv->rssi;
+		candidate->bestJoinPri = adv->joinPri;
+	}
+
+	if (adv->rssi > candidate->bestRssi)
+		candidate->bestRssi = adv->rssi;
+	if (adv->joinPri < candidate->bestJoinPri)
+		candidate->bestJoinPri = adv->joinPri;
+	for (i = 0; i < candidate->numNeighbors; i++)
+	{
+		if (candidate->neighbors[i] == adv->moteId)
+			return;
+	}
+	if (candidate->numNeighbors < DN_MAX_CANDIDATE_NEIGHBORS)
+	{
+		candidate->neighbors[candidate->numNeighbors++] = adv->moteId;
+	}
+}
+
+//===== score
+
+static int16_t dn_candidate_score(const dn_candidate_net_t* candidate)
+{
+	uint8_t extraNeighbors = (candidate->numNeighbors > 0) ? candidate->numNeighbors - 1 : 0;
+	return candidate->bestRssi + DN_NEIGHBOR_BONUS_DB * extraNeighbors;
+}
+
+//===== best
+
+/**
+ Return the best ranked candidate not yet failed, or NULL if none remains.
+ Ties are broken by the join priority heard (closer to the manager wins).
+ */
+static dn_candidate_net_t* dn_candidate_best(void)
+{
+	dn_candidate_net_t* best = NULL;
+	dn_candidate_net_t* candidate;
+	uint8_t i;
+
+	for (i = 0; i < dn_fsm_vars.numCandidates; i++)
+	{
+		candidate = &dn_fsm_vars.candidates[i];
+		if (candidate->failed)
+			continue;
+		if (best == NULL
+				|| dn_candidate_score(candidate) > dn_candidate_score(best)
+				|| (dn_candidate_score(candidate) == dn_candidate_score(best)
+				&& candidate->bestJoinPri < best->bestJoinPri))
+		{
+			best = candidate;
+		}
+	}
+	return best;
+}
+
+//===== fallback
+
+/**
+ Called on join failures. After repeated failures on a network selected by
+ ranking, the network is marked as failed and the next best one is configured
+ for the next join attempt. If none remains, the search starts over.
+ Returns TRUE if the mote should be reset to apply a new network ID.
+ */
+static bool dn_candidate_fallback(void)
+{
+	dn_candidate_net_t* candidate;
+	uint8_t i;
+
+	if (!dn_fsm_vars.promiscuous || dn_fsm_vars.numCandidates == 0)
+	{
+		// Network not chosen by ranking; let the mote keep trying
+		return FALSE;
+	}
+	if (++dn_fsm_vars.joinFails < DN_JOIN_FAILS_BEFORE_FALLBACK)
+	{
+		return FALSE;
+	}
+	dn_fsm_vars.joinFails = 0;
+
+	for (i = 0; i < dn_fsm_vars.numCandidates; i++)
+	{
+		if (dn_fsm_vars.candidates[i].netId == dn_fsm_vars.networkId)
+			dn_fsm_vars.candidates[i].failed = TRUE;
+	}
+
+	candidate = dn_candidate_best();
+	if (candidate != NULL)
+	{
+		log_warn("Join of network %#.4x failed; falling back to %#.4x",
+				dn_fsm_vars.networkId, candidate->netId);
+		dn_fsm_vars.networkId = candidate->netId;
+	} else
+	{
+		log_warn("Join failed for all networks heard; searching again");
+		dn_fsm_vars.numCandidates = 0;
+		dn_fsm_vars.networkId = DN_PROMISCUOUS_NET_ID;
+	}
+	return TRUE;
+}
+
+//========== Join duty cycle
+
+//===== dutyCycle
+
+/**
+ The duty cycle to join at: Halved for every DN_JOIN_FAILS_BEFORE_RELAX failed
+ attempts since the last successful join, but not below the configured floor.
+ If not configured, that of the mote.
+ */
+static uint8_t dn_join_dutyCycle(void)
+{
+	uint8_t halvings = dn_fsm_vars.failedJoins / DN_JOIN_FAILS_BEFORE_RELAX;
+	uint8_t dutyCycle = dn_fsm_vars.connectOpts.joinDutyCycle;
+
+	if (!dn_fsm_vars.connectOpts.setJoinDutyCycle)
+	{
+		return DN_JOIN_DUTY_CYCLE_MOTE_DEFAULT;
+	}
+	dutyCycle = halvings < 8 ? dutyCycle >> halvings : 0;
+	if (dutyCycle < dn_fsm_vars.connectOpts.minJoinDutyCycle)
+	{
+		dutyCycle = dn_fsm_vars.connectOpts.minJoinDutyCycle;
+	}
+	return dutyCycle;
+}
+
+//===== failed
+
+/**
+ Counts a failed join attempt, and returns TRUE if the mote should now join at
+ a lower duty cycle than the one under way.
+ */
+static bool dn_join_failed(void)
+{
+	if (dn_fsm_vars.failedJoins < 0xff)
+	{
+		dn_fsm_vars.failedJoins++;
+	}
+	dn_fsm_vars.connectStats.joinFails++;
+	return dn_join_dutyCycle() < dn_fsm_vars.joinDutyCycle;
+}
+
+//===== end
+
+/**
+ Adds the join under way to the connect stats. The mote is taken to listen for
+ (duty cycle + 1) / 256 of the time.
+ */
+static void dn_join_end(bool joined)
+{
+	dn_qsl_connect_stats_t* stats = &dn_fsm_vars.connectStats;
+	uint32_t elapsed_ms = dn_time_ms() - dn_fsm_vars.joinStart_ms; // Handle dn_time_ms wrap around
+	uint32_t listen_ms = (uint32_t)((uint64_t)elapsed_ms * (dn_fsm_vars.joinDutyCycle + 1) / 256);
+
+	dn_fsm_vars.joinTimed = FALSE;
+	stats->totalJoin_ms += elapsed_ms;
+	stats->totalJoinListen_ms += listen_ms;
+	if (joined)
+	{
+		dn_fsm_vars.failedJoins = 0;
+		stats->lastJoin_ms = elapsed_ms;
+		stats->lastJoinListen_ms = listen_ms;
+		stats->lastJoinCharge_uC = (uint32_t)((uint64_t)listen_ms * DN_MOTE_RX_CURRENT_UA / 1000); // ms x uA = nC
+		debug("Joined in %u ms, listening for about %u ms at duty cycle %u",
+				elapsed_ms, listen_ms, dn_fsm_vars.joinDutyCycle);
+	}
+}
+
+//========== Network time
+
+//===== sync
+
+/**
+ Store a new sync point. If the previous drift anchor is old enough, the
+ difference between elapsed network and local time since then gives a new
+ drift estimate, which is low-pass filtered into the current one.
+ */
+static void dn_time_sync(uint32_t local_ms, const uint8_t* utcSecs, uint32_t utcUsecs, const uint8_t* asn, uint16_t asnOffset)
+{
+	dn_time_sync_t* sync = &dn_fsm_vars.timeSync;
+	uint64_t utc_us = readUintBE(utcSecs, 8) * 1000000 + utcUsecs;
+	uint32_t baseline_ms = local_ms - sync->anchorLocal_ms; // Handle dn_time_ms wrap around
+	int64_t error_us;
+	int32_t drift_ppb;
+
+	sync->seq++;
+	DN_MEMORY_BARRIER();
+
+	if (!sync->valid || sync->stale)
+	{
+		// First sync or network time jumped; restart drift baseline
+		sync->anchorLocal_ms = local_ms;
+		sync->anchorUtc_us = utc_us;
+	} else if (baseline_ms >= DN_TIME_DRIFT_MIN_BASELINE_S * 1000)
+	{
+		error_us = (int64_t)(utc_us - sync->anchorUtc_us) - (int64_t)baseline_ms * 1000;
+		drift_ppb = (int32_t)(error_us * 1000000 / baseline_ms);
+		if (drift_ppb > DN_TIME_DRIFT_MAX_PPB || drift_ppb < -DN_TIME_DRIFT_MAX_PPB)
+		{
+			log_warn("Discarding drift estimate of %ld ppb", (long)drift_ppb);
+		} else if (!sync->driftValid)
+		{
+			sync->drift_ppb = drift_ppb;
+			sync->driftValid = TRUE;
+		} else
+		{
+			sync->drift_ppb += (drift_ppb - sync->drift_ppb) / (1 << DN_TIME_DRIFT_FILTER_SHIFT);
+		}
+		debug("Drift estimate: %ld ppb (filtered %ld ppb)", (long)drift_ppb, (long)sync->drift_ppb);
+		sync->anchorLocal_ms = local_ms;
+		sync->anchorUtc_us = utc_us;
+	}
+
+	sync->local_ms = local_ms;
+	sync->utc_us = utc_us;
+	sync->asn = readUintBE(asn, 5);
+	sync->asnOffset_us = asnOffset;
+	sync->valid = TRUE;
+	sync->stale = FALSE;
+
+	DN_MEMORY_BARRIER();
+	sync->seq++;
+}
+
+//===== snapshot
+
+/**
+ Take a consistent copy of the time mapping, retrying if an update from the
+ notification/reply context happened meanwhile.
+ */
+static void dn_time_snapshot(dn_time_sync_t* copy)
+{
+	uint8_t seq;
+	do
+	{
+		seq = dn_fsm_vars.timeSync.seq;
+		DN_MEMORY_BARRIER();
+		memcpy(copy, (const void*)&dn_fsm_vars.timeSync, sizeof (dn_time_sync_t));
+		DN_MEMORY_BARRIER();
+	} while ((seq & 1) || seq != dn_fsm_vars.timeSync.seq);
+}
+
 //=========================== helpers =========================================
 
 static dn_err_t checkAndSaveNetConfig(uint16_t netID, const uint8_t* joinKey, uint16_t srcPort, uint32_t req_service_ms)
@@ -1291,12 +2157,16 @@ static dn_err_t checkAndSaveNetConfig(uint16_t netID, const uint8_t* joinKey, ui
 		dn_fsm_vars.networkId = DN_DEFAULT_NET_ID;
 	} else if (netID == DN_PROMISCUOUS_NET_ID)
 	{
-		debug("Promiscuous network ID given; will search for and join first network advertised");
+		debug("Promiscuous network ID given; will search for and join best network advertised");
 		dn_fsm_vars.networkId = netID;
 	} else
 	{
 		dn_fsm_vars.networkId = netID;
 	}
+	dn_fsm_vars.promiscuous = (netID == DN_PROMISCUOUS_NET_ID);
+	dn_fsm_vars.scanning = FALSE;
+	dn_fsm_vars.numCandidates = 0;
+	dn_fsm_vars.joinFails = 0;
 
 	if (joinKey == NULL)
 	{
@@ -1325,27 +2195,64 @@ static dn_err_t checkAndSaveNetConfig(uint16_t netID, const uint8_t* joinKey, ui
 	return DN_ERR_NONE;
 }
 
+static uint64_t readUintBE(const uint8_t* from, uint8_t len)
+{
+	uint64_t val = 0;
+	uint8_t i;
+	for (i = 0; i < len; i++)
+	{
+		val = (val << 8) | from[i];
+	}
+	return val;
+}
+
 static uint8_t getPayloadLimit(uint16_t destPort)
 {
-	bool destIsF0Bx = (destPort >= DN_WELL_KNOWN_PORT_1 && destPort <= DN_WELL_KNOWN_PORT_8);
+	uint16_t port = (destPort > 0) ? destPort : DN_DEFAULT_DEST_PORT; // As sent by dn_qsl_send
+	bool destIsF0Bx = (port >= DN_WELL_KNOWN_PORT_1 && port <= DN_WELL_KNOWN_PORT_8);
 	bool srcIsF0Bx = (dn_fsm_vars.srcPort >= DN_WELL_KNOWN_PORT_1 && dn_fsm_vars.srcPort <= DN_WELL_KNOWN_PORT_8);
 	int8_t destIsMng = memcmp(DN_DEST_IP, DN_DEFAULT_DEST_IP, DN_IPv6ADDR_LEN);
+	uint8_t limit;
 
 	if (destIsMng == 0)
 	{
 		if (destIsF0Bx && srcIsF0Bx)
-			return DN_PAYLOAD_SIZE_LIMIT_MNG_HIGH;
+			limit = DN_PAYLOAD_SIZE_LIMIT_MNG_HIGH;
 		else if (destIsF0Bx || srcIsF0Bx)
-			return DN_PAYLOAD_SIZE_LIMIT_MNG_MED;
+			limit = DN_PAYLOAD_SIZE_LIMIT_MNG_MED;
 		else
-			return DN_PAYLOAD_SIZE_LIMIT_MNG_LOW;
+			limit = DN_PAYLOAD_SIZE_LIMIT_MNG_LOW;
 	} else
 	{
 		if (destIsF0Bx && srcIsF0Bx)
-			return DN_PAYLOAD_SIZE_LIMIT_IP_HIGH;
+			limit = DN_PAYLOAD_SIZE_LIMIT_IP_HIGH;
 		else if (destIsF0Bx || srcIsF0Bx)
-			return DN_PAYLOAD_SIZE_LIMIT_IP_MED;
+			limit = DN_PAYLOAD_SIZE_LIMIT_IP_MED;
 		else
-			return DN_PAYLOAD_SIZE_LIMIT_IP_LOW;
+			limit = DN_PAYLOAD_SIZE_LIMIT_IP_LOW;
+	}
+	// The payload buffer may have been configured shorter
+	return (limit < DN_DEFAULT_PAYLOAD_SIZE_LIMIT) ? limit : DN_DEFAULT_PAYLOAD_SIZE_LIMIT;
+}
+
+/**
+ Copy counters that are written from the UART context as well. As they only
+ increase, a copy that still agrees with them afterwards holds the values they
+ all had at the end of the copy. Returns FALSE if none did within
+ DN_STATS_SNAPSHOT_TRIES copies.
+ */
+static bool snapshotCounters(void* copy, const void* counters, uint16_t size)
+{
+	uint8_t tries;
+
+	for (tries = 0; tries < DN_STATS_SNAPSHOT_TRIES; tries++)
+	{
+		memcpy(copy, counters, size);
+		DN_MEMORY_BARRIER();
+		if (memcmp(copy, counters, size) == 0)
+		{
+			return TRUE;
+		}
 	}
+	return FALSE;
 }
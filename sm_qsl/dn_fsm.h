@@ -11,6 +11,7 @@ Finite State Machine for the QuickStart Library.
 
 #include "dn_common.h"
 #include "dn_defaults.h"
+#include "dn_hist.h"
 
 //=========================== defines =========================================
 
@@ -25,6 +26,7 @@ Finite State Machine for the QuickStart Library.
 #define DN_FSM_STATE_CONNECTED			0x0f
 #define DN_FSM_STATE_SENDING			0x10
 #define DN_FSM_STATE_SEND_FAILED		0x11
+#define DN_FSM_STATE_SYNCING_TIME		0x12
 
 //===== Mote states
 #define DN_MOTE_STATE_IDLE           0x01
@@ -44,6 +46,17 @@ Finite State Machine for the QuickStart Library.
 #define DN_MOTE_EVENT_MASK_SVC_CHANGE	0x0080
 #define DN_MOTE_EVENT_MASK_JOIN_STARTED	0x0100
 
+//===== Mote capabilities
+/*
+ Bitmap derived from the mote software version, read once after dn_qsl_init,
+ to let the FSM take the fastest path the firmware supports.
+ */
+#define DN_MOTE_CAP_NONE				0x00
+#define DN_MOTE_CAP_JOIN_ANY_NET_ID		0x01 // Network ID 0xFFFF joins the first network heard
+
+#define DN_MOTE_CAP_JOIN_ANY_NET_ID_MIN_MAJOR	1 // Supported as of version 1.4.x
+#define DN_MOTE_CAP_JOIN_ANY_NET_ID_MIN_MINOR	4
+
 //===== Mote response codes
 #define DN_RC_OK					0x00
 #define DN_RC_ERROR					0x01
@@ -64,12 +77,25 @@ Finite State Machine for the QuickStart Library.
 #define DN_RC_ERASE_FAIL			0x12
 
 //===== Timing
-#define DN_FSM_RUN_INTERVAL_MS			10 // Decides how often to kick the FSM
+#ifndef DN_FSM_MAX_IDLE_MS
+#define DN_FSM_MAX_IDLE_MS				1000 // Longest the FSM sleeps while nothing is due (watchdog is fed in between)
+#endif
 #define DN_MIN_TX_INTERPACKET_DELAY_MS	20 // Minimum delay between each packet sent to the mote (according to LTC5800-IPM spec)
-#define DN_CMD_PERIOD_MS				DN_MIN_TX_INTERPACKET_DELAY_MS * 5 // Delay between each command sent to mote
+#ifndef DN_CMD_PERIOD_MS
+#define DN_CMD_PERIOD_MS				(DN_MIN_TX_INTERPACKET_DELAY_MS * 5) // Delay between each command sent to mote
+#endif
+#ifndef DN_SERIAL_RESPONSE_TIMEOUT_MS
 #define DN_SERIAL_RESPONSE_TIMEOUT_MS	500 // Very conservative; commands are expected to be answered within 125 ms
+#endif
+#ifndef DN_CONNECT_TIMEOUT_S
 #define DN_CONNECT_TIMEOUT_S			180 // Usually takes 10-60 s, but service req. and promiscuous search can add 60 s each.
+#endif
+#ifndef DN_SEND_TIMEOUT_MS
 #define DN_SEND_TIMEOUT_MS				1000 // Usually takes < 20 ms
+#endif
+#ifndef DN_TIME_SYNC_TIMEOUT_MS
+#define DN_TIME_SYNC_TIMEOUT_MS			1000 // A single getParameter<time>; usually takes < 20 ms
+#endif
 
 //===== Connect
 #define DN_PROTOCOL_TYPE_UDP	0x00 // Only currently supported protocol type
@@ -80,6 +106,28 @@ Finite State Machine for the QuickStart Library.
 #define DN_SERVICE_STATE_COMPLETED	0x00
 #define DN_SERVICE_STATE_PENDING	0x01
 
+//===== Join duty cycle
+/*
+ Share of time the mote listens for advertisements while joining, from 0
+ (0.2 %) to 255 (100 %). Listening at full duty cycle cuts the time to join
+ several-fold, but a mote out of range of any network, or with a wrong join
+ key, would keep its receiver on for nothing; the duty cycle is thus halved
+ after repeated failures. See dn_qsl_setConnectOptions.
+ */
+#define DN_JOIN_DUTY_CYCLE_MOTE_DEFAULT	64 // Used by the mote unless set
+#ifndef DN_JOIN_DUTY_CYCLE_FIRST
+#define DN_JOIN_DUTY_CYCLE_FIRST		255
+#endif
+#ifndef DN_JOIN_DUTY_CYCLE_MIN
+#define DN_JOIN_DUTY_CYCLE_MIN			32
+#endif
+#ifndef DN_JOIN_FAILS_BEFORE_RELAX
+#define DN_JOIN_FAILS_BEFORE_RELAX		2 // Failed join attempts per halving
+#endif
+#ifndef DN_MOTE_RX_CURRENT_UA
+#define DN_MOTE_RX_CURRENT_UA			4500 // LTC5800-IPM receiver; for the charge estimates in the connect stats
+#endif
+
 //===== Send
 #define DN_PACKET_PRIORITY_LOW		0x00
 #define DN_PACKET_PRIORITY_MEDIUM	0x01 // Recommended for data traffic
@@ -87,8 +135,79 @@ Finite State Machine for the QuickStart Library.
 
 #define DN_PACKET_ID_NO_NOTIF	0xffff // Do not generate txDone notification
 
+//===== Promiscuous search
+/*
+ When joining with DN_PROMISCUOUS_NET_ID, advertisements are gathered for the
+ scan window before the advertising networks are ranked by the best RSSI heard,
+ plus a bonus for each additional neighbor advertising the same network. The
+ best network is joined, falling back to the next one if joining it fails
+ repeatedly. A window of 0 joins the first network heard.
+ */
+#ifndef DN_PROMISCUOUS_SCAN_WINDOW_MS
+#define DN_PROMISCUOUS_SCAN_WINDOW_MS	0
+#endif
+#ifndef DN_MAX_CANDIDATE_NETWORKS
+#define DN_MAX_CANDIDATE_NETWORKS		4
+#endif
+#ifndef DN_MAX_CANDIDATE_NEIGHBORS
+#define DN_MAX_CANDIDATE_NEIGHBORS		8 // Distinct advertising motes tracked per network
+#endif
+#ifndef DN_NEIGHBOR_BONUS_DB
+#define DN_NEIGHBOR_BONUS_DB			2 // Score added per additional neighbor
+#endif
+#ifndef DN_JOIN_FAILS_BEFORE_FALLBACK
+#define DN_JOIN_FAILS_BEFORE_FALLBACK	2 // joinFail events before trying the next network
+#endif
+
+//===== Network time
+#ifndef DN_TIME_SYNC_PERIOD_S
+#define DN_TIME_SYNC_PERIOD_S			600 // Max age of the time mapping before a new getParameter<time> is issued
+#endif
+#ifndef DN_TIME_DRIFT_MIN_BASELINE_S
+#define DN_TIME_DRIFT_MIN_BASELINE_S	60 // Min time between sync points used to estimate drift (ms resolution gives < 17 ppm error)
+#endif
+#ifndef DN_TIME_DRIFT_MAX_PPB
+#define DN_TIME_DRIFT_MAX_PPB			500000 // Estimates beyond +/- 500 ppm are treated as bogus
+#endif
+#ifndef DN_TIME_DRIFT_FILTER_SHIFT
+#define DN_TIME_DRIFT_FILTER_SHIFT		2 // New drift estimates are weighted by 1 / 2^shift
+#endif
+#define DN_ASN_SLOT_US					7250 // Duration of one SmartMesh IP timeslot
+
 //===== Read
-#define DN_INBOX_SIZE	10 // Max number of buffered downstream messages
+#ifndef DN_INBOX_SIZE
+#define DN_INBOX_SIZE	10 // Max number of buffered downstream messages (max 127)
+#endif
+
+//===== Concurrency
+/*
+ The inbox is a single-producer/single-consumer queue: Notifications push to it
+ from whatever context the UART feeds the HDLC layer (an interrupt on the MCU
+ ports, the read daemon on Linux), while dn_qsl_read pops from the main loop.
+ DN_MEMORY_BARRIER (see dn_defaults.h) orders the slot contents against the
+ index that publishes them.
+ */
+
+//===== Stats
+#ifndef DN_STATS_SNAPSHOT_TRIES
+#define DN_STATS_SNAPSHOT_TRIES	4 // Copies of the counters dn_qsl_getStats makes before giving up
+#endif
+
+//===== Serial latency
+/*
+ The time from issuing each command to its reply is recorded in a log-linear
+ histogram per command (see dn_hist.h and dn_qsl_getLatency), in units of
+ DN_LATENCY_UNIT_US; the last bin ends past DN_SERIAL_RESPONSE_TIMEOUT_MS. The
+ histograms take DN_QSL_NUM_CMDS * (2 * DN_HIST_NUM_BINS + 8) bytes of RAM,
+ 1.5 KB by default, so they are only kept on hosted builds unless
+ DN_LATENCY_HIST is set; fewer DN_HIST_NUM_BINS shrink them too.
+ */
+#ifndef DN_LATENCY_HIST
+#define DN_LATENCY_HIST		DN_HOSTED
+#endif
+#ifndef DN_LATENCY_UNIT_US
+#define DN_LATENCY_UNIT_US	64 // A power of two
+#endif
 
 //===== Reset/disconnect
 /*
@@ -96,22 +215,85 @@ Finite State Machine for the QuickStart Library.
  its imminent software reset. It does, however, take much longer:
  About 20 seconds for disconnect vs 5 seconds for reset only.
  */
+#ifndef DN_MOTE_DISCONNECT_BEFORE_RESET
 #define DN_MOTE_DISCONNECT_BEFORE_RESET FALSE
+#endif
+
+//===== C Library buffers
+/*
+ The C Library writes the replies of the mote into a buffer of this size,
+ which must hold the largest reply the FSM asks for (checked in dn_fsm.c).
+ Notifications get a whole MAX_FRAME_LENGTH, as a received packet can fill a
+ frame regardless of DN_DEFAULT_PAYLOAD_SIZE_LIMIT.
+ */
+#ifndef DN_REPLY_BUF_LEN
+#define DN_REPLY_BUF_LEN	MAX_FRAME_LENGTH
+#endif
+
+//===== Configuration checks
+DN_STATIC_ASSERT(DN_INBOX_SIZE >= 1 && DN_INBOX_SIZE <= 127, inbox_size_1_to_127);
+DN_STATIC_ASSERT(DN_CMD_PERIOD_MS >= DN_MIN_TX_INTERPACKET_DELAY_MS, cmd_period_at_least_interpacket_delay);
+DN_STATIC_ASSERT(DN_CMD_PERIOD_MS <= 0xffff && DN_PROMISCUOUS_SCAN_WINDOW_MS <= 0xffff, fsm_delays_fit_16_bits);
+DN_STATIC_ASSERT(DN_FSM_MAX_IDLE_MS > 0, fsm_max_idle_positive);
+DN_STATIC_ASSERT(DN_SEND_TIMEOUT_MS >= DN_SERIAL_RESPONSE_TIMEOUT_MS
+		&& DN_TIME_SYNC_TIMEOUT_MS >= DN_SERIAL_RESPONSE_TIMEOUT_MS, cmd_timeouts_cover_serial_response_timeout);
+DN_STATIC_ASSERT((uint32_t)DN_CONNECT_TIMEOUT_S * 1000 > DN_PROMISCUOUS_SCAN_WINDOW_MS, connect_timeout_covers_scan_window);
+DN_STATIC_ASSERT(DN_JOIN_DUTY_CYCLE_MIN <= DN_JOIN_DUTY_CYCLE_FIRST && DN_JOIN_DUTY_CYCLE_FIRST <= 255, join_duty_cycles_in_order);
+DN_STATIC_ASSERT(DN_JOIN_FAILS_BEFORE_RELAX >= 1, join_fails_before_relax_positive);
+DN_STATIC_ASSERT(DN_MAX_CANDIDATE_NETWORKS >= 1 && DN_MAX_CANDIDATE_NETWORKS <= 255
+		&& DN_MAX_CANDIDATE_NEIGHBORS >= 1 && DN_MAX_CANDIDATE_NEIGHBORS <= 255, candidates_fit_8_bits);
+DN_STATIC_ASSERT(DN_TIME_DRIFT_FILTER_SHIFT < 31, drift_filter_shift_below_31);
+DN_STATIC_ASSERT(DN_LATENCY_UNIT_US > 0 && (DN_LATENCY_UNIT_US & (DN_LATENCY_UNIT_US - 1)) == 0, latency_unit_power_of_two);
+DN_STATIC_ASSERT(DN_STATS_SNAPSHOT_TRIES >= 1, stats_snapshot_tries_positive);
 
 //=========================== typedef =========================================
 
 typedef void (*dn_fsm_timer_cbt)(void);
 typedef void (*dn_fsm_reply_cbt)(void);
 
+/*
+ Head and tail run from 0 to (2 * DN_INBOX_SIZE - 1), so that a full and an
+ empty inbox can be told apart without a shared counter. Only the consumer
+ writes head and only the producer writes tail; a packet arriving to a full
+ inbox is therefore dropped (newest lost) rather than overwriting the oldest.
+ */
 typedef struct
 {
 	uint8_t pktBuf[DN_INBOX_SIZE][DN_DEFAULT_PAYLOAD_SIZE_LIMIT];
 	uint8_t pktSize[DN_INBOX_SIZE];
-	uint8_t head;
-	uint8_t tail;
-	uint8_t unreadPackets;
+	volatile uint8_t head;
+	volatile uint8_t tail;
 } dn_inbox_t;
 
+typedef struct
+{
+	uint16_t netId;
+	int8_t bestRssi;
+	uint8_t bestJoinPri; // Lower is closer to the manager
+	uint8_t numNeighbors;
+	uint16_t neighbors[DN_MAX_CANDIDATE_NEIGHBORS];
+	bool failed;
+} dn_candidate_net_t;
+
+/*
+ Mapping from local time to network time. Written from the notification/reply
+ context and read from the main loop; seq is odd while an update is ongoing.
+ */
+typedef struct
+{
+	volatile uint8_t seq;
+	bool valid;
+	bool stale; // Time change event seen; resync at next opportunity
+	uint32_t local_ms; // Local time of the sync point
+	uint64_t utc_us; // Network UTC at the sync point
+	uint64_t asn; // Network ASN at the sync point
+	uint16_t asnOffset_us; // Offset into the timeslot at the sync point
+	int32_t drift_ppb; // Network clock rate relative to local clock, minus one
+	uint32_t anchorLocal_ms; // Older sync point used as drift estimation baseline
+	uint64_t anchorUtc_us;
+	bool driftValid;
+} dn_time_sync_t;
+
 //=========================== variables =======================================
 
 //=========================== prototypes ======================================
@@ -0,0 +1,370 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Span-based implementation of the HDLC module (dn_hdlc.h in the C Library).
+
+Instead of one callback per received byte, the UART hands over spans
+(see dn_uart_span.h). Runs of bytes up to the next flag or escape are found
+with a lookup table, or a word or SIMD vector at a time on hosts, and are then
+copied and run through the FCS in one pass. Outgoing frames are collected
+unescaped, then encoded in one pass into a contiguous buffer that is handed
+to the UART as a whole (dn_uart_txSpan), ready for DMA or a single write().
+
+To use, build this file instead of dn_hdlc.c from the C Library (e.g. with
+HDLC=qsl in the Raspberry Pi simple_makefile). The UART port must implement
+dn_uart_span.h.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include "dn_hdlc.h"
+#include "dn_hdlc_span.h"
+#include "dn_uart.h"
+#include "dn_uart_span.h"
+#include "dn_fcs.h"
+#include "dn_trace.h"
+#include "dn_capture.h"
+
+//=========================== defines =========================================
+
+#define DN_HDLC_FCS_LEN		2
+
+//===== Scanning for flag and escape bytes
+#define DN_HDLC_SCAN_TABLE	0 // Lookup table, one byte at a time (any target)
+#define DN_HDLC_SCAN_WORD	1 // Eight bytes at a time with bit tricks (64-bit little-endian hosts)
+#define DN_HDLC_SCAN_SSE2	2 // Sixteen bytes at a time (x86 hosts)
+
+#ifndef DN_HDLC_SCAN
+#if defined(__SSE2__)
+#define DN_HDLC_SCAN	DN_HDLC_SCAN_SSE2
+#elif defined(__linux__) && defined(__LP64__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define DN_HDLC_SCAN	DN_HDLC_SCAN_WORD
+#else
+#define DN_HDLC_SCAN	DN_HDLC_SCAN_TABLE
+#endif
+#endif
+
+#if DN_HDLC_SCAN == DN_HDLC_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	dn_hdlc_rxFrame_cbt rxFrame_cb;
+	// Input
+	uint8_t inputBuf[DN_HDLC_MAX_FRAME_LENGTH];
+	uint8_t inputBufFill;
+	uint16_t inputFcs;
+	bool busyReceiving;
+	bool inputEscaping;
+	bool inputOverflow;
+	bool lastRxByteFlag;
+	// Output
+	uint8_t outputBuf[DN_HDLC_MAX_FRAME_LENGTH];
+	uint8_t outputBufFill;
+	bool outputOverflow;
+	uint8_t txBuf[DN_HDLC_ENCODED_MAX_LEN(DN_HDLC_MAX_FRAME_LENGTH)];
+} dn_hdlc_vars_t;
+
+static dn_hdlc_vars_t dn_hdlc_vars;
+
+// Bytes that end a run of ordinary bytes in the input
+static const uint8_t dn_hdlc_special[256] = {
+	[DN_HDLC_FLAG] = 1,
+	[DN_HDLC_ESCAPE] = 1,
+};
+
+//=========================== prototypes ======================================
+
+static void dn_hdlc_rxSpan(const uint8_t* data, uint16_t len);
+static void dn_hdlc_inputOpen(void);
+static void dn_hdlc_inputWrite(const uint8_t* data, uint16_t len);
+static void dn_hdlc_inputClose(void);
+// helpers
+static uint16_t runLength(const uint8_t* data, uint16_t len);
+static uint16_t escapeInto(const uint8_t* data, uint16_t len, uint8_t* out, uint16_t fill, uint16_t* fcs);
+
+//=========================== public ==========================================
+
+void dn_hdlc_init(dn_hdlc_rxFrame_cbt rxFrame_cb)
+{
+	memset(&dn_hdlc_vars, 0, sizeof (dn_hdlc_vars));
+	dn_hdlc_vars.rxFrame_cb = rxFrame_cb;
+	dn_fcs_init();
+	dn_uart_initSpan(dn_hdlc_rxSpan);
+}
+
+//===== output
+
+void dn_hdlc_outputOpen(void)
+{
+	dn_hdlc_vars.outputBufFill = 0;
+	dn_hdlc_vars.outputOverflow = FALSE;
+}
+
+void dn_hdlc_outputWrite(uint8_t b)
+{
+	// Collected as is; escaping and FCS are done on close
+	if (dn_hdlc_vars.outputBufFill == DN_HDLC_MAX_FRAME_LENGTH)
+	{
+		dn_hdlc_vars.outputOverflow = TRUE;
+		return;
+	}
+	dn_hdlc_vars.outputBuf[dn_hdlc_vars.outputBufFill++] = b;
+}
+
+void dn_hdlc_outputClose(void)
+{
+	uint16_t len;
+
+	if (dn_hdlc_vars.outputOverflow)
+	{
+		// Never sent; the mote would reject a truncated frame anyway
+		return;
+	}
+	len = dn_hdlc_encode
+			(
+			dn_hdlc_vars.outputBuf,
+			dn_hdlc_vars.outputBufFill,
+			dn_hdlc_vars.txBuf,
+			sizeof (dn_hdlc_vars.txBuf)
+			);
+	// The command ID follows the control byte
+	dn_trace(HDLC_TX, dn_hdlc_vars.outputBuf[1], dn_hdlc_vars.outputBufFill);
+	dn_capture(DN_CAPTURE_TO_MOTE, dn_hdlc_vars.outputBuf, dn_hdlc_vars.outputBufFill);
+	dn_uart_txSpan(dn_hdlc_vars.txBuf, len);
+}
+
+uint16_t dn_hdlc_encode(const uint8_t* frame, uint16_t len, uint8_t* out, uint16_t outSize)
+{
+	uint16_t fcs = DN_HDLC_CRCINIT;
+	uint8_t fcsBytes[DN_HDLC_FCS_LEN];
+	uint16_t fill = 0;
+
+	if (outSize < DN_HDLC_ENCODED_MAX_LEN(len))
+	{
+		return 0;
+	}
+
+	out[fill++] = DN_HDLC_FLAG;
+	fill = escapeInto(frame, len, out, fill, &fcs);
+
+	// FCS is sent least significant byte first
+	fcs = ~fcs;
+	fcsBytes[0] = (uint8_t)fcs;
+	fcsBytes[1] = (uint8_t)(fcs >> 8);
+	fill = escapeInto(fcsBytes, DN_HDLC_FCS_LEN, out, fill, NULL);
+
+	out[fill++] = DN_HDLC_FLAG;
+	return fill;
+}
+
+//=========================== private =========================================
+
+/**
+ Parse received bytes. A frame opens on the first non-flag byte after a flag,
+ and closes on the next flag.
+ */
+static void dn_hdlc_rxSpan(const uint8_t* data, uint16_t len)
+{
+	const uint8_t* flag;
+	uint16_t run;
+	uint8_t b;
+
+	while (len > 0)
+	{
+		if (!dn_hdlc_vars.busyReceiving)
+		{
+			if (!dn_hdlc_vars.lastRxByteFlag)
+			{
+				// Hunt for a flag
+				flag = memchr(data, DN_HDLC_FLAG, len);
+				if (flag == NULL)
+				{
+					return;
+				}
+				len -= flag + 1 - data;
+				data = flag + 1;
+				dn_hdlc_vars.lastRxByteFlag = TRUE;
+				continue;
+			}
+			if (*data == DN_HDLC_FLAG)
+			{
+				// Repeated flags
+				data++;
+				len--;
+				continue;
+			}
+			dn_hdlc_inputOpen();
+		}
+
+		// Copy the run of ordinary bytes, unescaping its first if needed
+		run = runLength(data, len);
+		if (run > 0 && dn_hdlc_vars.inputEscaping)
+		{
+			b = *data ^ DN_HDLC_ESCAPE_MASK;
+			dn_hdlc_inputWrite(&b, 1);
+			dn_hdlc_vars.inputEscaping = FALSE;
+			data++;
+			len--;
+			run--;
+		}
+		dn_hdlc_inputWrite(data, run);
+		data += run;
+		len -= run;
+		if (len == 0)
+		{
+			return;
+		}
+
+		// Handle the flag or escape ending the run
+		if (*data == DN_HDLC_ESCAPE)
+		{
+			dn_hdlc_vars.inputEscaping = TRUE;
+		} else
+		{
+			dn_hdlc_inputClose();
+		}
+		data++;
+		len--;
+	}
+}
+
+static void dn_hdlc_inputOpen(void)
+{
+	dn_hdlc_vars.busyReceiving = TRUE;
+	dn_hdlc_vars.inputBufFill = 0;
+	dn_hdlc_vars.inputFcs = DN_HDLC_CRCINIT;
+	dn_hdlc_vars.inputEscaping = FALSE;
+	dn_hdlc_vars.inputOverflow = FALSE;
+	dn_hdlc_vars.lastRxByteFlag = FALSE;
+}
+
+/**
+ Append unescaped bytes to the input frame, and run them through the FCS.
+ */
+static void dn_hdlc_inputWrite(const uint8_t* data, uint16_t len)
+{
+	if (len == 0 || dn_hdlc_vars.inputOverflow)
+	{
+		return;
+	}
+	if (len > DN_HDLC_MAX_FRAME_LENGTH - dn_hdlc_vars.inputBufFill)
+	{
+		// Frame too long; drop it when it closes
+		dn_hdlc_vars.inputOverflow = TRUE;
+		return;
+	}
+	memcpy(&dn_hdlc_vars.inputBuf[dn_hdlc_vars.inputBufFill], data, len);
+	dn_hdlc_vars.inputBufFill += len;
+	dn_hdlc_vars.inputFcs = dn_fcs_update(dn_hdlc_vars.inputFcs, data, len);
+}
+
+static void dn_hdlc_inputClose(void)
+{
+	dn_hdlc_vars.busyReceiving = FALSE;
+	dn_hdlc_vars.lastRxByteFlag = TRUE;
+
+	// Pass on frames that fit and check out, without their FCS
+	if (!dn_hdlc_vars.inputOverflow
+			&& dn_hdlc_vars.inputBufFill > DN_HDLC_FCS_LEN
+			&& dn_hdlc_vars.inputFcs == DN_HDLC_CRCGOOD)
+	{
+		dn_trace(HDLC_RX, dn_hdlc_vars.inputBuf[1], dn_hdlc_vars.inputBufFill - DN_HDLC_FCS_LEN);
+		dn_capture(0, dn_hdlc_vars.inputBuf, dn_hdlc_vars.inputBufFill - DN_HDLC_FCS_LEN);
+		dn_hdlc_vars.rxFrame_cb(dn_hdlc_vars.inputBuf, dn_hdlc_vars.inputBufFill - DN_HDLC_FCS_LEN);
+	} else
+	{
+		dn_trace(HDLC_RX_ERROR, dn_hdlc_vars.inputBufFill, dn_hdlc_vars.inputOverflow);
+		dn_capture(DN_CAPTURE_BAD, dn_hdlc_vars.inputBuf, dn_hdlc_vars.inputBufFill);
+	}
+}
+
+//=========================== helpers =========================================
+
+/**
+ Number of bytes before the first flag or escape byte (len if none).
+ */
+static uint16_t runLength(const uint8_t* data, uint16_t len)
+{
+	uint16_t n = 0;
+
+#if DN_HDLC_SCAN == DN_HDLC_SCAN_SSE2
+	const __m128i flag = _mm_set1_epi8((char)DN_HDLC_FLAG);
+	const __m128i escape = _mm_set1_epi8((char)DN_HDLC_ESCAPE);
+	__m128i v;
+	int mask;
+
+	for (; n + 16 <= len; n += 16)
+	{
+		v = _mm_loadu_si128((const __m128i*)&data[n]);
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, flag), _mm_cmpeq_epi8(v, escape)));
+		if (mask != 0)
+		{
+			return n + __builtin_ctz(mask);
+		}
+	}
+#elif DN_HDLC_SCAN == DN_HDLC_SCAN_WORD
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t highs = 0x8080808080808080ULL;
+	uint64_t w;
+	uint64_t x;
+	uint64_t y;
+	uint64_t mask;
+
+	for (; n + 8 <= len; n += 8)
+	{
+		memcpy(&w, &data[n], sizeof (w));
+		// A byte of x (or y) is zero where data holds a flag (or escape)
+		x = w ^ (ones * DN_HDLC_FLAG);
+		y = w ^ (ones * DN_HDLC_ESCAPE);
+		mask = ((x - ones) & ~x & highs) | ((y - ones) & ~y & highs);
+		if (mask != 0)
+		{
+			// Exact for the lowest matching byte, which comes first in memory
+			return n + (__builtin_ctzll(mask) >> 3);
+		}
+	}
+#endif
+
+	// Table for the remainder (or everything, on small targets)
+	while (n < len && !dn_hdlc_special[data[n]])
+	{
+		n++;
+	}
+	return n;
+}
+
+/**
+ Append escaped bytes to out, starting at fill, and optionally run them
+ through the FCS on the way. Runs of ordinary bytes are copied whole.
+
+ \return The new fill of out.
+ */
+static uint16_t escapeInto(const uint8_t* data, uint16_t len, uint8_t* out, uint16_t fill, uint16_t* fcs)
+{
+	uint16_t run;
+
+	while (len > 0)
+	{
+		run = runLength(data, len);
+		memcpy(&out[fill], data, run);
+		fill += run;
+		if (fcs != NULL)
+		{
+			// Include the special byte ending the run, if any
+			*fcs = dn_fcs_update(*fcs, data, (run < len) ? run + 1 : run);
+		}
+		data += run;
+		len -= run;
+		if (len > 0)
+		{
+			out[fill++] = DN_HDLC_ESCAPE;
+			out[fill++] = *data++ ^ DN_HDLC_ESCAPE_MASK;
+			len--;
+		}
+	}
+	return fill;
+}
@@ -0,0 +1,50 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Additions of the span-based HDLC module (dn_hdlc_span.c) to the HDLC API of
+the C Library (dn_hdlc.h).
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_HDLC_SPAN_H
+#define DN_HDLC_SPAN_H
+
+#include "dn_common.h"
+#include "dn_hdlc.h"
+
+//=========================== defines =========================================
+
+/*
+ Buffer size needed to encode a frame of len bytes: Worst case, every byte of
+ the frame and its 2-byte FCS is escaped, and the frame is wrapped in flags.
+ */
+#define DN_HDLC_ENCODED_MAX_LEN(len)	(2 * ((len) + 2) + 2)
+
+//=========================== typedef =========================================
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Encode a frame in a single pass: Opening flag, escaped content, escaped
+ FCS and closing flag.
+
+ \param frame The unescaped frame content.
+ \param len Byte size of the frame content.
+ \param out Where to write the encoded frame.
+ \param outSize Capacity of out; DN_HDLC_ENCODED_MAX_LEN(len) always suffices.
+ \return The byte size of the encoded frame, or 0 if it did not fit.
+ */
+uint16_t dn_hdlc_encode(const uint8_t* frame, uint16_t len, uint8_t* out, uint16_t outSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_HDLC_SPAN_H */
@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Log-linear histograms for the QuickStart Library.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include "dn_hist.h"
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+static uint8_t dn_hist_bin(uint32_t value);
+static uint32_t dn_hist_binMax(uint8_t bin);
+
+//=========================== public ==========================================
+
+void dn_hist_record(dn_hist_t* hist, uint32_t value)
+{
+	uint8_t bin = dn_hist_bin(value);
+	uint8_t i;
+
+	if (hist->bins[bin] == 0xffff)
+	{
+		for (i = 0; i < DN_HIST_NUM_BINS; i++)
+		{
+			hist->bins[i] >>= 1;
+		}
+	}
+	hist->bins[bin]++;
+	hist->count++;
+	if (value > hist->max)
+	{
+		hist->max = value;
+	}
+}
+
+uint32_t dn_hist_percentile(const dn_hist_t* hist, uint8_t percent)
+{
+	uint32_t total = 0;
+	uint32_t rank;
+	uint32_t seen = 0;
+	uint32_t bound;
+	uint8_t i;
+
+	for (i = 0; i < DN_HIST_NUM_BINS; i++)
+	{
+		total += hist->bins[i];
+	}
+	if (total == 0)
+	{
+		return 0;
+	}
+
+	// Smallest bin that has at least percent of the values at or below it
+	rank = (total * percent + 99) / 100;
+	for (i = 0; i < DN_HIST_NUM_BINS - 1; i++)
+	{
+		seen += hist->bins[i];
+		if (seen >= rank)
+		{
+			break;
+		}
+	}
+	bound = dn_hist_binMax(i);
+	return (i == DN_HIST_NUM_BINS - 1 || bound > hist->max) ? hist->max : bound;
+}
+
+//=========================== private =========================================
+
+/**
+ Bins 0 to DN_HIST_SUB_COUNT - 1 hold their own value. Above, the bin is given
+ by the position of the most significant bit, and the DN_HIST_SUB_BITS bits
+ below it.
+ */
+static uint8_t dn_hist_bin(uint32_t value)
+{
+	uint8_t shift;
+	uint32_t bin;
+
+	if (value < DN_HIST_SUB_COUNT)
+	{
+		return value;
+	}
+	shift = 31 - __builtin_clz(value) - DN_HIST_SUB_BITS;
+	bin = ((uint32_t)(shift + 1) << DN_HIST_SUB_BITS) | ((value >> shift) & (DN_HIST_SUB_COUNT - 1));
+	return bin < DN_HIST_NUM_BINS ? bin : DN_HIST_NUM_BINS - 1;
+}
+
+static uint32_t dn_hist_binMax(uint8_t bin)
+{
+	uint8_t shift;
+
+	if (bin < DN_HIST_SUB_COUNT)
+	{
+		return bin;
+	}
+	shift = (bin >> DN_HIST_SUB_BITS) - 1;
+	return (((uint32_t)(DN_HIST_SUB_COUNT | (bin & (DN_HIST_SUB_COUNT - 1))) + 1) << shift) - 1;
+}
+
+//=========================== helpers =========================================
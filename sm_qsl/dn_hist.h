@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Log-linear histograms for the QuickStart Library.
+
+Values below DN_HIST_SUB_COUNT have a bin each; above, every power of two is
+split into DN_HIST_SUB_COUNT bins, so that the width of a bin stays within
+1 / DN_HIST_SUB_COUNT of the values in it, whatever their magnitude. Values
+beyond the last bin land in it, while the exact maximum is kept aside.
+
+Recording is a few shifts and an increment. Should a bin be about to overflow,
+all bins are halved first, which keeps the shape while weighting it towards
+recent values. Meant to be written from a single context; a reader in another
+context may see a recording half done, which is of no consequence to the
+percentiles.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_HIST_H
+#define DN_HIST_H
+
+#include "dn_common.h"
+#include "dn_defaults.h"
+
+//=========================== defines =========================================
+
+#define DN_HIST_SUB_BITS	2
+#define DN_HIST_SUB_COUNT	(1 << DN_HIST_SUB_BITS)
+#ifndef DN_HIST_NUM_BINS
+#define DN_HIST_NUM_BINS	48 // Up to 2^(48 / DN_HIST_SUB_COUNT + 1) = 8192
+#endif
+
+//=========================== typedef =========================================
+
+typedef struct
+{
+	uint16_t bins[DN_HIST_NUM_BINS];
+	uint32_t count; // Values recorded, before any halving
+	uint32_t max;
+} dn_hist_t;
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Record a value.
+ */
+void dn_hist_record(dn_hist_t* hist, uint32_t value);
+
+/**
+ \brief Get a percentile.
+ \param percent 1 to 100.
+ \return The upper bound of the bin holding the percentile, but no more than
+ the maximum recorded; 0 if nothing was recorded.
+ */
+uint32_t dn_hist_percentile(const dn_hist_t* hist, uint8_t percent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_HIST_H */
@@ -16,8 +16,103 @@ QuickStart Library API.
 
 #define DN_DEST_IP	DN_DEFAULT_DEST_IP
 
+//===== Stats
+// Commands the FSM issues to the mote, to count response timeouts by
+#define DN_QSL_CMD_RESET				0
+#define DN_QSL_CMD_DISCONNECT			1
+#define DN_QSL_CMD_GET_MOTE_STATUS		2
+#define DN_QSL_CMD_GET_MOTE_INFO		3
+#define DN_QSL_CMD_OPEN_SOCKET			4
+#define DN_QSL_CMD_BIND_SOCKET			5
+#define DN_QSL_CMD_SET_JOIN_KEY			6
+#define DN_QSL_CMD_SET_NETWORK_ID		7
+#define DN_QSL_CMD_SET_JOIN_DUTY_CYCLE	8
+#define DN_QSL_CMD_SEARCH				9
+#define DN_QSL_CMD_JOIN					10
+#define DN_QSL_CMD_REQUEST_SERVICE		11
+#define DN_QSL_CMD_GET_SERVICE_INFO		12
+#define DN_QSL_CMD_SEND_TO				13
+#define DN_QSL_CMD_GET_TIME				14
+#define DN_QSL_NUM_CMDS					15
+
+// Replies are counted by response code (DN_RC_* in dn_fsm.h); any above the last known share the last counter
+#define DN_QSL_NUM_RC					0x14
+
 //=========================== typedef =========================================
 
+/*
+ How the mote searches for a network; see dn_qsl_setConnectOptions.
+ */
+typedef struct
+{
+	bool setJoinDutyCycle; // FALSE leaves the mote's own setting alone
+	uint8_t joinDutyCycle; // First join attempt: 0 (0.2 %) to 255 (100 %) of the time listening
+	uint8_t minJoinDutyCycle; // Floor when relaxing after failed attempts
+} dn_qsl_connect_opts_t;
+
+/*
+ Counters since dn_qsl_init. The listening time is estimated from the join
+ duty cycle, and the charge from that and DN_MOTE_RX_CURRENT_UA.
+ */
+typedef struct
+{
+	uint32_t connects; // Connect processes started
+	uint32_t connected; // Connect processes that succeeded
+	uint32_t lastConnect_ms; // Time to connected of the last that succeeded
+	uint32_t joins; // Join operations started
+	uint32_t joinFails; // joinFail events, and connects timed out while joining
+	uint8_t joinDutyCycle; // Of the join under way, or of the last one
+	uint32_t lastJoin_ms; // Join started until operational, for the last successful join
+	uint32_t lastJoinListen_ms; // Estimated time spent listening over the same
+	uint32_t lastJoinCharge_uC; // Estimated charge drawn by the receiver over the same
+	uint32_t totalJoin_ms; // Over all joins, successful or not
+	uint32_t totalJoinListen_ms;
+} dn_qsl_connect_stats_t;
+
+/*
+ Counters since dn_qsl_init, for monitoring a fleet. They only ever increase;
+ see dn_qsl_getStats. Connect processes are counted in dn_qsl_connect_stats_t.
+ */
+typedef struct
+{
+	// Send
+	uint32_t sends; // dn_qsl_send calls
+	uint32_t sendsQueued; // Packets accepted by the mote for transmission
+	uint32_t bytesSent; // Payload bytes of the same
+	uint32_t sendFailsNotConnected;
+	uint32_t sendFailsTooLong; // Payload over the limit for the destination
+	uint32_t sendFailsRejected; // Refused by the mote, e.g. for lack of queue space
+	uint32_t sendFailsSerial; // Command could not be handed to the serial link
+	uint32_t sendFailsTimeout; // Mote did not reply in time
+	// Receive
+	uint32_t packetsReceived;
+	uint32_t bytesReceived; // Payload bytes of the same, including dropped packets
+	uint32_t inboxOverflows; // Packets dropped for a full inbox
+	// Serial commands
+	uint32_t commands; // Commands issued to the mote
+	uint32_t replies[DN_QSL_NUM_RC]; // Replies by response code
+	uint32_t rspTimeouts[DN_QSL_NUM_CMDS]; // Response timeouts by command (DN_QSL_CMD_*)
+	uint32_t cmdTimeouts; // Connects, sends and time syncs that ran out of time
+	// Connection
+	uint32_t resets; // Resets and disconnects issued to the mote
+	uint32_t boots; // Boot events from the mote, whether issued or not
+	uint32_t connectionsLost; // Mote reset or disconnected while connected
+} dn_qsl_stats_t;
+
+/*
+ Round trip of a command to the mote, from issuing it to its reply. The
+ percentiles are the upper bounds of the histogram bins holding them, within
+ a quarter of the value (see dn_hist.h).
+ */
+typedef struct
+{
+	uint32_t count; // Replies timed
+	uint32_t timeouts; // Replies that never came; not part of the percentiles
+	uint32_t p50_us;
+	uint32_t p99_us;
+	uint32_t max_us;
+} dn_qsl_latency_t;
+
 //=========================== variables =======================================
 
 //=========================== prototypes ======================================
@@ -50,6 +145,19 @@ bool dn_qsl_init(void);
 bool dn_qsl_isConnected(void);
 
 
+//===== getState
+
+/**
+ \brief Return the current state of the FSM, one of DN_FSM_STATE_* in dn_fsm.h.
+ 
+ Meant for monitoring; safe to call from any thread, as the state is a single
+ byte.
+ 
+ \return The FSM state.
+ */
+uint8_t dn_qsl_getState(void);
+
+
 //===== connect
 
 /**
@@ -70,6 +178,76 @@ bool dn_qsl_isConnected(void);
 bool dn_qsl_connect(uint16_t netID, const uint8_t* joinKey, uint16_t srcPort, uint32_t service_ms);
 
 
+//===== setConnectOptions
+
+/**
+ \brief Set how the mote searches for a network on subsequent connects.
+ 
+ The join duty cycle is the share of time the mote listens for advertisements
+ while joining: Higher joins faster, but costs more energy. When set, the first
+ join attempt after dn_qsl_init, and after each successful join, listens at
+ joinDutyCycle. Every DN_JOIN_FAILS_BEFORE_RELAX failed attempts halve it, down
+ to minJoinDutyCycle, and the mote is reset to join at the lower duty cycle.
+ Set both equal for a fixed duty cycle.
+ 
+ dn_qsl_init restores the defaults (DN_JOIN_DUTY_CYCLE_FIRST and
+ DN_JOIN_DUTY_CYCLE_MIN).
+ 
+ \param opts The options, copied.
+ */
+void dn_qsl_setConnectOptions(const dn_qsl_connect_opts_t* opts);
+
+
+//===== getConnectStats
+
+/**
+ \brief Get the connect counters, to weigh time to join against energy spent.
+ 
+ Copied as dn_qsl_getStats does, as joinFail events arrive from the context
+ feeding the UART.
+ 
+ \param stats Pointer to where the counters are copied.
+ \return FALSE if the copy may be torn; see dn_qsl_getStats.
+ */
+bool dn_qsl_getConnectStats(dn_qsl_connect_stats_t* stats);
+
+
+//===== getStats
+
+/**
+ \brief Get a snapshot of the counters.
+ 
+ The counters are written with plain increments, some of them from the
+ context feeding the UART; they are copied until the copy and the counters
+ agree, which makes the snapshot consistent as of a single point in time.
+ Under a constant stream of notifications it may give up after
+ DN_STATS_SNAPSHOT_TRIES attempts.
+ 
+ \param stats Pointer to where the counters are copied.
+ \return FALSE if the copy may be torn, i.e. counters may be from different
+ points in time; each is still valid on its own.
+ */
+bool dn_qsl_getStats(dn_qsl_stats_t* stats);
+
+
+//===== getLatency
+
+/**
+ \brief Get the round-trip latency of a command to the mote since dn_qsl_init.
+ 
+ Meant for setting tight timeouts from measurements; see dn_fsm.h.
+ 
+ The histogram is copied as the counters of dn_qsl_getStats are. Built
+ without DN_LATENCY_HIST (see dn_fsm.h), only the timeouts are counted.
+ 
+ \param cmd The command, one of DN_QSL_CMD_*.
+ \param latency Pointer to where the summary is written.
+ \return FALSE if the command is unknown, or if the histogram may have been
+ torn by a reply timed while it was copied.
+ */
+bool dn_qsl_getLatency(uint8_t cmd, dn_qsl_latency_t* latency);
+
+
 //===== send
 
 /**
@@ -90,6 +268,21 @@ bool dn_qsl_connect(uint16_t netID, const uint8_t* joinKey, uint16_t srcPort, ui
 bool dn_qsl_send(const uint8_t* payload, uint8_t payloadSize_B, uint16_t destPort);
 
 
+//===== getPayloadLimit
+
+/**
+ \brief Get the longest payload dn_qsl_send accepts for a destination port.
+ 
+ The limit depends on whether the source and destination ports are among the
+ well-known ports, which compress best inside the mesh, and on the destination
+ address; it is never above DN_DEFAULT_PAYLOAD_SIZE_LIMIT.
+ 
+ \param destPort The destination port (default if 0).
+ \return The payload limit in bytes.
+ */
+uint8_t dn_qsl_getPayloadLimit(uint16_t destPort);
+
+
 //===== read
 
 /**
@@ -104,6 +297,36 @@ bool dn_qsl_send(const uint8_t* payload, uint8_t payloadSize_B, uint16_t destPor
  */
 uint8_t dn_qsl_read(uint8_t* readBuffer);
 
+
+//===== networkTime
+
+/**
+ \brief Get the current network time (UTC) in microseconds.
+ 
+ The QSL keeps a mapping from local time to network time, fed by the
+ timeIndication notification and by asking the mote for its time. Between
+ sync points, the network time is extrapolated from the local clock while
+ correcting for its estimated drift. If connected and the mapping is older than
+ DN_TIME_SYNC_PERIOD_S (or the network time has changed), the mote is first
+ asked for a new sync point, blocking for up to DN_TIME_SYNC_TIMEOUT_MS.
+ 
+ \return Microseconds since 1970-01-01 UTC, or 0 if the network time is unknown.
+ */
+uint64_t dn_qsl_networkTime_us(void);
+
+
+//===== networkAsn
+
+/**
+ \brief Get the current network Absolute Slot Number.
+ 
+ Extrapolated from the same mapping as dn_qsl_networkTime_us, which should be
+ called first to keep the mapping fresh.
+ 
+ \return The current ASN, or 0 if the network time is unknown.
+ */
+uint64_t dn_qsl_networkAsn(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Hooks into the internals of the QuickStart Library, for the host tools that
+exercise them directly (tools/test, tools/bench).
+
+They exist only when the library is built with DN_QSL_HOOKS set to 1, which no
+port does; applications should stick to dn_qsl_api.h.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_QSL_HOOKS_H
+#define DN_QSL_HOOKS_H
+
+#include "dn_common.h"
+
+//=========================== defines =========================================
+
+#ifndef DN_QSL_HOOKS
+#define DN_QSL_HOOKS	0
+#endif
+
+//=========================== typedef =========================================
+
+typedef void (*dn_qsl_hook_event_cbt)(void);
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#if DN_QSL_HOOKS
+
+/**
+ \brief Push a downstream packet into the inbox, as a receive notification
+ does from the context feeding the UART data.
+
+ The producer side of the inbox; dn_qsl_read is the consumer. A packet that
+ finds the inbox full, or is too long, is dropped and counted in
+ dn_qsl_stats_t.inboxOverflows.
+
+ \return A boolean indicating if the packet was queued.
+ */
+bool dn_qsl_hook_inboxPush(const uint8_t* payload, uint8_t size);
+
+/**
+ \brief Schedule an event of the FSM and have the FSM run it.
+
+ The event is scheduled as the FSM schedules its own, made due at once, and
+ run by a single pass of the FSM loop, which does not sleep as it is due. Any
+ event the FSM had scheduled is replaced, so only call this while connected
+ and idle.
+ */
+void dn_qsl_hook_dispatchEvent(dn_qsl_hook_event_cbt cb);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_QSL_HOOKS_H */
@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Single-producer/single-consumer byte ring for the QuickStart Library.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include "dn_ring.h"
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+//=========================== public ==========================================
+
+bool dn_ring_init(dn_ring_t* ring, uint8_t* buf, uint16_t size)
+{
+	if (size == 0 || size > DN_RING_MAX_SIZE || (size & (size - 1)) != 0)
+	{
+		return FALSE;
+	}
+	ring->buf = buf;
+	ring->mask = size - 1;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->overruns = 0;
+	return TRUE;
+}
+
+uint16_t dn_ring_count(const dn_ring_t* ring)
+{
+	// Unsigned arithmetic handles wrap around of the free running indices
+	uint16_t count = ring->head - ring->tail;
+
+	// Past an overrun, only a buffer full is left to read
+	return (count > ring->mask + 1) ? ring->mask + 1 : count;
+}
+
+uint16_t dn_ring_free(const dn_ring_t* ring)
+{
+	return (uint16_t)(ring->mask + 1 - dn_ring_count(ring));
+}
+
+uint16_t dn_ring_overruns(const dn_ring_t* ring)
+{
+	return ring->overruns;
+}
+
+uint16_t dn_ring_write(dn_ring_t* ring, const uint8_t* data, uint16_t len)
+{
+	uint16_t head = ring->head;
+	uint16_t offset = head & ring->mask;
+	uint16_t firstLen;
+
+	if (len > dn_ring_free(ring))
+	{
+		len = dn_ring_free(ring);
+	}
+
+	// Copy up to the end of the buffer, then the rest from the start
+	firstLen = ring->mask + 1 - offset;
+	if (firstLen > len)
+	{
+		firstLen = len;
+	}
+	memcpy(&ring->buf[offset], data, firstLen);
+	memcpy(ring->buf, &data[firstLen], len - firstLen);
+
+	// Publish bytes only after they are in place
+	DN_MEMORY_BARRIER();
+	ring->head = head + len;
+	return len;
+}
+
+bool dn_ring_commit(dn_ring_t* ring, uint16_t len)
+{
+	bool intact = TRUE;
+
+	if (len > dn_ring_free(ring))
+	{
+		// The writer does not wait; the head still moves on with it
+		ring->overruns++;
+		intact = FALSE;
+	}
+	DN_MEMORY_BARRIER();
+	ring->head += len;
+	return intact;
+}
+
+uint16_t dn_ring_readSpan(dn_ring_t* ring, const uint8_t** span)
+{
+	uint16_t head = ring->head;
+	uint16_t count;
+	uint16_t offset;
+	uint16_t toEnd;
+
+	if ((uint16_t)(head - ring->tail) > ring->mask + 1)
+	{
+		// Overrun: the oldest unread bytes are gone, skip to those left
+		ring->tail = head - (ring->mask + 1);
+	}
+	count = head - ring->tail;
+	offset = ring->tail & ring->mask;
+	toEnd = ring->mask + 1 - offset;
+
+	// Read head before the bytes it publishes
+	DN_MEMORY_BARRIER();
+	*span = &ring->buf[offset];
+	return (count < toEnd) ? count : toEnd;
+}
+
+void dn_ring_consume(dn_ring_t* ring, uint16_t len)
+{
+	// Finish reading bytes before handing their space back
+	DN_MEMORY_BARRIER();
+	ring->tail += len;
+}
+
+uint16_t dn_ring_read(dn_ring_t* ring, uint8_t* data, uint16_t maxLen)
+{
+	const uint8_t* span;
+	uint16_t spanLen;
+	uint16_t copied = 0;
+
+	while (copied < maxLen && (spanLen = dn_ring_readSpan(ring, &span)) > 0)
+	{
+		if (spanLen > maxLen - copied)
+		{
+			spanLen = maxLen - copied;
+		}
+		memcpy(&data[copied], span, spanLen);
+		dn_ring_consume(ring, spanLen);
+		copied += spanLen;
+	}
+	return copied;
+}
+
+//=========================== private =========================================
+
+//=========================== helpers =========================================
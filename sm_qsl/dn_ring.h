@@ -0,0 +1,125 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Single-producer/single-consumer byte ring for the QuickStart Library.
+
+The producer either copies data in (dn_ring_write), or writes the buffer
+directly, e.g. by DMA, and then commits the number of bytes written. The
+consumer reads contiguous spans in place, so that they can be handed on
+without copying. Producer and consumer may run in different contexts (an
+interrupt and the main loop) without locking.
+
+A direct writer such as a DMA channel does not wait for the consumer, and may
+overwrite bytes not read yet. dn_ring_commit counts such overruns, and the
+consumer then resumes at the oldest byte still in the buffer.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_RING_H
+#define DN_RING_H
+
+#include "dn_common.h"
+#include "dn_defaults.h"
+
+//=========================== defines =========================================
+
+#define DN_RING_MAX_SIZE	0x8000 // Largest power of two the 16-bit indices allow
+
+//=========================== typedef =========================================
+
+typedef struct
+{
+	uint8_t* buf;
+	uint16_t mask;			// Size of buffer minus one; size is a power of two
+	volatile uint16_t head;	// Free running; only written by the producer
+	volatile uint16_t tail;	// Free running; only written by the consumer
+	volatile uint16_t overruns;	// Commits past unread bytes; only written by the producer
+} dn_ring_t;
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Initialize an empty ring on top of the given buffer.
+
+ \param ring The ring to initialize.
+ \param buf The buffer to store bytes in.
+ \param size Byte size of the buffer; a power of two up to DN_RING_MAX_SIZE.
+ \return A boolean indicating if the size was valid.
+ */
+bool dn_ring_init(dn_ring_t* ring, uint8_t* buf, uint16_t size);
+
+/**
+ \brief Get the number of bytes available to the consumer.
+ */
+uint16_t dn_ring_count(const dn_ring_t* ring);
+
+/**
+ \brief Get the number of bytes the producer can add.
+ */
+uint16_t dn_ring_free(const dn_ring_t* ring);
+
+/**
+ \brief Get the number of overruns counted by dn_ring_commit.
+ */
+uint16_t dn_ring_overruns(const dn_ring_t* ring);
+
+/**
+ \brief Copy bytes into the ring (producer).
+
+ \return The number of bytes copied, which is less than len if the ring fills.
+ */
+uint16_t dn_ring_write(dn_ring_t* ring, const uint8_t* data, uint16_t len);
+
+/**
+ \brief Publish bytes the producer wrote into the buffer directly.
+
+ The bytes must have been written at the positions following the head, e.g.
+ by a DMA channel in circular mode over the same buffer. The length counts
+ every byte written since the last commit, even when the writer went around
+ the buffer: more than dn_ring_free means unread bytes were overwritten.
+
+ \param ring The ring the bytes were written to.
+ \param len The number of bytes written, less than the buffer size beyond
+ the free space.
+ \return A boolean indicating if no unread byte was lost; if one was, the
+ overrun is counted.
+ */
+bool dn_ring_commit(dn_ring_t* ring, uint16_t len);
+
+/**
+ \brief Get the longest contiguous span of readable bytes (consumer).
+
+ The span stays valid until it is consumed. If the readable bytes wrap around
+ the end of the buffer, a second call after consuming returns the rest. After
+ an overrun, bytes that were overwritten before being read are skipped.
+
+ \param ring The ring to read from.
+ \param span Set to point at the first readable byte.
+ \return The number of bytes in the span (0 if the ring is empty).
+ */
+uint16_t dn_ring_readSpan(dn_ring_t* ring, const uint8_t** span);
+
+/**
+ \brief Release bytes that have been read (consumer).
+ */
+void dn_ring_consume(dn_ring_t* ring, uint16_t len);
+
+/**
+ \brief Copy bytes out of the ring and consume them (consumer).
+
+ \return The number of bytes copied.
+ */
+uint16_t dn_ring_read(dn_ring_t* ring, uint8_t* data, uint16_t maxLen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_RING_H */
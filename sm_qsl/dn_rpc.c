@@ -0,0 +1,157 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Opcode dispatch of downstream commands for the QuickStart Library.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include "dn_rpc.h"
+#include "dn_qsl_api.h"
+#include "dn_time.h"
+#define DN_LOG_MODULE	DN_LOG_FSM
+#include "dn_debug.h"
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	dn_rpc_handler_cbt handlers[DN_RPC_NUM_OPCODES];
+	dn_rpc_stats_t stats[DN_RPC_NUM_OPCODES];
+	uint16_t replyPort;
+	uint8_t rxBuf[DN_DEFAULT_PAYLOAD_SIZE_LIMIT];
+	uint8_t txBuf[DN_DEFAULT_PAYLOAD_SIZE_LIMIT];
+} dn_rpc_vars_t;
+
+static dn_rpc_vars_t dn_rpc_vars;
+
+//=========================== prototypes ======================================
+
+static bool sendReply(uint8_t opcode, uint8_t corrId, uint8_t status, uint8_t dataLen);
+
+//=========================== public ==========================================
+
+void dn_rpc_init(uint16_t replyPort)
+{
+	memset(&dn_rpc_vars, 0, sizeof (dn_rpc_vars));
+	dn_rpc_vars.replyPort = replyPort;
+}
+
+bool dn_rpc_register(uint8_t opcode, dn_rpc_handler_cbt handler)
+{
+	if (opcode >= DN_RPC_NUM_OPCODES)
+	{
+		log_warn("Opcode %u exceeds dispatch table (%u)", opcode, DN_RPC_NUM_OPCODES);
+		return FALSE;
+	}
+	dn_rpc_vars.handlers[opcode] = handler;
+	return TRUE;
+}
+
+bool dn_rpc_dispatch(const uint8_t* payload, uint8_t payloadSize_B)
+{
+	uint64_t start_us = dn_time_us64();
+	uint32_t latency_us;
+	dn_rpc_handler_cbt handler = NULL;
+	dn_rpc_stats_t* stats;
+	uint8_t opcode;
+	uint8_t corrId;
+	uint8_t status;
+	uint8_t replyCapacity;
+	uint8_t replyLen;
+	bool sent;
+
+	if (payloadSize_B < DN_RPC_REQ_HEADER_LEN)
+	{
+		log_warn("Dropped malformed request of %u bytes", payloadSize_B);
+		return FALSE;
+	}
+	opcode = payload[0];
+	corrId = payload[1];
+
+	// Direct table lookup; anything out of range is treated as unregistered
+	if (opcode < DN_RPC_NUM_OPCODES)
+	{
+		handler = dn_rpc_vars.handlers[opcode];
+	}
+	if (handler == NULL)
+	{
+		debug("No handler for opcode %u", opcode);
+		sendReply(opcode, corrId, DN_RPC_RC_UNKNOWN_OPCODE, 0);
+		return FALSE;
+	}
+
+	// What dn_qsl_send will accept for the reply port, rather than the buffer size
+	replyCapacity = dn_qsl_getPayloadLimit(dn_rpc_vars.replyPort) - DN_RPC_REPLY_HEADER_LEN;
+	replyLen = replyCapacity;
+	status = handler
+			(
+			&payload[DN_RPC_REQ_HEADER_LEN],
+			payloadSize_B - DN_RPC_REQ_HEADER_LEN,
+			&dn_rpc_vars.txBuf[DN_RPC_REPLY_HEADER_LEN],
+			&replyLen
+			);
+	if (replyLen > replyCapacity)
+	{
+		log_warn("Handler for opcode %u overran reply buffer", opcode);
+		replyLen = replyCapacity;
+	}
+	sent = sendReply(opcode, corrId, status, replyLen);
+
+	// Service latency covers handler execution and the upstream reply
+	latency_us = (uint32_t)(dn_time_us64() - start_us);
+	stats = &dn_rpc_vars.stats[opcode];
+	stats->requests++;
+	if (status != DN_RPC_RC_OK || !sent)
+	{
+		stats->failures++;
+	}
+	stats->lastLatency_us = latency_us;
+	stats->sumLatency_us += latency_us;
+	if (latency_us > stats->maxLatency_us)
+	{
+		stats->maxLatency_us = latency_us;
+	}
+	debug("Opcode %u (corrId %u) served in %u us", opcode, corrId, latency_us);
+
+	return sent;
+}
+
+uint8_t dn_rpc_poll(void)
+{
+	uint8_t dispatched = 0;
+	uint8_t bytesRead;
+
+	while ((bytesRead = dn_qsl_read(dn_rpc_vars.rxBuf)) > 0)
+	{
+		dn_rpc_dispatch(dn_rpc_vars.rxBuf, bytesRead);
+		dispatched++;
+	}
+	return dispatched;
+}
+
+bool dn_rpc_getStats(uint8_t opcode, dn_rpc_stats_t* stats)
+{
+	if (opcode >= DN_RPC_NUM_OPCODES)
+	{
+		return FALSE;
+	}
+	memcpy(stats, &dn_rpc_vars.stats[opcode], sizeof (dn_rpc_stats_t));
+	return TRUE;
+}
+
+//=========================== private =========================================
+
+/**
+ Prepend the reply header to the data already written into the TX buffer and
+ send it upstream.
+ */
+static bool sendReply(uint8_t opcode, uint8_t corrId, uint8_t status, uint8_t dataLen)
+{
+	dn_rpc_vars.txBuf[0] = opcode;
+	dn_rpc_vars.txBuf[1] = corrId;
+	dn_rpc_vars.txBuf[2] = status;
+	return dn_qsl_send(dn_rpc_vars.txBuf, DN_RPC_REPLY_HEADER_LEN + dataLen, dn_rpc_vars.replyPort);
+}
+
+//=========================== helpers =========================================
@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Opcode dispatch of downstream commands for the QuickStart Library.
+
+Downstream payloads are interpreted as requests on the form
+[opcode | correlation ID | arguments...], and are routed through a direct
+table to the handler registered for the opcode. The reply of the handler is
+sent back upstream as [opcode | correlation ID | status | data...], allowing
+the manager-side application to match it with the original request.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_RPC_H
+#define DN_RPC_H
+
+#include "dn_common.h"
+#include "dn_defaults.h"
+
+//=========================== defines =========================================
+
+#define DN_RPC_NUM_OPCODES	32 // Size of the dispatch table; opcodes 0 to (DN_RPC_NUM_OPCODES - 1) are valid
+#define DN_RPC_REQ_HEADER_LEN	2 // Opcode and correlation ID
+#define DN_RPC_REPLY_HEADER_LEN	3 // Opcode, correlation ID and status
+#define DN_RPC_MAX_REPLY_LEN	(DN_DEFAULT_PAYLOAD_SIZE_LIMIT - DN_RPC_REPLY_HEADER_LEN) // Reply buffer; handlers get less for ports outside the well-known range
+
+DN_STATIC_ASSERT(DN_DEFAULT_PAYLOAD_SIZE_LIMIT > DN_RPC_REPLY_HEADER_LEN, payload_size_limit_holds_rpc_reply);
+
+//===== Reply status
+#define DN_RPC_RC_OK				0x00
+#define DN_RPC_RC_ERROR				0x01 // Generic handler failure
+#define DN_RPC_RC_UNKNOWN_OPCODE	0xfe // No handler registered for opcode
+
+//=========================== typedef =========================================
+
+/**
+ \brief Handler for a single opcode.
+
+ \param args Pointer to the arguments following the request header.
+ \param argsLen Byte size of the arguments.
+ \param reply Pointer to where the reply data should be written.
+ \param replyLen In: capacity of the reply buffer, i.e. what dn_qsl_send accepts
+ for the reply port less the reply header. Out: bytes written.
+ \return Status to send back with the reply (DN_RPC_RC_OK on success).
+ */
+typedef uint8_t (*dn_rpc_handler_cbt)(const uint8_t* args, uint8_t argsLen, uint8_t* reply, uint8_t* replyLen);
+
+typedef struct
+{
+	uint32_t requests;		// Number of requests dispatched to the handler
+	uint32_t failures;		// Number of non-OK statuses or failed reply sends
+	uint32_t lastLatency_us;	// Service latency of the last request
+	uint32_t maxLatency_us;	// Worst service latency observed
+	uint64_t sumLatency_us;	// Accumulated latency; divide by requests for mean
+} dn_rpc_stats_t;
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Clear the dispatch table and statistics.
+
+ \param replyPort The destination port replies are sent to (default if 0).
+ */
+void dn_rpc_init(uint16_t replyPort);
+
+/**
+ \brief Register (or with NULL, unregister) the handler of an opcode.
+
+ \return A boolean indicating if the opcode fits in the dispatch table.
+ */
+bool dn_rpc_register(uint8_t opcode, dn_rpc_handler_cbt handler);
+
+/**
+ \brief Dispatch a single request and send its reply upstream.
+
+ Useful for applications that read the inbox themselves. A request too short
+ to hold an opcode and a correlation ID cannot be answered, and is dropped.
+
+ \return A boolean indicating if a handler was found and its reply sent.
+ */
+bool dn_rpc_dispatch(const uint8_t* payload, uint8_t payloadSize_B);
+
+/**
+ \brief Drain the inbox, dispatching every request in it.
+
+ Should be called frequently, as the time a request spends in the inbox adds
+ directly to the round trip seen by the manager.
+
+ \return The number of requests dispatched.
+ */
+uint8_t dn_rpc_poll(void);
+
+/**
+ \brief Get a copy of the service statistics for an opcode.
+
+ \return A boolean indicating if the opcode fits in the dispatch table.
+ */
+bool dn_rpc_getStats(uint8_t opcode, dn_rpc_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_RPC_H */
@@ -24,6 +24,32 @@ Copyright (c) 2016, Dust Networks. All rights reserved.
 uint32_t dn_time_ms(void);
 void dn_sleep_ms(uint32_t milliseconds);
 
+/**
+ \brief Get the time in us on a monotonic clock that, for all practical
+ purposes, never wraps around.
+
+ Meant for measuring intervals, e.g. latencies; subtract two readings. The
+ resolution depends on the port, and the epoch is unrelated to dn_time_ms().
+ */
+uint64_t dn_time_us64(void);
+
+/**
+ \brief Sleep until dn_time_ms() reaches the deadline, or until woken early by
+ data from the mote, in the deepest sleep mode the port can wake up from.
+
+ May return early for other reasons as well; callers check what they are
+ waiting for and sleep again.
+ */
+void dn_sleep_until(uint32_t deadline_ms);
+
+/**
+ \brief End an ongoing or the next dn_sleep_until early.
+
+ Called by the uart port, from its RX context, after handing on bytes
+ received from the mote.
+ */
+void dn_sleep_wake(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Binary trace ring for the QuickStart Library.
+
+A record is claimed with dn_atomic_fetchInc on the head, so that the main loop
+and the UART context never share a slot.
+
+A record being written carries the sequence number of the next slot, which is
+never expected in its own, so a copy taken meanwhile can tell it is torn.
+dn_trace_copy reads the sequence number before and after the rest of each
+record, as a reader that is not halted with the writers has to.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <string.h>
+
+#include "dn_trace.h"
+#include "dn_time.h"
+
+//=========================== defines =========================================
+
+#if DN_TRACE_SIZE < 2 || (DN_TRACE_SIZE & (DN_TRACE_SIZE - 1)) != 0
+#error "DN_TRACE_SIZE must be a power of two, 2 or more"
+#endif
+
+// Sequence number of a slot while its record for index is written or copied torn
+#define DN_TRACE_SEQ_INVALID(index)	((uint16_t)((index) + 1))
+
+//=========================== variables =======================================
+
+#if DN_TRACE
+dn_trace_ring_t dn_trace_ring = {.magic = DN_TRACE_MAGIC, .version = DN_TRACE_VERSION, .size = DN_TRACE_SIZE};
+#endif
+
+//=========================== prototypes ======================================
+
+//=========================== public ==========================================
+
+void dn_trace_record(uint16_t id, uint32_t arg0, uint32_t arg1)
+{
+#if DN_TRACE
+	uint32_t index = dn_atomic_fetchInc(&dn_trace_ring.head);
+	dn_trace_rec_t* rec = &dn_trace_ring.recs[index & (DN_TRACE_SIZE - 1)];
+
+	rec->seq = DN_TRACE_SEQ_INVALID(index);
+	DN_MEMORY_BARRIER(); // Invalidate the slot before the contents change
+	rec->ts_us = (uint32_t)dn_time_us64();
+	rec->id = id;
+	rec->arg0 = arg0;
+	rec->arg1 = arg1;
+	DN_MEMORY_BARRIER(); // Publish the contents before the sequence number
+	rec->seq = (uint16_t)index;
+#endif
+}
+
+const uint8_t* dn_trace_get(uint32_t* size)
+{
+#if DN_TRACE
+	*size = sizeof (dn_trace_ring);
+	return (const uint8_t*)&dn_trace_ring;
+#else
+	*size = 0;
+	return NULL;
+#endif
+}
+
+uint32_t dn_trace_copy(dn_trace_ring_t* copy)
+{
+#if DN_TRACE
+	const dn_trace_rec_t* rec;
+	dn_trace_rec_t* dst;
+	uint32_t index;
+	uint16_t seq;
+
+	memset(copy, 0, sizeof (*copy));
+	copy->magic = DN_TRACE_MAGIC;
+	copy->version = DN_TRACE_VERSION;
+	copy->size = DN_TRACE_SIZE;
+	copy->head = dn_trace_ring.head;
+	DN_MEMORY_BARRIER();
+	for (index = copy->head > DN_TRACE_SIZE ? copy->head - DN_TRACE_SIZE : 0; index != copy->head; index++)
+	{
+		rec = &dn_trace_ring.recs[index & (DN_TRACE_SIZE - 1)];
+		dst = &copy->recs[index & (DN_TRACE_SIZE - 1)];
+		seq = rec->seq;
+		DN_MEMORY_BARRIER();
+		dst->ts_us = rec->ts_us;
+		dst->id = rec->id;
+		dst->arg0 = rec->arg0;
+		dst->arg1 = rec->arg1;
+		DN_MEMORY_BARRIER();
+		// Overwritten by a later record, or written to, while being copied
+		dst->seq = (seq == (uint16_t)index && rec->seq == seq) ? seq : DN_TRACE_SEQ_INVALID(index);
+	}
+	return sizeof (*copy);
+#else
+	return 0;
+#endif
+}
+
+//=========================== private =========================================
+
+//=========================== helpers =========================================
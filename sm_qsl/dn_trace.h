@@ -0,0 +1,129 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Binary trace ring for the QuickStart Library.
+
+dn_trace() records a timestamp, an event ID and two 32-bit arguments into a
+ring of fixed-size records in RAM, overwriting the oldest; nothing is
+formatted on the device. The events and the format strings of their arguments
+are listed in dn_trace_events.h, which only the host decoder (tools/trace)
+expands into strings. Recording is safe from the main loop and from the
+context feeding the UART data alike, so it can be used where log_* would
+stall on a slow console, e.g. in the notification callback.
+
+To get the trace off the device, dump the dn_trace_ring variable as is from a
+debugger, with the device halted:
+	(gdb) dump binary value trace.bin dn_trace_ring
+or, from a port that has a file system, write out a dn_trace_copy() of it.
+
+Building with DN_TRACE set to 0 compiles every dn_trace() away.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_TRACE_H
+#define DN_TRACE_H
+
+#include "dn_common.h"
+#include "dn_defaults.h"
+
+//=========================== defines =========================================
+
+#ifndef DN_TRACE
+#define DN_TRACE		1
+#endif
+
+#ifndef DN_TRACE_SIZE
+#if DN_HOSTED
+#define DN_TRACE_SIZE	64 // Number of records kept; a power of two
+#else
+#define DN_TRACE_SIZE	16 // 256 bytes of RAM
+#endif
+#endif
+
+#define DN_TRACE_MAGIC		0x43525444 // "DTRC" in a little-endian dump
+#define DN_TRACE_VERSION	1
+
+#if DN_TRACE
+#define dn_trace(id, arg0, arg1)	dn_trace_record(DN_TRACE_ ## id, (uint32_t)(arg0), (uint32_t)(arg1))
+#else
+#define dn_trace(id, arg0, arg1)	do {}while(0)
+#endif
+
+//=========================== typedef =========================================
+
+enum
+{
+#define DN_TRACE_EVENT(name, format)	DN_TRACE_ ## name,
+#include "dn_trace_events.h"
+#undef DN_TRACE_EVENT
+	DN_TRACE_NUM_EVENTS
+};
+
+typedef struct
+{
+	uint32_t ts_us; // Lower 32 bits of dn_time_us64()
+	uint16_t id;
+	uint16_t seq; // Lower 16 bits of the record index; invalidated first and written last, so torn records can be told
+	uint32_t arg0;
+	uint32_t arg1;
+} dn_trace_rec_t;
+
+/*
+ The layout of a dump, read by the host decoder. head is the index of the next
+ record; the records before it, up to DN_TRACE_SIZE of them, are in
+ recs[index % size].
+ */
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;
+	volatile uint32_t head;
+	dn_trace_rec_t recs[DN_TRACE_SIZE];
+} dn_trace_ring_t;
+
+//=========================== variables =======================================
+
+#if DN_TRACE
+extern dn_trace_ring_t dn_trace_ring;
+#endif
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Record an event; use the dn_trace() macro instead.
+ */
+void dn_trace_record(uint16_t id, uint32_t arg0, uint32_t arg1);
+
+/**
+ \brief Get the trace ring, laid out as the host decoder reads it.
+
+ Only consistent while nothing is recorded, e.g. once the library is stopped;
+ use dn_trace_copy otherwise.
+
+ \param size Set to the byte size of the ring.
+ \return A pointer to the ring, or NULL if built without tracing.
+ */
+const uint8_t* dn_trace_get(uint32_t* size);
+
+/**
+ \brief Copy the trace ring while records may still be added.
+
+ Records overwritten or written to during the copy are marked torn in it, and
+ skipped by the decoder.
+
+ \param copy Where to copy the ring to.
+ \return The byte size of the copy, or 0 if built without tracing.
+ */
+uint32_t dn_trace_copy(dn_trace_ring_t* copy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_TRACE_H */
@@ -0,0 +1,37 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Trace events of the QuickStart Library.
+
+Each entry gives the event name and the format of its two arguments. The list
+is expanded into event IDs on the device (dn_trace.h), while the format strings
+are only ever compiled into the host decoder (tools/trace). New events are
+added at the end, so that the IDs of existing ones stay the same, and take
+only %u, %d, %x and %#x conversions of 32-bit arguments.
+
+No include guard; this file is meant to be included with DN_TRACE_EVENT
+defined.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+//===== FSM
+DN_TRACE_EVENT(FSM_STATE,		"FSM state %#.2x --> %#.2x")
+DN_TRACE_EVENT(FSM_CMD,			"Command issued in state %#.2x (QSL command %u)")
+DN_TRACE_EVENT(FSM_REPLY,		"Reply to command %#.2x, RC %#x")
+DN_TRACE_EVENT(FSM_RSP_TIMEOUT,	"Response timeout in state %#.2x (QSL command %u)")
+DN_TRACE_EVENT(FSM_CMD_TIMEOUT,	"Command timeout in state %#.2x after %u ms")
+
+//===== Notifications
+DN_TRACE_EVENT(NOTIF,			"Notification %#.2x, subCmdId %#.2x")
+DN_TRACE_EVENT(MOTE_EVENTS,		"Mote events %#.4x in mote state %#.2x")
+DN_TRACE_EVENT(INBOX_OVERFLOW,	"Inbox overflow; newest packet of %u bytes dropped (%u so far)")
+
+//===== Send
+DN_TRACE_EVENT(SEND,			"Send %u bytes to port %u")
+DN_TRACE_EVENT(SEND_DONE,		"Send queued %u, state %#.2x")
+
+//===== Serial (span-based HDLC)
+DN_TRACE_EVENT(HDLC_TX,			"Frame out: command %#.2x, %u bytes")
+DN_TRACE_EVENT(HDLC_RX,			"Frame in: command %#.2x, %u bytes")
+DN_TRACE_EVENT(HDLC_RX_ERROR,	"Frame in dropped: %u bytes, overflow %u")
@@ -0,0 +1,59 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Block-oriented extension of the uart module (dn_uart.h in the C Library).
+
+Ports deliver received bytes in spans, as the driver hands them over (a DMA
+buffer, a read() call), and transmit whole frames at once. The byte-oriented
+dn_uart_init, dn_uart_txByte and dn_uart_txFlush remain available on top of
+these for the HDLC module of the C Library.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_UART_SPAN_H
+#define DN_UART_SPAN_H
+
+#include "dn_common.h"
+#include "dn_uart.h"
+
+//=========================== defines =========================================
+
+//=========================== typedef =========================================
+
+/**
+ \brief Called with bytes received from the mote.
+
+ Called from whatever context the port receives in (an interrupt on the MCU
+ ports, the read daemon on Linux). The span is only valid during the call.
+ */
+typedef void (*dn_uart_rxSpan_cbt)(const uint8_t* data, uint16_t len);
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Initialize the UART, delivering received bytes in spans.
+
+ Use instead of dn_uart_init.
+ */
+void dn_uart_initSpan(dn_uart_rxSpan_cbt rxSpan_cb);
+
+/**
+ \brief Transmit a span of bytes, e.g. a complete HDLC frame.
+
+ Any bytes staged by dn_uart_txByte are sent first. The data may be reused as
+ soon as the function returns.
+ */
+void dn_uart_txSpan(const uint8_t* data, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_UART_SPAN_H */
@@ -0,0 +1,43 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Helpers shared by the host microbenchmarks.
+
+Every result is printed on a line of its own, as "name value unit", so that
+the output of two revisions can be compared by name (see "make compare").
+Names are stable identifiers in lower case; units ending in "/s" are better
+when higher, all others when lower. Anything else a benchmark has to say,
+such as a mismatch against its reference, goes to stderr along with a
+non-zero exit code.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <time.h>
+
+//=========================== defines =========================================
+
+//=========================== typedef =========================================
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+static inline double bench_now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void bench_result(const char* name, double value, const char* unit)
+{
+	printf("%-26s %12.2f %s\n", name, value, unit);
+}
+
+#endif /* BENCH_H */
@@ -0,0 +1,124 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Host microbenchmark of the FCS-16 implementation selected by DN_FCS_IMPL.
+
+The output is first checked against a bitwise reference: the standard check
+value, and random data split at random points (so that every implementation
+is exercised across its step boundaries). Throughput is then measured over
+frame-sized buffers, and reported as fcs_<implementation> in the format of
+bench.h.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "dn_fcs.h"
+
+//=========================== defines =========================================
+
+#define BENCH_FCS_INIT		0xffff
+#define BENCH_FCS_CHECK		0x906e // FCS of "123456789" (CRC-16/X-25)
+#define BENCH_FRAME_LEN		128
+#define BENCH_NUM_FRAMES	8192
+#define BENCH_REPEAT		200
+#define BENCH_NUM_VECTORS	10000
+
+//=========================== variables =======================================
+
+static const char* bench_implName =
+#if DN_FCS_IMPL == DN_FCS_SLICE8
+		"slice8";
+#elif DN_FCS_IMPL == DN_FCS_SLICE4
+		"slice4";
+#elif DN_FCS_IMPL == DN_FCS_TABLE
+		"table";
+#else
+		"nibble";
+#endif
+
+static uint8_t bench_data[BENCH_NUM_FRAMES * BENCH_FRAME_LEN];
+
+//=========================== prototypes ======================================
+
+static uint16_t refUpdate(uint16_t fcs, const uint8_t* data, uint16_t len);
+
+//=========================== main ============================================
+
+int main(void)
+{
+	volatile uint16_t sink = 0;
+	uint16_t fcs;
+	uint16_t len;
+	uint16_t split;
+	uint32_t i;
+	uint32_t n;
+	double start;
+	double elapsed;
+	char name[32];
+
+	dn_fcs_init();
+	srand(1);
+	for (i = 0; i < sizeof (bench_data); i++)
+	{
+		bench_data[i] = (uint8_t)rand();
+	}
+
+	// Verify
+	fcs = ~dn_fcs_update(BENCH_FCS_INIT, (const uint8_t*)"123456789", 9);
+	if (fcs != BENCH_FCS_CHECK)
+	{
+		fprintf(stderr, "fcs %s: WRONG check value %#.4x\n", bench_implName, fcs);
+		return 1;
+	}
+	for (i = 0; i < BENCH_NUM_VECTORS; i++)
+	{
+		len = rand() % (BENCH_FRAME_LEN + 1);
+		split = len ? rand() % len : 0;
+		n = (rand() % BENCH_NUM_FRAMES) * BENCH_FRAME_LEN;
+		fcs = dn_fcs_update(BENCH_FCS_INIT, &bench_data[n], split);
+		fcs = dn_fcs_update(fcs, &bench_data[n + split], len - split);
+		if (fcs != refUpdate(BENCH_FCS_INIT, &bench_data[n], len))
+		{
+			fprintf(stderr, "fcs %s: MISMATCH for %u bytes split at %u\n", bench_implName, len, split);
+			return 1;
+		}
+	}
+
+	// Measure
+	start = bench_now_s();
+	for (i = 0; i < BENCH_REPEAT; i++)
+	{
+		for (n = 0; n < sizeof (bench_data); n += BENCH_FRAME_LEN)
+		{
+			sink ^= dn_fcs_update(BENCH_FCS_INIT, &bench_data[n], BENCH_FRAME_LEN);
+		}
+	}
+	elapsed = bench_now_s() - start;
+	snprintf(name, sizeof (name), "fcs_%s", bench_implName);
+	bench_result(name, (double)sizeof (bench_data) * BENCH_REPEAT / 1e6 / elapsed, "MB/s");
+	return 0;
+}
+
+//=========================== helpers =========================================
+
+/**
+ Bitwise FCS-16, independent of the tables under test.
+ */
+static uint16_t refUpdate(uint16_t fcs, const uint8_t* data, uint16_t len)
+{
+	uint8_t bit;
+
+	while (len-- > 0)
+	{
+		fcs ^= *data++;
+		for (bit = 0; bit < 8; bit++)
+		{
+			fcs = (fcs & 1) ? (fcs >> 1) ^ 0x8408 : fcs >> 1;
+		}
+	}
+	return fcs;
+}
@@ -0,0 +1,393 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Host microbenchmark of the HDLC receive and transmit paths.
+
+RX: A stream of encoded frames is decoded by a byte-at-a-time state machine
+fed through a function pointer (as the C Library HDLC module is fed by the
+UART), and by the span-based dn_hdlc_span.c fed in chunks (as a DMA buffer or
+read() call delivers them). Both must accept the same frames; throughput is
+reported in MB/s of encoded input.
+
+TX: The same frames are encoded byte by byte through a function pointer (as
+the C Library HDLC module emits to dn_uart_txByte), and in a single pass into
+a contiguous buffer by dn_hdlc_encode. Both must produce the same bytes;
+throughput is reported in MB/s of frame content.
+
+Each is timed over BENCH_REPEAT passes, and reported in the format of bench.h.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "dn_hdlc.h"
+#include "dn_hdlc_span.h"
+#include "dn_uart.h"
+#include "dn_uart_span.h"
+
+//=========================== defines =========================================
+
+#define BENCH_NUM_FRAMES	20000
+#define BENCH_REPEAT		20
+#define BENCH_CHUNK			64 // Bytes handed over per span
+#define BENCH_STREAM_SIZE	(BENCH_NUM_FRAMES * (2 * (DN_HDLC_MAX_FRAME_LENGTH + 2) + 1) + 1)
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	dn_uart_rxSpan_cbt rxSpan_cb;
+	uint8_t* stream;
+	uint32_t streamLen;
+	uint32_t frames;
+	uint32_t sum;
+	// Byte-at-a-time reference decoder
+	uint8_t refBuf[DN_HDLC_MAX_FRAME_LENGTH];
+	uint8_t refFill;
+	uint16_t refFcs;
+	bool refBusy;
+	bool refEscaping;
+	uint8_t refLastByte;
+	uint16_t refFcsTable[256];
+	// Frames and their encoding
+	uint8_t frameData[BENCH_NUM_FRAMES][DN_HDLC_MAX_FRAME_LENGTH];
+	uint8_t frameLen[BENCH_NUM_FRAMES];
+	uint8_t* txOut;
+	uint32_t txFill;
+} bench_vars_t;
+
+static bench_vars_t bench_vars;
+
+//=========================== prototypes ======================================
+
+static void buildStream(void);
+static void refRxByte(uint8_t b);
+static void rxFrame(uint8_t* frame, uint8_t len);
+static int benchTx(void);
+static void refTxFrame(const uint8_t* frame, uint8_t len, void (*txByte_cb)(uint8_t));
+static void refTxByte(uint8_t b);
+static uint16_t fcsByte(uint16_t fcs, uint8_t b);
+
+//=========================== main ============================================
+
+int main(void)
+{
+	void (*volatile rxByte_cb)(uint8_t) = refRxByte;
+	uint32_t refFrames;
+	uint32_t refSum;
+	uint32_t i;
+	uint32_t n;
+	uint32_t len;
+	double start;
+	double ref_s;
+	double span_s;
+	double mb;
+
+	buildStream();
+	for (n = 0; n < 256; n++)
+	{
+		bench_vars.refFcsTable[n] = fcsByte(0, (uint8_t)n);
+	}
+	mb = (double)bench_vars.streamLen * BENCH_REPEAT / 1e6;
+
+	// Per-byte reference
+	bench_vars.refLastByte = DN_HDLC_FLAG;
+	start = bench_now_s();
+	for (i = 0; i < BENCH_REPEAT; i++)
+	{
+		for (n = 0; n < bench_vars.streamLen; n++)
+		{
+			rxByte_cb(bench_vars.stream[n]);
+		}
+	}
+	ref_s = bench_now_s() - start;
+	refFrames = bench_vars.frames;
+	refSum = bench_vars.sum;
+
+	// Span-based
+	bench_vars.frames = 0;
+	bench_vars.sum = 0;
+	dn_hdlc_init(rxFrame);
+	start = bench_now_s();
+	for (i = 0; i < BENCH_REPEAT; i++)
+	{
+		for (n = 0; n < bench_vars.streamLen; n += len)
+		{
+			len = bench_vars.streamLen - n;
+			if (len > BENCH_CHUNK)
+			{
+				len = BENCH_CHUNK;
+			}
+			bench_vars.rxSpan_cb(&bench_vars.stream[n], (uint16_t)len);
+		}
+	}
+	span_s = bench_now_s() - start;
+
+	if (bench_vars.frames != refFrames || bench_vars.sum != refSum
+			|| refFrames != BENCH_NUM_FRAMES * BENCH_REPEAT)
+	{
+		fprintf(stderr, "hdlc rx: MISMATCH (per-byte %u frames, span %u frames)\n",
+				refFrames, bench_vars.frames);
+		return 1;
+	}
+	bench_result("hdlc_rx_byte", mb / ref_s, "MB/s");
+	bench_result("hdlc_rx_span", mb / span_s, "MB/s"); // In BENCH_CHUNK-byte spans
+	return benchTx();
+}
+
+static int benchTx(void)
+{
+	void (*volatile txByte_cb)(uint8_t) = refTxByte;
+	uint8_t* refOut;
+	uint32_t refFill;
+	uint32_t bytes = 0;
+	uint32_t i;
+	uint32_t f;
+	uint16_t len;
+	double start;
+	double ref_s;
+	double enc_s;
+	double mb;
+
+	for (f = 0; f < BENCH_NUM_FRAMES; f++)
+	{
+		bytes += bench_vars.frameLen[f];
+	}
+	mb = (double)bytes * BENCH_REPEAT / 1e6;
+	bench_vars.txOut = malloc(BENCH_STREAM_SIZE * 2);
+	refOut = bench_vars.txOut + BENCH_STREAM_SIZE;
+
+	// Per-byte reference
+	start = bench_now_s();
+	for (i = 0; i < BENCH_REPEAT; i++)
+	{
+		bench_vars.txFill = 0;
+		for (f = 0; f < BENCH_NUM_FRAMES; f++)
+		{
+			refTxFrame(bench_vars.frameData[f], bench_vars.frameLen[f], txByte_cb);
+		}
+	}
+	ref_s = bench_now_s() - start;
+	memcpy(refOut, bench_vars.txOut, bench_vars.txFill);
+	refFill = bench_vars.txFill;
+
+	// Single pass into a contiguous buffer
+	start = bench_now_s();
+	for (i = 0; i < BENCH_REPEAT; i++)
+	{
+		bench_vars.txFill = 0;
+		for (f = 0; f < BENCH_NUM_FRAMES; f++)
+		{
+			len = dn_hdlc_encode
+					(
+					bench_vars.frameData[f],
+					bench_vars.frameLen[f],
+					&bench_vars.txOut[bench_vars.txFill],
+					DN_HDLC_ENCODED_MAX_LEN(DN_HDLC_MAX_FRAME_LENGTH)
+					);
+			bench_vars.txFill += len;
+		}
+	}
+	enc_s = bench_now_s() - start;
+
+	if (bench_vars.txFill != refFill || memcmp(refOut, bench_vars.txOut, refFill) != 0)
+	{
+		fprintf(stderr, "hdlc tx: MISMATCH (per-byte %u bytes, encode %u bytes)\n", refFill, bench_vars.txFill);
+		return 1;
+	}
+
+	// The API path, as used by the serial module, must agree too
+	bench_vars.txFill = 0;
+	dn_hdlc_outputOpen();
+	for (i = 0; i < bench_vars.frameLen[0]; i++)
+	{
+		dn_hdlc_outputWrite(bench_vars.frameData[0][i]);
+	}
+	dn_hdlc_outputClose();
+	if (bench_vars.txFill == 0 || memcmp(refOut, bench_vars.txOut, bench_vars.txFill) != 0)
+	{
+		fprintf(stderr, "hdlc tx: MISMATCH through dn_hdlc_output*\n");
+		return 1;
+	}
+
+	bench_result("hdlc_tx_byte", mb / ref_s, "MB/s");
+	bench_result("hdlc_tx_encode", mb / enc_s, "MB/s");
+	return 0;
+}
+
+//=========================== stubs ===========================================
+
+void dn_uart_initSpan(dn_uart_rxSpan_cbt rxSpan_cb)
+{
+	bench_vars.rxSpan_cb = rxSpan_cb;
+}
+
+void dn_uart_init(dn_uart_rxByte_cbt rxByte_cb)
+{
+	(void)rxByte_cb;
+}
+
+void dn_uart_txByte(uint8_t byte)
+{
+	(void)byte;
+}
+
+void dn_uart_txFlush(void)
+{
+}
+
+void dn_uart_txSpan(const uint8_t* data, uint16_t len)
+{
+	memcpy(&bench_vars.txOut[bench_vars.txFill], data, len);
+	bench_vars.txFill += len;
+}
+
+//=========================== private =========================================
+
+/**
+ Encode frames of random length and content, as the mote would send them.
+ */
+static void buildStream(void)
+{
+	uint8_t* frame;
+	uint8_t* out;
+	uint16_t fcs;
+	uint32_t f;
+	uint8_t len;
+	uint8_t i;
+	uint8_t b;
+
+	bench_vars.stream = malloc(BENCH_STREAM_SIZE);
+	out = bench_vars.stream;
+	srand(1);
+	*out++ = DN_HDLC_FLAG;
+	for (f = 0; f < BENCH_NUM_FRAMES; f++)
+	{
+		len = 4 + rand() % (DN_HDLC_MAX_FRAME_LENGTH - 2 - 4);
+		frame = bench_vars.frameData[f];
+		bench_vars.frameLen[f] = len;
+		fcs = DN_HDLC_CRCINIT;
+		for (i = 0; i < len; i++)
+		{
+			frame[i] = (uint8_t)rand();
+			fcs = fcsByte(fcs, frame[i]);
+		}
+		fcs = ~fcs;
+		for (i = 0; i < len + 2; i++)
+		{
+			b = (i < len) ? frame[i] : (uint8_t)(fcs >> (8 * (i - len)));
+			if (b == DN_HDLC_FLAG || b == DN_HDLC_ESCAPE)
+			{
+				*out++ = DN_HDLC_ESCAPE;
+				b ^= DN_HDLC_ESCAPE_MASK;
+			}
+			*out++ = b;
+		}
+		*out++ = DN_HDLC_FLAG;
+	}
+	bench_vars.streamLen = out - bench_vars.stream;
+}
+
+/**
+ Byte-at-a-time decoder with a table-driven FCS, structured like the C Library
+ HDLC module.
+ */
+static void refRxByte(uint8_t b)
+{
+	if (!bench_vars.refBusy && bench_vars.refLastByte == DN_HDLC_FLAG && b != DN_HDLC_FLAG)
+	{
+		bench_vars.refBusy = TRUE;
+		bench_vars.refFill = 0;
+		bench_vars.refFcs = DN_HDLC_CRCINIT;
+		bench_vars.refEscaping = FALSE;
+	}
+	if (bench_vars.refBusy && b != DN_HDLC_FLAG)
+	{
+		if (b == DN_HDLC_ESCAPE)
+		{
+			bench_vars.refEscaping = TRUE;
+		} else
+		{
+			if (bench_vars.refEscaping)
+			{
+				b ^= DN_HDLC_ESCAPE_MASK;
+				bench_vars.refEscaping = FALSE;
+			}
+			if (bench_vars.refFill < DN_HDLC_MAX_FRAME_LENGTH)
+			{
+				bench_vars.refBuf[bench_vars.refFill++] = b;
+				bench_vars.refFcs = (bench_vars.refFcs >> 8)
+						^ bench_vars.refFcsTable[(bench_vars.refFcs ^ b) & 0xff];
+			}
+		}
+	} else if (bench_vars.refBusy && b == DN_HDLC_FLAG)
+	{
+		bench_vars.refBusy = FALSE;
+		if (bench_vars.refFill > 2 && bench_vars.refFcs == DN_HDLC_CRCGOOD)
+		{
+			rxFrame(bench_vars.refBuf, bench_vars.refFill - 2);
+		}
+	}
+	bench_vars.refLastByte = b;
+}
+
+/**
+ Byte-at-a-time encoder, structured like the C Library HDLC module.
+ */
+static void refTxFrame(const uint8_t* frame, uint8_t len, void (*txByte_cb)(uint8_t))
+{
+	uint16_t fcs = DN_HDLC_CRCINIT;
+	uint8_t i;
+	uint8_t b;
+
+	txByte_cb(DN_HDLC_FLAG);
+	for (i = 0; i < len + 2; i++)
+	{
+		if (i < len)
+		{
+			b = frame[i];
+			fcs = (fcs >> 8) ^ bench_vars.refFcsTable[(fcs ^ b) & 0xff];
+		} else
+		{
+			b = (uint8_t)((uint16_t)~fcs >> (8 * (i - len)));
+		}
+		if (b == DN_HDLC_FLAG || b == DN_HDLC_ESCAPE)
+		{
+			txByte_cb(DN_HDLC_ESCAPE);
+			b ^= DN_HDLC_ESCAPE_MASK;
+		}
+		txByte_cb(b);
+	}
+	txByte_cb(DN_HDLC_FLAG);
+}
+
+static void refTxByte(uint8_t b)
+{
+	bench_vars.txOut[bench_vars.txFill++] = b;
+}
+
+static void rxFrame(uint8_t* frame, uint8_t len)
+{
+	bench_vars.frames++;
+	bench_vars.sum += len + frame[0] + frame[len - 1];
+}
+
+//=========================== helpers =========================================
+
+/**
+ Bitwise FCS-16, independent of the tables under test.
+ */
+static uint16_t fcsByte(uint16_t fcs, uint8_t b)
+{
+	uint8_t bit;
+
+	fcs ^= b;
+	for (bit = 0; bit < 8; bit++)
+	{
+		fcs = (fcs & 1) ? (fcs >> 1) ^ 0x8408 : fcs >> 1;
+	}
+	return fcs;
+}
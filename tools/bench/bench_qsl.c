@@ -0,0 +1,272 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Host microbenchmark of the QuickStart Library on top of the serial stack.
+
+The library runs on the simulator port (examples/sim/Scenarios): Its virtual
+clock only moves when the library sleeps, and the simulated mote of
+tools/mote_emu answers in the same process, so that the wall time measured
+is that of the code alone. Everything goes through dn_qsl_api.h, apart from
+the producer side of the inbox and the event dispatch of the FSM
+(dn_qsl_hooks.h):
+ - endian_*: dn_write_uint16_t and friends of the port
+ - qsl_payload_limit: dn_qsl_getPayloadLimit, as done on every send
+ - qsl_inbox_push_pop: A downstream packet through the inbox, pushed as a
+   receive notification does and taken out by dn_qsl_read
+ - fsm_dispatch: Scheduling an event of the FSM and running it from the FSM
+   loop (dn_qsl_hooks.h)
+ - qsl_send_round_trip: dn_qsl_send, the mote sending the packet back, and
+   dn_qsl_read, i.e. both serial paths (HDLC, FCS, C Library) and the FSM
+
+Each is timed BENCH_RUNS times and the best run is reported, in the format of
+bench.h.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "dn_qsl_api.h"
+#include "dn_qsl_hooks.h"
+#include "dn_time.h"
+#include "dn_endianness.h"
+#include "dn_sim.h"
+#include "dn_mote_sim.h"
+
+//=========================== defines =========================================
+
+#define BENCH_RUNS			5 // Timed runs per benchmark; the best is reported
+#define BENCH_OPS			2000000 // Per run, for the benchmarks that do not involve the mote
+#define BENCH_ROUND_TRIPS	20000 // Per run
+#define BENCH_SRC_PORT		DN_WELL_KNOWN_PORT_1
+#define BENCH_BANDWIDTH_MS	1000
+#define BENCH_PAYLOAD_LEN	40
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	uint8_t buf[DN_DEFAULT_PAYLOAD_SIZE_LIMIT];
+	uint32_t dispatched;
+} bench_vars_t;
+
+static bench_vars_t bench_vars;
+
+//=========================== prototypes ======================================
+
+static void benchEndianness(void);
+static void benchPayloadLimit(void);
+static void benchInbox(void);
+static void benchDispatch(void);
+static int benchRoundTrip(void);
+static void noopEvent(void);
+static double fastest(double best_s, double run_s);
+static void report(const char* name, double best_s, uint32_t ops, double scale, const char* unit);
+
+//=========================== main ============================================
+
+int main(void)
+{
+	dn_mote_sim_cfg_t cfg;
+
+	// A mote that answers promptly and always the same, and echoes every packet
+	dn_mote_sim_defaultCfg(&cfg);
+	cfg.replyDelay_ms = 1;
+	cfg.txDoneDelay_ms = 10;
+	cfg.jitter_pct = 0;
+	cfg.joinFail_pct = 0;
+	cfg.echo = TRUE;
+	dn_sim_startMote(&cfg);
+	dn_qsl_init();
+	if (!dn_qsl_connect(DN_DEFAULT_NET_ID, NULL, BENCH_SRC_PORT, BENCH_BANDWIDTH_MS))
+	{
+		fprintf(stderr, "qsl: Failed to connect to the simulated mote\n");
+		return 1;
+	}
+
+	benchEndianness();
+	benchPayloadLimit();
+	benchInbox();
+	benchDispatch();
+	return benchRoundTrip();
+}
+
+//=========================== private =========================================
+
+static void benchEndianness(void)
+{
+	volatile uint32_t sink = 0;
+	uint16_t val16;
+	uint32_t val32;
+	uint32_t i;
+	uint8_t r;
+	double best_w16 = 1e9;
+	double best_w32 = 1e9;
+	double best_r16 = 1e9;
+	double best_r32 = 1e9;
+	double start;
+
+	for (r = 0; r < BENCH_RUNS; r++)
+	{
+		start = bench_now_s();
+		for (i = 0; i < BENCH_OPS; i++)
+		{
+			dn_write_uint16_t(bench_vars.buf, (uint16_t)i);
+		}
+		best_w16 = fastest(best_w16, bench_now_s() - start);
+
+		start = bench_now_s();
+		for (i = 0; i < BENCH_OPS; i++)
+		{
+			dn_write_uint32_t(bench_vars.buf, i);
+		}
+		best_w32 = fastest(best_w32, bench_now_s() - start);
+
+		start = bench_now_s();
+		for (i = 0; i < BENCH_OPS; i++)
+		{
+			dn_read_uint16_t(&val16, bench_vars.buf);
+			sink += val16;
+		}
+		best_r16 = fastest(best_r16, bench_now_s() - start);
+
+		start = bench_now_s();
+		for (i = 0; i < BENCH_OPS; i++)
+		{
+			dn_read_uint32_t(&val32, bench_vars.buf);
+			sink += val32;
+		}
+		best_r32 = fastest(best_r32, bench_now_s() - start);
+	}
+	report("endian_write_uint16", best_w16, BENCH_OPS, 1e9, "ns/op");
+	report("endian_write_uint32", best_w32, BENCH_OPS, 1e9, "ns/op");
+	report("endian_read_uint16", best_r16, BENCH_OPS, 1e9, "ns/op");
+	report("endian_read_uint32", best_r32, BENCH_OPS, 1e9, "ns/op");
+}
+
+static void benchPayloadLimit(void)
+{
+	volatile uint32_t sink = 0;
+	uint16_t ports[2] = {DN_WELL_KNOWN_PORT_2, DN_DEFAULT_DEST_PORT};
+	uint32_t i;
+	uint8_t r;
+	double best = 1e9;
+	double start;
+
+	for (r = 0; r < BENCH_RUNS; r++)
+	{
+		start = bench_now_s();
+		for (i = 0; i < BENCH_OPS; i++)
+		{
+			sink += dn_qsl_getPayloadLimit(ports[i & 1]);
+		}
+		best = fastest(best, bench_now_s() - start);
+	}
+	report("qsl_payload_limit", best, BENCH_OPS, 1e9, "ns/op");
+}
+
+static void benchInbox(void)
+{
+	uint32_t i;
+	uint8_t r;
+	double best = 1e9;
+	double start;
+
+	memset(bench_vars.buf, 0x5a, sizeof (bench_vars.buf));
+	for (r = 0; r < BENCH_RUNS; r++)
+	{
+		start = bench_now_s();
+		for (i = 0; i < BENCH_OPS; i++)
+		{
+			dn_qsl_hook_inboxPush(bench_vars.buf, BENCH_PAYLOAD_LEN);
+			if (dn_qsl_read(bench_vars.buf) != BENCH_PAYLOAD_LEN)
+			{
+				fprintf(stderr, "qsl inbox: Packet lost\n");
+				exit(1);
+			}
+		}
+		best = fastest(best, bench_now_s() - start);
+	}
+	report("qsl_inbox_push_pop", best, BENCH_OPS, 1e9, "ns/op");
+}
+
+/**
+ The FSM is connected, and has no event of its own scheduled.
+ */
+static void benchDispatch(void)
+{
+	uint32_t i;
+	uint8_t r;
+	double best = 1e9;
+	double start;
+
+	for (r = 0; r < BENCH_RUNS; r++)
+	{
+		bench_vars.dispatched = 0;
+		start = bench_now_s();
+		for (i = 0; i < BENCH_OPS; i++)
+		{
+			dn_qsl_hook_dispatchEvent(noopEvent);
+		}
+		best = fastest(best, bench_now_s() - start);
+		if (bench_vars.dispatched != BENCH_OPS)
+		{
+			fprintf(stderr, "fsm dispatch: %u of %u events run\n", bench_vars.dispatched, BENCH_OPS);
+			exit(1);
+		}
+	}
+	report("fsm_dispatch", best, BENCH_OPS, 1e9, "ns/op");
+}
+
+static int benchRoundTrip(void)
+{
+	uint32_t i;
+	uint8_t r;
+	double best = 1e9;
+	double start;
+
+	for (i = 0; i < BENCH_PAYLOAD_LEN; i++)
+	{
+		bench_vars.buf[i] = (uint8_t)i;
+	}
+	for (r = 0; r < BENCH_RUNS; r++)
+	{
+		start = bench_now_s();
+		for (i = 0; i < BENCH_ROUND_TRIPS; i++)
+		{
+			if (!dn_qsl_send(bench_vars.buf, BENCH_PAYLOAD_LEN, DN_DEFAULT_DEST_PORT))
+			{
+				fprintf(stderr, "qsl round trip: Send failed\n");
+				return 1;
+			}
+			// Wait for the echo, in virtual time
+			while (dn_qsl_read(bench_vars.buf) == 0)
+			{
+				dn_sleep_ms(1);
+			}
+		}
+		best = fastest(best, bench_now_s() - start);
+	}
+	report("qsl_send_round_trip", best, BENCH_ROUND_TRIPS, 1e6, "us/op");
+	return 0;
+}
+
+static void noopEvent(void)
+{
+	bench_vars.dispatched++;
+}
+
+//=========================== helpers =========================================
+
+static double fastest(double best_s, double run_s)
+{
+	return (run_s < best_s) ? run_s : best_s;
+}
+
+static void report(const char* name, double best_s, uint32_t ops, double scale, const char* unit)
+{
+	bench_result(name, best_s * scale / ops, unit);
+}
@@ -0,0 +1,303 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Host converter of QuickStart Library serial captures (see dn_capture.h).
+
+Reads a capture ring, from a RAM dump or the file mapped on Linux, and writes
+the frames from oldest to newest as a pcapng file:
+	./capture_pcap capture.bin > capture.pcapng
+Each frame is an Enhanced Packet Block on a single interface of link type
+USER0, holding the serial API frame as it was before HDLC escaping and
+without its FCS: control, command ID, sequence number, length, payload. The
+direction is carried in the packet flags (inbound from the mote, outbound
+to it), as is a failed FCS, so that Wireshark can filter on
+"frame.packet_flags_direction" and "frame.packet_flags_crc_error". With -l,
+the frames are listed as text instead.
+
+Slots torn by a dump taken while the device was writing, or never written,
+are skipped and counted.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dn_capture.h"
+
+//=========================== defines =========================================
+
+// Capture layout; little-endian, as written by every supported target
+#define CAP_HEADER_LEN		16
+#define CAP_SLOT_HEADER_LEN	16
+
+// pcapng
+#define PCAPNG_SHB				0x0a0d0d0a
+#define PCAPNG_IDB				0x00000001
+#define PCAPNG_EPB				0x00000006
+#define PCAPNG_BYTE_ORDER		0x1a2b3c4d
+#define PCAPNG_LINKTYPE_USER0	147
+#define PCAPNG_OPT_END			0
+#define PCAPNG_OPT_IF_NAME		2
+#define PCAPNG_OPT_IF_TSRESOL	9
+#define PCAPNG_OPT_EPB_FLAGS	2
+#define PCAPNG_FLAGS_INBOUND	0x00000001
+#define PCAPNG_FLAGS_OUTBOUND	0x00000002
+#define PCAPNG_FLAGS_CRC_ERROR	0x01000000
+
+#define CAP_IF_NAME			"SmartMesh IP serial"
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	FILE* out;
+	bool list;
+} cap_vars_t;
+
+static cap_vars_t cap_vars;
+
+//=========================== prototypes ======================================
+
+static void writeHeader(uint16_t snapLen);
+static void writeFrame(uint64_t ts_us, uint8_t flags, const uint8_t* frame, uint16_t capLen, uint16_t len);
+static void listFrame(uint64_t ts_us, uint8_t flags, const uint8_t* frame, uint16_t capLen, uint16_t len);
+static void writeOption(uint16_t code, const void* value, uint16_t len);
+static void putU32(uint32_t v);
+static void putU16(uint16_t v);
+static void putPad(uint32_t len);
+static uint64_t getU64(const uint8_t* p);
+static uint32_t getU32(const uint8_t* p);
+static uint16_t getU16(const uint8_t* p);
+
+//=========================== main ============================================
+
+int main(int argc, char** argv)
+{
+	uint8_t* dump;
+	long dumpLen;
+	FILE* f;
+	uint16_t frameLen;
+	uint32_t size;
+	uint32_t slotLen;
+	uint32_t head;
+	uint32_t index;
+	uint32_t skipped = 0;
+	uint32_t converted = 0;
+	uint16_t len;
+	const uint8_t* slot;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "lh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'l':
+			cap_vars.list = TRUE;
+			break;
+		default:
+			printf("Usage: %s [-l] capture.bin > capture.pcapng\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		printf("Usage: %s [-l] capture.bin > capture.pcapng\n", argv[0]);
+		return 1;
+	}
+	if (!cap_vars.list && isatty(STDOUT_FILENO))
+	{
+		fprintf(stderr, "Not writing pcapng to a terminal; redirect the output, or list with -l\n");
+		return 1;
+	}
+	cap_vars.out = stdout;
+
+	f = fopen(argv[optind], "rb");
+	if (f == NULL)
+	{
+		perror("Unable to open capture");
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	dumpLen = ftell(f);
+	rewind(f);
+	dump = malloc(dumpLen > 0 ? dumpLen : 1);
+	if (dumpLen < CAP_HEADER_LEN || fread(dump, 1, dumpLen, f) != (size_t)dumpLen)
+	{
+		fprintf(stderr, "Capture too short\n");
+		return 1;
+	}
+	fclose(f);
+
+	frameLen = getU16(&dump[6]);
+	size = getU32(&dump[8]);
+	head = getU32(&dump[12]);
+	slotLen = CAP_SLOT_HEADER_LEN + frameLen;
+	if (getU32(&dump[0]) != DN_CAPTURE_MAGIC || getU16(&dump[4]) != DN_CAPTURE_VERSION
+			|| size == 0 || (size & (size - 1)) != 0
+			|| (uint64_t)dumpLen < CAP_HEADER_LEN + (uint64_t)size * slotLen)
+	{
+		fprintf(stderr, "Not a capture of version %u\n", DN_CAPTURE_VERSION);
+		return 1;
+	}
+
+	if (!cap_vars.list)
+	{
+		writeHeader(frameLen);
+	}
+
+	// Oldest to newest
+	for (index = head > size ? head - size : 0; index != head; index++)
+	{
+		slot = &dump[CAP_HEADER_LEN + (index & (size - 1)) * slotLen];
+		if (getU32(&slot[8]) != index)
+		{
+			skipped++;
+			continue;
+		}
+		len = getU16(&slot[12]);
+		if (cap_vars.list)
+		{
+			listFrame(getU64(&slot[0]), slot[14], &slot[CAP_SLOT_HEADER_LEN], len < frameLen ? len : frameLen, len);
+		} else
+		{
+			writeFrame(getU64(&slot[0]), slot[14], &slot[CAP_SLOT_HEADER_LEN], len < frameLen ? len : frameLen, len);
+		}
+		converted++;
+	}
+
+	fprintf(stderr, "%u frames converted, %u skipped (torn or never written), %u captured in total\n",
+			converted, skipped, head);
+	free(dump);
+	return 0;
+}
+
+//=========================== private =========================================
+
+/**
+ Section Header Block, then the Interface Description Block of the serial
+ link, with microsecond timestamps.
+ */
+static void writeHeader(uint16_t snapLen)
+{
+	uint8_t tsresol = 6;
+	uint32_t nameLen = sizeof (CAP_IF_NAME) - 1;
+	uint32_t blockLen;
+
+	putU32(PCAPNG_SHB);
+	putU32(28);
+	putU32(PCAPNG_BYTE_ORDER);
+	putU16(1); // Version 1.0
+	putU16(0);
+	putU32(0xffffffff); // Section length unknown
+	putU32(0xffffffff);
+	putU32(28);
+
+	blockLen = 20 + 4 + ((nameLen + 3) & ~3) + 4 + 4 + 4;
+	putU32(PCAPNG_IDB);
+	putU32(blockLen);
+	putU16(PCAPNG_LINKTYPE_USER0);
+	putU16(0);
+	putU32(snapLen);
+	writeOption(PCAPNG_OPT_IF_NAME, CAP_IF_NAME, nameLen);
+	writeOption(PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+	writeOption(PCAPNG_OPT_END, NULL, 0);
+	putU32(blockLen);
+}
+
+/**
+ Enhanced Packet Block, with the direction and a failed FCS in its flags.
+ */
+static void writeFrame(uint64_t ts_us, uint8_t flags, const uint8_t* frame, uint16_t capLen, uint16_t len)
+{
+	uint32_t epbFlags;
+	uint32_t blockLen = 28 + ((capLen + 3) & ~3) + 8 + 4 + 4;
+
+	epbFlags = (flags & DN_CAPTURE_TO_MOTE) ? PCAPNG_FLAGS_OUTBOUND : PCAPNG_FLAGS_INBOUND;
+	if (flags & DN_CAPTURE_BAD)
+	{
+		epbFlags |= PCAPNG_FLAGS_CRC_ERROR;
+	}
+
+	putU32(PCAPNG_EPB);
+	putU32(blockLen);
+	putU32(0); // Interface
+	putU32((uint32_t)(ts_us >> 32));
+	putU32((uint32_t)ts_us);
+	putU32(capLen);
+	putU32(len);
+	fwrite(frame, 1, capLen, cap_vars.out);
+	putPad(capLen);
+	writeOption(PCAPNG_OPT_EPB_FLAGS, NULL, 4);
+	putU32(epbFlags);
+	writeOption(PCAPNG_OPT_END, NULL, 0);
+	putU32(blockLen);
+}
+
+static void listFrame(uint64_t ts_us, uint8_t flags, const uint8_t* frame, uint16_t capLen, uint16_t len)
+{
+	uint16_t i;
+
+	printf("%llu.%06llu %s%s %3u:", (unsigned long long)(ts_us / 1000000), (unsigned long long)(ts_us % 1000000),
+			(flags & DN_CAPTURE_TO_MOTE) ? "->mote" : "<-mote", (flags & DN_CAPTURE_BAD) ? " BAD" : "", len);
+	for (i = 0; i < capLen; i++)
+	{
+		printf(" %02x", frame[i]);
+	}
+	printf("%s\n", capLen < len ? " ..." : "");
+}
+
+//=========================== helpers =========================================
+
+/**
+ Option header and value, padded to 32 bits; the value is written by the
+ caller if NULL.
+ */
+static void writeOption(uint16_t code, const void* value, uint16_t len)
+{
+	putU16(code);
+	putU16(len);
+	if (value != NULL)
+	{
+		fwrite(value, 1, len, cap_vars.out);
+		putPad(len);
+	}
+}
+
+static void putU32(uint32_t v)
+{
+	uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+
+	fwrite(b, 1, sizeof (b), cap_vars.out);
+}
+
+static void putU16(uint16_t v)
+{
+	uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+
+	fwrite(b, 1, sizeof (b), cap_vars.out);
+}
+
+static void putPad(uint32_t len)
+{
+	static const uint8_t zeros[3] = {0, 0, 0};
+
+	fwrite(zeros, 1, (4 - (len & 3)) & 3, cap_vars.out);
+}
+
+static uint64_t getU64(const uint8_t* p)
+{
+	return (uint64_t)getU32(p) | ((uint64_t)getU32(&p[4]) << 32);
+}
+
+static uint32_t getU32(const uint8_t* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t getU16(const uint8_t* p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
@@ -0,0 +1,1358 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Simulated SmartMesh IP mote; see dn_mote_sim.h.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include "dn_mote_sim.h"
+#include "dn_fcs.h"
+#include "dn_hdlc.h"
+#include "dn_ipmt.h"
+#include "dn_fsm.h"
+
+//=========================== defines =========================================
+
+// Serial API header: control, command ID, sequence number, payload length
+#define SIM_HEADER_LEN			4
+#define SIM_CTRL_ACK			0x01 // Frame is a reply or an acknowledgement
+#define SIM_CTRL_ACK_REQUESTED	0x02 // Receiver should acknowledge the frame
+
+#define SIM_MAX_PAYLOAD_LEN		(DN_MOTE_SIM_MAX_FRAME_LEN - SIM_HEADER_LEN)
+#define SIM_ENCODED_MAX_LEN		(2 * (DN_MOTE_SIM_MAX_FRAME_LEN + 2) + 2)
+
+// Timers, run in this order when due at the same time
+#define SIM_TIMER_BOOT			0
+#define SIM_TIMER_JOIN			1
+#define SIM_TIMER_SVC			2
+#define SIM_TIMER_ADV			3
+#define SIM_TIMER_TIME			4
+#define SIM_TIMER_DOWNSTREAM	5
+#define SIM_NUM_TIMERS			6
+
+#define SIM_DEFAULT_JOIN_DUTY_CYCLE	64 // joinDelay_ms applies at this duty cycle
+#define SIM_API_VERSION			4
+#define SIM_HW_MODEL			1
+#define SIM_HW_REV				1
+#define SIM_BOOT_SW_VER			1
+#define SIM_NUM_PARENTS			2 // Reported once operational
+#define SIM_MANAGER_MOTE_ID		1 // The access point
+#define SIM_ADV_NEIGHBORS		4 // Distinct motes advertising each network
+#define SIM_UTC_BASE_S			1451606400ULL // Network time starts 2016-01-01
+#define SIM_DOWNSTREAM_SRC_PORT	DN_WELL_KNOWN_PORT_1
+#define SIM_SOCKET_ID_BASE		1
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	bool armed;
+	uint32_t due_ms;
+} dn_mote_sim_timer_t;
+
+typedef struct
+{
+	uint32_t due_ms;
+	uint8_t len;
+	uint8_t frame[DN_MOTE_SIM_MAX_FRAME_LEN];
+} dn_mote_sim_txFrame_t;
+
+typedef struct
+{
+	bool open;
+	bool bound;
+	uint16_t port;
+} dn_mote_sim_socket_t;
+
+typedef struct
+{
+	dn_mote_sim_cfg_t cfg;
+	dn_mote_sim_tx_cbt tx_cb;
+	dn_mote_sim_trace_cbt trace_cb;
+	uint32_t rng;
+	// Time
+	uint32_t now_ms;
+	uint64_t clock_ms; // Never wraps; drives network time
+	uint64_t boot_ms;
+	dn_mote_sim_timer_t timers[SIM_NUM_TIMERS];
+	// HDLC RX
+	uint8_t rxBuf[DN_MOTE_SIM_MAX_FRAME_LEN + 2];
+	uint8_t rxLen;
+	bool rxBusy;
+	bool rxEscaping;
+	bool rxOverflow;
+	// Serial API
+	uint8_t notifSeqNo;
+	bool lastReqValid;
+	uint8_t lastReqCmdId;
+	uint8_t lastReqSeqNo;
+	uint8_t lastReplyLen;
+	uint8_t lastReply[SIM_MAX_PAYLOAD_LEN];
+	dn_mote_sim_txFrame_t txQueue[DN_MOTE_SIM_TX_QUEUE_SIZE]; // Sorted by due time
+	uint8_t txCount;
+	// Mote
+	uint8_t state;
+	bool resetting; // Deaf until the boot event
+	bool disconnecting;
+	bool searching; // Reporting advertisements
+	bool joining;
+	uint8_t advNext;
+	uint16_t networkId;
+	uint8_t joinKey[DN_JOIN_KEY_LEN];
+	uint8_t joinDutyCycle;
+	const dn_mote_sim_net_t* joinNet;
+	dn_mote_sim_socket_t sockets[DN_MOTE_SIM_MAX_SOCKETS];
+	// Service
+	bool svcPending;
+	uint32_t svcRequested_ms;
+	uint32_t service_ms;
+	uint32_t downstreamCount;
+	// Replay
+	const dn_mote_sim_rec_t* replay; // NULL when simulating
+	uint32_t replayCount;
+	uint32_t replayStart_ms;
+	uint32_t replayNotif; // Next recorded notification
+	uint32_t replayCursor[256]; // Per command, next recorded request to answer with
+	uint32_t replayParamCursor[2][256]; // Per parameter of setParameter and getParameter
+	dn_mote_sim_stats_t stats;
+} dn_mote_sim_vars_t;
+
+static dn_mote_sim_vars_t dn_mote_sim_vars;
+
+//=========================== prototypes ======================================
+
+// Time
+static void advanceTo(uint32_t now_ms);
+static void armTimer(uint8_t timer, uint32_t delay_ms);
+static bool isDue(uint32_t due_ms);
+static uint32_t jitter(uint32_t delay_ms);
+static uint32_t nextRandom(void);
+// Serial API
+static void rxByte(uint8_t b);
+static void rxFrame(const uint8_t* frame, uint8_t len);
+static void queueFrame(uint8_t control, uint8_t cmdId, uint8_t seqNo, const uint8_t* payload, uint8_t len, uint32_t delay_ms);
+static void reply(uint8_t cmdId, uint8_t seqNo, const uint8_t* payload, uint8_t len);
+static void notify(uint8_t cmdId, const uint8_t* payload, uint8_t len, uint32_t delay_ms);
+static void notifyEvents(uint32_t events, uint32_t delay_ms);
+static void sendDue(void);
+static uint16_t encode(const uint8_t* frame, uint8_t len, uint8_t* out);
+
+static void replayDue(void);
+static bool replayReply(uint8_t cmdId, const uint8_t* req, uint8_t reqLen, uint8_t* rsp, uint8_t* rspLen, uint32_t* delay_ms);
+static uint32_t replayNextNotif(uint32_t from);
+static bool isRecRequest(const dn_mote_sim_rec_t* rec);
+// Commands; each writes the reply payload, starting with the RC
+static uint8_t cmd_setParameter(const uint8_t* req, uint8_t len, uint8_t* rsp);
+static uint8_t cmd_getParameter(const uint8_t* req, uint8_t len, uint8_t* rsp);
+static uint8_t cmd_openSocket(const uint8_t* req, uint8_t len, uint8_t* rsp);
+static uint8_t cmd_bindSocket(const uint8_t* req, uint8_t len, uint8_t* rsp);
+static uint8_t cmd_search(const uint8_t* req, uint8_t len, uint8_t* rsp);
+static uint8_t cmd_join(const uint8_t* req, uint8_t len, uint8_t* rsp);
+static uint8_t cmd_requestService(const uint8_t* req, uint8_t len, uint8_t* rsp);
+static uint8_t cmd_getServiceInfo(const uint8_t* req, uint8_t len, uint8_t* rsp);
+static uint8_t cmd_sendTo(const uint8_t* req, uint8_t len, uint8_t* rsp);
+static uint8_t cmd_reset(const uint8_t* req, uint8_t len, uint8_t* rsp);
+static uint8_t cmd_disconnect(const uint8_t* req, uint8_t len, uint8_t* rsp);
+// Timers
+static void timer_boot(void);
+static void timer_join(void);
+static void timer_svc(void);
+static void timer_adv(void);
+static void timer_time(void);
+static void timer_downstream(void);
+// helpers
+static void boot(void);
+static void startJoinAttempt(void);
+static uint8_t writeTime(uint8_t* out);
+static const dn_mote_sim_net_t* findNet(uint16_t netId);
+static dn_mote_sim_socket_t* findSocket(uint8_t socketId);
+static dn_mote_sim_socket_t* firstBoundSocket(uint8_t* socketId);
+static void putU16(uint8_t* out, uint16_t v);
+static void putU32(uint8_t* out, uint32_t v);
+static uint16_t getU16(const uint8_t* in);
+static uint32_t getU32(const uint8_t* in);
+
+//=========================== public ==========================================
+
+void dn_mote_sim_defaultCfg(dn_mote_sim_cfg_t* cfg)
+{
+	static const uint8_t mac[8] = {0x00, 0x17, 0x0d, 0x00, 0x00, 0x51, 0x4d, 0x01};
+
+	memset(cfg, 0, sizeof (*cfg));
+	memcpy(cfg->macAddress, mac, sizeof (mac));
+	cfg->swVerMajor = 1;
+	cfg->swVerMinor = 4;
+	cfg->swVerPatch = 1;
+	cfg->swVerBuild = 8;
+	cfg->numNets = 1;
+	cfg->nets[0].netId = DN_DEFAULT_NET_ID;
+	cfg->nets[0].rssi = -60;
+	memcpy(cfg->nets[0].joinKey, dn_default_joinKey, DN_JOIN_KEY_LEN);
+	cfg->replyDelay_ms = 5;
+	cfg->bootDelay_ms = 500;
+	cfg->disconnectDelay_ms = 2000;
+	cfg->advPeriod_ms = 1000;
+	cfg->joinDelay_ms = 20000;
+	cfg->svcDelay_ms = 5000;
+	cfg->txDoneDelay_ms = 500;
+	cfg->jitter_pct = 20;
+	cfg->seed = 1;
+	cfg->minService_ms = 1000;
+}
+
+void dn_mote_sim_init(const dn_mote_sim_cfg_t* cfg, dn_mote_sim_tx_cbt tx_cb,
+		dn_mote_sim_trace_cbt trace_cb, uint32_t now_ms)
+{
+	memset(&dn_mote_sim_vars, 0, sizeof (dn_mote_sim_vars));
+	memcpy(&dn_mote_sim_vars.cfg, cfg, sizeof (dn_mote_sim_vars.cfg));
+	dn_mote_sim_vars.tx_cb = tx_cb;
+	dn_mote_sim_vars.trace_cb = trace_cb;
+	dn_mote_sim_vars.rng = (cfg->seed != 0) ? cfg->seed : 1;
+	dn_mote_sim_vars.now_ms = now_ms;
+	dn_fcs_init();
+
+	// Factory defaults, as stored in a fresh mote
+	dn_mote_sim_vars.networkId = DN_DEFAULT_NET_ID;
+	memcpy(dn_mote_sim_vars.joinKey, dn_default_joinKey, DN_JOIN_KEY_LEN);
+
+	// Power up
+	dn_mote_sim_vars.resetting = TRUE;
+	armTimer(SIM_TIMER_BOOT, dn_mote_sim_vars.cfg.bootDelay_ms);
+}
+
+void dn_mote_sim_initReplay(const dn_mote_sim_rec_t* recs, uint32_t count, dn_mote_sim_tx_cbt tx_cb,
+		dn_mote_sim_trace_cbt trace_cb, uint32_t now_ms)
+{
+	memset(&dn_mote_sim_vars, 0, sizeof (dn_mote_sim_vars));
+	dn_mote_sim_vars.tx_cb = tx_cb;
+	dn_mote_sim_vars.trace_cb = trace_cb;
+	dn_mote_sim_vars.now_ms = now_ms;
+	dn_fcs_init();
+
+	dn_mote_sim_vars.replay = recs;
+	dn_mote_sim_vars.replayCount = count;
+	dn_mote_sim_vars.replayStart_ms = now_ms;
+	dn_mote_sim_vars.replayNotif = replayNextNotif(0);
+}
+
+void dn_mote_sim_rx(const uint8_t* data, uint16_t len, uint32_t now_ms)
+{
+	advanceTo(now_ms);
+	while (len-- > 0)
+	{
+		rxByte(*data++);
+	}
+}
+
+void dn_mote_sim_run(uint32_t now_ms)
+{
+	static void (* const handlers[SIM_NUM_TIMERS])(void) = {
+		timer_boot, timer_join, timer_svc, timer_adv, timer_time, timer_downstream
+	};
+	dn_mote_sim_timer_t* timer;
+	uint8_t i;
+
+	advanceTo(now_ms);
+	for (i = 0; i < SIM_NUM_TIMERS; i++)
+	{
+		timer = &dn_mote_sim_vars.timers[i];
+		if (timer->armed && isDue(timer->due_ms))
+		{
+			timer->armed = FALSE;
+			handlers[i]();
+		}
+	}
+	if (dn_mote_sim_vars.replay != NULL)
+	{
+		replayDue();
+	}
+	sendDue();
+}
+
+void dn_mote_sim_reboot(uint32_t now_ms)
+{
+	advanceTo(now_ms);
+	dn_mote_sim_vars.txCount = 0; // Whatever was about to be sent is lost
+	dn_mote_sim_vars.resetting = TRUE;
+	dn_mote_sim_vars.disconnecting = FALSE;
+	armTimer(SIM_TIMER_BOOT, dn_mote_sim_vars.cfg.bootDelay_ms);
+}
+
+uint32_t dn_mote_sim_nextEvent(uint32_t now_ms)
+{
+	uint32_t next = DN_MOTE_SIM_NO_EVENT;
+	int32_t until;
+	uint8_t i;
+
+	for (i = 0; i < SIM_NUM_TIMERS; i++)
+	{
+		if (dn_mote_sim_vars.timers[i].armed)
+		{
+			until = (int32_t)(dn_mote_sim_vars.timers[i].due_ms - now_ms); // Handle wrap around
+			if (until <= 0)
+			{
+				return 0;
+			}
+			if ((uint32_t)until < next)
+			{
+				next = until;
+			}
+		}
+	}
+	if (dn_mote_sim_vars.txCount > 0)
+	{
+		until = (int32_t)(dn_mote_sim_vars.txQueue[0].due_ms - now_ms);
+		if (until <= 0)
+		{
+			return 0;
+		}
+		if ((uint32_t)until < next)
+		{
+			next = until;
+		}
+	}
+	if (dn_mote_sim_vars.replay != NULL && dn_mote_sim_vars.replayNotif < dn_mote_sim_vars.replayCount)
+	{
+		until = (int32_t)(dn_mote_sim_vars.replayStart_ms
+				+ dn_mote_sim_vars.replay[dn_mote_sim_vars.replayNotif].offset_ms - now_ms);
+		if (until <= 0)
+		{
+			return 0;
+		}
+		if ((uint32_t)until < next)
+		{
+			next = until;
+		}
+	}
+	return next;
+}
+
+uint8_t dn_mote_sim_state(void)
+{
+	return dn_mote_sim_vars.state;
+}
+
+const dn_mote_sim_stats_t* dn_mote_sim_getStats(void)
+{
+	return &dn_mote_sim_vars.stats;
+}
+
+//=========================== private =========================================
+
+//========== Time
+
+/**
+ Move the clock forward; time never runs backwards, even when now_ms wraps.
+ */
+static void advanceTo(uint32_t now_ms)
+{
+	dn_mote_sim_vars.clock_ms += (uint32_t)(now_ms - dn_mote_sim_vars.now_ms);
+	dn_mote_sim_vars.now_ms = now_ms;
+}
+
+static void armTimer(uint8_t timer, uint32_t delay_ms)
+{
+	dn_mote_sim_vars.timers[timer].armed = TRUE;
+	dn_mote_sim_vars.timers[timer].due_ms = dn_mote_sim_vars.now_ms + jitter(delay_ms);
+}
+
+static bool isDue(uint32_t due_ms)
+{
+	return (int32_t)(dn_mote_sim_vars.now_ms - due_ms) >= 0; // Handle wrap around
+}
+
+static uint32_t jitter(uint32_t delay_ms)
+{
+	int32_t pct = dn_mote_sim_vars.cfg.jitter_pct;
+
+	if (pct == 0 || delay_ms == 0)
+	{
+		return delay_ms;
+	}
+	pct = (int32_t)(nextRandom() % (2 * pct + 1)) - pct;
+	return delay_ms + (int64_t)delay_ms * pct / 100;
+}
+
+/**
+ Xorshift; the same seed gives the same run on every platform.
+ */
+static uint32_t nextRandom(void)
+{
+	uint32_t x = dn_mote_sim_vars.rng;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	dn_mote_sim_vars.rng = x;
+	return x;
+}
+
+//========== Serial API
+
+//===== rxByte
+
+/**
+ HDLC receive: Collect the bytes between two flags, unescaping as we go, and
+ pass on frames with a valid FCS.
+ */
+static void rxByte(uint8_t b)
+{
+	if (b == DN_HDLC_FLAG)
+	{
+		if (dn_mote_sim_vars.rxBusy && dn_mote_sim_vars.rxLen > 0)
+		{
+			if (dn_mote_sim_vars.rxOverflow
+					|| dn_mote_sim_vars.rxLen < SIM_HEADER_LEN + 2
+					|| dn_fcs_update(DN_HDLC_CRCINIT, dn_mote_sim_vars.rxBuf, dn_mote_sim_vars.rxLen) != DN_HDLC_CRCGOOD
+					|| dn_mote_sim_vars.rxBuf[3] != dn_mote_sim_vars.rxLen - 2 - SIM_HEADER_LEN)
+			{
+				dn_mote_sim_vars.stats.rxErrors++;
+			} else
+			{
+				rxFrame(dn_mote_sim_vars.rxBuf, dn_mote_sim_vars.rxLen - 2);
+			}
+		}
+		// A closing flag may also open the next frame
+		dn_mote_sim_vars.rxBusy = TRUE;
+		dn_mote_sim_vars.rxLen = 0;
+		dn_mote_sim_vars.rxEscaping = FALSE;
+		dn_mote_sim_vars.rxOverflow = FALSE;
+		return;
+	}
+	if (!dn_mote_sim_vars.rxBusy)
+	{
+		return;
+	}
+	if (b == DN_HDLC_ESCAPE)
+	{
+		dn_mote_sim_vars.rxEscaping = TRUE;
+		return;
+	}
+	if (dn_mote_sim_vars.rxEscaping)
+	{
+		b ^= DN_HDLC_ESCAPE_MASK;
+		dn_mote_sim_vars.rxEscaping = FALSE;
+	}
+	if (dn_mote_sim_vars.rxLen < sizeof (dn_mote_sim_vars.rxBuf))
+	{
+		dn_mote_sim_vars.rxBuf[dn_mote_sim_vars.rxLen++] = b;
+	} else
+	{
+		dn_mote_sim_vars.rxOverflow = TRUE;
+	}
+}
+
+//===== rxFrame
+
+/**
+ Execute a request from the host and queue its reply. A retransmitted request
+ (same command and sequence number as the last one) is answered with the last
+ reply instead of being executed twice.
+ */
+static void rxFrame(const uint8_t* frame, uint8_t len)
+{
+	uint8_t control = frame[0];
+	uint8_t cmdId = frame[1];
+	uint8_t seqNo = frame[2];
+	const uint8_t* req = &frame[SIM_HEADER_LEN];
+	uint8_t reqLen = len - SIM_HEADER_LEN;
+	uint8_t rsp[SIM_MAX_PAYLOAD_LEN];
+	uint8_t rspLen;
+	uint32_t delay_ms;
+
+	dn_mote_sim_vars.stats.rxFrames++;
+	if (dn_mote_sim_vars.trace_cb != NULL)
+	{
+		dn_mote_sim_vars.trace_cb(FALSE, frame, len);
+	}
+
+	if (control & SIM_CTRL_ACK)
+	{
+		// Host acknowledging a notification
+		dn_mote_sim_vars.stats.acks++;
+		return;
+	}
+	if (dn_mote_sim_vars.resetting)
+	{
+		// Rebooting; nobody is listening
+		return;
+	}
+	dn_mote_sim_vars.stats.requests++;
+
+	if (dn_mote_sim_vars.lastReqValid
+			&& cmdId == dn_mote_sim_vars.lastReqCmdId
+			&& seqNo == dn_mote_sim_vars.lastReqSeqNo)
+	{
+		reply(cmdId, seqNo, dn_mote_sim_vars.lastReply, dn_mote_sim_vars.lastReplyLen);
+		return;
+	}
+
+	if (dn_mote_sim_vars.replay != NULL)
+	{
+		if (!replayReply(cmdId, req, reqLen, rsp, &rspLen, &delay_ms))
+		{
+			dn_mote_sim_vars.stats.replayMisses++;
+			return;
+		}
+		dn_mote_sim_vars.stats.replayedReplies++;
+		dn_mote_sim_vars.lastReqValid = TRUE;
+		dn_mote_sim_vars.lastReqCmdId = cmdId;
+		dn_mote_sim_vars.lastReqSeqNo = seqNo;
+		dn_mote_sim_vars.lastReplyLen = rspLen;
+		memcpy(dn_mote_sim_vars.lastReply, rsp, rspLen);
+		queueFrame(SIM_CTRL_ACK, cmdId, seqNo, rsp, rspLen, delay_ms);
+		return;
+	}
+
+	switch (cmdId)
+	{
+	case CMDID_SETPARAMETER:
+		rspLen = cmd_setParameter(req, reqLen, rsp);
+		break;
+	case CMDID_GETPARAMETER:
+		rspLen = cmd_getParameter(req, reqLen, rsp);
+		break;
+	case CMDID_OPENSOCKET:
+		rspLen = cmd_openSocket(req, reqLen, rsp);
+		break;
+	case CMDID_BINDSOCKET:
+		rspLen = cmd_bindSocket(req, reqLen, rsp);
+		break;
+	case CMDID_SEARCH:
+		rspLen = cmd_search(req, reqLen, rsp);
+		break;
+	case CMDID_JOIN:
+		rspLen = cmd_join(req, reqLen, rsp);
+		break;
+	case CMDID_REQUESTSERVICE:
+		rspLen = cmd_requestService(req, reqLen, rsp);
+		break;
+	case CMDID_GETSERVICEINFO:
+		rspLen = cmd_getServiceInfo(req, reqLen, rsp);
+		break;
+	case CMDID_SENDTO:
+		rspLen = cmd_sendTo(req, reqLen, rsp);
+		break;
+	case CMDID_RESET:
+		rspLen = cmd_reset(req, reqLen, rsp);
+		break;
+	case CMDID_DISCONNECT:
+		rspLen = cmd_disconnect(req, reqLen, rsp);
+		break;
+	default:
+		rsp[0] = DN_RC_UNKNOWN_CMD;
+		rspLen = 1;
+		break;
+	}
+
+	dn_mote_sim_vars.lastReqValid = TRUE;
+	dn_mote_sim_vars.lastReqCmdId = cmdId;
+	dn_mote_sim_vars.lastReqSeqNo = seqNo;
+	dn_mote_sim_vars.lastReplyLen = rspLen;
+	memcpy(dn_mote_sim_vars.lastReply, rsp, rspLen);
+	reply(cmdId, seqNo, rsp, rspLen);
+}
+
+//===== queueFrame
+
+/**
+ Queue a frame to be sent after the given delay. Frames due at the same time
+ keep the order they were queued in.
+ */
+static void queueFrame(uint8_t control, uint8_t cmdId, uint8_t seqNo, const uint8_t* payload, uint8_t len, uint32_t delay_ms)
+{
+	dn_mote_sim_txFrame_t* txFrame;
+	uint32_t due_ms = dn_mote_sim_vars.now_ms + delay_ms;
+	uint8_t pos;
+
+	if (dn_mote_sim_vars.txCount == DN_MOTE_SIM_TX_QUEUE_SIZE || len > SIM_MAX_PAYLOAD_LEN)
+	{
+		dn_mote_sim_vars.stats.txDropped++;
+		return;
+	}
+
+	// Insert after every frame due no later than this one
+	pos = dn_mote_sim_vars.txCount;
+	while (pos > 0 && (int32_t)(dn_mote_sim_vars.txQueue[pos - 1].due_ms - due_ms) > 0)
+	{
+		dn_mote_sim_vars.txQueue[pos] = dn_mote_sim_vars.txQueue[pos - 1];
+		pos--;
+	}
+	txFrame = &dn_mote_sim_vars.txQueue[pos];
+	txFrame->due_ms = due_ms;
+	txFrame->len = SIM_HEADER_LEN + len;
+	txFrame->frame[0] = control;
+	txFrame->frame[1] = cmdId;
+	txFrame->frame[2] = seqNo;
+	txFrame->frame[3] = len;
+	memcpy(&txFrame->frame[SIM_HEADER_LEN], payload, len);
+	dn_mote_sim_vars.txCount++;
+}
+
+static void reply(uint8_t cmdId, uint8_t seqNo, const uint8_t* payload, uint8_t len)
+{
+	queueFrame(SIM_CTRL_ACK, cmdId, seqNo, payload, len, dn_mote_sim_vars.cfg.replyDelay_ms);
+}
+
+static void notify(uint8_t cmdId, const uint8_t* payload, uint8_t len, uint32_t delay_ms)
+{
+	dn_mote_sim_vars.stats.notifs++;
+	queueFrame(SIM_CTRL_ACK_REQUESTED, cmdId, dn_mote_sim_vars.notifSeqNo++, payload, len, delay_ms);
+}
+
+static void notifyEvents(uint32_t events, uint32_t delay_ms)
+{
+	uint8_t payload[9];
+
+	putU32(&payload[0], events);
+	payload[4] = dn_mote_sim_vars.state;
+	putU32(&payload[5], 0); // No alarms
+	notify(CMDID_EVENTS, payload, sizeof (payload), delay_ms);
+}
+
+//===== sendDue
+
+/**
+ Encode and hand over every frame that is due, oldest first.
+ */
+static void sendDue(void)
+{
+	uint8_t out[SIM_ENCODED_MAX_LEN];
+	dn_mote_sim_txFrame_t* txFrame;
+	uint16_t outLen;
+
+	while (dn_mote_sim_vars.txCount > 0 && isDue(dn_mote_sim_vars.txQueue[0].due_ms))
+	{
+		txFrame = &dn_mote_sim_vars.txQueue[0];
+		if (dn_mote_sim_vars.trace_cb != NULL)
+		{
+			dn_mote_sim_vars.trace_cb(TRUE, txFrame->frame, txFrame->len);
+		}
+		outLen = encode(txFrame->frame, txFrame->len, out);
+
+		// Remove before calling out, which may feed the next request right back
+		dn_mote_sim_vars.txCount--;
+		memmove(&dn_mote_sim_vars.txQueue[0], &dn_mote_sim_vars.txQueue[1],
+				dn_mote_sim_vars.txCount * sizeof (dn_mote_sim_vars.txQueue[0]));
+		dn_mote_sim_vars.tx_cb(out, outLen);
+	}
+}
+
+//===== encode
+
+/**
+ HDLC transmit: Flag, escaped frame and FCS (LSB first), flag.
+ */
+static uint16_t encode(const uint8_t* frame, uint8_t len, uint8_t* out)
+{
+	uint8_t fcsBytes[2];
+	uint16_t fcs;
+	uint16_t n = 0;
+	uint8_t b;
+	uint8_t i;
+
+	fcs = (uint16_t)~dn_fcs_update(DN_HDLC_CRCINIT, frame, len);
+	fcsBytes[0] = fcs & 0xff;
+	fcsBytes[1] = fcs >> 8;
+
+	out[n++] = DN_HDLC_FLAG;
+	for (i = 0; i < len + 2; i++)
+	{
+		b = (i < len) ? frame[i] : fcsBytes[i - len];
+		if (b == DN_HDLC_FLAG || b == DN_HDLC_ESCAPE)
+		{
+			out[n++] = DN_HDLC_ESCAPE;
+			b ^= DN_HDLC_ESCAPE_MASK;
+		}
+		out[n++] = b;
+	}
+	out[n++] = DN_HDLC_FLAG;
+	return n;
+}
+
+//========== Replay
+
+//===== replayDue
+
+/**
+ Queue the recorded notifications that are due, with their recorded control
+ byte and sequence number, as long as there is room.
+ */
+static void replayDue(void)
+{
+	const dn_mote_sim_rec_t* rec;
+
+	while (dn_mote_sim_vars.replayNotif < dn_mote_sim_vars.replayCount
+			&& dn_mote_sim_vars.txCount < DN_MOTE_SIM_TX_QUEUE_SIZE)
+	{
+		rec = &dn_mote_sim_vars.replay[dn_mote_sim_vars.replayNotif];
+		if (!isDue(dn_mote_sim_vars.replayStart_ms + rec->offset_ms))
+		{
+			break;
+		}
+		queueFrame(rec->frame[0], rec->frame[1], rec->frame[2], &rec->frame[SIM_HEADER_LEN],
+				rec->len - SIM_HEADER_LEN, 0);
+		dn_mote_sim_vars.stats.notifs++;
+		dn_mote_sim_vars.stats.replayedNotifs++;
+		dn_mote_sim_vars.replayNotif = replayNextNotif(dn_mote_sim_vars.replayNotif + 1);
+	}
+}
+
+//===== replayReply
+
+/**
+ Find the next recorded request of the same command, and of the same parameter
+ for setParameter and getParameter, that was answered, and get its reply and
+ how long it took. A recorded request that was asked again before any reply
+ (a retransmission) is passed over for the later one.
+ */
+static bool replayReply(uint8_t cmdId, const uint8_t* req, uint8_t reqLen, uint8_t* rsp, uint8_t* rspLen, uint32_t* delay_ms)
+{
+	const dn_mote_sim_rec_t* recs = dn_mote_sim_vars.replay;
+	const dn_mote_sim_rec_t* rec;
+	const dn_mote_sim_rec_t* answer;
+	uint32_t* cursor = &dn_mote_sim_vars.replayCursor[cmdId];
+	bool byParam = FALSE;
+	uint32_t i;
+	uint32_t j;
+
+	if ((cmdId == CMDID_SETPARAMETER || cmdId == CMDID_GETPARAMETER) && reqLen > 0)
+	{
+		cursor = &dn_mote_sim_vars.replayParamCursor[cmdId == CMDID_GETPARAMETER][req[0]];
+		byParam = TRUE;
+	}
+
+	for (i = *cursor; i < dn_mote_sim_vars.replayCount; i++)
+	{
+		rec = &recs[i];
+		if (!isRecRequest(rec) || rec->frame[1] != cmdId
+				|| (byParam && (rec->len <= SIM_HEADER_LEN || rec->frame[SIM_HEADER_LEN] != req[0])))
+		{
+			continue;
+		}
+		for (j = i + 1; j < dn_mote_sim_vars.replayCount; j++)
+		{
+			answer = &recs[j];
+			if (isRecRequest(answer) && answer->frame[1] == cmdId)
+			{
+				break; // Asked again before any reply
+			}
+			if (!answer->toMote && (answer->frame[0] & SIM_CTRL_ACK)
+					&& answer->frame[1] == cmdId && answer->frame[2] == rec->frame[2])
+			{
+				*cursor = i + 1;
+				*rspLen = answer->len - SIM_HEADER_LEN;
+				memcpy(rsp, &answer->frame[SIM_HEADER_LEN], *rspLen);
+				*delay_ms = answer->offset_ms - rec->offset_ms;
+				return TRUE;
+			}
+		}
+	}
+	return FALSE;
+}
+
+/**
+ Index of the first recorded notification at or after from.
+ */
+static uint32_t replayNextNotif(uint32_t from)
+{
+	const dn_mote_sim_rec_t* rec;
+
+	for (; from < dn_mote_sim_vars.replayCount; from++)
+	{
+		rec = &dn_mote_sim_vars.replay[from];
+		if (!rec->toMote && !(rec->frame[0] & SIM_CTRL_ACK) && rec->len >= SIM_HEADER_LEN)
+		{
+			break;
+		}
+	}
+	return from;
+}
+
+static bool isRecRequest(const dn_mote_sim_rec_t* rec)
+{
+	return rec->toMote && !(rec->frame[0] & SIM_CTRL_ACK) && rec->len >= SIM_HEADER_LEN;
+}
+
+//========== Commands
+
+static uint8_t cmd_setParameter(const uint8_t* req, uint8_t len, uint8_t* rsp)
+{
+	if (len < 1)
+	{
+		rsp[0] = DN_RC_INVALID_LEN;
+		return 1;
+	}
+	rsp[0] = DN_RC_OK;
+	rsp[1] = req[0];
+	switch (req[0])
+	{
+	case PARAMID_JOINKEY:
+		if (len != 1 + DN_JOIN_KEY_LEN)
+		{
+			rsp[0] = DN_RC_INVALID_LEN;
+			break;
+		}
+		memcpy(dn_mote_sim_vars.joinKey, &req[1], DN_JOIN_KEY_LEN);
+		break;
+	case PARAMID_NETWORKID:
+		if (len != 3)
+		{
+			rsp[0] = DN_RC_INVALID_LEN;
+			break;
+		}
+		dn_mote_sim_vars.networkId = getU16(&req[1]);
+		break;
+	case PARAMID_JOINDUTYCYCLE:
+		if (len != 2)
+		{
+			rsp[0] = DN_RC_INVALID_LEN;
+			break;
+		}
+		dn_mote_sim_vars.joinDutyCycle = req[1];
+		break;
+	default:
+		rsp[0] = DN_RC_UNKNOWN_PARAM;
+		break;
+	}
+	return 2;
+}
+
+static uint8_t cmd_getParameter(const uint8_t* req, uint8_t len, uint8_t* rsp)
+{
+	const dn_mote_sim_cfg_t* cfg = &dn_mote_sim_vars.cfg;
+	uint8_t n = 2;
+
+	if (len < 1)
+	{
+		rsp[0] = DN_RC_INVALID_LEN;
+		return 1;
+	}
+	rsp[0] = DN_RC_OK;
+	rsp[1] = req[0];
+	switch (req[0])
+	{
+	case PARAMID_MOTESTATUS:
+		rsp[n++] = dn_mote_sim_vars.state;
+		rsp[n++] = 0;
+		putU16(&rsp[n], 0);
+		n += 2;
+		rsp[n++] = (dn_mote_sim_vars.state == DN_MOTE_STATE_OPERATIONAL) ? SIM_NUM_PARENTS : 0;
+		putU32(&rsp[n], 0); // No alarms
+		n += 4;
+		rsp[n++] = 0;
+		break;
+	case PARAMID_MOTEINFO:
+		rsp[n++] = SIM_API_VERSION;
+		memcpy(&rsp[n], cfg->macAddress, sizeof (cfg->macAddress));
+		n += sizeof (cfg->macAddress);
+		rsp[n++] = SIM_HW_MODEL;
+		rsp[n++] = SIM_HW_REV;
+		rsp[n++] = cfg->swVerMajor;
+		rsp[n++] = cfg->swVerMinor;
+		rsp[n++] = cfg->swVerPatch;
+		putU16(&rsp[n], cfg->swVerBuild);
+		n += 2;
+		rsp[n++] = SIM_BOOT_SW_VER;
+		break;
+	case PARAMID_NETWORKID:
+		putU16(&rsp[n], dn_mote_sim_vars.networkId);
+		n += 2;
+		break;
+	case PARAMID_TIME:
+		n += writeTime(&rsp[n]);
+		break;
+	default:
+		rsp[0] = DN_RC_UNKNOWN_PARAM;
+		break;
+	}
+	return n;
+}
+
+static uint8_t cmd_openSocket(const uint8_t* req, uint8_t len, uint8_t* rsp)
+{
+	uint8_t i;
+
+	if (len != 1)
+	{
+		rsp[0] = DN_RC_INVALID_LEN;
+		return 1;
+	}
+	if (req[0] != DN_PROTOCOL_TYPE_UDP)
+	{
+		rsp[0] = DN_RC_INVALID_VALUE;
+		return 1;
+	}
+	for (i = 0; i < DN_MOTE_SIM_MAX_SOCKETS; i++)
+	{
+		if (!dn_mote_sim_vars.sockets[i].open)
+		{
+			memset(&dn_mote_sim_vars.sockets[i], 0, sizeof (dn_mote_sim_vars.sockets[i]));
+			dn_mote_sim_vars.sockets[i].open = TRUE;
+			rsp[0] = DN_RC_OK;
+			rsp[1] = SIM_SOCKET_ID_BASE + i;
+			return 2;
+		}
+	}
+	rsp[0] = DN_RC_NO_RESOURCES;
+	return 1;
+}
+
+static uint8_t cmd_bindSocket(const uint8_t* req, uint8_t len, uint8_t* rsp)
+{
+	dn_mote_sim_socket_t* socket;
+	uint16_t port;
+	uint8_t i;
+
+	if (len != 3)
+	{
+		rsp[0] = DN_RC_INVALID_LEN;
+		return 1;
+	}
+	socket = findSocket(req[0]);
+	port = getU16(&req[1]);
+	if (socket == NULL)
+	{
+		rsp[0] = DN_RC_NOT_FOUND;
+		return 1;
+	}
+	for (i = 0; i < DN_MOTE_SIM_MAX_SOCKETS; i++)
+	{
+		if (dn_mote_sim_vars.sockets[i].bound && dn_mote_sim_vars.sockets[i].port == port)
+		{
+			rsp[0] = DN_RC_BUSY;
+			return 1;
+		}
+	}
+	socket->bound = TRUE;
+	socket->port = port;
+	rsp[0] = DN_RC_OK;
+	return 1;
+}
+
+static uint8_t cmd_search(const uint8_t* req, uint8_t len, uint8_t* rsp)
+{
+	if (dn_mote_sim_vars.state != DN_MOTE_STATE_IDLE)
+	{
+		rsp[0] = DN_RC_INVALID_STATE;
+		return 1;
+	}
+	dn_mote_sim_vars.state = DN_MOTE_STATE_SEARCHING;
+	dn_mote_sim_vars.searching = TRUE;
+	armTimer(SIM_TIMER_ADV, dn_mote_sim_vars.cfg.advPeriod_ms);
+	rsp[0] = DN_RC_OK;
+	return 1;
+}
+
+static uint8_t cmd_join(const uint8_t* req, uint8_t len, uint8_t* rsp)
+{
+	uint16_t netId = dn_mote_sim_vars.networkId;
+	const dn_mote_sim_cfg_t* cfg = &dn_mote_sim_vars.cfg;
+
+	if ((dn_mote_sim_vars.state != DN_MOTE_STATE_IDLE
+			&& dn_mote_sim_vars.state != DN_MOTE_STATE_SEARCHING)
+			|| dn_mote_sim_vars.joining)
+	{
+		rsp[0] = DN_RC_INVALID_STATE;
+		return 1;
+	}
+
+	// Stop reporting advertisements
+	dn_mote_sim_vars.searching = FALSE;
+	dn_mote_sim_vars.timers[SIM_TIMER_ADV].armed = FALSE;
+
+	dn_mote_sim_vars.state = DN_MOTE_STATE_SEARCHING;
+	if (netId == DN_PROMISCUOUS_NET_ID
+			&& (cfg->swVerMajor > DN_MOTE_CAP_JOIN_ANY_NET_ID_MIN_MAJOR
+			|| (cfg->swVerMajor == DN_MOTE_CAP_JOIN_ANY_NET_ID_MIN_MAJOR
+			&& cfg->swVerMinor >= DN_MOTE_CAP_JOIN_ANY_NET_ID_MIN_MINOR)))
+	{
+		dn_mote_sim_vars.joinNet = (cfg->numNets > 0) ? &cfg->nets[0] : NULL;
+	} else
+	{
+		dn_mote_sim_vars.joinNet = findNet(netId);
+	}
+	rsp[0] = DN_RC_OK;
+	notifyEvents(DN_MOTE_EVENT_MASK_JOIN_STARTED, cfg->replyDelay_ms); // After the reply
+	dn_mote_sim_vars.joining = TRUE;
+	dn_mote_sim_vars.stats.joins++;
+	startJoinAttempt();
+	return 1;
+}
+
+static uint8_t cmd_requestService(const uint8_t* req, uint8_t len, uint8_t* rsp)
+{
+	if (len != 7)
+	{
+		rsp[0] = DN_RC_INVALID_LEN;
+		return 1;
+	}
+	if (dn_mote_sim_vars.state != DN_MOTE_STATE_OPERATIONAL)
+	{
+		rsp[0] = DN_RC_INVALID_STATE;
+		return 1;
+	}
+	if (getU16(&req[0]) != DN_SERVICE_ADDRESS || req[2] != DN_SERVICE_TYPE_BW)
+	{
+		rsp[0] = DN_RC_INVALID_VALUE;
+		return 1;
+	}
+	dn_mote_sim_vars.svcRequested_ms = getU32(&req[3]);
+	dn_mote_sim_vars.svcPending = TRUE;
+	armTimer(SIM_TIMER_SVC, dn_mote_sim_vars.cfg.svcDelay_ms);
+	rsp[0] = DN_RC_OK;
+	return 1;
+}
+
+static uint8_t cmd_getServiceInfo(const uint8_t* req, uint8_t len, uint8_t* rsp)
+{
+	if (len != 3)
+	{
+		rsp[0] = DN_RC_INVALID_LEN;
+		return 1;
+	}
+	rsp[0] = DN_RC_OK;
+	memcpy(&rsp[1], req, 3);
+	rsp[4] = dn_mote_sim_vars.svcPending ? DN_SERVICE_STATE_PENDING : DN_SERVICE_STATE_COMPLETED;
+	putU32(&rsp[5], dn_mote_sim_vars.service_ms);
+	return 9;
+}
+
+static uint8_t cmd_sendTo(const uint8_t* req, uint8_t len, uint8_t* rsp)
+{
+	const uint8_t hdrLen = 1 + DN_IPv6ADDR_LEN + 2 + 1 + 1 + 2;
+	dn_mote_sim_socket_t* socket;
+	uint8_t notif[1 + DN_IPv6ADDR_LEN + 2 + SIM_MAX_PAYLOAD_LEN];
+	uint8_t payloadLen;
+	uint16_t destPort;
+	uint16_t packetId;
+
+	if (len < hdrLen || len - hdrLen > DN_PAYLOAD_SIZE_LIMIT_MNG_HIGH)
+	{
+		rsp[0] = DN_RC_INVALID_LEN;
+		return 1;
+	}
+	if (dn_mote_sim_vars.state != DN_MOTE_STATE_OPERATIONAL)
+	{
+		rsp[0] = DN_RC_INVALID_STATE;
+		return 1;
+	}
+	socket = findSocket(req[0]);
+	if (socket == NULL || !socket->bound)
+	{
+		rsp[0] = DN_RC_NOT_FOUND;
+		return 1;
+	}
+	destPort = getU16(&req[1 + DN_IPv6ADDR_LEN]);
+	packetId = getU16(&req[1 + DN_IPv6ADDR_LEN + 4]);
+	payloadLen = len - hdrLen;
+	dn_mote_sim_vars.stats.packetsSent++;
+	rsp[0] = DN_RC_OK;
+
+	if (packetId != DN_PACKET_ID_NO_NOTIF)
+	{
+		uint8_t txDone[3];
+		putU16(&txDone[0], packetId);
+		txDone[2] = 0; // Delivered
+		notify(CMDID_TXDONE, txDone, sizeof (txDone), jitter(dn_mote_sim_vars.cfg.txDoneDelay_ms));
+	}
+	if (dn_mote_sim_vars.cfg.echo)
+	{
+		// Back from where it went, to the port it came from
+		notif[0] = req[0];
+		memcpy(&notif[1], &req[1], DN_IPv6ADDR_LEN);
+		putU16(&notif[1 + DN_IPv6ADDR_LEN], destPort);
+		memcpy(&notif[1 + DN_IPv6ADDR_LEN + 2], &req[hdrLen], payloadLen);
+		notify(CMDID_RECEIVE, notif, 1 + DN_IPv6ADDR_LEN + 2 + payloadLen,
+				jitter(dn_mote_sim_vars.cfg.txDoneDelay_ms));
+	}
+	return 1;
+}
+
+static uint8_t cmd_reset(const uint8_t* req, uint8_t len, uint8_t* rsp)
+{
+	dn_mote_sim_vars.resetting = TRUE;
+	armTimer(SIM_TIMER_BOOT, dn_mote_sim_vars.cfg.bootDelay_ms);
+	rsp[0] = DN_RC_OK;
+	return 1;
+}
+
+static uint8_t cmd_disconnect(const uint8_t* req, uint8_t len, uint8_t* rsp)
+{
+	if (dn_mote_sim_vars.state == DN_MOTE_STATE_IDLE || dn_mote_sim_vars.disconnecting)
+	{
+		rsp[0] = DN_RC_INVALID_STATE;
+		return 1;
+	}
+	dn_mote_sim_vars.disconnecting = TRUE;
+	armTimer(SIM_TIMER_BOOT, dn_mote_sim_vars.cfg.disconnectDelay_ms);
+	rsp[0] = DN_RC_OK;
+	return 1;
+}
+
+//========== Timers
+
+/**
+ Boot, unless this was the end of a disconnect, which is followed by a reset.
+ */
+static void timer_boot(void)
+{
+	if (dn_mote_sim_vars.disconnecting)
+	{
+		dn_mote_sim_vars.disconnecting = FALSE;
+		notifyEvents(DN_MOTE_EVENT_MASK_DISCONNECTED, 0);
+		dn_mote_sim_vars.resetting = TRUE;
+		armTimer(SIM_TIMER_BOOT, dn_mote_sim_vars.cfg.bootDelay_ms);
+		return;
+	}
+	boot();
+}
+
+/**
+ End of a join attempt. It fails if the join key is wrong or the dice say so,
+ in which case the mote tries again.
+ */
+static void timer_join(void)
+{
+	const dn_mote_sim_net_t* net = dn_mote_sim_vars.joinNet;
+	bool failed;
+
+	if (!dn_mote_sim_vars.joining)
+	{
+		return;
+	}
+	failed = memcmp(net->joinKey, dn_mote_sim_vars.joinKey, DN_JOIN_KEY_LEN) != 0
+			|| nextRandom() % 100 < dn_mote_sim_vars.cfg.joinFail_pct;
+	if (failed)
+	{
+		dn_mote_sim_vars.stats.joinFails++;
+		notifyEvents(DN_MOTE_EVENT_MASK_JOIN_FAIL, 0);
+		dn_mote_sim_vars.stats.joins++;
+		startJoinAttempt();
+		return;
+	}
+
+	dn_mote_sim_vars.joining = FALSE;
+	dn_mote_sim_vars.state = DN_MOTE_STATE_OPERATIONAL;
+	notifyEvents(DN_MOTE_EVENT_MASK_OPERATIONAL, 0);
+	if (dn_mote_sim_vars.cfg.timeIndicationPeriod_ms > 0)
+	{
+		armTimer(SIM_TIMER_TIME, dn_mote_sim_vars.cfg.timeIndicationPeriod_ms);
+	}
+	if (dn_mote_sim_vars.cfg.downstreamPeriod_ms > 0)
+	{
+		armTimer(SIM_TIMER_DOWNSTREAM, dn_mote_sim_vars.cfg.downstreamPeriod_ms);
+	}
+}
+
+static void timer_svc(void)
+{
+	if (dn_mote_sim_vars.state != DN_MOTE_STATE_OPERATIONAL)
+	{
+		return;
+	}
+	dn_mote_sim_vars.svcPending = FALSE;
+	dn_mote_sim_vars.stats.svcGrants++;
+	dn_mote_sim_vars.service_ms = dn_mote_sim_vars.svcRequested_ms;
+	if (dn_mote_sim_vars.service_ms < dn_mote_sim_vars.cfg.minService_ms)
+	{
+		dn_mote_sim_vars.service_ms = dn_mote_sim_vars.cfg.minService_ms;
+	}
+	notifyEvents(DN_MOTE_EVENT_MASK_SVC_CHANGE, 0);
+}
+
+/**
+ Report an advertisement from each network within range in turn.
+ */
+static void timer_adv(void)
+{
+	const dn_mote_sim_net_t* net;
+	uint8_t adv[6];
+	uint16_t moteId;
+
+	if (!dn_mote_sim_vars.searching || dn_mote_sim_vars.cfg.numNets == 0)
+	{
+		return;
+	}
+	net = &dn_mote_sim_vars.cfg.nets[dn_mote_sim_vars.advNext];
+	dn_mote_sim_vars.advNext = (dn_mote_sim_vars.advNext + 1) % dn_mote_sim_vars.cfg.numNets;
+
+	moteId = SIM_MANAGER_MOTE_ID + nextRandom() % SIM_ADV_NEIGHBORS;
+	putU16(&adv[0], net->netId);
+	putU16(&adv[2], moteId);
+	adv[4] = (uint8_t)(net->rssi + (int8_t)(nextRandom() % 7) - 3);
+	adv[5] = moteId - SIM_MANAGER_MOTE_ID; // The access point is closest to the manager
+	notify(CMDID_ADVRECEIVED, adv, sizeof (adv), 0);
+	armTimer(SIM_TIMER_ADV, dn_mote_sim_vars.cfg.advPeriod_ms / dn_mote_sim_vars.cfg.numNets);
+}
+
+/**
+ Stand-in for the TIME pin being strobed.
+ */
+static void timer_time(void)
+{
+	uint8_t payload[4 + 8 + 4 + 5 + 2];
+
+	if (dn_mote_sim_vars.state != DN_MOTE_STATE_OPERATIONAL)
+	{
+		return;
+	}
+	notify(CMDID_TIMEINDICATION, payload, writeTime(payload), 0);
+	armTimer(SIM_TIMER_TIME, dn_mote_sim_vars.cfg.timeIndicationPeriod_ms);
+}
+
+/**
+ Downstream data from the manager: a 4-byte counter, to the first bound socket.
+ */
+static void timer_downstream(void)
+{
+	uint8_t notif[1 + DN_IPv6ADDR_LEN + 2 + 4];
+	uint8_t socketId;
+
+	if (dn_mote_sim_vars.state != DN_MOTE_STATE_OPERATIONAL)
+	{
+		return;
+	}
+	if (firstBoundSocket(&socketId) != NULL)
+	{
+		notif[0] = socketId;
+		memcpy(&notif[1], dn_default_manager_ipv6Addr, DN_IPv6ADDR_LEN);
+		putU16(&notif[1 + DN_IPv6ADDR_LEN], SIM_DOWNSTREAM_SRC_PORT);
+		putU32(&notif[1 + DN_IPv6ADDR_LEN + 2], dn_mote_sim_vars.downstreamCount++);
+		notify(CMDID_RECEIVE, notif, sizeof (notif), 0);
+	}
+	armTimer(SIM_TIMER_DOWNSTREAM, dn_mote_sim_vars.cfg.downstreamPeriod_ms);
+}
+
+//=========================== helpers =========================================
+
+/**
+ Come up idle, with everything but the stored configuration forgotten.
+ */
+static void boot(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < SIM_NUM_TIMERS; i++)
+	{
+		dn_mote_sim_vars.timers[i].armed = FALSE;
+	}
+	memset(dn_mote_sim_vars.sockets, 0, sizeof (dn_mote_sim_vars.sockets));
+	dn_mote_sim_vars.state = DN_MOTE_STATE_IDLE;
+	dn_mote_sim_vars.resetting = FALSE;
+	dn_mote_sim_vars.searching = FALSE;
+	dn_mote_sim_vars.joining = FALSE;
+	dn_mote_sim_vars.joinNet = NULL;
+	dn_mote_sim_vars.joinDutyCycle = SIM_DEFAULT_JOIN_DUTY_CYCLE;
+	dn_mote_sim_vars.svcPending = FALSE;
+	dn_mote_sim_vars.service_ms = 0;
+	dn_mote_sim_vars.lastReqValid = FALSE;
+	dn_mote_sim_vars.boot_ms = dn_mote_sim_vars.clock_ms;
+	dn_mote_sim_vars.stats.boots++;
+	notifyEvents(DN_MOTE_EVENT_MASK_BOOT, 0);
+}
+
+/**
+ Arm the end of a join attempt, unless no network with the configured ID is
+ within range, in which case the mote keeps searching forever. Joining takes
+ longer as the duty cycle is lowered.
+ */
+static void startJoinAttempt(void)
+{
+	uint8_t dutyCycle = dn_mote_sim_vars.joinDutyCycle;
+
+	if (dn_mote_sim_vars.joinNet == NULL)
+	{
+		return;
+	}
+	if (dutyCycle == 0)
+	{
+		dutyCycle = 1;
+	}
+	armTimer(SIM_TIMER_JOIN, (uint64_t)dn_mote_sim_vars.cfg.joinDelay_ms * SIM_DEFAULT_JOIN_DUTY_CYCLE / dutyCycle);
+}
+
+/**
+ Write uptime, UTC, ASN and offset into the ASN, as in timeIndication and
+ getParameter<time>. Returns the number of bytes written.
+ */
+static uint8_t writeTime(uint8_t* out)
+{
+	uint64_t clock_us = dn_mote_sim_vars.clock_ms * 1000;
+	uint64_t utcSecs = SIM_UTC_BASE_S + dn_mote_sim_vars.clock_ms / 1000;
+	uint64_t asn = clock_us / DN_ASN_SLOT_US;
+
+	putU32(&out[0], (uint32_t)((dn_mote_sim_vars.clock_ms - dn_mote_sim_vars.boot_ms) / 1000));
+	putU32(&out[4], (uint32_t)(utcSecs >> 32));
+	putU32(&out[8], (uint32_t)utcSecs);
+	putU32(&out[12], (uint32_t)(clock_us % 1000000));
+	out[16] = (uint8_t)(asn >> 32);
+	putU32(&out[17], (uint32_t)asn);
+	putU16(&out[21], (uint16_t)(clock_us % DN_ASN_SLOT_US));
+	return 23;
+}
+
+static const dn_mote_sim_net_t* findNet(uint16_t netId)
+{
+	uint8_t i;
+
+	for (i = 0; i < dn_mote_sim_vars.cfg.numNets; i++)
+	{
+		if (dn_mote_sim_vars.cfg.nets[i].netId == netId)
+		{
+			return &dn_mote_sim_vars.cfg.nets[i];
+		}
+	}
+	return NULL;
+}
+
+static dn_mote_sim_socket_t* findSocket(uint8_t socketId)
+{
+	uint8_t i = socketId - SIM_SOCKET_ID_BASE;
+
+	if (i >= DN_MOTE_SIM_MAX_SOCKETS || !dn_mote_sim_vars.sockets[i].open)
+	{
+		return NULL;
+	}
+	return &dn_mote_sim_vars.sockets[i];
+}
+
+static dn_mote_sim_socket_t* firstBoundSocket(uint8_t* socketId)
+{
+	uint8_t i;
+
+	for (i = 0; i < DN_MOTE_SIM_MAX_SOCKETS; i++)
+	{
+		if (dn_mote_sim_vars.sockets[i].bound)
+		{
+			*socketId = SIM_SOCKET_ID_BASE + i;
+			return &dn_mote_sim_vars.sockets[i];
+		}
+	}
+	return NULL;
+}
+
+static void putU16(uint8_t* out, uint16_t v)
+{
+	out[0] = v >> 8;
+	out[1] = v & 0xff;
+}
+
+static void putU32(uint8_t* out, uint32_t v)
+{
+	out[0] = v >> 24;
+	out[1] = (v >> 16) & 0xff;
+	out[2] = (v >> 8) & 0xff;
+	out[3] = v & 0xff;
+}
+
+static uint16_t getU16(const uint8_t* in)
+{
+	return ((uint16_t)in[0] << 8) | in[1];
+}
+
+static uint32_t getU32(const uint8_t* in)
+{
+	return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
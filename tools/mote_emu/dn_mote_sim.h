@@ -0,0 +1,198 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Simulated SmartMesh IP mote, for exercising the QuickStart Library without an
+LTC5800.
+
+The mote speaks the HDLC-framed serial API, but knows nothing of how the bytes
+are carried or how time passes: Bytes from the host are fed in with
+dn_mote_sim_rx, bytes to the host are handed to the TX callback, and the
+caller passes the current time in ms to every call. It can thus sit behind a
+pseudo-terminal in real time (mote_emu.c) or be driven in-process under a
+virtual clock.
+
+Only the subset of the API used by the QuickStart Library is implemented:
+ - Commands: setParameter (joinKey, networkId, joinDutyCycle), getParameter
+   (moteStatus, moteInfo, time), openSocket, bindSocket, search, join,
+   requestService, getServiceInfo, sendTo, reset and disconnect
+ - Notifications: events, advReceived, timeIndication, receive and txDone
+Notifications are sent once; acknowledgements from the host are accepted but
+not required.
+
+Instead of simulating, the mote can replay a recorded session (e.g. from a
+serial capture, see dn_capture.h): Notifications are sent at their recorded
+times, while every request from the host is answered with the reply to the
+next recorded request of the same command (and parameter), after the recorded
+latency. A request that has no recorded counterpart left is not answered and
+counted as a miss, which is where the host has diverged from the recording.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#ifndef DN_MOTE_SIM_H
+#define DN_MOTE_SIM_H
+
+#include "dn_common.h"
+
+//=========================== defines =========================================
+
+#define DN_MOTE_SIM_MAX_NETS		4 // Networks within range
+#define DN_MOTE_SIM_MAX_SOCKETS		4
+#define DN_MOTE_SIM_TX_QUEUE_SIZE	16 // Frames waiting to be sent to the host
+#define DN_MOTE_SIM_MAX_FRAME_LEN	128 // Serial API header and payload
+#define DN_MOTE_SIM_NO_EVENT		0xffffffff // Nothing scheduled
+
+//=========================== typedef =========================================
+
+typedef void (*dn_mote_sim_tx_cbt)(const uint8_t* data, uint16_t len);
+typedef void (*dn_mote_sim_trace_cbt)(bool toHost, const uint8_t* frame, uint8_t len);
+
+typedef struct
+{
+	uint16_t netId;
+	int8_t rssi; // Reported in advertisements
+	uint8_t joinKey[16];
+} dn_mote_sim_net_t;
+
+/*
+ Every delay is scaled by a random factor within +/- jitter_pct percent, drawn
+ from a generator seeded with seed, so runs with the same seed are identical.
+ */
+typedef struct
+{
+	// Identity
+	uint8_t macAddress[8];
+	uint8_t swVerMajor;
+	uint8_t swVerMinor;
+	uint8_t swVerPatch;
+	uint16_t swVerBuild;
+	// Networks within range
+	uint8_t numNets;
+	dn_mote_sim_net_t nets[DN_MOTE_SIM_MAX_NETS];
+	// Timing
+	uint16_t replyDelay_ms; // Request received until reply sent
+	uint16_t bootDelay_ms; // Reset until boot event
+	uint32_t disconnectDelay_ms; // Disconnect until boot event
+	uint16_t advPeriod_ms; // Per network, while searching
+	uint32_t joinDelay_ms; // Join until operational
+	uint32_t svcDelay_ms; // Service request until svcChange event
+	uint16_t txDoneDelay_ms; // sendTo until txDone
+	uint32_t timeIndicationPeriod_ms; // 0 to disable
+	uint32_t downstreamPeriod_ms; // 0 to disable
+	uint8_t jitter_pct;
+	uint32_t seed;
+	// Behaviour
+	uint32_t minService_ms; // Best service the manager grants
+	uint8_t joinFail_pct; // Chance that a join attempt fails
+	bool echo; // Send every packet back as downstream data
+} dn_mote_sim_cfg_t;
+
+/*
+ A frame of a recorded session, in either direction, as in a serial capture:
+ control, command ID, sequence number, length and payload, without the FCS.
+ */
+typedef struct
+{
+	uint32_t offset_ms; // Since the start of the recording
+	bool toMote;
+	uint8_t len;
+	uint8_t frame[DN_MOTE_SIM_MAX_FRAME_LEN];
+} dn_mote_sim_rec_t;
+
+typedef struct
+{
+	uint32_t rxFrames;
+	uint32_t rxErrors; // Bad FCS, overflow or truncated header
+	uint32_t requests;
+	uint32_t acks; // Acknowledgements of notifications
+	uint32_t notifs;
+	uint32_t boots;
+	uint32_t joins; // Join attempts started
+	uint32_t joinFails;
+	uint32_t svcGrants; // Service requests completed
+	uint32_t packetsSent; // Accepted by sendTo
+	uint32_t txDropped; // TX queue full
+	// Replay
+	uint32_t replayedNotifs;
+	uint32_t replayedReplies;
+	uint32_t replayMisses; // Requests without a recorded reply left
+} dn_mote_sim_stats_t;
+
+//=========================== variables =======================================
+
+//=========================== prototypes ======================================
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/**
+ \brief Fill in a configuration resembling a recent mote within range of a
+ single network using the default network ID and join key.
+ */
+void dn_mote_sim_defaultCfg(dn_mote_sim_cfg_t* cfg);
+
+/**
+ \brief Power up the mote; the boot event follows after the boot delay.
+
+ \param cfg The configuration, copied.
+ \param tx_cb Called with encoded bytes for the host.
+ \param trace_cb Called with every unescaped frame in either direction; may be
+ NULL.
+ \param now_ms The current time.
+ */
+void dn_mote_sim_init(const dn_mote_sim_cfg_t* cfg, dn_mote_sim_tx_cbt tx_cb,
+		dn_mote_sim_trace_cbt trace_cb, uint32_t now_ms);
+
+/**
+ \brief Start replaying a recorded session instead of simulating; the first
+ frame of the recording is due at once.
+
+ \param recs The frames, oldest first; must outlive the replay.
+ \param count Number of frames.
+ \param tx_cb Called with encoded bytes for the host.
+ \param trace_cb As for dn_mote_sim_init; may be NULL.
+ \param now_ms The current time.
+ */
+void dn_mote_sim_initReplay(const dn_mote_sim_rec_t* recs, uint32_t count, dn_mote_sim_tx_cbt tx_cb,
+		dn_mote_sim_trace_cbt trace_cb, uint32_t now_ms);
+
+/**
+ \brief Feed bytes received from the host.
+ */
+void dn_mote_sim_rx(const uint8_t* data, uint16_t len, uint32_t now_ms);
+
+/**
+ \brief Run everything that is due: Send frames and advance the mote state.
+ */
+void dn_mote_sim_run(uint32_t now_ms);
+
+/**
+ \brief Reset the mote as if its RESET pin was pulled; the boot event follows
+ after the boot delay.
+ */
+void dn_mote_sim_reboot(uint32_t now_ms);
+
+/**
+ \brief Get the time until something is due.
+
+ \return The number of ms until dn_mote_sim_run has work to do (0 if overdue),
+ or DN_MOTE_SIM_NO_EVENT if nothing is scheduled.
+ */
+uint32_t dn_mote_sim_nextEvent(uint32_t now_ms);
+
+/**
+ \brief Get the mote state (DN_MOTE_STATE_*) as reported in moteStatus.
+ */
+uint8_t dn_mote_sim_state(void);
+
+/**
+ \brief Get the counters since dn_mote_sim_init.
+ */
+const dn_mote_sim_stats_t* dn_mote_sim_getStats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DN_MOTE_SIM_H */
@@ -0,0 +1,372 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+SmartMesh IP mote emulator: The simulated mote of dn_mote_sim.c behind a
+pseudo-terminal, so that a port of the QuickStart Library can run against it
+unmodified on a Linux host.
+
+The slave side of the pseudo-terminal is printed at start-up, and can also be
+reached through a fixed symbolic link (-l). Point UART_PORTNAME of the port to
+either, e.g. for the Raspberry Pi example:
+	./mote_emu -l /tmp/ttyMOTE
+	#define UART_PORTNAME "/tmp/ttyMOTE"
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+
+#include "dn_mote_sim.h"
+#include "dn_defaults.h"
+
+//=========================== defines =========================================
+
+#define EMU_RX_BUFFER_SIZE	256
+#define EMU_MAX_POLL_MS		1000
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	int masterFd;
+	int slaveFd;
+	const char* linkPath;
+	bool verbose;
+	uint32_t start_ms;
+	volatile sig_atomic_t stop;
+} mote_emu_vars_t;
+
+static mote_emu_vars_t mote_emu_vars;
+
+//=========================== prototypes ======================================
+
+static void usage(const char* prog);
+static bool parseNet(const char* arg, dn_mote_sim_net_t* net);
+static bool parseSwVer(const char* arg, dn_mote_sim_cfg_t* cfg);
+static bool openPty(void);
+static void tx(const uint8_t* data, uint16_t len);
+static void trace(bool toHost, const uint8_t* frame, uint8_t len);
+static void printStats(void);
+static void onSignal(int sig);
+static uint32_t now_ms(void);
+
+//=========================== main ============================================
+
+int main(int argc, char** argv)
+{
+	dn_mote_sim_cfg_t cfg;
+	uint8_t rxBuf[EMU_RX_BUFFER_SIZE];
+	struct pollfd pfd;
+	uint32_t timeout;
+	bool netsGiven = FALSE;
+	ssize_t n;
+	int opt;
+
+	dn_mote_sim_defaultCfg(&cfg);
+	mote_emu_vars.verbose = TRUE;
+	while ((opt = getopt(argc, argv, "l:n:v:r:b:a:j:s:t:d:J:f:S:x:eqh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'l':
+			mote_emu_vars.linkPath = optarg;
+			break;
+		case 'n':
+			if (!netsGiven)
+			{
+				cfg.numNets = 0; // First -n replaces the default network
+				netsGiven = TRUE;
+			}
+			if (cfg.numNets == DN_MOTE_SIM_MAX_NETS || !parseNet(optarg, &cfg.nets[cfg.numNets]))
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			cfg.numNets++;
+			break;
+		case 'v':
+			if (!parseSwVer(optarg, &cfg))
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'r':
+			cfg.replyDelay_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			cfg.bootDelay_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			cfg.advPeriod_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			cfg.joinDelay_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			cfg.svcDelay_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg.timeIndicationPeriod_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			cfg.downstreamPeriod_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'J':
+			cfg.jitter_pct = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			cfg.joinFail_pct = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			cfg.minService_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			cfg.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			cfg.echo = TRUE;
+			break;
+		case 'q':
+			mote_emu_vars.verbose = FALSE;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!openPty())
+	{
+		return 1;
+	}
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	mote_emu_vars.start_ms = now_ms();
+	dn_mote_sim_init(&cfg, tx, trace, now_ms());
+
+	pfd.fd = mote_emu_vars.masterFd;
+	pfd.events = POLLIN;
+	while (!mote_emu_vars.stop)
+	{
+		timeout = dn_mote_sim_nextEvent(now_ms());
+		if (timeout > EMU_MAX_POLL_MS)
+		{
+			timeout = EMU_MAX_POLL_MS;
+		}
+		if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN))
+		{
+			n = read(mote_emu_vars.masterFd, rxBuf, sizeof (rxBuf));
+			if (n > 0)
+			{
+				dn_mote_sim_rx(rxBuf, n, now_ms());
+			}
+		}
+		dn_mote_sim_run(now_ms());
+	}
+
+	printStats();
+	if (mote_emu_vars.linkPath != NULL)
+	{
+		unlink(mote_emu_vars.linkPath);
+	}
+	return 0;
+}
+
+//=========================== helpers =========================================
+
+static void usage(const char* prog)
+{
+	printf("Usage: %s [options]\n", prog);
+	printf("  -l path         Symbolic link to the pseudo-terminal\n");
+	printf("  -n id[:rssi[:key]]  Network within range (repeatable; key as 32 hex digits)\n");
+	printf("  -v a.b.c.d      Mote software version\n");
+	printf("  -r ms           Reply delay\n");
+	printf("  -b ms           Boot delay after reset\n");
+	printf("  -a ms           Advertisement period while searching\n");
+	printf("  -j ms           Join duration at the default duty cycle\n");
+	printf("  -s ms           Service request duration\n");
+	printf("  -t ms           timeIndication period (0: off)\n");
+	printf("  -d ms           Downstream data period (0: off)\n");
+	printf("  -J pct          Timing jitter\n");
+	printf("  -f pct          Join failure rate\n");
+	printf("  -S ms           Best service the manager grants\n");
+	printf("  -x seed         Random seed\n");
+	printf("  -e              Echo sent packets back as downstream data\n");
+	printf("  -q              Do not trace frames\n");
+}
+
+static bool parseNet(const char* arg, dn_mote_sim_net_t* net)
+{
+	char* end;
+	uint8_t i;
+
+	memcpy(net->joinKey, dn_default_joinKey, DN_JOIN_KEY_LEN);
+	net->rssi = -60;
+	net->netId = strtoul(arg, &end, 0);
+	if (*end == ':')
+	{
+		net->rssi = strtol(end + 1, &end, 0);
+	}
+	if (*end == ':')
+	{
+		end++;
+		if (strlen(end) != 2 * DN_JOIN_KEY_LEN)
+		{
+			return FALSE;
+		}
+		for (i = 0; i < DN_JOIN_KEY_LEN; i++)
+		{
+			if (sscanf(&end[2 * i], "%2hhx", &net->joinKey[i]) != 1)
+			{
+				return FALSE;
+			}
+		}
+		end += 2 * DN_JOIN_KEY_LEN;
+	}
+	return *end == '\0';
+}
+
+static bool parseSwVer(const char* arg, dn_mote_sim_cfg_t* cfg)
+{
+	unsigned int major, minor, patch, build;
+
+	if (sscanf(arg, "%u.%u.%u.%u", &major, &minor, &patch, &build) != 4)
+	{
+		return FALSE;
+	}
+	cfg->swVerMajor = major;
+	cfg->swVerMinor = minor;
+	cfg->swVerPatch = patch;
+	cfg->swVerBuild = build;
+	return TRUE;
+}
+
+/**
+ Open a pseudo-terminal in raw mode. The slave side is kept open here as well,
+ so that the host can close and reopen it without the master seeing a hangup.
+ */
+static bool openPty(void)
+{
+	struct termios options;
+	const char* slaveName;
+
+	mote_emu_vars.masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (mote_emu_vars.masterFd < 0
+			|| grantpt(mote_emu_vars.masterFd) != 0
+			|| unlockpt(mote_emu_vars.masterFd) != 0
+			|| (slaveName = ptsname(mote_emu_vars.masterFd)) == NULL)
+	{
+		perror("Unable to open pseudo-terminal");
+		return FALSE;
+	}
+	mote_emu_vars.slaveFd = open(slaveName, O_RDWR | O_NOCTTY);
+	if (mote_emu_vars.slaveFd < 0)
+	{
+		perror("Unable to open pseudo-terminal slave");
+		return FALSE;
+	}
+
+	// No echo or line editing, or the host would read its own requests back
+	tcgetattr(mote_emu_vars.slaveFd, &options);
+	cfmakeraw(&options);
+	tcsetattr(mote_emu_vars.slaveFd, TCSANOW, &options);
+
+	if (mote_emu_vars.linkPath != NULL)
+	{
+		unlink(mote_emu_vars.linkPath);
+		if (symlink(slaveName, mote_emu_vars.linkPath) != 0)
+		{
+			perror("Unable to create link");
+			return FALSE;
+		}
+		printf("Mote on %s (%s)\n", mote_emu_vars.linkPath, slaveName);
+	} else
+	{
+		printf("Mote on %s\n", slaveName);
+	}
+	fflush(stdout);
+	return TRUE;
+}
+
+static void tx(const uint8_t* data, uint16_t len)
+{
+	ssize_t n;
+
+	while (len > 0)
+	{
+		n = write(mote_emu_vars.masterFd, data, len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("Write failed");
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+static void trace(bool toHost, const uint8_t* frame, uint8_t len)
+{
+	const char* kind;
+	uint8_t i;
+
+	if (!mote_emu_vars.verbose)
+	{
+		return;
+	}
+	if (toHost)
+	{
+		kind = (frame[0] & 0x01) ? "rsp" : "ntf";
+	} else
+	{
+		kind = (frame[0] & 0x01) ? "ack" : "req";
+	}
+	printf("%9.3f %s %s cmd %#.2x seq %3u len %3u |", (now_ms() - mote_emu_vars.start_ms) / 1000.0,
+			toHost ? "<-" : "->", kind, frame[1], frame[2], frame[3]);
+	for (i = 4; i < len; i++)
+	{
+		printf(" %02x", frame[i]);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+static void printStats(void)
+{
+	const dn_mote_sim_stats_t* stats = dn_mote_sim_getStats();
+
+	printf("\nFrames in: %u (%u errors), requests: %u, acks: %u, notifications: %u\n",
+			stats->rxFrames, stats->rxErrors, stats->requests, stats->acks, stats->notifs);
+	printf("Boots: %u, joins: %u (%u failed), packets sent: %u, TX dropped: %u\n",
+			stats->boots, stats->joins, stats->joinFails, stats->packetsSent, stats->txDropped);
+}
+
+static void onSignal(int sig)
+{
+	mote_emu_vars.stop = 1;
+}
+
+static uint32_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
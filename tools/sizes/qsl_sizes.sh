@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Copyright (c) 2016, Dust Networks. All rights reserved.
+#
+# RAM taken by the QuickStart Library as configured, largest first: lists the
+# variables in the given object files with their size, and the total. The
+# numbers shift with the defines of dn_defaults.h and a dn_qsl_config.h
+# (dn_fsm_vars holds the inbox and buffers).
+#
+# Run by "make sizes" in the Raspberry Pi and simulator makefiles, and after
+# each build of the NUCLEO-L053R8 project on its objects, e.g.
+#	sh tools/sizes/qsl_sizes.sh -n arm-none-eabi-nm Debug/sm_qsl/*.o
+#
+# \license See attached DN_LICENSE.txt.
+
+NM=${NM:-nm}
+if [ "$1" = "-n" ]; then
+	NM=$2
+	shift 2
+fi
+if [ $# -eq 0 ]; then
+	echo "usage: $0 [-n nm] object..." >&2
+	exit 1
+fi
+
+# BSS, data and common symbols only; code and constants stay in flash
+"$NM" -S -t d "$@" | awk '$3 ~ /^[bBdDC]$/ { print $2, $4 }' | sort -rn \
+	| awk '{ printf "%8d %s\n", $1, $2; total += $1 } END { printf "%8d total\n", total }'
@@ -0,0 +1,274 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Host stress test of the inbox of the QuickStart Library.
+
+The inbox is a single-producer/single-consumer queue: Receive notifications
+push to it from the context feeding the UART data, while dn_qsl_read pops from
+the main loop. Here a producer thread pushes through dn_qsl_hook_inboxPush
+(dn_qsl_hooks.h) while the main thread reads, as fast as both can go, with
+packets of varying size that each carry their sequence number and a pattern
+derived from it. Three phases are checked:
+ - capacity: From a single thread, DN_INBOX_SIZE packets are all queued, the
+   next ones are dropped and counted as overflows, and the queued ones are
+   read back in order
+ - lossless: The producer retries whenever the inbox is full; every packet
+   must be read, in order and intact, and the overflow counter must match the
+   retries
+ - lossy: The producer never retries; the packets read must be in order and
+   intact, and those read plus those dropped must add up to those sent, with
+   every drop counted as an overflow
+
+The library runs on the simulator port (examples/sim/Scenarios), although
+nothing here talks to the mote.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dn_qsl_api.h"
+#include "dn_qsl_hooks.h"
+#include "dn_fsm.h"
+
+//=========================== defines =========================================
+
+#define STRESS_PACKETS		2000000 // Per threaded phase
+#define STRESS_HEADER_LEN	4 // Sequence number
+#define STRESS_OVERFILL		3 // Pushes past capacity in the capacity phase
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	bool retry; // Producer retries a full inbox instead of dropping
+	uint32_t rejected; // Pushes refused; written by the producer only
+	volatile bool done;
+	uint32_t failures;
+} stress_vars_t;
+
+static stress_vars_t stress_vars;
+
+//=========================== prototypes ======================================
+
+static void phaseCapacity(void);
+static void phaseThreaded(bool retry);
+static void* producer(void* arg);
+static uint8_t fillPacket(uint8_t* buf, uint32_t seq);
+static bool checkPacket(const uint8_t* buf, uint8_t len, uint32_t* seq);
+static uint32_t overflows(void);
+static void fail(const char* phase, const char* what, uint32_t seq);
+
+//=========================== main ============================================
+
+int main(void)
+{
+	dn_qsl_init();
+
+	phaseCapacity();
+	phaseThreaded(TRUE);
+	phaseThreaded(FALSE);
+
+	if (stress_vars.failures > 0)
+	{
+		printf("inbox stress: %u failures\n", stress_vars.failures);
+		return 1;
+	}
+	printf("inbox stress: OK\n");
+	return 0;
+}
+
+//=========================== private =========================================
+
+static void phaseCapacity(void)
+{
+	uint8_t buf[DN_DEFAULT_PAYLOAD_SIZE_LIMIT];
+	uint32_t before = overflows();
+	uint32_t seq;
+	uint32_t got;
+	uint8_t len;
+
+	for (seq = 0; seq < DN_INBOX_SIZE; seq++)
+	{
+		len = fillPacket(buf, seq);
+		if (!dn_qsl_hook_inboxPush(buf, len))
+		{
+			fail("capacity", "Push below capacity refused", seq);
+		}
+	}
+	for (; seq < DN_INBOX_SIZE + STRESS_OVERFILL; seq++)
+	{
+		len = fillPacket(buf, seq);
+		if (dn_qsl_hook_inboxPush(buf, len))
+		{
+			fail("capacity", "Push past capacity accepted", seq);
+		}
+	}
+	memset(buf, 0, sizeof (buf));
+	if (dn_qsl_hook_inboxPush(buf, DN_DEFAULT_PAYLOAD_SIZE_LIMIT + 1))
+	{
+		fail("capacity", "Oversized push accepted", 0);
+	}
+	if (overflows() - before != STRESS_OVERFILL + 1)
+	{
+		fail("capacity", "Overflow count off", overflows() - before);
+	}
+
+	for (seq = 0; seq < DN_INBOX_SIZE; seq++)
+	{
+		len = dn_qsl_read(buf);
+		if (!checkPacket(buf, len, &got) || got != seq)
+		{
+			fail("capacity", "Packet lost, reordered or corrupt", seq);
+		}
+	}
+	if (dn_qsl_read(buf) != 0)
+	{
+		fail("capacity", "Inbox not empty after reading it all", 0);
+	}
+	printf("capacity: %u queued, %u dropped\n", DN_INBOX_SIZE, STRESS_OVERFILL + 1);
+}
+
+static void phaseThreaded(bool retry)
+{
+	const char* phase = retry ? "lossless" : "lossy";
+	uint8_t buf[DN_DEFAULT_PAYLOAD_SIZE_LIMIT];
+	pthread_t thread;
+	uint32_t before = overflows();
+	uint32_t received = 0;
+	uint32_t expected = 0;
+	uint32_t seq;
+	uint8_t len;
+	bool last = FALSE;
+
+	stress_vars.retry = retry;
+	stress_vars.rejected = 0;
+	stress_vars.done = FALSE;
+	if (pthread_create(&thread, NULL, producer, NULL) != 0)
+	{
+		fail(phase, "Unable to start producer", 0);
+		return;
+	}
+
+	// Read until the producer is done and the inbox is drained after that
+	while (!last)
+	{
+		last = stress_vars.done;
+		__sync_synchronize();
+		while ((len = dn_qsl_read(buf)) > 0)
+		{
+			if (!checkPacket(buf, len, &seq))
+			{
+				fail(phase, "Corrupt packet", expected);
+				continue;
+			}
+			if (seq < expected || (retry && seq != expected))
+			{
+				fail(phase, "Packet lost or reordered", seq);
+			}
+			expected = seq + 1;
+			received++;
+		}
+		sched_yield();
+	}
+	pthread_join(thread, NULL);
+
+	if (overflows() - before != stress_vars.rejected)
+	{
+		fail(phase, "Overflow count does not match the pushes refused", overflows() - before);
+	}
+	if (retry && received != STRESS_PACKETS)
+	{
+		fail(phase, "Packets lost", STRESS_PACKETS - received);
+	}
+	if (!retry && received + stress_vars.rejected != STRESS_PACKETS)
+	{
+		fail(phase, "Packets neither read nor dropped", STRESS_PACKETS - received - stress_vars.rejected);
+	}
+	printf("%s: %u sent, %u read, %u refused while full\n", phase, STRESS_PACKETS, received, stress_vars.rejected);
+}
+
+static void* producer(void* arg)
+{
+	uint8_t buf[DN_DEFAULT_PAYLOAD_SIZE_LIMIT];
+	uint32_t seq;
+	uint8_t len;
+
+	for (seq = 0; seq < STRESS_PACKETS; seq++)
+	{
+		len = fillPacket(buf, seq);
+		while (!dn_qsl_hook_inboxPush(buf, len))
+		{
+			stress_vars.rejected++;
+			if (!stress_vars.retry)
+			{
+				break;
+			}
+			sched_yield(); // Let the consumer in, on a single core
+		}
+	}
+	__sync_synchronize();
+	stress_vars.done = TRUE;
+	return NULL;
+}
+
+//=========================== helpers =========================================
+
+/**
+ Sequence number, then a pattern of it over a length that varies with it.
+ */
+static uint8_t fillPacket(uint8_t* buf, uint32_t seq)
+{
+	uint8_t len = STRESS_HEADER_LEN + seq % (DN_DEFAULT_PAYLOAD_SIZE_LIMIT - STRESS_HEADER_LEN + 1);
+	uint8_t i;
+
+	memcpy(buf, &seq, STRESS_HEADER_LEN);
+	for (i = STRESS_HEADER_LEN; i < len; i++)
+	{
+		buf[i] = (uint8_t)(seq * 31 + i);
+	}
+	return len;
+}
+
+static bool checkPacket(const uint8_t* buf, uint8_t len, uint32_t* seq)
+{
+	uint8_t i;
+
+	if (len < STRESS_HEADER_LEN)
+	{
+		return FALSE;
+	}
+	memcpy(seq, buf, STRESS_HEADER_LEN);
+	if (len != STRESS_HEADER_LEN + *seq % (DN_DEFAULT_PAYLOAD_SIZE_LIMIT - STRESS_HEADER_LEN + 1))
+	{
+		return FALSE;
+	}
+	for (i = STRESS_HEADER_LEN; i < len; i++)
+	{
+		if (buf[i] != (uint8_t)(*seq * 31 + i))
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static uint32_t overflows(void)
+{
+	dn_qsl_stats_t stats;
+
+	dn_qsl_getStats(&stats);
+	return stats.inboxOverflows;
+}
+
+static void fail(const char* phase, const char* what, uint32_t seq)
+{
+	if (stress_vars.failures++ < 10)
+	{
+		fprintf(stderr, "%s: %s (%u)\n", phase, what, seq);
+	}
+}
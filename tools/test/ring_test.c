@@ -0,0 +1,280 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Host test of the byte ring of the QuickStart Library (dn_ring.h).
+
+Checked, over a small ring so that the indices wrap many times:
+ - init: Only power of two sizes up to DN_RING_MAX_SIZE are accepted
+ - full/empty: Counts and free space at both ends, and writes past full
+ - wrap: Bytes come out in order and intact as they wrap around the end of
+   the buffer, including when the free running indices themselves wrap
+ - spans: Readable bytes that wrap come as two spans, the first up to the
+   end of the buffer
+ - commit: Bytes written into the buffer directly, as a DMA channel does,
+   including overruns of unread bytes, which are counted and skipped
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "dn_ring.h"
+
+//=========================== defines =========================================
+
+#define RING_SIZE		16
+#define RING_ROUNDS		20000 // Enough for the 16-bit indices to wrap
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	dn_ring_t ring;
+	uint8_t buf[RING_SIZE];
+	uint8_t nextIn; // Pattern byte of the next byte written
+	uint8_t nextOut; // Pattern byte of the next byte expected
+	uint32_t failures;
+} ring_test_vars_t;
+
+static ring_test_vars_t ring_test_vars;
+
+//=========================== prototypes ======================================
+
+static void testInit(void);
+static void testFullEmpty(void);
+static void testWrap(void);
+static void testSpans(void);
+static void testCommit(void);
+static void reset(void);
+static uint16_t writePattern(uint16_t len);
+static void readPattern(const char* test, uint16_t len);
+static void dmaWrite(uint16_t len);
+static void check(const char* test, bool ok, const char* what, uint32_t value);
+
+//=========================== main ============================================
+
+int main(void)
+{
+	testInit();
+	testFullEmpty();
+	testWrap();
+	testSpans();
+	testCommit();
+
+	if (ring_test_vars.failures > 0)
+	{
+		printf("ring test: %u failures\n", ring_test_vars.failures);
+		return 1;
+	}
+	printf("ring test: OK\n");
+	return 0;
+}
+
+//=========================== private =========================================
+
+static void testInit(void)
+{
+	dn_ring_t* ring = &ring_test_vars.ring;
+	uint8_t* buf = ring_test_vars.buf;
+
+	check("init", !dn_ring_init(ring, buf, 0), "Size 0 accepted", 0);
+	check("init", !dn_ring_init(ring, buf, 12), "Size not a power of two accepted", 12);
+	check("init", !dn_ring_init(ring, buf, 0xFFFF), "Size not a power of two accepted", 0xFFFF);
+	check("init", dn_ring_init(ring, buf, 1), "Size 1 refused", 1);
+	check("init", dn_ring_init(ring, buf, DN_RING_MAX_SIZE), "Largest size refused", DN_RING_MAX_SIZE);
+	check("init", dn_ring_init(ring, buf, RING_SIZE), "Size refused", RING_SIZE);
+}
+
+static void testFullEmpty(void)
+{
+	const uint8_t* span;
+	uint8_t out[RING_SIZE];
+
+	reset();
+	check("full/empty", dn_ring_count(&ring_test_vars.ring) == 0, "New ring not empty", 0);
+	check("full/empty", dn_ring_free(&ring_test_vars.ring) == RING_SIZE, "New ring short of space", 0);
+	check("full/empty", dn_ring_readSpan(&ring_test_vars.ring, &span) == 0, "Span from an empty ring", 0);
+	check("full/empty", dn_ring_read(&ring_test_vars.ring, out, sizeof (out)) == 0, "Read from an empty ring", 0);
+
+	check("full/empty", writePattern(RING_SIZE - 1) == RING_SIZE - 1, "Write below capacity cut short", 0);
+	check("full/empty", dn_ring_free(&ring_test_vars.ring) == 1, "Free space off", dn_ring_free(&ring_test_vars.ring));
+	check("full/empty", writePattern(3) == 1, "Write past capacity not cut short", 0);
+	check("full/empty", dn_ring_count(&ring_test_vars.ring) == RING_SIZE, "Full ring count off", dn_ring_count(&ring_test_vars.ring));
+	check("full/empty", dn_ring_free(&ring_test_vars.ring) == 0, "Full ring has space", 0);
+	check("full/empty", writePattern(1) == 0, "Write to a full ring", 0);
+
+	readPattern("full/empty", RING_SIZE);
+	check("full/empty", dn_ring_count(&ring_test_vars.ring) == 0, "Drained ring not empty", 0);
+	check("full/empty", dn_ring_free(&ring_test_vars.ring) == RING_SIZE, "Drained ring short of space", 0);
+	printf("full/empty: OK\n");
+}
+
+static void testWrap(void)
+{
+	uint32_t round;
+	uint16_t len;
+
+	reset();
+	// Lengths that do not divide the size, so every offset gets to wrap
+	for (round = 0; round < RING_ROUNDS; round++)
+	{
+		len = 1 + round % (RING_SIZE - 1);
+		check("wrap", writePattern(len) == len, "Write cut short", round);
+		readPattern("wrap", len);
+		// Keep some bytes in between, then take them out again
+		writePattern(round % 4);
+		readPattern("wrap", round % 4);
+	}
+	check("wrap", dn_ring_count(&ring_test_vars.ring) == 0, "Bytes left over", dn_ring_count(&ring_test_vars.ring));
+	printf("wrap: OK\n");
+}
+
+static void testSpans(void)
+{
+	const uint8_t* span;
+	uint16_t offset;
+	uint16_t len;
+
+	for (offset = 0; offset < RING_SIZE; offset++)
+	{
+		reset();
+		writePattern(offset);
+		readPattern("spans", offset);
+
+		// Fill the ring from that offset; the bytes wrap unless it is 0
+		writePattern(RING_SIZE);
+		len = dn_ring_readSpan(&ring_test_vars.ring, &span);
+		check("spans", len == RING_SIZE - offset, "First span not up to the end of the buffer", offset);
+		check("spans", span == &ring_test_vars.buf[offset], "First span not at the oldest byte", offset);
+		check("spans", span[0] == ring_test_vars.nextOut, "First span contents off", offset);
+		dn_ring_consume(&ring_test_vars.ring, len);
+		ring_test_vars.nextOut += len;
+
+		len = dn_ring_readSpan(&ring_test_vars.ring, &span);
+		check("spans", len == offset, "Second span length off", offset);
+		if (len > 0)
+		{
+			check("spans", span == ring_test_vars.buf, "Second span not at the start of the buffer", offset);
+			check("spans", span[len - 1] == (uint8_t)(ring_test_vars.nextOut + len - 1), "Second span contents off", offset);
+		}
+		dn_ring_consume(&ring_test_vars.ring, len);
+		ring_test_vars.nextOut += len;
+		check("spans", dn_ring_readSpan(&ring_test_vars.ring, &span) == 0, "Third span", offset);
+	}
+	printf("spans: OK\n");
+}
+
+static void testCommit(void)
+{
+	uint32_t round;
+	uint16_t len;
+
+	reset();
+	for (round = 0; round < RING_ROUNDS; round++)
+	{
+		len = 1 + round % RING_SIZE;
+		dmaWrite(len);
+		check("commit", dn_ring_commit(&ring_test_vars.ring, len), "Overrun reported within capacity", round);
+		readPattern("commit", len);
+	}
+	check("commit", dn_ring_overruns(&ring_test_vars.ring) == 0, "Overruns counted", dn_ring_overruns(&ring_test_vars.ring));
+
+	// The writer goes past unread bytes, less than a whole buffer
+	reset();
+	dmaWrite(10);
+	dn_ring_commit(&ring_test_vars.ring, 10);
+	dmaWrite(9);
+	check("commit", !dn_ring_commit(&ring_test_vars.ring, 9), "Overrun not reported", 0);
+	check("commit", dn_ring_count(&ring_test_vars.ring) == RING_SIZE, "Count past an overrun off", dn_ring_count(&ring_test_vars.ring));
+	check("commit", dn_ring_free(&ring_test_vars.ring) == 0, "Space past an overrun", dn_ring_free(&ring_test_vars.ring));
+	// Only the newest buffer full is left, oldest first
+	ring_test_vars.nextOut += 19 - RING_SIZE;
+	readPattern("commit", RING_SIZE);
+
+	// The writer goes all the way around the buffer, and then some
+	dmaWrite(RING_SIZE + 5);
+	check("commit", !dn_ring_commit(&ring_test_vars.ring, RING_SIZE + 5), "Lap not reported", 0);
+	ring_test_vars.nextOut += 5;
+	readPattern("commit", RING_SIZE);
+	check("commit", dn_ring_overruns(&ring_test_vars.ring) == 2, "Overrun count off", dn_ring_overruns(&ring_test_vars.ring));
+
+	// Back to normal after that
+	dmaWrite(7);
+	check("commit", dn_ring_commit(&ring_test_vars.ring, 7), "Overrun reported after recovery", 0);
+	readPattern("commit", 7);
+	printf("commit: %u overruns\n", dn_ring_overruns(&ring_test_vars.ring));
+}
+
+//=========================== helpers =========================================
+
+static void reset(void)
+{
+	memset(ring_test_vars.buf, 0, sizeof (ring_test_vars.buf));
+	dn_ring_init(&ring_test_vars.ring, ring_test_vars.buf, RING_SIZE);
+	ring_test_vars.nextIn = 0;
+	ring_test_vars.nextOut = 0;
+}
+
+/**
+ Write a run of the pattern, as much as fits.
+ */
+static uint16_t writePattern(uint16_t len)
+{
+	uint8_t data[RING_SIZE + 4];
+	uint16_t written;
+	uint16_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		data[i] = (uint8_t)(ring_test_vars.nextIn + i);
+	}
+	written = dn_ring_write(&ring_test_vars.ring, data, len);
+	ring_test_vars.nextIn += written;
+	return written;
+}
+
+/**
+ Read len bytes and check that they continue the pattern.
+ */
+static void readPattern(const char* test, uint16_t len)
+{
+	uint8_t data[RING_SIZE];
+	uint16_t got;
+	uint16_t i;
+
+	got = dn_ring_read(&ring_test_vars.ring, data, len);
+	check(test, got == len, "Read cut short", got);
+	for (i = 0; i < got; i++)
+	{
+		if (data[i] != ring_test_vars.nextOut)
+		{
+			check(test, FALSE, "Byte lost, reordered or corrupt", i);
+			ring_test_vars.nextOut = data[i];
+		}
+		ring_test_vars.nextOut++;
+	}
+}
+
+/**
+ Write the pattern into the buffer past the head, as a DMA channel in circular
+ mode does, without committing it.
+ */
+static void dmaWrite(uint16_t len)
+{
+	uint16_t pos = ring_test_vars.ring.head;
+	uint16_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		ring_test_vars.buf[(pos + i) & (RING_SIZE - 1)] = ring_test_vars.nextIn++;
+	}
+}
+
+static void check(const char* test, bool ok, const char* what, uint32_t value)
+{
+	if (!ok && ring_test_vars.failures++ < 10)
+	{
+		fprintf(stderr, "%s: %s (%u)\n", test, what, value);
+	}
+}
@@ -0,0 +1,302 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Host test of the opcode dispatch of the QuickStart Library (dn_rpc.h).
+
+The library runs on the simulator port (examples/sim/Scenarios), connected to
+the simulated mote of tools/mote_emu, which sends every packet back as
+downstream data; each reply is thus read back from the inbox and checked.
+Checked:
+ - register: Opcodes past the dispatch table are refused
+ - dispatch: A request reaches its handler with its arguments, and the reply
+   carries the opcode, correlation ID, status and data of the handler
+ - unknown: Unregistered and out of range opcodes are answered with
+   DN_RPC_RC_UNKNOWN_OPCODE; requests too short for a header are dropped
+ - oversize: Handlers are offered what the reply port accepts, and a handler
+   claiming more is cut down to that
+ - poll: Requests queued in the inbox are all dispatched; this runs before
+   connecting, as the echo of each reply would otherwise be dispatched in turn
+ - stats: Requests and failures are counted per opcode
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "dn_qsl_api.h"
+#include "dn_qsl_hooks.h"
+#include "dn_fsm.h"
+#include "dn_rpc.h"
+#include "dn_time.h"
+#include "dn_sim.h"
+#include "dn_mote_sim.h"
+
+//=========================== defines =========================================
+
+#define RPC_SRC_PORT		DN_WELL_KNOWN_PORT_1
+#define RPC_BANDWIDTH_MS	1000
+#define RPC_ECHO_WAIT_MS	1000 // Virtual time to wait for a reply to come back
+
+// Opcodes of the handlers below
+#define RPC_OP_REVERSE		1 // Replies with the arguments reversed
+#define RPC_OP_FAIL			2 // Replies DN_RPC_RC_ERROR and no data
+#define RPC_OP_GREEDY		3 // Claims more reply bytes than offered
+#define RPC_OP_UNREGISTERED	4
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	uint8_t reply[DN_DEFAULT_PAYLOAD_SIZE_LIMIT];
+	uint8_t offered; // Reply capacity the last handler was given
+	uint32_t failures;
+} rpc_test_vars_t;
+
+static rpc_test_vars_t rpc_test_vars;
+
+//=========================== prototypes ======================================
+
+static void testRegister(void);
+static void testDispatch(void);
+static void testUnknown(void);
+static void testOversize(void);
+static void testPoll(void);
+static void testStats(void);
+static uint8_t handleReverse(const uint8_t* args, uint8_t argsLen, uint8_t* reply, uint8_t* replyLen);
+static uint8_t handleFail(const uint8_t* args, uint8_t argsLen, uint8_t* reply, uint8_t* replyLen);
+static uint8_t handleGreedy(const uint8_t* args, uint8_t argsLen, uint8_t* reply, uint8_t* replyLen);
+static uint8_t awaitReply(void);
+static void checkReply(const char* test, uint8_t len, uint8_t opcode, uint8_t corrId, uint8_t status, uint8_t dataLen);
+static void check(const char* test, bool ok, const char* what, uint32_t value);
+
+//=========================== main ============================================
+
+int main(void)
+{
+	dn_mote_sim_cfg_t cfg;
+
+	dn_mote_sim_defaultCfg(&cfg);
+	cfg.replyDelay_ms = 1;
+	cfg.txDoneDelay_ms = 10;
+	cfg.jitter_pct = 0;
+	cfg.joinFail_pct = 0;
+	cfg.echo = TRUE;
+	dn_sim_startMote(&cfg);
+	dn_qsl_init();
+	dn_rpc_init(DN_DEFAULT_DEST_PORT);
+
+	testRegister();
+	testPoll();
+	if (!dn_qsl_connect(DN_DEFAULT_NET_ID, NULL, RPC_SRC_PORT, RPC_BANDWIDTH_MS))
+	{
+		fprintf(stderr, "rpc test: Failed to connect to the simulated mote\n");
+		return 1;
+	}
+	testDispatch();
+	testUnknown();
+	testOversize();
+	testStats();
+
+	if (rpc_test_vars.failures > 0)
+	{
+		printf("rpc test: %u failures\n", rpc_test_vars.failures);
+		return 1;
+	}
+	printf("rpc test: OK\n");
+	return 0;
+}
+
+//=========================== private =========================================
+
+static void testRegister(void)
+{
+	check("register", !dn_rpc_register(DN_RPC_NUM_OPCODES, handleReverse), "Opcode past the table accepted", DN_RPC_NUM_OPCODES);
+	check("register", !dn_rpc_register(0xff, handleReverse), "Opcode past the table accepted", 0xff);
+	check("register", dn_rpc_register(RPC_OP_REVERSE, handleReverse), "Opcode refused", RPC_OP_REVERSE);
+	check("register", dn_rpc_register(RPC_OP_FAIL, handleFail), "Opcode refused", RPC_OP_FAIL);
+	check("register", dn_rpc_register(RPC_OP_GREEDY, handleGreedy), "Opcode refused", RPC_OP_GREEDY);
+	check("register", dn_rpc_register(DN_RPC_NUM_OPCODES - 1, handleReverse), "Last opcode refused", DN_RPC_NUM_OPCODES - 1);
+	printf("register: OK\n");
+}
+
+static void testDispatch(void)
+{
+	const uint8_t request[] = {RPC_OP_REVERSE, 0x42, 1, 2, 3, 4, 5};
+	uint8_t len;
+
+	check("dispatch", dn_rpc_dispatch(request, sizeof (request)), "Reply not sent", 0);
+	len = awaitReply();
+	checkReply("dispatch", len, RPC_OP_REVERSE, 0x42, DN_RPC_RC_OK, 5);
+	check("dispatch", memcmp(&rpc_test_vars.reply[DN_RPC_REPLY_HEADER_LEN], "\x05\x04\x03\x02\x01", 5) == 0, "Reply data off", 0);
+
+	// No arguments at all
+	check("dispatch", dn_rpc_dispatch(request, DN_RPC_REQ_HEADER_LEN), "Reply without arguments not sent", 0);
+	checkReply("dispatch", awaitReply(), RPC_OP_REVERSE, 0x42, DN_RPC_RC_OK, 0);
+
+	// A failing handler still gets its reply across
+	check("dispatch", dn_rpc_dispatch((const uint8_t*)"\x02\x07", 2), "Failed status not sent", 0);
+	checkReply("dispatch", awaitReply(), RPC_OP_FAIL, 0x07, DN_RPC_RC_ERROR, 0);
+	printf("dispatch: OK\n");
+}
+
+static void testUnknown(void)
+{
+	check("unknown", !dn_rpc_dispatch((const uint8_t*)"\x04\x11", 2), "Unregistered opcode dispatched", RPC_OP_UNREGISTERED);
+	checkReply("unknown", awaitReply(), RPC_OP_UNREGISTERED, 0x11, DN_RPC_RC_UNKNOWN_OPCODE, 0);
+
+	check("unknown", !dn_rpc_dispatch((const uint8_t*)"\xc8\x12", 2), "Out of range opcode dispatched", 200);
+	checkReply("unknown", awaitReply(), 200, 0x12, DN_RPC_RC_UNKNOWN_OPCODE, 0);
+
+	// Unregistering makes the opcode unknown again
+	dn_rpc_register(DN_RPC_NUM_OPCODES - 1, NULL);
+	check("unknown", !dn_rpc_dispatch((const uint8_t*)"\x1f\x13", 2), "Unregistered handler called", DN_RPC_NUM_OPCODES - 1);
+	checkReply("unknown", awaitReply(), DN_RPC_NUM_OPCODES - 1, 0x13, DN_RPC_RC_UNKNOWN_OPCODE, 0);
+
+	// Too short to answer
+	check("unknown", !dn_rpc_dispatch((const uint8_t*)"\x01", 1), "Request without correlation ID dispatched", 1);
+	check("unknown", !dn_rpc_dispatch((const uint8_t*)"", 0), "Empty request dispatched", 0);
+	check("unknown", awaitReply() == 0, "Reply to a malformed request", 0);
+	printf("unknown: OK\n");
+}
+
+static void testOversize(void)
+{
+	uint8_t request[DN_DEFAULT_PAYLOAD_SIZE_LIMIT];
+	uint8_t capacity = dn_qsl_getPayloadLimit(DN_DEFAULT_DEST_PORT) - DN_RPC_REPLY_HEADER_LEN;
+
+	// The largest request the inbox takes, answered with all the handler may send
+	memset(request, 0x5a, sizeof (request));
+	request[0] = RPC_OP_REVERSE;
+	request[1] = 0x21;
+	dn_rpc_dispatch(request, sizeof (request));
+	check("oversize", rpc_test_vars.offered == capacity, "Capacity offered off", rpc_test_vars.offered);
+	checkReply("oversize", awaitReply(), RPC_OP_REVERSE, 0x21,
+			(sizeof (request) - DN_RPC_REQ_HEADER_LEN > capacity) ? DN_RPC_RC_ERROR : DN_RPC_RC_OK,
+			(sizeof (request) - DN_RPC_REQ_HEADER_LEN > capacity) ? 0 : sizeof (request) - DN_RPC_REQ_HEADER_LEN);
+
+	// A handler overrunning its capacity is cut down to it
+	check("oversize", dn_rpc_dispatch((const uint8_t*)"\x03\x22", 2), "Overrunning reply not sent", 0);
+	checkReply("oversize", awaitReply(), RPC_OP_GREEDY, 0x22, DN_RPC_RC_OK, capacity);
+	printf("oversize: %u bytes of reply data\n", capacity);
+}
+
+/**
+ Not connected yet, so the handler runs but its reply cannot be sent, which
+ counts as a failure.
+ */
+static void testPoll(void)
+{
+	dn_rpc_stats_t stats;
+	uint8_t corrId;
+	uint8_t request[DN_RPC_REQ_HEADER_LEN + 1];
+
+	for (corrId = 0; corrId < DN_INBOX_SIZE; corrId++)
+	{
+		request[0] = RPC_OP_REVERSE;
+		request[1] = corrId;
+		request[2] = corrId;
+		check("poll", dn_qsl_hook_inboxPush(request, sizeof (request)), "Request not queued", corrId);
+	}
+	check("poll", dn_rpc_poll() == DN_INBOX_SIZE, "Requests not all dispatched", 0);
+	check("poll", dn_rpc_poll() == 0, "Requests dispatched twice", 0);
+	dn_rpc_getStats(RPC_OP_REVERSE, &stats);
+	check("poll", stats.requests == DN_INBOX_SIZE, "Requests off", stats.requests);
+	check("poll", stats.failures == DN_INBOX_SIZE, "Unsent replies not counted", stats.failures);
+	printf("poll: %u requests\n", DN_INBOX_SIZE);
+}
+
+static void testStats(void)
+{
+	dn_rpc_stats_t stats;
+
+	check("stats", !dn_rpc_getStats(DN_RPC_NUM_OPCODES, &stats), "Stats past the table", 0);
+	check("stats", dn_rpc_getStats(RPC_OP_REVERSE, &stats), "Stats refused", RPC_OP_REVERSE);
+	check("stats", stats.requests == 3 + DN_INBOX_SIZE, "Requests off", stats.requests);
+	check("stats", stats.failures == DN_INBOX_SIZE + ((DN_DEFAULT_PAYLOAD_SIZE_LIMIT - DN_RPC_REQ_HEADER_LEN
+			> dn_qsl_getPayloadLimit(DN_DEFAULT_DEST_PORT) - DN_RPC_REPLY_HEADER_LEN) ? 1 : 0), "Failures off", stats.failures);
+	check("stats", stats.maxLatency_us >= stats.lastLatency_us, "Worst latency below the last", stats.maxLatency_us);
+	dn_rpc_getStats(RPC_OP_FAIL, &stats);
+	check("stats", stats.requests == 1 && stats.failures == 1, "Failed request not counted", stats.failures);
+	dn_rpc_getStats(RPC_OP_UNREGISTERED, &stats);
+	check("stats", stats.requests == 0, "Unknown opcode counted", stats.requests);
+	printf("stats: OK\n");
+}
+
+/**
+ Reply with the arguments reversed, or DN_RPC_RC_ERROR if they do not fit.
+ */
+static uint8_t handleReverse(const uint8_t* args, uint8_t argsLen, uint8_t* reply, uint8_t* replyLen)
+{
+	uint8_t i;
+
+	rpc_test_vars.offered = *replyLen;
+	if (argsLen > *replyLen)
+	{
+		*replyLen = 0;
+		return DN_RPC_RC_ERROR;
+	}
+	for (i = 0; i < argsLen; i++)
+	{
+		reply[i] = args[argsLen - 1 - i];
+	}
+	*replyLen = argsLen;
+	return DN_RPC_RC_OK;
+}
+
+static uint8_t handleFail(const uint8_t* args, uint8_t argsLen, uint8_t* reply, uint8_t* replyLen)
+{
+	*replyLen = 0;
+	return DN_RPC_RC_ERROR;
+}
+
+/**
+ Fill what is offered, and claim a byte more.
+ */
+static uint8_t handleGreedy(const uint8_t* args, uint8_t argsLen, uint8_t* reply, uint8_t* replyLen)
+{
+	memset(reply, 0xa5, *replyLen);
+	*replyLen += 1;
+	return DN_RPC_RC_OK;
+}
+
+//=========================== helpers =========================================
+
+/**
+ Wait, in virtual time, for the mote to send a reply back.
+
+ \return Its length, or 0 if none came.
+ */
+static uint8_t awaitReply(void)
+{
+	uint32_t start_ms = dn_time_ms();
+	uint8_t len;
+
+	while ((len = dn_qsl_read(rpc_test_vars.reply)) == 0
+			&& (uint32_t)(dn_time_ms() - start_ms) < RPC_ECHO_WAIT_MS)
+	{
+		dn_sleep_ms(1);
+	}
+	return len;
+}
+
+static void checkReply(const char* test, uint8_t len, uint8_t opcode, uint8_t corrId, uint8_t status, uint8_t dataLen)
+{
+	if (len == 0)
+	{
+		check(test, FALSE, "No reply", corrId);
+		return;
+	}
+	check(test, len == DN_RPC_REPLY_HEADER_LEN + dataLen, "Reply length off", len);
+	check(test, rpc_test_vars.reply[0] == opcode, "Reply opcode off", rpc_test_vars.reply[0]);
+	check(test, rpc_test_vars.reply[1] == corrId, "Reply correlation ID off", rpc_test_vars.reply[1]);
+	check(test, rpc_test_vars.reply[2] == status, "Reply status off", rpc_test_vars.reply[2]);
+}
+
+static void check(const char* test, bool ok, const char* what, uint32_t value)
+{
+	if (!ok && rpc_test_vars.failures++ < 10)
+	{
+		fprintf(stderr, "%s: %s (%u)\n", test, what, value);
+	}
+}
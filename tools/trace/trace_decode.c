@@ -0,0 +1,338 @@
+/*
+Copyright (c) 2016, Dust Networks. All rights reserved.
+
+Host decoder of QuickStart Library trace dumps (see dn_trace.h).
+
+Reads a dump of dn_trace_ring, and prints the records from oldest to newest
+with their format strings from dn_trace_events.h applied. With -j, writes a
+Chrome trace instead (load it in chrome://tracing or ui.perfetto.dev), with a
+track of FSM states, a track of serial commands from request to reply, a
+track of frames on the wire and a track of everything else:
+	./trace_decode -j trace.bin > trace.json
+
+Records marked torn by dn_trace_copy, or never written, are skipped and
+counted. A dump of the live ring taken byte by byte while the device was
+recording cannot be checked this way; halt the device first, or write out a
+dn_trace_copy() of the ring.
+
+\license See attached DN_LICENSE.txt.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dn_trace.h"
+#include "dn_fsm.h"
+#include "dn_ipmt.h"
+
+//=========================== defines =========================================
+
+// Dump layout; little-endian, as written by every supported target
+#define DUMP_HEADER_LEN		12
+#define DUMP_REC_LEN		16
+
+// Chrome trace tracks
+#define TID_FSM			1
+#define TID_SERIAL		2
+#define TID_FRAMES		3
+#define TID_EVENTS		4
+
+//=========================== variables =======================================
+
+typedef struct
+{
+	bool json;
+	bool first; // No JSON event written yet
+	uint64_t ts_us; // Unwrapped time of the record being decoded
+	// FSM state span under way
+	bool stateOpen;
+	uint8_t state;
+	uint64_t stateStart_us;
+	// Command under way
+	bool cmdOpen;
+	uint64_t cmdStart_us;
+} decode_vars_t;
+
+static decode_vars_t decode_vars;
+
+static const char* const decode_eventNames[DN_TRACE_NUM_EVENTS] = {
+#define DN_TRACE_EVENT(name, format)	#name,
+#include "dn_trace_events.h"
+#undef DN_TRACE_EVENT
+};
+
+static const char* const decode_eventFormats[DN_TRACE_NUM_EVENTS] = {
+#define DN_TRACE_EVENT(name, format)	format,
+#include "dn_trace_events.h"
+#undef DN_TRACE_EVENT
+};
+
+//=========================== prototypes ======================================
+
+static void decode(uint16_t id, uint32_t arg0, uint32_t arg1);
+static void jsonEvent(const char* ph, uint8_t tid, const char* name, uint64_t ts_us, uint64_t dur_us, const char* msg);
+static void jsonThreadName(uint8_t tid, const char* name);
+static const char* stateName(uint8_t state);
+static const char* cmdName(uint8_t cmdId);
+static uint32_t getU32(const uint8_t* p);
+static uint16_t getU16(const uint8_t* p);
+
+//=========================== main ============================================
+
+int main(int argc, char** argv)
+{
+	uint8_t* dump;
+	long dumpLen;
+	FILE* f;
+	uint16_t size;
+	uint32_t head;
+	uint32_t index;
+	uint32_t skipped = 0;
+	uint32_t decoded = 0;
+	uint32_t prevTs = 0;
+	const uint8_t* rec;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "jh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'j':
+			decode_vars.json = TRUE;
+			break;
+		default:
+			printf("Usage: %s [-j] dump.bin\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		printf("Usage: %s [-j] dump.bin\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[optind], "rb");
+	if (f == NULL)
+	{
+		perror("Unable to open dump");
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	dumpLen = ftell(f);
+	rewind(f);
+	dump = malloc(dumpLen > 0 ? dumpLen : 1);
+	if (dumpLen < DUMP_HEADER_LEN || fread(dump, 1, dumpLen, f) != (size_t)dumpLen)
+	{
+		fprintf(stderr, "Dump too short\n");
+		return 1;
+	}
+	fclose(f);
+
+	size = getU16(&dump[6]);
+	head = getU32(&dump[8]);
+	if (getU32(&dump[0]) != DN_TRACE_MAGIC || getU16(&dump[4]) != DN_TRACE_VERSION
+			|| size == 0 || dumpLen < DUMP_HEADER_LEN + (long)size * DUMP_REC_LEN)
+	{
+		fprintf(stderr, "Not a trace dump of version %u\n", DN_TRACE_VERSION);
+		return 1;
+	}
+
+	if (decode_vars.json)
+	{
+		printf("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		decode_vars.first = TRUE;
+		jsonThreadName(TID_FSM, "FSM state");
+		jsonThreadName(TID_SERIAL, "Serial commands");
+		jsonThreadName(TID_FRAMES, "Frames");
+		jsonThreadName(TID_EVENTS, "Events");
+	}
+
+	// Oldest to newest; timestamps are unwrapped from their differences
+	for (index = head > size ? head - size : 0; index != head; index++)
+	{
+		rec = &dump[DUMP_HEADER_LEN + (index % size) * DUMP_REC_LEN];
+		if (getU16(&rec[6]) != (uint16_t)index)
+		{
+			skipped++;
+			continue;
+		}
+		if (decoded > 0)
+		{
+			decode_vars.ts_us += (uint32_t)(getU32(&rec[0]) - prevTs);
+		}
+		prevTs = getU32(&rec[0]);
+		decode(getU16(&rec[4]), getU32(&rec[8]), getU32(&rec[12]));
+		decoded++;
+	}
+
+	if (decode_vars.json)
+	{
+		// Close the spans still under way at the end of the trace
+		if (decode_vars.stateOpen)
+		{
+			jsonEvent("X", TID_FSM, stateName(decode_vars.state), decode_vars.stateStart_us,
+					decode_vars.ts_us - decode_vars.stateStart_us, NULL);
+		}
+		if (decode_vars.cmdOpen)
+		{
+			jsonEvent("X", TID_SERIAL, "(no reply)", decode_vars.cmdStart_us,
+					decode_vars.ts_us - decode_vars.cmdStart_us, NULL);
+		}
+		printf("\n]}\n");
+	}
+	fprintf(stderr, "%u records decoded, %u skipped (torn or never written), %u recorded in total\n",
+			decoded, skipped, head);
+	free(dump);
+	return 0;
+}
+
+//=========================== private =========================================
+
+static void decode(uint16_t id, uint32_t arg0, uint32_t arg1)
+{
+	char msg[128];
+	char name[48];
+
+	if (id >= DN_TRACE_NUM_EVENTS)
+	{
+		snprintf(msg, sizeof (msg), "Unknown event %u (%#x, %#x)", id, arg0, arg1);
+		id = DN_TRACE_NUM_EVENTS;
+	} else
+	{
+		snprintf(msg, sizeof (msg), decode_eventFormats[id], arg0, arg1);
+	}
+
+	if (!decode_vars.json)
+	{
+		printf("%12.3f ms  %-16s %s\n", decode_vars.ts_us / 1000.0,
+				id < DN_TRACE_NUM_EVENTS ? decode_eventNames[id] : "?", msg);
+		return;
+	}
+
+	switch (id)
+	{
+	case DN_TRACE_FSM_STATE:
+		if (decode_vars.stateOpen)
+		{
+			jsonEvent("X", TID_FSM, stateName(decode_vars.state), decode_vars.stateStart_us,
+					decode_vars.ts_us - decode_vars.stateStart_us, NULL);
+		}
+		decode_vars.stateOpen = TRUE;
+		decode_vars.state = (uint8_t)arg1;
+		decode_vars.stateStart_us = decode_vars.ts_us;
+		break;
+	case DN_TRACE_FSM_CMD:
+		decode_vars.cmdOpen = TRUE;
+		decode_vars.cmdStart_us = decode_vars.ts_us;
+		break;
+	case DN_TRACE_FSM_REPLY:
+	case DN_TRACE_FSM_RSP_TIMEOUT:
+		if (decode_vars.cmdOpen)
+		{
+			jsonEvent("X", TID_SERIAL, id == DN_TRACE_FSM_REPLY ? cmdName((uint8_t)arg0) : "(timeout)",
+					decode_vars.cmdStart_us, decode_vars.ts_us - decode_vars.cmdStart_us, msg);
+			decode_vars.cmdOpen = FALSE;
+		} else
+		{
+			jsonEvent("i", TID_SERIAL, decode_eventNames[id], decode_vars.ts_us, 0, msg);
+		}
+		break;
+	case DN_TRACE_HDLC_TX:
+	case DN_TRACE_HDLC_RX:
+		snprintf(name, sizeof (name), "%s %s", id == DN_TRACE_HDLC_TX ? "->" : "<-", cmdName((uint8_t)arg0));
+		jsonEvent("i", TID_FRAMES, name, decode_vars.ts_us, 0, msg);
+		break;
+	default:
+		jsonEvent("i", TID_EVENTS, id < DN_TRACE_NUM_EVENTS ? decode_eventNames[id] : "?",
+				decode_vars.ts_us, 0, msg);
+		break;
+	}
+}
+
+//=========================== helpers =========================================
+
+/**
+ Write a Chrome trace event: A complete event ("X") with a duration, or an
+ instant event ("i"). The format strings hold no characters that need escaping
+ in JSON.
+ */
+static void jsonEvent(const char* ph, uint8_t tid, const char* name, uint64_t ts_us, uint64_t dur_us, const char* msg)
+{
+	printf("%s{\"name\": \"%s\", \"ph\": \"%s\", \"pid\": 1, \"tid\": %u, \"ts\": %llu",
+			decode_vars.first ? "" : ",\n", name, ph, tid, (unsigned long long)ts_us);
+	decode_vars.first = FALSE;
+	if (ph[0] == 'X')
+	{
+		printf(", \"dur\": %llu", (unsigned long long)dur_us);
+	} else
+	{
+		printf(", \"s\": \"t\"");
+	}
+	if (msg != NULL)
+	{
+		printf(", \"args\": {\"msg\": \"%s\"}", msg);
+	}
+	printf("}");
+}
+
+static void jsonThreadName(uint8_t tid, const char* name)
+{
+	printf("%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+			decode_vars.first ? "" : ",\n", tid, name);
+	decode_vars.first = FALSE;
+}
+
+static const char* stateName(uint8_t state)
+{
+	switch (state)
+	{
+	case DN_FSM_STATE_NOT_INITIALIZED:	return "NOT_INITIALIZED";
+	case DN_FSM_STATE_DISCONNECTED:		return "DISCONNECTED";
+	case DN_FSM_STATE_PRE_JOIN:			return "PRE_JOIN";
+	case DN_FSM_STATE_JOINING:			return "JOINING";
+	case DN_FSM_STATE_REQ_SERVICE:		return "REQ_SERVICE";
+	case DN_FSM_STATE_RESETTING:		return "RESETTING";
+	case DN_FSM_STATE_PROMISCUOUS:		return "PROMISCUOUS";
+	case DN_FSM_STATE_CONNECTED:		return "CONNECTED";
+	case DN_FSM_STATE_SENDING:			return "SENDING";
+	case DN_FSM_STATE_SEND_FAILED:		return "SEND_FAILED";
+	case DN_FSM_STATE_SYNCING_TIME:		return "SYNCING_TIME";
+	default:							return "?";
+	}
+}
+
+static const char* cmdName(uint8_t cmdId)
+{
+	switch (cmdId)
+	{
+	case CMDID_SETPARAMETER:	return "setParameter";
+	case CMDID_GETPARAMETER:	return "getParameter";
+	case CMDID_JOIN:			return "join";
+	case CMDID_DISCONNECT:		return "disconnect";
+	case CMDID_RESET:			return "reset";
+	case CMDID_REQUESTSERVICE:	return "requestService";
+	case CMDID_GETSERVICEINFO:	return "getServiceInfo";
+	case CMDID_OPENSOCKET:		return "openSocket";
+	case CMDID_BINDSOCKET:		return "bindSocket";
+	case CMDID_SENDTO:			return "sendTo";
+	case CMDID_SEARCH:			return "search";
+	case CMDID_TIMEINDICATION:	return "timeIndication";
+	case CMDID_EVENTS:			return "events";
+	case CMDID_RECEIVE:			return "receive";
+	case CMDID_TXDONE:			return "txDone";
+	case CMDID_ADVRECEIVED:		return "advReceived";
+	default:					return "?";
+	}
+}
+
+static uint32_t getU32(const uint8_t* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t getU16(const uint8_t* p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}